@@ -92,7 +92,6 @@
 	NSStatusItem * appStatusItem;
 	int progressCount;
 	NSDictionary * standardURLs;
-	NSTimer * checkTimer;
 	int lastCountOfUnread;
 	BOOL growlAvailable;
 	BOOL isStatusBarVisible;
@@ -26,6 +26,7 @@
 #import "Import.h"
 #import "Export.h"
 #import "RefreshManager.h"
+#import "RefreshScheduler.h"
 #import "ArrayExtensions.h"
 #import "StringExtensions.h"
 #import "SplitViewExtensions.h"
@@ -88,7 +89,6 @@
 	-(void)startProgressIndicator;
 	-(void)stopProgressIndicator;
 	-(void)doEditFolder:(Folder *)folder;
-	-(void)refreshOnTimer:(NSTimer *)aTimer;
 	-(BOOL)installFilename:(NSString *)srcFile toPath:(NSString *)path;
 	-(void)setStatusBarState:(BOOL)isVisible withAnimation:(BOOL)doAnimate;
 	-(void)setFilterBarState:(BOOL)isVisible withAnimation:(BOOL)doAnimate;
@@ -108,7 +108,6 @@
 	-(BOOL)isFilterBarVisible;
 	-(BOOL)isStatusBarVisible;
 	-(NSDictionary *)registrationDictionaryForGrowl;
-	-(NSTimer *)checkTimer;
 	-(ToolbarItem *)toolbarItemWithIdentifier:(NSString *)theIdentifier;
 	-(void)searchArticlesWithString:(NSString *)searchString;
 	-(void)sourceWindowWillClose:(NSNotification *)notification;
@@ -141,7 +140,6 @@ static void MySleepCallBack(void * x, io_service_t y, natural_t messageType, voi
 		appStatusItem = nil;
 		scriptsMenuItem = nil;
 		isStatusBarVisible = YES;
-		checkTimer = nil;
 		didCompleteInitialisation = NO;
 		emptyTrashWarning = nil;
 		searchString = nil;
@@ -302,33 +300,8 @@ static void MySleepCallBack(void * refCon, io_service_t service, natural_t messa
 {
 	if (messageType == kIOMessageSystemHasPoweredOn)
 	{
-		AppController * app = (AppController *)[NSApp delegate];
-		Preferences * prefs = [Preferences standardPreferences];
-		int frequency = [prefs refreshFrequency];
-		if (frequency > 0)
-		{
-			NSDate * lastRefresh = [prefs objectForKey:MAPref_LastRefreshDate];
-			if ((lastRefresh == nil) || ([app checkTimer] == nil))
-				[app handleCheckFrequencyChange:nil];
-			else
-			{
-				// Wait at least 15 seconds after waking to avoid refresh errors.
-				NSTimeInterval interval = -[lastRefresh timeIntervalSinceNow];
-				if (interval > frequency)
-				{
-					[NSTimer scheduledTimerWithTimeInterval:15.0
-													 target:app
-												   selector:@selector(refreshOnTimer:)
-												   userInfo:nil
-													repeats:NO];
-					[app handleCheckFrequencyChange:nil];
-				}
-				else
-				{
-					[[app checkTimer] setFireDate:[NSDate dateWithTimeIntervalSinceNow:15.0 + frequency - interval]];
-				}
-			}
-		}
+		// Wait at least 15 seconds after waking to avoid refresh errors.
+		[[RefreshScheduler sharedScheduler] deferRefreshesForInterval:15.0];
 	}
 	else if (messageType == kIOMessageCanSystemSleep)
 	{
@@ -502,7 +475,7 @@ static void MyScriptsFolderWatcherCallBack(FNMessage message, OptionBits flags,
 	// Use Growl if it is installed
 	[GrowlApplicationBridge setGrowlDelegate:self];
 	
-	// Start the check timer
+	// Start scheduling refreshes
 	[self handleCheckFrequencyChange:nil];
 	
 	// Register to be informed when the system awakes from sleep
@@ -2166,27 +2139,7 @@ static void MyScriptsFolderWatcherCallBack(FNMessage message, OptionBits flags,
  */
 -(void)handleCheckFrequencyChange:(NSNotification *)nc
 {
-	int newFrequency = [[Preferences standardPreferences] refreshFrequency];
-	
-	[checkTimer invalidate];
-	[checkTimer release];
-	checkTimer = nil;
-	if (newFrequency > 0)
-	{
-		checkTimer = [[NSTimer scheduledTimerWithTimeInterval:newFrequency
-													   target:self
-													 selector:@selector(refreshOnTimer:)
-													 userInfo:nil
-													  repeats:NO] retain];
-	}
-}
-
-/* checkTimer
- * Return the refresh timer object.
- */
--(NSTimer *)checkTimer
-{
-	return checkTimer;
+	[[RefreshScheduler sharedScheduler] setRefreshFrequency:[[Preferences standardPreferences] refreshFrequency]];
 }
 
 /* doViewColumn
@@ -2639,15 +2592,6 @@ static void MyScriptsFolderWatcherCallBack(FNMessage message, OptionBits flags,
 	return [[RefreshManager sharedManager] isRefreshing];
 }
 
-/* refreshOnTimer
- * Each time the check timer fires, we see if a connect is not nswindow
- * running and then kick one off.
- */
--(void)refreshOnTimer:(NSTimer *)aTimer
-{
-	[self refreshAllSubscriptions:self];
-}
-
 /* markSelectedFoldersRead
  * Mark read all articles in the specified array of folders.
  */
@@ -3462,9 +3406,6 @@ static void MyScriptsFolderWatcherCallBack(FNMessage message, OptionBits flags,
  */
 -(IBAction)refreshAllSubscriptions:(id)sender
 {
-	// Reset the refresh timer
-	[self handleCheckFrequencyChange:nil];
-	
 	if (![self isConnecting])
 		[[RefreshManager sharedManager] refreshSubscriptions:[foldersTree folders:0] ignoringSubscriptionStatus:NO];		
 }
@@ -4408,7 +4349,6 @@ static void MyScriptsFolderWatcherCallBack(FNMessage message, OptionBits flags,
 	[groupFolder release];
 	[preferenceController release];
 	[activityViewer release];
-	[checkTimer release];
 	[appDockMenu release];
 	[appStatusItem release];
 	[db release];
@@ -24,6 +24,7 @@
 #import "Constants.h"
 #import "Database.h"
 #import "ArticleFilter.h"
+#import "ArticleIndex.h"
 #import "ArticleRef.h"
 #import "StringExtensions.h"
 
@@ -33,6 +34,8 @@
 	-(void)setSortColumnIdentifier:(NSString *)str;
 	-(NSArray *)wrappedMarkAllReadInArray:(NSArray *)folderArray withUndo:(BOOL)undoFlag;
 	-(void)innerMarkReadByArray:(NSArray *)articleArray readFlag:(BOOL)readFlag;
+	-(void)removeArticlesFromArrays:(NSSet *)articleSet;
+	-(BOOL)updateFoldersOfArticles:(NSArray *)articleArray;
 @end
 
 @implementation ArticleController
@@ -283,9 +286,11 @@
  */
 -(void)sortArticles
 {
+	ArticleIndex * articleIndex = [[ArticleIndex alloc] initWithArticles:currentArrayOfArticles];
 	NSArray * sortedArrayOfArticles;
 
-	sortedArrayOfArticles = [currentArrayOfArticles sortedArrayUsingDescriptors:[[Preferences standardPreferences] articleSortDescriptors]];
+	sortedArrayOfArticles = [articleIndex articlesSortedUsingDescriptors:[[Preferences standardPreferences] articleSortDescriptors]];
+	[articleIndex release];
 	NSAssert([sortedArrayOfArticles count] == [currentArrayOfArticles count], @"Lost articles from currentArrayOfArticles during sort");
 	[currentArrayOfArticles autorelease];
 	currentArrayOfArticles = [sortedArrayOfArticles retain];
@@ -343,25 +348,27 @@
  */
 -(NSArray *)applyFilter:(NSArray *)unfilteredArray
 {
-	NSMutableArray * filteredArray = [NSMutableArray arrayWithArray:unfilteredArray];
-	
 	NSString * guidOfArticleToPreserve = (articleToPreserve != nil) ? [articleToPreserve guid] : @"";
 	int folderIdOfArticleToPreserve = [articleToPreserve folderId];
+	NSUInteger rowToPreserve = NSNotFound;
+	NSUInteger count = [unfilteredArray count];
+	NSUInteger index;
 	
-	ArticleFilter * filter = [ArticleFilter filterByTag:[[Preferences standardPreferences] filterMode]];
-	SEL comparator = [filter comparator];
-	int count = [filteredArray count];
-	int index;
-	
-	for (index = count - 1; index >= 0; --index)
+	for (index = 0; index < count && ![guidOfArticleToPreserve isEqualToString:@""]; ++index)
 	{
-		Article * article = [filteredArray objectAtIndex:index];
+		Article * article = [unfilteredArray objectAtIndex:index];
 		if (([article folderId] == folderIdOfArticleToPreserve) && [[article guid] isEqualToString:guidOfArticleToPreserve])
+		{
+			rowToPreserve = index;
 			guidOfArticleToPreserve = @"";
-		else if ((comparator != nil) && !((BOOL)(NSInteger)[ArticleFilter performSelector:comparator withObject:article]))
-			[filteredArray removeObjectAtIndex:index];
+		}
 	}
 	
+	ArticleFilter * filter = [ArticleFilter filterByTag:[[Preferences standardPreferences] filterMode]];
+	ArticleIndex * articleIndex = [[ArticleIndex alloc] initWithArticles:unfilteredArray];
+	NSMutableArray * filteredArray = [NSMutableArray arrayWithArray:[articleIndex articlesMatchingFilter:filter includingRow:rowToPreserve]];
+	[articleIndex release];
+	
 	if (![guidOfArticleToPreserve isEqualToString:@""])
 	{
 		Article * articleToAdd = nil;
@@ -409,33 +416,35 @@
 	[undoManager registerUndoWithTarget:self selector:markDeletedUndoAction object:articleArray];
 	[undoManager setActionName:NSLocalizedString(@"Delete", nil)];
 	
-	// We will make a new copy of currentArrayOfArticles and folderArrayOfArticles with the selected articles removed.
-	NSMutableArray * currentArrayCopy = [[NSMutableArray alloc] initWithArray:currentArrayOfArticles];
-	NSMutableArray * folderArrayCopy = [[NSMutableArray alloc] initWithArray:folderArrayOfArticles];
+	// Articles leave the list when they are deleted from a normal folder or
+	// restored from the trash.
+	Database * db = [Database sharedDatabase];
+	NSSet * currentArticleSet = [NSSet setWithArray:currentArrayOfArticles];
+	NSMutableSet * removedArticleSet = [NSMutableSet set];
+	BOOL isTrashFolder = (currentFolderId == [db trashFolderId]);
 	BOOL needFolderRedraw = NO;
 	BOOL needReload = NO;
 	
-	// Iterate over every selected article in the table and set the deleted
-	// flag on the article while simultaneously removing it from our copies
-	Database * db = [Database sharedDatabase];
-	[db beginTransaction];
+	// Deleting marks the articles read so check for unread ones first.
 	for (Article * theArticle in articleArray)
 	{
 		if (![theArticle isRead])
-			needFolderRedraw = YES;
-		[db markArticleDeleted:[theArticle folderId] guid:[theArticle guid] isDeleted:deleteFlag];
-		if (![currentArrayOfArticles containsObject:theArticle])
-			needReload = YES;
-		else if (deleteFlag && (currentFolderId != [db trashFolderId]))
 		{
-			[currentArrayCopy removeObject:theArticle];
-			[folderArrayCopy removeObject:theArticle];
-		}
-		else if (!deleteFlag && (currentFolderId == [db trashFolderId]))
-		{
-			[currentArrayCopy removeObject:theArticle];
-			[folderArrayCopy removeObject:theArticle];
+			needFolderRedraw = YES;
+			break;
 		}
+	}
+
+	// Set the deleted flag on every selected article in one go then work out
+	// which of them have to be removed from the list.
+	[db beginTransaction];
+	[db markArticlesDeleted:articleArray isDeleted:deleteFlag];
+	for (Article * theArticle in articleArray)
+	{
+		if (![currentArticleSet containsObject:theArticle])
+			needReload = YES;
+		else if (deleteFlag != isTrashFolder)
+			[removedArticleSet addObject:theArticle];
 		else
 			needReload = YES;
 
@@ -450,10 +459,7 @@
 										  wasHardDeleted:NO];
 	}
 	[db commitTransaction];
-	[currentArrayOfArticles autorelease];
-	currentArrayOfArticles = currentArrayCopy;
-	[folderArrayOfArticles autorelease];
-	folderArrayOfArticles = folderArrayCopy;
+	[self removeArticlesFromArrays:removedArticleSet];
 	if (needReload)
 		[mainArticleView refreshFolder:MA_Refresh_ReloadFromDatabase];
 	else
@@ -479,25 +485,17 @@
  */
 -(void)deleteArticlesByArray:(NSArray *)articleArray
 {		
-	// Make a new copy of currentArrayOfArticles and folderArrayOfArticles with the selected article removed.
-	NSMutableArray * currentArrayCopy = [[NSMutableArray alloc] initWithArray:currentArrayOfArticles];
-	NSMutableArray * folderArrayCopy = [[NSMutableArray alloc] initWithArray:folderArrayOfArticles];
 	BOOL needFolderRedraw = NO;
 	
-	// Iterate over every selected article in the table and remove it from
-	// the database.
+	// Remove every selected article in the table from the database in one go.
 	Database * db = [Database sharedDatabase];
 
 	[db beginTransaction];
+	BOOL didDelete = [db deleteArticles:articleArray];
 	for (Article * theArticle in articleArray)	
 	{
 		if (![theArticle isRead])
 			needFolderRedraw = YES;
-		if ([db deleteArticle:[theArticle folderId] guid:[theArticle guid]])
-		{
-			[currentArrayCopy removeObject:theArticle];
-			[folderArrayCopy removeObject:theArticle];
-		}
 
 		// notify all plugins
 		[[PluginHelper helper] articleStateChanged:theArticle
@@ -510,11 +508,9 @@
 										  wasHardDeleted:YES];
 	}
 	[db commitTransaction];
-	[currentArrayOfArticles autorelease];
-	currentArrayOfArticles = currentArrayCopy;
-	[folderArrayOfArticles autorelease];
-	folderArrayOfArticles = folderArrayCopy;
-	[mainArticleView refreshFolder:MA_Refresh_RedrawList];
+	if (didDelete)
+		[self removeArticlesFromArrays:[NSSet setWithArray:articleArray]];
+	[mainArticleView refreshFolder:didDelete ? MA_Refresh_RedrawList : MA_Refresh_ReloadFromDatabase];
 
 	// If any of the articles we deleted were unread then the
 	// folder's unread count just changed.
@@ -561,11 +557,10 @@
 	[undoManager registerUndoWithTarget:self selector:markFlagUndoAction object:articleArray];
 	[undoManager setActionName:NSLocalizedString(@"Flag", nil)];
 	
-	[db beginTransaction];
+	[db markArticlesFlagged:articleArray isFlagged:flagged];
 	for (Article * theArticle in articleArray)
 	{
 		[theArticle markFlagged:flagged];
-		[db markArticleFlagged:[theArticle folderId] guid:[theArticle guid] isFlagged:flagged];
 
 		// notify all plugins
 		[[PluginHelper helper] articleStateChanged:theArticle
@@ -577,7 +572,6 @@
 											wasUnDeleted:NO
 										  wasHardDeleted:NO];
 	}
-	[db commitTransaction];
 	[mainArticleView refreshFolder:MA_Refresh_RedrawList];
 }
 
@@ -608,14 +602,7 @@
 	[undoManager registerUndoWithTarget:self selector:markReadUndoAction object:articleArray];
 	[undoManager setActionName:NSLocalizedString(@"Mark Read", nil)];
 
-	Database * db = [Database sharedDatabase];
-	BOOL singleArticle = [articleArray count] < 2;
-	
-	if (!singleArticle)
-		[db beginTransaction];
 	[self innerMarkReadByArray:articleArray readFlag:readFlag];
-	if (!singleArticle)
-		[db commitTransaction];
 	[mainArticleView refreshFolder:MA_Refresh_RedrawList];
 	
 	// The info bar has a count of unread articles so we need to
@@ -628,17 +615,10 @@
  */
 -(void)innerMarkReadByArray:(NSArray *)articleArray readFlag:(BOOL)readFlag
 {
-	Database * db = [Database sharedDatabase];
-	int lastFolderId = -1;
-	
+	[[Database sharedDatabase] markArticlesRead:articleArray isRead:readFlag];
 	for (Article * theArticle in articleArray)
 	{
-		int folderId = [theArticle folderId];
-		[db markArticleRead:folderId guid:[theArticle guid] isRead:readFlag];
 		[theArticle markRead:readFlag];
-		if (folderId != lastFolderId && lastFolderId != -1)
-			[foldersTree updateFolder:lastFolderId recurseToParents:YES];
-		lastFolderId = folderId;
 
 		// notify all plugins
 		[[PluginHelper helper] articleStateChanged:theArticle
@@ -650,8 +630,47 @@
 											wasUnDeleted:NO
 										  wasHardDeleted:NO];
 	}
-	if (lastFolderId != -1)
-		[foldersTree updateFolder:lastFolderId recurseToParents:YES];
+	[self updateFoldersOfArticles:articleArray];
+}
+
+/* updateFoldersOfArticles
+ * Redraws each folder that contains one of the articles or references in the array.
+ * Returns YES if one of them is the current folder.
+ */
+-(BOOL)updateFoldersOfArticles:(NSArray *)articleArray
+{
+	NSMutableSet * folderIds = [NSMutableSet set];
+	for (id theArticle in articleArray)
+		[folderIds addObject:[NSNumber numberWithInt:[theArticle folderId]]];
+
+	for (NSNumber * folderId in folderIds)
+		[foldersTree updateFolder:[folderId intValue] recurseToParents:YES];
+	return [folderIds containsObject:[NSNumber numberWithInt:currentFolderId]];
+}
+
+/* removeArticlesFromArrays
+ * Replaces currentArrayOfArticles and folderArrayOfArticles with copies that leave out
+ * the articles in the specified set.
+ */
+-(void)removeArticlesFromArrays:(NSSet *)articleSet
+{
+	if ([articleSet count] == 0)
+		return;
+
+	NSMutableArray * currentArrayCopy = [[NSMutableArray alloc] initWithCapacity:[currentArrayOfArticles count]];
+	for (Article * theArticle in currentArrayOfArticles)
+		if (![articleSet containsObject:theArticle])
+			[currentArrayCopy addObject:theArticle];
+
+	NSMutableArray * folderArrayCopy = [[NSMutableArray alloc] initWithCapacity:[folderArrayOfArticles count]];
+	for (Article * theArticle in folderArrayOfArticles)
+		if (![articleSet containsObject:theArticle])
+			[folderArrayCopy addObject:theArticle];
+
+	[currentArrayOfArticles autorelease];
+	currentArrayOfArticles = currentArrayCopy;
+	[folderArrayOfArticles autorelease];
+	folderArrayOfArticles = folderArrayCopy;
 }
 
 /* markAllReadUndo
@@ -772,8 +791,6 @@
 -(void)markAllReadByReferencesArray:(NSArray *)refArray readFlag:(BOOL)readFlag
 {
 	Database * db = [Database sharedDatabase];
-	int lastFolderId = -1;
-	BOOL needRefilter = NO;
 	
 	// Set up to undo or redo this action
 	NSUndoManager * undoManager = [[NSApp mainWindow] undoManager];
@@ -781,26 +798,11 @@
 	[undoManager registerUndoWithTarget:self selector:markAllReadUndoAction object:refArray];
 	[undoManager setActionName:NSLocalizedString(@"Mark All Read", nil)];
 	
-	[db beginTransaction];
-	for (ArticleReference *ref in refArray)
-	{
-		int folderId = [ref folderId];
-		[db markArticleRead:folderId guid:[ref guid] isRead:readFlag];
-		if (folderId != lastFolderId && lastFolderId != -1)
-		{
-			[foldersTree updateFolder:lastFolderId recurseToParents:YES];
-			if (lastFolderId == currentFolderId)
-				needRefilter = YES;
-		}
-		lastFolderId = folderId;
-	}
-	[db commitTransaction];
+	[db markArticlesRead:refArray isRead:readFlag];
+	BOOL needRefilter = [self updateFoldersOfArticles:refArray];
 	
-	if (lastFolderId != -1)
+	if ([refArray count] > 0)
 	{
-		[foldersTree updateFolder:lastFolderId recurseToParents:YES];
-		if (lastFolderId == currentFolderId)
-			needRefilter = YES;
         if (!IsRSSFolder([db folderFromID:currentFolderId]))
             [mainArticleView refreshFolder:MA_Refresh_ReloadFromDatabase];
         else if (needRefilter)
@@ -72,6 +72,8 @@ static NSMutableArray * _filterList = nil;
  * 2. Add a comparator in this file that returns TRUE if the article should be filtered IN.
  * 3. Add a new line below with the filter name, tag and comparator.
  * 4. Localise the filter name in the Localizable.strings for each language.
+ * 5. Optionally add a case for the tag to ArticleIndex so the filter runs over the
+ *    index columns instead of calling the comparator for every article.
  *
  * That's it really. The filtering and menu is handled automatically.
  */
@@ -0,0 +1,41 @@
+//
+//  ArticleIndex.h
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Cocoa/Cocoa.h>
+
+@class ArticleFilter;
+
+/* ArticleIndex
+ * A column-wise snapshot of an array of articles used to sort and filter the
+ * article list without going through KVC for every comparison. Each column is
+ * extracted once from the articles when first needed so the index should be
+ * discarded as soon as the article state changes.
+ */
+@interface ArticleIndex : NSObject {
+	NSArray * articles;
+	id * rows;
+	NSUInteger countOfRows;
+	double * dates;
+	double * createdDates;
+	unsigned char * flags;
+}
+
+// Public functions
+-(id)initWithArticles:(NSArray *)theArticles;
+-(NSArray *)articlesMatchingFilter:(ArticleFilter *)filter includingRow:(NSUInteger)preservedRow;
+-(NSArray *)articlesSortedUsingDescriptors:(NSArray *)sortDescriptors;
+@end
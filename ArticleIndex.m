@@ -0,0 +1,460 @@
+//
+//  ArticleIndex.m
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "ArticleIndex.h"
+#import "ArticleFilter.h"
+#import "CalendarExtensions.h"
+#import "Preferences.h"
+#import "Constants.h"
+#import "Database.h"
+#import "Message.h"
+
+// Bits in the per-row flag column.
+#define MA_Index_Read			0x01
+#define MA_Index_Flagged		0x02
+#define MA_Index_Comments		0x04
+#define MA_Index_Enclosure		0x08
+
+// The columns that a sort descriptor key can be mapped to.
+typedef enum {
+	MA_Column_None = 0,
+	MA_Column_Date,
+	MA_Column_Read,
+	MA_Column_Flagged,
+	MA_Column_Comments,
+	MA_Column_Enclosure,
+	MA_Column_FolderName,
+	MA_Column_Author,
+	MA_Column_Subject,
+	MA_Column_Link,
+	MA_Column_Summary,
+	MA_Column_EnclosureName
+} ArticleIndexColumn;
+
+typedef enum {
+	MA_SortKey_Double,
+	MA_SortKey_Flag,
+	MA_SortKey_Rank
+} ArticleSortKeyType;
+
+// One level of a sort. Exactly one of the column pointers is used depending on the type.
+typedef struct {
+	ArticleSortKeyType type;
+	BOOL ascending;
+	const double * doubles;
+	const unsigned char * flags;
+	unsigned char mask;
+	int * ranks;
+} ArticleSortKey;
+
+// The keys of the sort in progress. The article list is only ever sorted on the
+// main thread so the comparator can pick these up from here.
+static const ArticleSortKey * activeSortKeys = NULL;
+static NSUInteger countOfActiveSortKeys = 0;
+
+@interface ArticleIndex (Private)
+	-(const double *)dateColumn;
+	-(const double *)createdDateColumn;
+	-(const unsigned char *)flagColumn;
+	-(int *)ranksForColumn:(ArticleIndexColumn)column selector:(SEL)selector;
+	-(NSArray *)arrayOfRows:(const NSUInteger *)order count:(NSUInteger)count;
+@end
+
+/* intervalOfDate
+ * Returns the date as seconds since the reference date. Missing dates sort first
+ * like nil does with NSSortDescriptor.
+ */
+static double intervalOfDate(NSDate * date)
+{
+	return (date != nil) ? [date timeIntervalSinceReferenceDate] : -HUGE_VAL;
+}
+
+/* columnForKey
+ * Maps a sort descriptor key to the index column that holds the same value.
+ */
+static ArticleIndexColumn columnForKey(NSString * key)
+{
+	static NSDictionary * columns = nil;
+	if (columns == nil)
+		columns = [[NSDictionary alloc] initWithObjectsAndKeys:
+				   [NSNumber numberWithInt:MA_Column_Date], [@"articleData." stringByAppendingString:MA_Field_Date],
+				   [NSNumber numberWithInt:MA_Column_Read], @"isRead",
+				   [NSNumber numberWithInt:MA_Column_Flagged], @"isFlagged",
+				   [NSNumber numberWithInt:MA_Column_Comments], @"hasComments",
+				   [NSNumber numberWithInt:MA_Column_Enclosure], @"hasEnclosure",
+				   [NSNumber numberWithInt:MA_Column_FolderName], @"containingFolder.name",
+				   [NSNumber numberWithInt:MA_Column_Author], [@"articleData." stringByAppendingString:MA_Field_Author],
+				   [NSNumber numberWithInt:MA_Column_Subject], [@"articleData." stringByAppendingString:MA_Field_Subject],
+				   [NSNumber numberWithInt:MA_Column_Link], [@"articleData." stringByAppendingString:MA_Field_Link],
+				   [NSNumber numberWithInt:MA_Column_Summary], [@"articleData." stringByAppendingString:MA_Field_Summary],
+				   [NSNumber numberWithInt:MA_Column_EnclosureName], @"enclosure",
+				   nil];
+	NSNumber * column = (key != nil) ? [columns objectForKey:key] : nil;
+	return (column != nil) ? [column intValue] : MA_Column_None;
+}
+
+/* compareRows
+ * Orders two row numbers by the active sort keys.
+ */
+static int compareRows(const void * first, const void * second)
+{
+	NSUInteger row1 = *(const NSUInteger *)first;
+	NSUInteger row2 = *(const NSUInteger *)second;
+	NSUInteger index;
+
+	for (index = 0; index < countOfActiveSortKeys; ++index)
+	{
+		const ArticleSortKey * key = &activeSortKeys[index];
+		int result = 0;
+
+		switch (key->type)
+		{
+			case MA_SortKey_Double:
+				if (key->doubles[row1] < key->doubles[row2])
+					result = -1;
+				else if (key->doubles[row1] > key->doubles[row2])
+					result = 1;
+				break;
+
+			case MA_SortKey_Flag:
+				result = ((key->flags[row1] & key->mask) != 0) - ((key->flags[row2] & key->mask) != 0);
+				break;
+
+			case MA_SortKey_Rank:
+				if (key->ranks[row1] < key->ranks[row2])
+					result = -1;
+				else if (key->ranks[row1] > key->ranks[row2])
+					result = 1;
+				break;
+		}
+		if (result != 0)
+			return key->ascending ? result : -result;
+	}
+	return 0;
+}
+
+@implementation ArticleIndex
+
+/* initWithArticles
+ * Creates an index over the specified array of articles. No column is read
+ * from the articles until it is needed.
+ */
+-(id)initWithArticles:(NSArray *)theArticles
+{
+	if ((self = [super init]) != nil)
+	{
+		articles = [theArticles retain];
+		countOfRows = [articles count];
+		rows = malloc(sizeof(id) * (countOfRows + 1));
+		[articles getObjects:rows];
+		dates = NULL;
+		createdDates = NULL;
+		flags = NULL;
+	}
+	return self;
+}
+
+/* dateColumn
+ * Returns the column of article dates.
+ */
+-(const double *)dateColumn
+{
+	if (dates == NULL)
+	{
+		NSUInteger row;
+		dates = malloc(sizeof(double) * (countOfRows + 1));
+		for (row = 0; row < countOfRows; ++row)
+			dates[row] = intervalOfDate([(Article *)rows[row] date]);
+	}
+	return dates;
+}
+
+/* createdDateColumn
+ * Returns the column of dates on which the articles were added to the database.
+ */
+-(const double *)createdDateColumn
+{
+	if (createdDates == NULL)
+	{
+		NSUInteger row;
+		createdDates = malloc(sizeof(double) * (countOfRows + 1));
+		for (row = 0; row < countOfRows; ++row)
+			createdDates[row] = intervalOfDate([(Article *)rows[row] createdDate]);
+	}
+	return createdDates;
+}
+
+/* flagColumn
+ * Returns the column of read, flagged, comments and enclosure bits.
+ */
+-(const unsigned char *)flagColumn
+{
+	if (flags == NULL)
+	{
+		NSUInteger row;
+		flags = malloc(countOfRows + 1);
+		for (row = 0; row < countOfRows; ++row)
+		{
+			Article * article = rows[row];
+			unsigned char bits = 0;
+			if ([article isRead])
+				bits |= MA_Index_Read;
+			if ([article isFlagged])
+				bits |= MA_Index_Flagged;
+			if ([article hasComments])
+				bits |= MA_Index_Comments;
+			if ([article hasEnclosure])
+				bits |= MA_Index_Enclosure;
+			flags[row] = bits;
+		}
+	}
+	return flags;
+}
+
+/* ranksForColumn
+ * Returns a malloc'd column that gives each row the rank of its string value in
+ * the order defined by the selector. Rows whose strings compare the same share a
+ * rank so the selector is only applied to the distinct values. Missing values
+ * rank first. The caller must free the column.
+ */
+-(int *)ranksForColumn:(ArticleIndexColumn)column selector:(SEL)selector
+{
+	Database * db = [Database sharedDatabase];
+	NSMutableDictionary * distinctValues = [[NSMutableDictionary alloc] init];
+	NSString ** values = malloc(sizeof(NSString *) * (countOfRows + 1));
+	int * ranks = malloc(sizeof(int) * (countOfRows + 1));
+	NSNumber * placeholder = [NSNumber numberWithInt:-1];
+	NSUInteger row;
+
+	for (row = 0; row < countOfRows; ++row)
+	{
+		Article * article = rows[row];
+		NSString * value = nil;
+
+		switch (column)
+		{
+			case MA_Column_FolderName:	value = [[db folderFromID:[article folderId]] name]; break;
+			case MA_Column_Author:		value = [article author]; break;
+			case MA_Column_Subject:		value = [article title]; break;
+			case MA_Column_Link:		value = [article link]; break;
+			case MA_Column_Summary:		value = [article summary]; break;
+			case MA_Column_EnclosureName:	value = [article enclosure]; break;
+			default:					break;
+		}
+		values[row] = value;
+		if (value != nil && [distinctValues objectForKey:value] == nil)
+			[distinctValues setObject:placeholder forKey:value];
+	}
+
+	NSArray * sortedValues = [[distinctValues allKeys] sortedArrayUsingSelector:selector];
+	NSString * previousValue = nil;
+	int rank = -1;
+	for (NSString * value in sortedValues)
+	{
+		if (previousValue == nil || (NSComparisonResult)(NSInteger)[previousValue performSelector:selector withObject:value] != NSOrderedSame)
+			++rank;
+		[distinctValues setObject:[NSNumber numberWithInt:rank] forKey:value];
+		previousValue = value;
+	}
+
+	for (row = 0; row < countOfRows; ++row)
+		ranks[row] = (values[row] != nil) ? [[distinctValues objectForKey:values[row]] intValue] : -1;
+
+	free(values);
+	[distinctValues release];
+	return ranks;
+}
+
+/* arrayOfRows
+ * Returns an array of the articles at the specified rows in the given order.
+ */
+-(NSArray *)arrayOfRows:(const NSUInteger *)order count:(NSUInteger)count
+{
+	id * objects = malloc(sizeof(id) * (count + 1));
+	NSUInteger index;
+
+	for (index = 0; index < count; ++index)
+		objects[index] = rows[order[index]];
+	NSArray * result = [NSArray arrayWithObjects:objects count:count];
+	free(objects);
+	return result;
+}
+
+/* articlesMatchingFilter
+ * Returns the articles that pass the specified filter in their original order.
+ * The article at preservedRow is always included so that the current selection
+ * does not vanish from under the user; pass NSNotFound to include no such row.
+ */
+-(NSArray *)articlesMatchingFilter:(ArticleFilter *)filter includingRow:(NSUInteger)preservedRow
+{
+	SEL comparator = [filter comparator];
+	if (comparator == nil)
+		return articles;
+
+	NSUInteger * matches = malloc(sizeof(NSUInteger) * (countOfRows + 1));
+	NSUInteger countOfMatches = 0;
+	NSUInteger row;
+
+	switch ([filter tag])
+	{
+		case MA_Filter_Unread: {
+			const unsigned char * rowFlags = [self flagColumn];
+			for (row = 0; row < countOfRows; ++row)
+				if (!(rowFlags[row] & MA_Index_Read) || row == preservedRow)
+					matches[countOfMatches++] = row;
+			break;
+		}
+
+		case MA_Filter_Flagged: {
+			const unsigned char * rowFlags = [self flagColumn];
+			for (row = 0; row < countOfRows; ++row)
+				if ((rowFlags[row] & MA_Index_Flagged) || row == preservedRow)
+					matches[countOfMatches++] = row;
+			break;
+		}
+
+		case MA_Filter_Today: {
+			// Articles with no date have always passed the date filters so they still do
+			const double * rowDates = [self dateColumn];
+			double startOfToday = [[NSCalendarDate today] timeIntervalSinceReferenceDate];
+			for (row = 0; row < countOfRows; ++row)
+				if (rowDates[row] >= startOfToday || rowDates[row] == -HUGE_VAL || row == preservedRow)
+					matches[countOfMatches++] = row;
+			break;
+		}
+
+		case MA_Filter_LastRefresh: {
+			const double * rowDates = [self createdDateColumn];
+			double lastRefresh = intervalOfDate([[Preferences standardPreferences] objectForKey:MAPref_LastRefreshDate]);
+			for (row = 0; row < countOfRows; ++row)
+				if (rowDates[row] >= lastRefresh || rowDates[row] == -HUGE_VAL || row == preservedRow)
+					matches[countOfMatches++] = row;
+			break;
+		}
+
+		default:
+			// Filters that the index knows nothing about use their own comparator.
+			for (row = 0; row < countOfRows; ++row)
+				if (row == preservedRow || (BOOL)(NSInteger)[ArticleFilter performSelector:comparator withObject:rows[row]])
+					matches[countOfMatches++] = row;
+			break;
+	}
+
+	NSArray * result = [self arrayOfRows:matches count:countOfMatches];
+	free(matches);
+	return result;
+}
+
+/* articlesSortedUsingDescriptors
+ * Returns the articles sorted by the specified sort descriptors. Descriptors whose key
+ * maps to an index column are compared on that column. If any descriptor doesn't then
+ * the whole sort falls back to NSSortDescriptor.
+ */
+-(NSArray *)articlesSortedUsingDescriptors:(NSArray *)sortDescriptors
+{
+	NSUInteger countOfKeys = [sortDescriptors count];
+	ArticleSortKey * keys = malloc(sizeof(ArticleSortKey) * (countOfKeys + 1));
+	NSUInteger countOfBuiltKeys = 0;
+	BOOL canSort = YES;
+
+	for (NSSortDescriptor * descriptor in sortDescriptors)
+	{
+		ArticleIndexColumn column = columnForKey([descriptor key]);
+		SEL selector = [descriptor selector];
+		BOOL isCompare = (selector == @selector(compare:));
+		ArticleSortKey * key = &keys[countOfBuiltKeys];
+
+		key->ascending = [descriptor ascending];
+		key->doubles = NULL;
+		key->flags = NULL;
+		key->mask = 0;
+		key->ranks = NULL;
+		switch (column)
+		{
+			case MA_Column_Date:
+				key->type = MA_SortKey_Double;
+				key->doubles = [self dateColumn];
+				canSort = isCompare;
+				break;
+
+			case MA_Column_Read:
+			case MA_Column_Flagged:
+			case MA_Column_Comments:
+			case MA_Column_Enclosure:
+				key->type = MA_SortKey_Flag;
+				key->flags = [self flagColumn];
+				key->mask = (column == MA_Column_Read) ? MA_Index_Read :
+							(column == MA_Column_Flagged) ? MA_Index_Flagged :
+							(column == MA_Column_Comments) ? MA_Index_Comments : MA_Index_Enclosure;
+				canSort = isCompare;
+				break;
+
+			case MA_Column_None:
+				canSort = NO;
+				break;
+
+			default:
+				key->type = MA_SortKey_Rank;
+				canSort = [@"" respondsToSelector:selector];
+				if (canSort)
+					key->ranks = [self ranksForColumn:column selector:selector];
+				break;
+		}
+		if (!canSort)
+			break;
+		++countOfBuiltKeys;
+	}
+
+	NSArray * result;
+	if (!canSort)
+		result = [articles sortedArrayUsingDescriptors:sortDescriptors];
+	else
+	{
+		NSUInteger * order = malloc(sizeof(NSUInteger) * (countOfRows + 1));
+		NSUInteger row;
+
+		for (row = 0; row < countOfRows; ++row)
+			order[row] = row;
+		activeSortKeys = keys;
+		countOfActiveSortKeys = countOfBuiltKeys;
+		mergesort(order, countOfRows, sizeof(NSUInteger), compareRows);
+		activeSortKeys = NULL;
+		countOfActiveSortKeys = 0;
+		result = [self arrayOfRows:order count:countOfRows];
+		free(order);
+	}
+
+	NSUInteger index;
+	for (index = 0; index < countOfBuiltKeys; ++index)
+		free(keys[index].ranks);
+	free(keys);
+	return result;
+}
+
+/* dealloc
+ * Clean up behind us.
+ */
+-(void)dealloc
+{
+	free(flags);
+	free(createdDates);
+	free(dates);
+	free(rows);
+	[articles release];
+	[super dealloc];
+}
+@end
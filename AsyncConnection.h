@@ -45,6 +45,10 @@ typedef enum {
 	ConnectStatus status;
 	id delegate;
 	SEL handler;
+	SEL dataHandler;
+	long long minimumStreamingLength;
+	NSUInteger countOfBytesReceived;
+	BOOL isStreaming;
 	BOOL isConnectionComplete;
 }
 
@@ -65,6 +69,9 @@ typedef enum {
 -(NSString *)URLString;
 
 -(void)setHttpHeaders:(NSDictionary *)headerFields;
+-(void)setStreamingHandler:(SEL)selector minimumLength:(long long)minimumLength;
 -(NSDictionary *)responseHeaders;
 -(NSData *)receivedData;
+-(NSUInteger)countOfBytesReceived;
+-(BOOL)isStreaming;
 @end
@@ -23,6 +23,9 @@
 #import "AsyncConnection.h"
 #import "StringExtensions.h"
 
+// Largest Content-Length that is trusted to size the receive buffer up front.
+static const long long MA_Max_Presize_Length = 8 * 1024 * 1024;
+
 // Private functions
 @interface AsyncConnection (Private)
 	-(void)sendConnectionCompleteNotification;
@@ -41,6 +44,10 @@
 		username = nil;
 		password = nil;
 		handler = nil;
+		dataHandler = nil;
+		minimumStreamingLength = 0;
+		countOfBytesReceived = 0;
+		isStreaming = NO;
 		delegate = nil;
 		aItem = nil;
 		contextData = nil;
@@ -61,6 +68,24 @@
 	return receivedData;
 }
 
+/* countOfBytesReceived
+ * Returns how much data the connection has received so far, whether it was
+ * collected in receivedData or streamed to the delegate.
+ */
+-(NSUInteger)countOfBytesReceived
+{
+	return countOfBytesReceived;
+}
+
+/* isStreaming
+ * Returns YES if the data is being passed to the delegate as it arrives, in which
+ * case receivedData stays empty.
+ */
+-(BOOL)isStreaming
+{
+	return isStreaming;
+}
+
 /* responseHeaders
  * Return the dictionary of the responses from the request. This will be nil if no
  * request has been initiated or any response was obtained.
@@ -113,6 +138,18 @@
 	httpHeaders = headerFields;
 }
 
+/* setStreamingHandler
+ * Asks for the data of a successful response to be passed to the delegate a piece
+ * at a time, as it arrives, rather than collected in receivedData. Streaming is only
+ * used when the server says up front that the response is at least minimumLength
+ * bytes long. The selector is called with the connection and the new data.
+ */
+-(void)setStreamingHandler:(SEL)selector minimumLength:(long long)minimumLength
+{
+	dataHandler = selector;
+	minimumStreamingLength = minimumLength;
+}
+
 /* setURLString
  * Sets the current URL of this connection.
  */
@@ -225,6 +262,8 @@
 -(void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response
 {
 	[receivedData setLength:0];
+	countOfBytesReceived = 0;
+	isStreaming = NO;
 	if ([response isKindOfClass:[NSHTTPURLResponse class]])
 	{
 		NSHTTPURLResponse * httpResponse = (NSHTTPURLResponse *)response;
@@ -262,6 +301,18 @@
 			NSString * contentEncoding = [responseHeaders valueForKey:@"Content-Encoding"];
 			if ([[contentEncoding lowercaseString] isEqualToString:@"gzip"])
 				[aItem appendDetail:NSLocalizedString(@"Article feed will be compressed", nil)];
+
+			// Stream the data if the delegate asked for it and the response is long
+			// enough. Otherwise use the length to size the buffer once. This is the
+			// compressed length for a gzip response so the buffer may still grow.
+			long long expectedLength = [response expectedContentLength];
+			if (dataHandler != nil && expectedLength != NSURLResponseUnknownLength && expectedLength >= minimumStreamingLength)
+				isStreaming = YES;
+			else if (expectedLength > 0 && expectedLength <= MA_Max_Presize_Length)
+			{
+				[receivedData release];
+				receivedData = [[NSMutableData alloc] initWithCapacity:(NSUInteger)expectedLength];
+			}
 		}
 		else if ([httpResponse statusCode] == 410)
 		{
@@ -293,11 +344,16 @@
 
 /* didReceiveData
  * We received a new block of data from the remote. Append it to what we
- * have so far.
+ * have so far or, when streaming, hand it straight to the delegate. The data
+ * has already been inflated if the response was compressed.
  */
 -(void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data
 {
-	[receivedData appendData:data];
+	countOfBytesReceived += [data length];
+	if (isStreaming)
+		[delegate performSelector:dataHandler withObject:self withObject:data];
+	else
+		[receivedData appendData:data];
 }
 
 /* willCacheResponse
@@ -0,0 +1,41 @@
+//
+//  CriteriaMatcher.h
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Cocoa/Cocoa.h>
+#import "Criteria.h"
+
+@class Article;
+
+// One compiled clause of a criteria tree. The layout is private to the matcher.
+typedef struct MatchInstruction MatchInstruction;
+
+@interface CriteriaMatcher : NSObject {
+	MatchInstruction * program;
+	NSUInteger countOfInstructions;
+	BOOL matchAll;
+	BOOL matchesNothing;
+	BOOL needsArticleText;
+	NSDate * expiryDate;
+}
+
+// Public functions
+-(id)initWithCriteriaTree:(CriteriaTree *)criteriaTree;
+-(BOOL)matchesArticle:(Article *)article;
+-(BOOL)needsArticleText;
+-(NSDate *)expiryDate;
++(NSCalendarDate *)startDateForCriteria:(Criteria *)criteria spanOfDays:(int *)spanOfDays;
+@end
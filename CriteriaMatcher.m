@@ -0,0 +1,685 @@
+//
+//  CriteriaMatcher.m
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "CriteriaMatcher.h"
+#import "Database.h"
+#import "Message.h"
+#import "StringExtensions.h"
+
+// The kinds of instruction in a compiled program
+typedef enum {
+	MA_Match_Flag = 0,
+	MA_Match_Integer,
+	MA_Match_String,
+	MA_Match_Substring,
+	MA_Match_Phrase,
+	MA_Match_Date,
+	MA_Match_DateRange,
+	MA_Match_Folder
+} MatchOpcode;
+
+// Comparisons made by the flag, integer, string and date instructions
+typedef enum {
+	MA_Compare_Equal = 0,
+	MA_Compare_NotEqual,
+	MA_Compare_Less,
+	MA_Compare_Greater,
+	MA_Compare_LessOrEqual,
+	MA_Compare_GreaterOrEqual
+} MatchComparison;
+
+// Article columns that string instructions look at. An instruction that covers more
+// than one column is true if it is true for any one of them.
+#define MA_Column_Title			0x01
+#define MA_Column_Author		0x02
+#define MA_Column_Text			0x04
+#define MA_Column_Link			0x08
+#define MA_Column_Enclosure		0x10
+#define MA_Column_GUID			0x20
+#define MA_Column_Summary		0x40
+
+// Relative cost of evaluating an instruction. Cheaper instructions run first so the
+// article text is only fetched when nothing else has decided the result.
+#define MA_Cost_Scalar			0
+#define MA_Cost_String			1
+#define MA_Cost_Text			2
+
+struct MatchInstruction {
+	MatchOpcode opcode;
+	MatchComparison comparison;
+	BOOL negate;
+	int fieldTag;
+	int columns;
+	int cost;
+	int intValue;
+	double lowValue;
+	double highValue;
+	char * stringValue;
+	char ** words;
+	NSUInteger countOfWords;
+	BOOL lastWordIsPrefix;
+	NSIndexSet * folderIds;
+};
+
+@interface CriteriaMatcher (Private)
+	-(BOOL)compileCriteria:(Criteria *)criteria into:(MatchInstruction *)instruction;
+	-(void)compileFolderCriteria:(Criteria *)criteria into:(MatchInstruction *)instruction;
+	-(void)compileDateCriteria:(Criteria *)criteria into:(MatchInstruction *)instruction;
+	-(BOOL)compileStringCriteria:(Criteria *)criteria field:(Field *)field into:(MatchInstruction *)instruction;
+	-(void)addFolder:(int)folderId toSet:(NSMutableIndexSet *)folderIds;
+@end
+
+/* copyUTF8String
+ * Returns a malloc'd copy of the UTF-8 form of the string.
+ */
+static char * copyUTF8String(NSString * string)
+{
+	const char * utf8String = [string UTF8String];
+	return strdup(utf8String != NULL ? utf8String : "");
+}
+
+/* compareInstructionCost
+ * qsort comparator that orders instructions from cheapest to most expensive.
+ */
+static int compareInstructionCost(const void * first, const void * second)
+{
+	return ((const MatchInstruction *)first)->cost - ((const MatchInstruction *)second)->cost;
+}
+
+/* comparisonHolds
+ * Returns whether the comparison is satisfied by an ordering, which is negative, zero
+ * or positive as the article's value is less than, equal to or greater than the value
+ * in the criteria.
+ */
+static BOOL comparisonHolds(MatchComparison comparison, int order)
+{
+	switch (comparison)
+	{
+		case MA_Compare_Equal:			return order == 0;
+		case MA_Compare_NotEqual:		return order != 0;
+		case MA_Compare_Less:			return order < 0;
+		case MA_Compare_Greater:		return order > 0;
+		case MA_Compare_LessOrEqual:	return order <= 0;
+		case MA_Compare_GreaterOrEqual:	return order >= 0;
+	}
+	return NO;
+}
+
+/* substringMatches
+ * The in-memory equivalent of the regexp function that SQLDatabase registers with
+ * SQLite: a case insensitive substring search where a \w prefix on the pattern asks
+ * for the match to be a whole, space delimited, word.
+ */
+static BOOL substringMatches(const char * pattern, const char * string)
+{
+	if (pattern == NULL || string == NULL || *pattern == '\0' || *string == '\0')
+		return NO;
+
+	BOOL wholeWord = NO;
+	if (pattern[0] == '\\' && pattern[1] == 'w')
+	{
+		pattern += 2;
+		wholeWord = YES;
+	}
+
+	const char * match = strcasestr(string, pattern);
+	if (match == NULL)
+		return NO;
+	if (!wholeWord)
+		return YES;
+
+	const char * endOfMatch = match + strlen(pattern);
+	return (match == string || isspace(*(match - 1))) && (*endOfMatch == '\0' || isspace(*endOfMatch));
+}
+
+/* isTokenCharacter
+ * Returns whether the byte is part of a word to the FTS3 simple tokenizer, which treats
+ * ASCII letters and digits and every byte of a non-ASCII character as word characters.
+ */
+static BOOL isTokenCharacter(unsigned char ch)
+{
+	return ch >= 0x80 || (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+/* tokenMatches
+ * Returns whether a token from the article matches a lower case search word. The
+ * tokenizer folds only ASCII letters so that is all that is folded here.
+ */
+static BOOL tokenMatches(const unsigned char * token, size_t length, const char * word, BOOL isPrefix)
+{
+	size_t wordLength = strlen(word);
+	if (isPrefix ? (length < wordLength) : (length != wordLength))
+		return NO;
+
+	size_t index;
+	for (index = 0; index < wordLength; ++index)
+	{
+		unsigned char ch = token[index];
+		if (ch >= 'A' && ch <= 'Z')
+			ch += 'a' - 'A';
+		if (ch != (unsigned char)word[index])
+			return NO;
+	}
+	return YES;
+}
+
+/* phraseMatches
+ * Returns whether the text contains the instruction's words as consecutive tokens,
+ * which is what a phrase query against the full text search index looks for.
+ */
+static BOOL phraseMatches(const MatchInstruction * instruction, const char * text)
+{
+	const unsigned char * start = (const unsigned char *)text;
+	if (start == NULL)
+		return NO;
+
+	while (*start != '\0')
+	{
+		while (*start != '\0' && !isTokenCharacter(*start))
+			++start;
+		if (*start == '\0')
+			break;
+
+		const unsigned char * position = start;
+		NSUInteger index;
+		for (index = 0; index < instruction->countOfWords; ++index)
+		{
+			while (*position != '\0' && !isTokenCharacter(*position))
+				++position;
+			const unsigned char * token = position;
+			while (*position != '\0' && isTokenCharacter(*position))
+				++position;
+
+			BOOL isPrefix = instruction->lastWordIsPrefix && (index + 1 == instruction->countOfWords);
+			if (!tokenMatches(token, position - token, instruction->words[index], isPrefix))
+				break;
+		}
+		if (index == instruction->countOfWords)
+			return YES;
+
+		while (*start != '\0' && isTokenCharacter(*start))
+			++start;
+	}
+	return NO;
+}
+
+/* columnText
+ * Returns the UTF-8 text of one of the article's string columns or NULL if it has none.
+ * The full text search index holds the text with the HTML stripped, so that's what a
+ * phrase search looks at.
+ */
+static const char * columnText(Article * article, int column, BOOL isPhraseSearch)
+{
+	NSString * text = nil;
+	switch (column)
+	{
+		case MA_Column_Title:		text = [article title]; break;
+		case MA_Column_Author:		text = [article author]; break;
+		case MA_Column_Text:		text = isPhraseSearch ? [[article body] plainTextFromHTML] : [article body]; break;
+		case MA_Column_Link:		text = [article link]; break;
+		case MA_Column_Enclosure:	text = [article enclosure]; break;
+		case MA_Column_GUID:		text = [article guid]; break;
+		case MA_Column_Summary:		text = [article summary]; break;
+	}
+	return [text UTF8String];
+}
+
+/* flagValue
+ * Returns the value of one of the article's flag columns.
+ */
+static int flagValue(Article * article, int fieldTag)
+{
+	switch (fieldTag)
+	{
+		case MA_FieldID_Read:					return [article isRead];
+		case MA_FieldID_Flagged:				return [article isFlagged];
+		case MA_FieldID_Deleted:				return [article isDeleted];
+		case MA_FieldID_HasEnclosure:			return [article hasEnclosure];
+		case MA_FieldID_EnclosureDownloaded:	return [article enclosureDownloaded];
+	}
+	return 0;
+}
+
+/* evaluateInstruction
+ * Runs a single instruction of the program against the article.
+ */
+static BOOL evaluateInstruction(const MatchInstruction * instruction, Article * article)
+{
+	switch (instruction->opcode)
+	{
+		case MA_Match_Flag: {
+			int value = flagValue(article, instruction->fieldTag);
+			return comparisonHolds(instruction->comparison, (value > instruction->intValue) - (value < instruction->intValue));
+		}
+
+		case MA_Match_Integer: {
+			int value = [article parentId];
+			return comparisonHolds(instruction->comparison, (value > instruction->intValue) - (value < instruction->intValue));
+		}
+
+		case MA_Match_Date:
+		case MA_Match_DateRange: {
+			NSDate * date = [article date];
+			if (date == nil)
+				return NO;
+			double value = [date timeIntervalSince1970];
+			if (instruction->opcode == MA_Match_DateRange)
+				return value >= instruction->lowValue && value < instruction->highValue;
+			return comparisonHolds(instruction->comparison, (value > instruction->lowValue) - (value < instruction->lowValue));
+		}
+
+		case MA_Match_Folder: {
+			BOOL isInScope = [instruction->folderIds containsIndex:[article folderId]];
+			return instruction->negate ? !isInScope : isInScope;
+		}
+
+		case MA_Match_String:
+		case MA_Match_Substring:
+		case MA_Match_Phrase: {
+			// A full text search is one test across all the columns. The other string
+			// tests are made on each column in turn, as the SQL 'or' of the columns.
+			BOOL isPhraseFound = NO;
+			int column;
+			for (column = MA_Column_Title; column <= MA_Column_Summary; column <<= 1)
+			{
+				if ((instruction->columns & column) == 0)
+					continue;
+
+				const char * text = columnText(article, column, instruction->opcode == MA_Match_Phrase);
+				if (instruction->opcode == MA_Match_Phrase)
+				{
+					if (phraseMatches(instruction, text))
+					{
+						isPhraseFound = YES;
+						break;
+					}
+				}
+				else if (instruction->opcode == MA_Match_Substring)
+				{
+					// The regexp function is false for a NULL column so not regexp is true
+					if (substringMatches(instruction->stringValue, text) != instruction->negate)
+						return YES;
+				}
+				else if (text != NULL && comparisonHolds(instruction->comparison, strcmp(text, instruction->stringValue)))
+					return YES;
+			}
+			if (instruction->opcode == MA_Match_Phrase)
+				return isPhraseFound != instruction->negate;
+			return NO;
+		}
+	}
+	return NO;
+}
+
+@implementation CriteriaMatcher
+
+/* initWithCriteriaTree
+ * Compiles a criteria tree into a program that tests articles in memory. The program
+ * gives the same answer as the SQL that criteriaToSQL creates from the same tree, so
+ * it must be compiled again whenever the folders or, after its expiry date, the day
+ * change.
+ */
+-(id)initWithCriteriaTree:(CriteriaTree *)criteriaTree
+{
+	if ((self = [super init]) != nil)
+	{
+		NSUInteger capacity = 0;
+		NSEnumerator * enumerator = [criteriaTree criteriaEnumerator];
+		while ([enumerator nextObject] != nil)
+			++capacity;
+
+		program = (MatchInstruction *)calloc(MAX(capacity, 1u), sizeof(MatchInstruction));
+		countOfInstructions = 0;
+		matchAll = [criteriaTree condition] != MA_CritCondition_Any;
+		matchesNothing = NO;
+		needsArticleText = NO;
+		expiryDate = [[NSDate distantFuture] retain];
+
+		for (Criteria * criteria in [criteriaTree criteriaEnumerator])
+		{
+			MatchInstruction * instruction = &program[countOfInstructions];
+			if ([self compileCriteria:criteria into:instruction])
+			{
+				if ((instruction->opcode == MA_Match_String || instruction->opcode == MA_Match_Substring || instruction->opcode == MA_Match_Phrase) && (instruction->columns & MA_Column_Text))
+					needsArticleText = YES;
+				++countOfInstructions;
+			}
+		}
+
+		// A tree without any clauses makes an empty 'where' clause, which SQLite rejects.
+		if (countOfInstructions == 0)
+			matchesNothing = YES;
+		qsort(program, countOfInstructions, sizeof(MatchInstruction), compareInstructionCost);
+	}
+	return self;
+}
+
+/* compileCriteria
+ * Compiles a single clause. Returns NO if the clause is left out of the program, as
+ * criteriaToSQL leaves out clauses with an unknown operator.
+ */
+-(BOOL)compileCriteria:(Criteria *)criteria into:(MatchInstruction *)instruction
+{
+	Field * field = [[Database sharedDatabase] fieldByName:[criteria field]];
+	NSAssert1(field != nil, @"Criteria field %@ does not have an associated database field", [criteria field]);
+
+	memset(instruction, 0, sizeof(MatchInstruction));
+	switch ([criteria operator])
+	{
+		case MA_CritOper_Is:					instruction->comparison = MA_Compare_Equal; break;
+		case MA_CritOper_IsNot:					instruction->comparison = MA_Compare_NotEqual; break;
+		case MA_CritOper_IsLessThan:
+		case MA_CritOper_IsBefore:				instruction->comparison = MA_Compare_Less; break;
+		case MA_CritOper_IsGreaterThan:
+		case MA_CritOper_IsAfter:				instruction->comparison = MA_Compare_Greater; break;
+		case MA_CritOper_IsLessThanOrEqual:
+		case MA_CritOper_IsOnOrBefore:			instruction->comparison = MA_Compare_LessOrEqual; break;
+		case MA_CritOper_IsGreaterThanOrEqual:
+		case MA_CritOper_IsOnOrAfter:			instruction->comparison = MA_Compare_GreaterOrEqual; break;
+		case MA_CritOper_Contains:
+		case MA_CritOper_NotContains:
+		case MA_CritOper_Under:
+		case MA_CritOper_NotUnder:				break;
+		default:								return NO;
+	}
+	instruction->fieldTag = [field tag];
+	instruction->cost = MA_Cost_Scalar;
+
+	switch ([field type])
+	{
+		case MA_FieldType_Flag:
+			if ([field tag] == MA_FieldID_Flagged || [field tag] == MA_FieldID_Read || [field tag] == MA_FieldID_Deleted ||
+				[field tag] == MA_FieldID_HasEnclosure || [field tag] == MA_FieldID_EnclosureDownloaded)
+			{
+				instruction->opcode = MA_Match_Flag;
+				instruction->intValue = [[criteria value] isEqualToString:@"Yes"] ? 1 : 0;
+				return YES;
+			}
+			break;
+
+		case MA_FieldType_Folder:
+			[self compileFolderCriteria:criteria into:instruction];
+			return YES;
+
+		case MA_FieldType_Date:
+			[self compileDateCriteria:criteria into:instruction];
+			return YES;
+
+		case MA_FieldType_String:
+			if ([self compileStringCriteria:criteria field:field into:instruction])
+				return YES;
+			break;
+
+		case MA_FieldType_Integer:
+			if ([field tag] == MA_FieldID_Parent)
+			{
+				instruction->opcode = MA_Match_Integer;
+				instruction->intValue = [[criteria value] intValue];
+				return YES;
+			}
+			if ([field tag] == MA_FieldID_GUID)
+			{
+				// The guid column holds text so SQLite compares the value as text too
+				instruction->opcode = MA_Match_String;
+				instruction->columns = MA_Column_GUID;
+				instruction->stringValue = copyUTF8String([criteria value]);
+				instruction->cost = MA_Cost_String;
+				return YES;
+			}
+			break;
+	}
+
+	// The field has no column in the messages table. The SQL for it fails so nothing
+	// matches.
+	matchesNothing = YES;
+	return NO;
+}
+
+/* compileFolderCriteria
+ * Compiles a folder clause into the set of folder IDs that it covers. The scope is
+ * worked out the same way as sqlScopeForFolder does it.
+ */
+-(void)compileFolderCriteria:(Criteria *)criteria into:(MatchInstruction *)instruction
+{
+	Folder * folder = [[Database sharedDatabase] folderFromName:[criteria value]];
+	NSMutableIndexSet * folderIds = [[NSMutableIndexSet alloc] init];
+	BOOL subScope = NO;
+
+	switch ([criteria operator])
+	{
+		case MA_CritOper_Under:		subScope = YES; instruction->negate = NO; break;
+		case MA_CritOper_NotUnder:	subScope = YES; instruction->negate = YES; break;
+		case MA_CritOper_IsNot:		instruction->negate = YES; break;
+		default:					instruction->negate = NO; break;
+	}
+	if (folder != nil && IsGroupFolder(folder))
+		subScope = YES;
+
+	if (folder == nil)
+		[folderIds addIndex:0];
+	else if (subScope)
+		[self addFolder:[folder itemId] toSet:folderIds];
+	else
+		[folderIds addIndex:[folder itemId]];
+
+	instruction->opcode = MA_Match_Folder;
+	instruction->folderIds = folderIds;
+}
+
+/* addFolder
+ * Adds a folder and everything below it to the set.
+ */
+-(void)addFolder:(int)folderId toSet:(NSMutableIndexSet *)folderIds
+{
+	[folderIds addIndex:folderId];
+	for (Folder * child in [[Database sharedDatabase] arrayOfFolders:folderId])
+		[self addFolder:[child itemId] toSet:folderIds];
+}
+
+/* compileDateCriteria
+ * Compiles a date clause to a comparison against a time, or to a range of times for
+ * the Is operator. Since "today", "yesterday" and "last week" are relative to the
+ * current day the program expires at the next midnight.
+ */
+-(void)compileDateCriteria:(Criteria *)criteria into:(MatchInstruction *)instruction
+{
+	int spanOfDays;
+	NSCalendarDate * startDate = [CriteriaMatcher startDateForCriteria:criteria spanOfDays:&spanOfDays];
+
+	if ([criteria operator] == MA_CritOper_Is)
+	{
+		NSCalendarDate * endDate = [startDate dateByAddingYears:0 months:0 days:spanOfDays hours:0 minutes:0 seconds:0];
+		instruction->opcode = MA_Match_DateRange;
+		instruction->lowValue = [startDate timeIntervalSince1970];
+		instruction->highValue = [endDate timeIntervalSince1970];
+	}
+	else
+	{
+		if (([criteria operator] == MA_CritOper_IsAfter) || ([criteria operator] == MA_CritOper_IsOnOrBefore))
+			startDate = [startDate dateByAddingYears:0 months:0 days:0 hours:23 minutes:59 seconds:59];
+		instruction->opcode = MA_Match_Date;
+		instruction->lowValue = [startDate timeIntervalSince1970];
+	}
+
+	NSCalendarDate * now = [NSCalendarDate calendarDate];
+	NSCalendarDate * today = [NSCalendarDate dateWithYear:[now yearOfCommonEra] month:[now monthOfYear] day:[now dayOfMonth] hour:0 minute:0 second:0 timeZone:[now timeZone]];
+	[expiryDate release];
+	expiryDate = [[today dateByAddingYears:0 months:0 days:1 hours:0 minutes:0 seconds:0] retain];
+}
+
+/* compileStringCriteria
+ * Compiles a string clause. Contains and does not contain on the subject, author and
+ * text become a phrase search like the full text search index query that the SQL
+ * uses. Everything else works on the column values directly. Returns NO if the field
+ * has no column to test.
+ */
+-(BOOL)compileStringCriteria:(Criteria *)criteria field:(Field *)field into:(MatchInstruction *)instruction
+{
+	int columns = 0;
+	switch ([field tag])
+	{
+		case MA_FieldID_Subject:	columns = MA_Column_Title; break;
+		case MA_FieldID_Author:		columns = MA_Column_Author; break;
+		case MA_FieldID_Text:		columns = MA_Column_Text; break;
+		case MA_FieldID_Link:		columns = MA_Column_Link; break;
+		case MA_FieldID_Enclosure:	columns = MA_Column_Enclosure; break;
+		case MA_FieldID_Summary:	columns = MA_Column_Summary; break;
+		default:					return NO;
+	}
+
+	BOOL isContains = [criteria operator] == MA_CritOper_Contains || [criteria operator] == MA_CritOper_NotContains;
+	instruction->negate = [criteria operator] == MA_CritOper_NotContains;
+	instruction->cost = MA_Cost_String;
+
+	if (isContains && (columns & (MA_Column_Title|MA_Column_Author|MA_Column_Text)))
+	{
+		// Split the value into words the way searchIndexQuery does
+		NSString * value = [criteria value];
+		BOOL wholeWord = [value hasPrefix:@"\\w"];
+		if (wholeWord)
+			value = [value substringFromIndex:2];
+
+		NSMutableArray * words = [NSMutableArray array];
+		NSCharacterSet * separators = [[NSCharacterSet alphanumericCharacterSet] invertedSet];
+		for (NSString * word in [value componentsSeparatedByCharactersInSet:separators])
+		{
+			if ([word length] > 0)
+				[words addObject:word];
+		}
+
+		if ([words count] > 0)
+		{
+			instruction->opcode = MA_Match_Phrase;
+			instruction->lastWordIsPrefix = !wholeWord;
+			instruction->countOfWords = [words count];
+			instruction->words = (char **)calloc([words count], sizeof(char *));
+
+			NSUInteger index;
+			for (index = 0; index < [words count]; ++index)
+			{
+				char * word = copyUTF8String([words objectAtIndex:index]);
+				char * ch;
+				for (ch = word; *ch != '\0'; ++ch)
+				{
+					if (*ch >= 'A' && *ch <= 'Z')
+						*ch += 'a' - 'A';
+				}
+				instruction->words[index] = word;
+			}
+
+			// A text search also covers the title
+			instruction->columns = (columns == MA_Column_Text) ? (MA_Column_Title|MA_Column_Text) : columns;
+			if (columns == MA_Column_Text)
+				instruction->cost = MA_Cost_Text;
+			return YES;
+		}
+	}
+
+	// Searches of the text always include the title
+	instruction->opcode = isContains ? MA_Match_Substring : MA_Match_String;
+	instruction->columns = (columns == MA_Column_Text) ? (MA_Column_Title|MA_Column_Text) : columns;
+	instruction->stringValue = copyUTF8String([criteria value]);
+	if (columns == MA_Column_Text)
+		instruction->cost = MA_Cost_Text;
+	return YES;
+}
+
+/* startDateForCriteria
+ * Returns the midnight at which the range of days named by a date criteria value
+ * starts and sets spanOfDays to the number of days in the range. The value may be
+ * "yesterday" or "last week", which is the last seven days, and any other value
+ * means today.
+ */
++(NSCalendarDate *)startDateForCriteria:(Criteria *)criteria spanOfDays:(int *)spanOfDays
+{
+	NSCalendarDate * startDate = [NSCalendarDate date];
+	NSString * criteriaValue = [[criteria value] lowercaseString];
+	*spanOfDays = 1;
+
+	// "yesterday" is a short hand way of specifying the previous day.
+	if ([criteriaValue isEqualToString:@"yesterday"])
+	{
+		startDate = [startDate dateByAddingYears:0 months:0 days:-1 hours:0 minutes:0 seconds:0];
+	}
+	// "last week" is a short hand way of specifying a range from 7 days ago to today.
+	else if ([criteriaValue isEqualToString:@"last week"])
+	{
+		startDate = [startDate dateByAddingYears:0 months:0 days:-6 hours:0 minutes:0 seconds:0];
+		*spanOfDays = 7;
+	}
+
+	criteriaValue = [NSString stringWithFormat:@"%d/%d/%d %d:%d:%d", [startDate dayOfMonth], [startDate monthOfYear], [startDate yearOfCommonEra], 0, 0, 0];
+	return [NSCalendarDate dateWithString:criteriaValue calendarFormat:@"%d/%m/%Y %H:%M:%S"];
+}
+
+/* matchesArticle
+ * Returns whether the article meets the criteria.
+ */
+-(BOOL)matchesArticle:(Article *)article
+{
+	if (matchesNothing)
+		return NO;
+
+	NSUInteger index;
+	for (index = 0; index < countOfInstructions; ++index)
+	{
+		BOOL result = evaluateInstruction(&program[index], article);
+		if (result != matchAll)
+			return result;
+	}
+	return matchAll;
+}
+
+/* needsArticleText
+ * Returns whether testing an article may need its text. Articles read from the
+ * database don't have their text loaded so it costs a query each to fetch it.
+ */
+-(BOOL)needsArticleText
+{
+	return needsArticleText;
+}
+
+/* expiryDate
+ * Returns the time after which relative dates in the program are out of date.
+ */
+-(NSDate *)expiryDate
+{
+	return expiryDate;
+}
+
+/* dealloc
+ * Clean up behind us.
+ */
+-(void)dealloc
+{
+	NSUInteger index;
+	for (index = 0; index < countOfInstructions; ++index)
+	{
+		MatchInstruction * instruction = &program[index];
+		NSUInteger wordIndex;
+
+		for (wordIndex = 0; wordIndex < instruction->countOfWords; ++wordIndex)
+			free(instruction->words[wordIndex]);
+		free(instruction->words);
+		free(instruction->stringValue);
+		[instruction->folderIds release];
+	}
+	free(program);
+	[expiryDate release];
+	[super dealloc];
+}
+@end
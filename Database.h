@@ -24,6 +24,8 @@
 #import "Field.h"
 #import "Criteria.h"
 
+@class CachedBody;
+
 @interface Database : NSObject {
 	SQLDatabase * sqlDatabase;
 	BOOL initializedfoldersDict;
@@ -40,7 +42,19 @@
 	NSMutableDictionary * fieldsByName;
 	NSMutableDictionary * fieldsByTitle;
 	NSMutableDictionary * foldersDict;
+	NSMutableDictionary * foldersByName;
+	NSMutableDictionary * foldersByFeedURL;
+	NSMutableDictionary * foldersByParent;
 	NSMutableDictionary * smartfoldersDict;
+	NSMutableDictionary * bodyCache;
+	CachedBody * newestBody;
+	CachedBody * oldestBody;
+	NSUInteger bodyCacheSize;
+	NSMutableSet * dirtyUnreadFolders;
+	NSMutableDictionary * folderPlans;
+	NSMutableDictionary * smartFolderResults;
+	NSMutableArray * smartFolderResultsOrder;
+	NSMutableDictionary * smartFolderMembers;
 }
 
 // General database functions
@@ -51,6 +65,7 @@
 -(void)beginTransaction;
 -(void)commitTransaction;
 -(void)compactDatabase;
+-(void)rebuildSearchIndex;
 -(int)countOfUnread;
 -(BOOL)readOnly;
 -(void)close;
@@ -85,6 +100,8 @@
 -(void)setFolderUnreadCount:(Folder *)folder adjustment:(int)adjustment;
 -(void)setFolderLastUpdate:(int)folderId lastUpdate:(NSDate *)lastUpdate;
 -(void)setFolderLastUpdateString:(int)folderId lastUpdateString:(NSString *)lastUpdateString;
+-(void)setFolderETag:(int)folderId etag:(NSString *)etag;
+-(void)setFolderBodyDigest:(int)folderId bodyDigest:(NSString *)bodyDigest;
 -(BOOL)setParent:(int)newParentID forFolder:(int)folderId;
 -(BOOL)setFirstChild:(int)childId forFolder:(int)folderId;
 -(BOOL)setNextSibling:(int)nextSiblingId forFolder:(int)folderId;
@@ -103,15 +120,22 @@
 -(BOOL)updateSearchFolder:(int)folderId withFolder:(NSString *)folderName withQuery:(CriteriaTree *)criteriaTree;
 -(CriteriaTree *)searchStringForSmartFolder:(int)folderId;
 -(NSString *)criteriaToSQL:(CriteriaTree *)criteriaTree;
+-(int)unreadCountOfSmartFolder:(int)folderId;
 
 // Article functions
--(BOOL)createArticle:(int)folderID article:(Article *)article guidHistory:(NSArray *)guidHistory;
+-(BOOL)createArticle:(int)folderID article:(Article *)article guidHistory:(NSSet *)guidHistory;
+-(int)createArticles:(NSArray *)articles inFolder:(int)folderID guidHistory:(NSSet *)guidHistory;
 -(BOOL)deleteArticle:(int)folderId guid:(NSString *)guid;
 -(NSArray *)arrayOfUnreadArticles:(int)folderId;
 -(NSArray *)arrayOfArticles:(int)folderId filterString:(NSString *)filterString;
+-(NSString *)bodyOfArticle:(int)folderId guid:(NSString *)guid;
 -(void)markArticleRead:(int)folderId guid:(NSString *)guid isRead:(BOOL)isRead;
 -(void)markArticleFlagged:(int)folderId guid:(NSString *)guid isFlagged:(BOOL)isFlagged;
 -(void)markArticleDeleted:(int)folderId guid:(NSString *)guid isDeleted:(BOOL)isDeleted;
+-(void)markArticlesRead:(NSArray *)articles isRead:(BOOL)isRead;
+-(void)markArticlesFlagged:(NSArray *)articles isFlagged:(BOOL)isFlagged;
+-(void)markArticlesDeleted:(NSArray *)articles isDeleted:(BOOL)isDeleted;
+-(BOOL)deleteArticles:(NSArray *)articles;
 -(BOOL)isTrashEmpty;
--(NSArray *)guidHistoryForFolderId:(int)folderId;
+-(NSSet *)guidHistoryForFolderId:(int)folderId;
 @end
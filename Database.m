@@ -25,6 +25,7 @@
 #import "Constants.h"
 #import "ArticleRef.h"
 #import "SearchString.h"
+#import "CriteriaMatcher.h"
 
 // Private scope flags
 #define MA_Scope_Inclusive		1
@@ -41,18 +42,153 @@
 	-(NSString *)sqlScopeForFolder:(Folder *)folder flags:(int)scopeFlags;
 	-(void)createInitialSmartFolder:(NSString *)folderName withCriteria:(Criteria *)criteria;
 	-(int)createFolderOnDatabase:(NSString *)name underParent:(int)parentId withType:(int)type;
+	-(void)createMessageIndexes;
+	-(NSString *)searchIndexQuery:(NSString *)value columns:(NSArray *)columnNames;
 	-(int)executeSQL:(NSString *)sqlStatement;
 	-(int)executeSQLWithFormat:(NSString *)sqlStatement, ...;
+	-(void)cacheBody:(NSString *)body forKey:(NSString *)key;
+	-(void)removeCachedBody:(int)folderId guid:(NSString *)guid;
+	-(void)clearBodyCache;
+	-(void)linkCachedBody:(CachedBody *)entry;
+	-(void)unlinkCachedBody:(CachedBody *)entry;
+	-(void)addFolderToIndexes:(Folder *)folder;
+	-(void)removeFolderFromIndexes:(Folder *)folder;
+	-(void)addFolder:(Folder *)folder toTable:(NSMutableDictionary *)table forKey:(id)key;
+	-(void)removeFolder:(Folder *)folder fromTable:(NSMutableDictionary *)table forKey:(id)key;
+	-(BOOL)storeArticle:(Article *)article inFolder:(Folder *)folder guidHistory:(NSSet *)guidHistory adjustment:(int *)adjustment;
+	-(void)recountUnreadArticles;
+	-(void)flushUnreadCounts;
+	-(NSDictionary *)guidsByFolder:(NSArray *)articles;
+	-(BOOL)executeSQL:(NSString *)sqlFormat inFolder:(int)folderId forGuids:(NSArray *)guids;
+	-(void)createFolderTree;
+	-(NSString *)sqlForFolder:(Folder *)folder;
+	-(BOOL)criteriaTreeDependsOnDate:(CriteriaTree *)criteriaTree;
+	-(void)invalidateFolderPlans;
+	-(NSArray *)cachedArticlesForFolder:(Folder *)folder sql:(NSString *)sql;
+	-(void)cacheArticles:(NSArray *)articles forFolder:(Folder *)folder sql:(NSString *)sql;
+	-(NSMutableDictionary *)membershipOfSmartFolder:(Folder *)folder;
+	-(void)setMembershipOfSmartFolder:(Folder *)folder fromArticles:(NSArray *)articles sql:(NSString *)sql;
+	-(NSDictionary *)readFlagsForQuery:(NSString *)sqlFormat inFolder:(int)folderId forGuids:(NSArray *)guids;
+	-(SQLStatement *)prepareBatch:(NSString *)sqlFormat inFolder:(int)folderId forGuids:(NSArray *)guids start:(NSUInteger *)start;
+	-(void)updateSmartFolderMembership:(NSDictionary *)guidsByFolder;
+	-(void)removeFromSmartFolderMembership:(NSDictionary *)guidsByFolder;
+	-(void)invalidateSmartFolderMembership;
 @end
 
 // The current database version number
 const int MA_Min_Supported_DB_Version = 12;
-const int MA_Current_DB_Version = 18;
+const int MA_Current_DB_Version = 24;
+
+// Number of guids bound into a single "message_id in (...)" statement by the bulk
+// article functions. SQLite allows at most 999 parameters per statement. Batches
+// that would be smaller are padded to one of these two sizes so that only two
+// statements are compiled for each query.
+const NSUInteger MA_Guid_Batch_Size = 500;
+const NSUInteger MA_Guid_Small_Batch_Size = 16;
+
+// Upper bound, in bytes, on the article bodies kept in memory by bodyOfArticle
+const NSUInteger MA_Body_Cache_Limit = 8 * 1024 * 1024;
+
+// Number of smart folders whose article lists arrayOfArticles keeps in memory
+const NSUInteger MA_Smart_Folder_Result_Cache_Size = 4;
 
 // There's just one database and we manage access to it through a
 // singleton object.
 static Database * _sharedDatabase = nil;
 
+// An article body in the body cache. The cached bodies are also linked together
+// from the most to the least recently used so that a body can be moved to the
+// front or evicted without searching for it. The links are not retained since
+// the cache dictionary owns every entry.
+@interface CachedBody : NSObject {
+	NSString * key;
+	NSString * body;
+	CachedBody * newer;
+	CachedBody * older;
+}
+
+// Accessor functions
+-(id)initWithKey:(NSString *)theKey body:(NSString *)theBody;
+-(NSString *)key;
+-(NSString *)body;
+-(CachedBody *)newer;
+-(CachedBody *)older;
+-(void)setNewer:(CachedBody *)newNewer;
+-(void)setOlder:(CachedBody *)newOlder;
+@end
+
+@implementation CachedBody
+
+/* initWithKey
+ * Initialises a cache entry for the body of the article with the given key.
+ */
+-(id)initWithKey:(NSString *)theKey body:(NSString *)theBody
+{
+	if ((self = [super init]) != nil)
+	{
+		key = [theKey retain];
+		body = [theBody retain];
+		newer = nil;
+		older = nil;
+	}
+	return self;
+}
+
+/* key
+ */
+-(NSString *)key
+{
+	return key;
+}
+
+/* body
+ */
+-(NSString *)body
+{
+	return body;
+}
+
+/* newer
+ * Returns the next more recently used entry.
+ */
+-(CachedBody *)newer
+{
+	return newer;
+}
+
+/* older
+ * Returns the next less recently used entry.
+ */
+-(CachedBody *)older
+{
+	return older;
+}
+
+/* setNewer
+ */
+-(void)setNewer:(CachedBody *)newNewer
+{
+	newer = newNewer;
+}
+
+/* setOlder
+ */
+-(void)setOlder:(CachedBody *)newOlder
+{
+	older = newOlder;
+}
+
+/* dealloc
+ * Clean up behind us.
+ */
+-(void)dealloc
+{
+	[key release];
+	[body release];
+	[super dealloc];
+}
+@end
+
 @implementation Database
 
 /* init
@@ -72,6 +208,18 @@ static Database * _sharedDatabase = nil;
 		searchString = @"";
 		smartfoldersDict = [[NSMutableDictionary dictionary] retain];
 		foldersDict = [[NSMutableDictionary dictionary] retain];
+		foldersByName = [[NSMutableDictionary alloc] init];
+		foldersByFeedURL = [[NSMutableDictionary alloc] init];
+		foldersByParent = [[NSMutableDictionary alloc] init];
+		bodyCache = [[NSMutableDictionary alloc] init];
+		newestBody = nil;
+		oldestBody = nil;
+		bodyCacheSize = 0;
+		dirtyUnreadFolders = [[NSMutableSet alloc] init];
+		folderPlans = [[NSMutableDictionary alloc] init];
+		smartFolderResults = [[NSMutableDictionary alloc] init];
+		smartFolderResultsOrder = [[NSMutableArray alloc] init];
+		smartFolderMembers = [[NSMutableDictionary alloc] init];
 	}
 	return self;
 }
@@ -180,13 +328,17 @@ static Database * _sharedDatabase = nil;
 		[self beginTransaction];
 
 		[self executeSQL:@"create table folders (folder_id integer primary key, parent_id, foldername, unread_count, last_update, type, flags, next_sibling, first_child)"];
-		[self executeSQL:@"create table messages (message_id, folder_id, parent_id, read_flag, marked_flag, deleted_flag, title, sender, link, createddate, date, text, revised_flag, enclosuredownloaded_flag, hasenclosure_flag, enclosure)"];
+		[self executeSQL:@"create table messages (article_id integer primary key, message_id text not null, folder_id integer not null, parent_id integer, read_flag integer, marked_flag integer, deleted_flag integer, "
+						 @"title text, sender text, link text, createddate real, date real, text text, revised_flag integer, enclosuredownloaded_flag integer, hasenclosure_flag integer, enclosure text, summary text, "
+						 @"unique (folder_id, message_id))"];
 		[self executeSQL:@"create table smart_folders (folder_id, search_string)"];
-		[self executeSQL:@"create table rss_folders (folder_id, feed_url, username, last_update_string, description, home_page, bloglines_id)"];
+		[self executeSQL:@"create table rss_folders (folder_id, feed_url, username, last_update_string, description, home_page, bloglines_id, etag, body_digest)"];
 		[self executeSQL:@"create table rss_guids (message_id, folder_id)"];
-		[self executeSQL:@"create index messages_folder_idx on messages (folder_id)"];
-		[self executeSQL:@"create index messages_message_idx on messages (message_id)"];
+		[self createMessageIndexes];
 		[self executeSQL:@"create index rss_guids_idx on rss_guids (folder_id)"];
+		[self executeSQL:@"create virtual table messages_fts using fts3(title, sender, text)"];
+		[self executeSQL:@"create table folder_tree (ancestor_id integer not null, folder_id integer not null, primary key (ancestor_id, folder_id))"];
+		[self executeSQL:@"create index folder_tree_folder_idx on folder_tree (folder_id)"];
 
 		// Create a criteria to find all marked articles
 		Criteria * markedCriteria = [[Criteria alloc] initWithField:MA_Field_Flagged withOperator:MA_CritOper_Is withValue:@"Yes"];
@@ -207,6 +359,7 @@ static Database * _sharedDatabase = nil;
 		[self executeSQLWithFormat:@"insert into folders (parent_id, foldername, unread_count, last_update, type, flags, next_sibling, first_child) values (-1, '%@', 0, 0, %d, 0, 0, 0)",
 			NSLocalizedString(@"Trash", nil),
 			MA_Trash_Folder];
+		[self executeSQLWithFormat:@"insert into folder_tree (ancestor_id, folder_id) values (%d, %d)", [sqlDatabase lastInsertRowId], [sqlDatabase lastInsertRowId]];
 
 		// Set the initial version
 		databaseVersion = MA_Current_DB_Version;
@@ -384,6 +537,127 @@ static Database * _sharedDatabase = nil;
 		[self commitTransaction];
 	}
 	
+	// Upgrade to rev 19.
+	// Rebuild the messages table with typed columns and a unique (folder_id, message_id) key, and
+	// replace the single column folder index with composite indexes for the common lookups. SQLite
+	// can't alter a column type so the table is copied. If there are duplicate articles the most
+	// recently added one wins. The copy also gets the article_id key that rev 20 adds, so this
+	// goes straight to rev 20 rather than copying every article a second time.
+	if (databaseVersion < 19)
+	{
+		[self beginTransaction];
+		
+		[self executeSQL:@"create table messages_new (article_id integer primary key, message_id text not null, folder_id integer not null, parent_id integer, read_flag integer, marked_flag integer, deleted_flag integer, "
+						 @"title text, sender text, link text, createddate real, date real, text text, revised_flag integer, enclosuredownloaded_flag integer, hasenclosure_flag integer, enclosure text, "
+						 @"unique (folder_id, message_id))"];
+		[self executeSQL:@"insert or replace into messages_new (message_id, folder_id, parent_id, read_flag, marked_flag, deleted_flag, title, sender, link, createddate, date, text, revised_flag, enclosuredownloaded_flag, hasenclosure_flag, enclosure) "
+						 @"select message_id, folder_id, parent_id, read_flag, marked_flag, deleted_flag, title, sender, link, createddate, date, text, revised_flag, enclosuredownloaded_flag, hasenclosure_flag, enclosure "
+						 @"from messages where message_id is not null and folder_id is not null order by rowid"];
+		[self executeSQL:@"drop table messages"];
+		[self executeSQL:@"alter table messages_new rename to messages"];
+		[self createMessageIndexes];
+		
+		// Set the new version
+		[self setDatabaseVersion:20];
+		[self commitTransaction];
+		
+		// Give the query planner statistics for the new indexes.
+		[self executeSQL:@"analyze"];
+	}
+	
+	// Upgrade to rev 20.
+	// Copy the messages table again to give it an explicit article_id key. This keeps row ids
+	// stable across a vacuum so that other tables can refer to them. Only databases that are
+	// already at rev 19 get here.
+	if (databaseVersion < 20)
+	{
+		[self beginTransaction];
+		
+		[self executeSQL:@"create table messages_new (article_id integer primary key, message_id text not null, folder_id integer not null, parent_id integer, read_flag integer, marked_flag integer, deleted_flag integer, "
+						 @"title text, sender text, link text, createddate real, date real, text text, revised_flag integer, enclosuredownloaded_flag integer, hasenclosure_flag integer, enclosure text, "
+						 @"unique (folder_id, message_id))"];
+		[self executeSQL:@"insert into messages_new (message_id, folder_id, parent_id, read_flag, marked_flag, deleted_flag, title, sender, link, createddate, date, text, revised_flag, enclosuredownloaded_flag, hasenclosure_flag, enclosure) "
+						 @"select message_id, folder_id, parent_id, read_flag, marked_flag, deleted_flag, title, sender, link, createddate, date, text, revised_flag, enclosuredownloaded_flag, hasenclosure_flag, enclosure "
+						 @"from messages order by rowid"];
+		[self executeSQL:@"drop table messages"];
+		[self executeSQL:@"alter table messages_new rename to messages"];
+		[self createMessageIndexes];
+		
+		// Set the new version
+		[self setDatabaseVersion:20];
+		[self commitTransaction];
+	}
+	
+	// Upgrade to rev 21.
+	// Add the full text search index over article titles, authors and bodies and fill it
+	// from the existing articles. Each row's docid is the article_id of its article.
+	if (databaseVersion < 21)
+	{
+		[self beginTransaction];
+		
+		[self executeSQL:@"create virtual table messages_fts using fts3(title, sender, text)"];
+		[self rebuildSearchIndex];
+		
+		// Set the new version
+		[self setDatabaseVersion:21];
+		[self commitTransaction];
+	}
+	
+	// Upgrade to rev 22.
+	// Add the folder_tree closure table that links every folder to itself and to each of
+	// its ancestors, so that the folders under a group can be found with an index lookup.
+	if (databaseVersion < 22)
+	{
+		[self beginTransaction];
+		
+		[self executeSQL:@"create table folder_tree (ancestor_id integer not null, folder_id integer not null, primary key (ancestor_id, folder_id))"];
+		[self executeSQL:@"create index folder_tree_folder_idx on folder_tree (folder_id)"];
+		[self createFolderTree];
+		
+		// Set the new version
+		[self setDatabaseVersion:22];
+		[self commitTransaction];
+	}
+	
+	// Upgrade to rev 23.
+	// Add the ETag and the digest of the last stored feed data to each subscription so
+	// that a refresh can tell that a feed hasn't changed.
+	if (databaseVersion < 23)
+	{
+		[self beginTransaction];
+		
+		[self executeSQL:@"alter table rss_folders add column etag default ''"];
+		[self executeSQL:@"alter table rss_folders add column body_digest default ''"];
+		
+		// Set the new version
+		[self setDatabaseVersion:23];
+		[self commitTransaction];
+	}
+	
+	// Upgrade to rev 24.
+	// Add the summary of each article so that the article list can show and sort by the
+	// summary without loading every article body.
+	if (databaseVersion < 24)
+	{
+		[self beginTransaction];
+		
+		[self executeSQL:@"alter table messages add column summary text"];
+		SQLStatement * articles = [sqlDatabase streamQuery:@"select article_id, text from messages"];
+		SQLStatement * update = [sqlDatabase prepareStatement:@"update messages set summary=? where article_id=?"];
+		for (SQLRow * row in [articles rowEnumerator])
+		{
+			NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+			[update bindString:[SafeString([row stringForColumnAtIndex:1]) summaryTextFromHTML] atIndex:1];
+			[update bindInt:[row intForColumnAtIndex:0] atIndex:2];
+			[update execute];
+			[pool drain];
+		}
+		
+		// Set the new version
+		[self setDatabaseVersion:24];
+		[self commitTransaction];
+	}
+	
 	// Read the folders tree sort method from the database.
 	// Make sure that the folders tree is not yet registered to receive notifications at this point.
 	int newFoldersTreeSortMethod = MA_FolderSort_ByName;
@@ -426,6 +700,61 @@ static Database * _sharedDatabase = nil;
 	return YES;
 }
 
+/* createMessageIndexes
+ * Creates the indexes on the messages table. The unique (folder_id, message_id) key
+ * covers lookups by folder so there is no separate folder index.
+ *
+ *   messages_message_idx - lookups by guid alone.
+ *   messages_unread_idx - unread articles in a folder and markFolderRead.
+ *   messages_read_idx - the Unread Articles smart folder across all folders.
+ *   messages_flagged_idx - the Marked Articles smart folder.
+ *   messages_deleted_idx - the trash, isTrashEmpty and purgeArticlesOlderThanDays.
+ *   messages_date_idx - date based smart folders.
+ */
+-(void)createMessageIndexes
+{
+	[self executeSQL:@"create index messages_message_idx on messages (message_id)"];
+	[self executeSQL:@"create index messages_unread_idx on messages (folder_id, read_flag)"];
+	[self executeSQL:@"create index messages_read_idx on messages (read_flag, folder_id)"];
+	[self executeSQL:@"create index messages_flagged_idx on messages (marked_flag, folder_id)"];
+	[self executeSQL:@"create index messages_deleted_idx on messages (deleted_flag, marked_flag, read_flag, date)"];
+	[self executeSQL:@"create index messages_date_idx on messages (date)"];
+}
+
+/* createFolderTree
+ * Fills the folder_tree table from the parent links in the folders table. Each folder
+ * gets a row for itself and one for every folder above it.
+ */
+-(void)createFolderTree
+{
+	NSMutableDictionary * parents = [NSMutableDictionary dictionary];
+	SQLResult * results = [sqlDatabase performQuery:@"select folder_id, parent_id from folders"];
+	if (results && [results rowCount])
+	{
+		for (SQLRow * row in [results rowEnumerator])
+			[parents setObject:[NSNumber numberWithInt:[[row stringForColumn:@"parent_id"] intValue]] forKey:[NSNumber numberWithInt:[[row stringForColumn:@"folder_id"] intValue]]];
+	}
+	[results release];
+
+	[self executeSQL:@"delete from folder_tree"];
+	SQLStatement * statement = [sqlDatabase prepareStatement:@"insert into folder_tree (ancestor_id, folder_id) values (?, ?)"];
+	for (NSNumber * folderNumber in parents)
+	{
+		// Walk up to the root. The depth check guards against a damaged database
+		// where the parent links form a loop.
+		NSNumber * ancestorNumber = folderNumber;
+		NSUInteger depth = 0;
+		while (ancestorNumber != nil && depth++ <= [parents count])
+		{
+			[statement bindInt:[ancestorNumber intValue] atIndex:1];
+			[statement bindInt:[folderNumber intValue] atIndex:2];
+			[statement execute];
+			NSNumber * parentNumber = [parents objectForKey:ancestorNumber];
+			ancestorNumber = ([parents objectForKey:parentNumber] != nil) ? parentNumber : nil;
+		}
+	}
+}
+
 /* relocateLockedDatabase
  * Tell the user that the database could not be created at the path specified by path
  * and prompt for an alternative location. Opens and returns the new location if we were successful.
@@ -635,6 +964,7 @@ static Database * _sharedDatabase = nil;
 -(void)commitTransaction
 {
 	NSAssert(inTransaction, @"Whoops! Not in a transaction. You forgot to call beginTransaction first");
+	[self flushUnreadCounts];
 	[self executeSQL:@"commit transaction"];
 	inTransaction = NO;
 }
@@ -648,6 +978,38 @@ static Database * _sharedDatabase = nil;
 		[self executeSQL:@"vacuum"];
 }
 
+/* rebuildSearchIndex
+ * Discards the full text search index and rebuilds it from the articles in the database.
+ * Use this to repair an index that has got out of step with the messages table.
+ */
+-(void)rebuildSearchIndex
+{
+	if (readOnly)
+		return;
+
+	BOOL ownTransaction = !inTransaction;
+	if (ownTransaction)
+		[self beginTransaction];
+
+	[self executeSQL:@"delete from messages_fts"];
+
+	SQLStatement * articles = [sqlDatabase streamQuery:@"select article_id, title, sender, text from messages"];
+	SQLStatement * insert = [sqlDatabase prepareStatement:@"insert into messages_fts (docid, title, sender, text) values (?, ?, ?, ?)"];
+	for (SQLRow * row in [articles rowEnumerator])
+	{
+		NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+		[insert bindInt:[row intForColumnAtIndex:0] atIndex:1];
+		[insert bindString:SafeString([row stringForColumnAtIndex:1]) atIndex:2];
+		[insert bindString:SafeString([row stringForColumnAtIndex:2]) atIndex:3];
+		[insert bindString:[SafeString([row stringForColumnAtIndex:3]) plainTextFromHTML] atIndex:4];
+		[insert execute];
+		[pool drain];
+	}
+
+	if (ownTransaction)
+		[self commitTransaction];
+}
+
 /* clearFolderFlag
  * Clears the specified flag for the folder.
  */
@@ -725,6 +1087,49 @@ static Database * _sharedDatabase = nil;
 	}
 }
 
+/* setFolderETag
+ * Sets the entity tag for the folder.
+ */
+-(void)setFolderETag:(int)folderId etag:(NSString *)etag
+{
+	// Exit now if we're read-only
+	if (readOnly)
+		return;
+	
+	// If no change to the entity tag, do nothing
+	Folder * folder = [self folderFromID:folderId];
+	if (folder != nil && IsRSSFolder(folder))
+	{
+		if ([[folder etag] isEqualToString:etag])
+			return;
+		
+		NSString * preparedETag = [SQLDatabase prepareStringForQuery:etag];
+		[folder setETag:etag];
+		[self executeSQLWithFormat:@"update rss_folders set etag='%@' where folder_id=%d", preparedETag, folderId];
+	}
+}
+
+/* setFolderBodyDigest
+ * Sets the digest of the feed data last stored for the folder.
+ */
+-(void)setFolderBodyDigest:(int)folderId bodyDigest:(NSString *)bodyDigest
+{
+	// Exit now if we're read-only
+	if (readOnly)
+		return;
+	
+	// If no change to the digest, do nothing
+	Folder * folder = [self folderFromID:folderId];
+	if (folder != nil && IsRSSFolder(folder))
+	{
+		if ([[folder bodyDigest] isEqualToString:bodyDigest])
+			return;
+		
+		[folder setBodyDigest:bodyDigest];
+		[self executeSQLWithFormat:@"update rss_folders set body_digest='%@' where folder_id=%d", [folder bodyDigest], folderId];
+	}
+}
+
 /* setFolderFeedURL
  * Change the URL of the feed on the specified RSS folder subscription.
  */
@@ -739,8 +1144,14 @@ static Database * _sharedDatabase = nil;
 	{
 		NSString * preparedURL = [SQLDatabase prepareStringForQuery:url];
 
+		[self removeFolderFromIndexes:folder];
 		[folder setFeedURL:url];
+		[self addFolderToIndexes:folder];
 		[self executeSQLWithFormat:@"update rss_folders set feed_url='%@' where folder_id=%d", preparedURL, folderId];
+
+		// The validators belong to the old URL.
+		[self setFolderETag:folderId etag:@""];
+		[self setFolderBodyDigest:folderId bodyDigest:@""];
 	}
 	return YES;
 }
@@ -757,8 +1168,8 @@ static Database * _sharedDatabase = nil;
 
 		[self verifyThreadSafety];
 		SQLResult * results = [sqlDatabase performQueryWithFormat:
-					@"insert into rss_folders (folder_id, description, username, home_page, last_update_string, feed_url, bloglines_id) "
-					 "values (%d, '', '', '', '', '%@', %d)",
+					@"insert into rss_folders (folder_id, description, username, home_page, last_update_string, feed_url, bloglines_id, etag, body_digest) "
+					 "values (%d, '', '', '', '', '%@', %d, '', '')",
 					folderId,
 					preparedURL,
 					0];
@@ -767,7 +1178,9 @@ static Database * _sharedDatabase = nil;
 
 		// Add this new folder to our internal cache
 		Folder * folder = [self folderFromID:folderId];
+		[self removeFolderFromIndexes:folder];
 		[folder setFeedURL:url];
+		[self addFolderToIndexes:folder];
 		[results release];
 	}
 	return folderId;
@@ -849,6 +1262,9 @@ static Database * _sharedDatabase = nil;
 		if (type == MA_RSS_Folder)
 			[folder setFlag:MA_FFlag_CheckForImage];
 		[foldersDict setObject:folder forKey:[NSNumber numberWithInt:newItemId]];
+		[self addFolderToIndexes:folder];
+		[self invalidateFolderPlans];
+		[self invalidateSmartFolderMembership];
 		
 		if (manualSort)
 		{
@@ -906,6 +1322,10 @@ static Database * _sharedDatabase = nil;
 	{
 		newItemId = [sqlDatabase lastInsertRowId];
 		[results release];
+
+		// Link the new folder to itself and to every folder above it.
+		[self executeSQLWithFormat:@"insert into folder_tree (ancestor_id, folder_id) select ancestor_id, %d from folder_tree where folder_id=%d union all select %d, %d",
+			newItemId, parentId, newItemId, newItemId];
 	}
 	
 	return newItemId;
@@ -971,6 +1391,12 @@ static Database * _sharedDatabase = nil;
 		}
 	}
 
+	// Forget compiled queries and cached results that may refer to this folder
+	NSNumber * folderNumber = [NSNumber numberWithInt:folderId];
+	[smartFolderResults removeObjectForKey:folderNumber];
+	[smartFolderResultsOrder removeObject:folderNumber];
+	[self invalidateFolderPlans];
+
 	// If we deleted the search folder, null out our cached handle
 	if (IsSearchFolder(folder))
 	{
@@ -995,13 +1421,18 @@ static Database * _sharedDatabase = nil;
 	
 	// For a smart folder, the next line is a no-op but it helpfully takes care of the case where a
 	// normal folder had it's type grobbed to MA_Smart_Folder.
+	[self executeSQLWithFormat:@"delete from messages_fts where docid in (select article_id from messages where folder_id=%d)", folderId];
 	[self executeSQLWithFormat:@"delete from messages where folder_id=%d", folderId];
 	[self executeSQLWithFormat:@"delete from folders where folder_id=%d", folderId];
+	[self executeSQLWithFormat:@"delete from folder_tree where folder_id=%d or ancestor_id=%d", folderId, folderId];
 
 	// Remove from the folders array. Do this after we send the notification
 	// so that the notification handlers don't fail if they try to dereference the
 	// folder.
+	[dirtyUnreadFolders removeObject:folder];
+	[self removeFolderFromIndexes:folder];
 	[foldersDict removeObjectForKey:[NSNumber numberWithInt:folderId]];
+	[self invalidateSmartFolderMembership];
 	return YES;
 }
 
@@ -1042,6 +1473,7 @@ static Database * _sharedDatabase = nil;
 	[self beginTransaction];
 	result = [self wrappedDeleteFolder:folderId];
 	[self commitTransaction];
+	[self clearBodyCache];
 
 	// Send the post-delete notification after we're finished. Note that the folder actually corresponding to
 	// each numFolder won't exist any more and the handlers need to be aware of this.
@@ -1070,7 +1502,12 @@ static Database * _sharedDatabase = nil;
 	if ([[folder name] isEqualToString:newName])
 		return NO;
 
+	[self removeFolderFromIndexes:folder];
 	[folder setName:newName];
+	[self addFolderToIndexes:folder];
+
+	// Criteria refer to folders by name so any compiled query may now be stale
+	[self invalidateFolderPlans];
 
 	// Rename in the database
 	NSString * preparedNewName = [SQLDatabase prepareStringForQuery:newName];
@@ -1211,7 +1648,9 @@ static Database * _sharedDatabase = nil;
 	}
 	
 	// Do the re-parent
+	[self removeFolderFromIndexes:folder];
 	[folder setParent:newParentID];
+	[self addFolderToIndexes:folder];
 	
 	// In addition to reparenting the child, we also need to fix up the unread count for all
 	// precedent parents.
@@ -1227,6 +1666,14 @@ static Database * _sharedDatabase = nil;
 
 	// Update the database now
 	[self executeSQLWithFormat:@"update folders set parent_id=%d where folder_id=%d", newParentID, folderId];
+
+	// Move the folder and everything under it in the folder tree by dropping the links to
+	// the old ancestors and linking the whole subtree to the new ones.
+	[self executeSQLWithFormat:@"delete from folder_tree where folder_id in (select folder_id from folder_tree where ancestor_id=%d) "
+							   @"and ancestor_id not in (select folder_id from folder_tree where ancestor_id=%d)", folderId, folderId];
+	[self executeSQLWithFormat:@"insert into folder_tree (ancestor_id, folder_id) select ancestors.ancestor_id, subtree.folder_id "
+							   @"from folder_tree as ancestors, folder_tree as subtree where ancestors.folder_id=%d and subtree.ancestor_id=%d", newParentID, folderId];
+	[self invalidateSmartFolderMembership];
 	return YES;
 }
 
@@ -1327,13 +1774,7 @@ static Database * _sharedDatabase = nil;
  */
 -(Folder *)folderFromName:(NSString *)wantedName
 {	
-	Folder * folder;
-	for (folder in [foldersDict objectEnumerator])
-	{
-		if ([[folder name] isEqualToString:wantedName])
-			break;
-	}
-	return folder;
+	return (wantedName != nil) ? [[foldersByName objectForKey:wantedName] objectAtIndex:0] : nil;
 }
 
 /* folderFromFeedURL
@@ -1341,14 +1782,69 @@ static Database * _sharedDatabase = nil;
  */
 -(Folder *)folderFromFeedURL:(NSString *)wantedFeedURL;
 {
-	Folder * folder;
-	
-	for (folder in [foldersDict objectEnumerator])
+	return (wantedFeedURL != nil) ? [[foldersByFeedURL objectForKey:wantedFeedURL] objectAtIndex:0] : nil;
+}
+
+/* addFolderToIndexes
+ * Enters the folder into the name, feed URL and parent lookup tables. Every method that
+ * adds a folder or changes one of those three attributes must pair this with a call to
+ * removeFolderFromIndexes beforehand.
+ */
+-(void)addFolderToIndexes:(Folder *)folder
+{
+	NSString * name = [folder name];
+	if (name != nil)
+		[self addFolder:folder toTable:foldersByName forKey:name];
+
+	NSString * feedURL = [folder feedURL];
+	if (feedURL != nil && ![feedURL isEqualToString:@""])
+		[self addFolder:folder toTable:foldersByFeedURL forKey:feedURL];
+
+	[self addFolder:folder toTable:foldersByParent forKey:[NSNumber numberWithInt:[folder parentId]]];
+}
+
+/* removeFolderFromIndexes
+ * Removes the folder from the lookup tables. Other folders with the same name or URL
+ * stay in the tables so that they can still be found.
+ */
+-(void)removeFolderFromIndexes:(Folder *)folder
+{
+	NSString * name = [folder name];
+	if (name != nil)
+		[self removeFolder:folder fromTable:foldersByName forKey:name];
+
+	NSString * feedURL = [folder feedURL];
+	if (feedURL != nil)
+		[self removeFolder:folder fromTable:foldersByFeedURL forKey:feedURL];
+
+	[self removeFolder:folder fromTable:foldersByParent forKey:[NSNumber numberWithInt:[folder parentId]]];
+}
+
+/* addFolder
+ * Adds the folder to the array of folders held under the key in one of the lookup tables.
+ */
+-(void)addFolder:(Folder *)folder toTable:(NSMutableDictionary *)table forKey:(id)key
+{
+	NSMutableArray * folders = [table objectForKey:key];
+	if (folders == nil)
 	{
-		if ([[folder feedURL] isEqualToString:wantedFeedURL])
-			break;
+		folders = [[NSMutableArray alloc] init];
+		[table setObject:folders forKey:key];
+		[folders release];
 	}
-	return folder;
+	[folders addObject:folder];
+}
+
+/* removeFolder
+ * Removes the folder from the array held under the key in one of the lookup tables and
+ * drops the array once it is empty.
+ */
+-(void)removeFolder:(Folder *)folder fromTable:(NSMutableDictionary *)table forKey:(id)key
+{
+	NSMutableArray * folders = [table objectForKey:key];
+	[folders removeObjectIdenticalTo:folder];
+	if (folders != nil && [folders count] == 0u)
+		[table removeObjectForKey:key];
 }
 
 /* handleAutoSortFoldersTreeChange
@@ -1361,202 +1857,268 @@ static Database * _sharedDatabase = nil;
 		[self executeSQLWithFormat:@"update info set folder_sort=%d", [[Preferences standardPreferences] foldersTreeSortMethod]];
 }
 
-/* createArticle
- * Adds or updates an article in the specified folder. Returns YES if the
- * article was added or updated or NO if we couldn't add the article for
- * some reason.
+/* storeArticle
+ * Adds or updates a single article in the specified folder. The folder's article cache
+ * must already be primed. The change to the folder's unread count is accumulated in
+ * adjustment rather than applied so that callers can write it back once. Returns YES
+ * if the article was added or updated.
  */
--(BOOL)createArticle:(int)folderID article:(Article *)article guidHistory:(NSArray *)guidHistory
+-(BOOL)storeArticle:(Article *)article inFolder:(Folder *)folder guidHistory:(NSSet *)guidHistory adjustment:(int *)adjustment
 {
-	// Exit now if we're read-only
-	if (readOnly)
-		return NO;
+	int folderID = [folder itemId];
 	
-	// Make sure the folder ID is valid. We need it to decipher
-	// some info before we add the article.
-	Folder * folder = [self folderFromID:folderID];
-	if (folder != nil)
+	// Extract the article data from the dictionary.
+	NSString * articleBody = [article body];
+	NSString * articleSummary = [SafeString(articleBody) summaryTextFromHTML];
+	NSString * articleTitle = [article title]; 
+	NSDate * articleDate = [article date];
+	NSString * articleLink = [article link];
+	NSString * userName = [article author];
+	NSString * articleEnclosure = [article enclosure];
+	NSString * articleGuid = [article guid];
+	int parentId = [article parentId];
+	BOOL marked_flag = [article isFlagged];
+	BOOL read_flag = [article isRead];
+	BOOL revised_flag = [article isRevised];
+	BOOL deleted_flag = [article isDeleted];
+	BOOL hasenclosure_flag = [article hasEnclosure];
+	BOOL enclosuredownloaded_flag = [article enclosureDownloaded];
+	
+	// We always set the created date ourselves
+	[article setCreatedDate:[NSDate date]];
+	
+	// Set some defaults
+	if (articleDate == nil)
+		articleDate = [NSDate date];
+	if (userName == nil)
+		userName = @"";
+	
+	// Parse off the title
+	if (articleTitle == nil || [articleTitle isBlank])
+		articleTitle = [articleBody firstNonBlankLine];
+	
+	// Save date as time intervals
+	NSTimeInterval interval = [articleDate timeIntervalSince1970];
+	NSTimeInterval createdInterval = [[article createdDate] timeIntervalSince1970];
+	
+	// Does this article already exist?
+	Article * existingArticle = [folder articleFromGuid:articleGuid];
+	// We're going to ignore the problem of feeds re-using guids, which is very naughty! Bad feed!
+	
+	if (existingArticle == nil && [guidHistory containsObject:articleGuid])
 	{
-		// Prime the article cache
-		[self initArticleArray:folder];
+		return NO; // Article has been deleted and removed from database, so ignore
+	}
+	else if (existingArticle == nil)
+	{
+		SQLStatement * statement = [sqlDatabase prepareStatement:
+			@"insert into messages (message_id, parent_id, folder_id, sender, link, date, createddate, read_flag, marked_flag, deleted_flag, title, text, revised_flag, enclosure, hasenclosure_flag, enclosuredownloaded_flag, summary) "
+			@"values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)"];
+		if (statement == nil)
+			return NO;
+		[statement bindString:SafeString(articleGuid) atIndex:1];
+		[statement bindInt:parentId atIndex:2];
+		[statement bindInt:folderID atIndex:3];
+		[statement bindString:userName atIndex:4];
+		[statement bindString:SafeString(articleLink) atIndex:5];
+		[statement bindDouble:interval atIndex:6];
+		[statement bindDouble:createdInterval atIndex:7];
+		[statement bindInt:read_flag atIndex:8];
+		[statement bindInt:marked_flag atIndex:9];
+		[statement bindInt:deleted_flag atIndex:10];
+		[statement bindString:SafeString(articleTitle) atIndex:11];
+		[statement bindString:SafeString(articleBody) atIndex:12];
+		[statement bindInt:revised_flag atIndex:13];
+		[statement bindString:SafeString(articleEnclosure) atIndex:14];
+		[statement bindInt:hasenclosure_flag atIndex:15];
+		[statement bindInt:enclosuredownloaded_flag atIndex:16];
+		[statement bindString:articleSummary atIndex:17];
+		if ([statement execute] != SQLITE_OK)
+			return NO;
+
+		// Add the article to the full text search index
+		statement = [sqlDatabase prepareStatement:@"insert into messages_fts (docid, title, sender, text) values (?, ?, ?, ?)"];
+		[statement bindInt:[sqlDatabase lastInsertRowId] atIndex:1];
+		[statement bindString:SafeString(articleTitle) atIndex:2];
+		[statement bindString:userName atIndex:3];
+		[statement bindString:[SafeString(articleBody) plainTextFromHTML] atIndex:4];
+		[statement execute];
+
+		statement = [sqlDatabase prepareStatement:@"insert into rss_guids (message_id, folder_id) values (?, ?)"];
+		[statement bindString:SafeString(articleGuid) atIndex:1];
+		[statement bindInt:folderID atIndex:2];
+		[statement execute];
 		
-		// Extract the article data from the dictionary.
-		NSString * articleBody = [article body];
-		NSString * articleTitle = [article title]; 
-		NSDate * articleDate = [article date];
-		NSString * articleLink = [article link];
-		NSString * userName = [article author];
-		NSString * articleEnclosure = [article enclosure];
-		NSString * articleGuid = [article guid];
-		int parentId = [article parentId];
-		BOOL marked_flag = [article isFlagged];
-		BOOL read_flag = [article isRead];
-		BOOL revised_flag = [article isRevised];
-		BOOL deleted_flag = [article isDeleted];
-		BOOL hasenclosure_flag = [article hasEnclosure];
-		
-		// We always set the created date ourselves
-		[article setCreatedDate:[NSDate date]];
-		
-		// Set some defaults
-		if (articleDate == nil)
-			articleDate = [NSDate date];
-		if (userName == nil)
-			userName = @"";
-		
-		// Parse off the title
-		if (articleTitle == nil || [articleTitle isBlank])
-			articleTitle = [articleBody firstNonBlankLine];
-		
-		// Save date as time intervals
-		NSTimeInterval interval = [articleDate timeIntervalSince1970];
-		NSTimeInterval createdInterval = [[article createdDate] timeIntervalSince1970];
-		
-		// Does this article already exist?
-		Article * existingArticle = [folder articleFromGuid:articleGuid];
-		// We're going to ignore the problem of feeds re-using guids, which is very naughty! Bad feed!
-		
-		// Fix title and article body so they're acceptable to SQL
-		NSString * preparedArticleTitle = [SQLDatabase prepareStringForQuery:articleTitle];
-		NSString * preparedArticleText = [SQLDatabase prepareStringForQuery:articleBody];
-		NSString * preparedArticleLink = [SQLDatabase prepareStringForQuery:articleLink];
-		NSString * preparedUserName = [SQLDatabase prepareStringForQuery:userName];
-		NSString * preparedArticleGuid = [SQLDatabase prepareStringForQuery:articleGuid];
-		NSString * preparedEnclosure = [SQLDatabase prepareStringForQuery:articleEnclosure];
-		
-		// Unread count adjustment factor
-		int adjustment = 0;
+		// Add the article to the folder with the values that were stored. The body is
+		// dropped so that it is only held in memory by the bounded body cache.
+		[article setFolderId:folderID];
+		[article setTitle:articleTitle];
+		[article setAuthor:userName];
+		[article setDate:articleDate];
+		[article setBody:nil];
+		[article setSummary:articleSummary];
+		[article setStatus:MA_MsgStatus_New];
+		[folder addArticleToCache:article];
 		
-		// Verify we're on the right thread
-		[self verifyThreadSafety];
+		// Update folder unread count
+		if (!read_flag)
+			++(*adjustment);
+	}
+	else if ([existingArticle isDeleted])
+	{
+		return NO;
+	}
+	else if (![[Preferences standardPreferences] boolForKey:MAPref_CheckForUpdatedArticles])
+	{
+		return NO;
+	}
+	else
+	{
+		// The article is revised if either the title or the body has changed.
 		
-		if (existingArticle == nil && [guidHistory containsObject:articleGuid])
+		NSString * existingTitle = [existingArticle title];
+		BOOL isArticleRevised = ![existingTitle isEqualToString:articleTitle];
+		
+		if (!isArticleRevised)
 		{
-			return NO; // Article has been deleted and removed from database, so ignore
+			// The body is fetched from the database on demand if it isn't already loaded.
+			NSString * existingBody = SafeString([existingArticle body]);
+			
+			isArticleRevised = ![existingBody isEqualToString:articleBody];
 		}
-		else if (existingArticle == nil)
+		
+		if (isArticleRevised)
 		{
-			SQLResult * results;
+			// Only pre-existing articles should be marked as revised.
+			// New articles created during the current refresh should not be marked as revised,
+			// even if there are multiple versions of the new article in the feed.
+			revised_flag = [existingArticle isRevised];
+			if (!revised_flag && ([existingArticle status] == MA_MsgStatus_Empty))
+				revised_flag = YES;
 			
-			results = [sqlDatabase performQueryWithFormat:
-				@"insert into messages (message_id, parent_id, folder_id, sender, link, date, createddate, read_flag, marked_flag, deleted_flag, title, text, revised_flag, enclosure, hasenclosure_flag) "
-				@"values('%@', %d, %d, '%@', '%@', %f, %f, %d, %d, %d, '%@', '%@', %d, '%@',%d)",
-				preparedArticleGuid,
-				parentId,
-				folderID,
-				preparedUserName,
-				preparedArticleLink,
-				interval,
-				createdInterval,
-				read_flag,
-				marked_flag,
-				deleted_flag,
-				preparedArticleTitle,
-				preparedArticleText,
-				revised_flag,
-				preparedEnclosure,
-				hasenclosure_flag];
-			if (!results)
+			SQLStatement * statement = [sqlDatabase prepareStatement:@"update messages set parent_id=?, sender=?, link=?, date=?, "
+				@"read_flag=0, title=?, text=?, revised_flag=?, summary=? where folder_id=? and message_id=?"];
+			if (statement == nil)
 				return NO;
-			[results release];
-			[self executeSQLWithFormat:@"insert into rss_guids (message_id, folder_id) values ('%@', %d)", preparedArticleGuid, folderID];
+			[statement bindInt:parentId atIndex:1];
+			[statement bindString:userName atIndex:2];
+			[statement bindString:SafeString(articleLink) atIndex:3];
+			[statement bindDouble:interval atIndex:4];
+			[statement bindString:SafeString(articleTitle) atIndex:5];
+			[statement bindString:SafeString(articleBody) atIndex:6];
+			[statement bindInt:revised_flag atIndex:7];
+			[statement bindString:articleSummary atIndex:8];
+			[statement bindInt:folderID atIndex:9];
+			[statement bindString:articleGuid atIndex:10];
+			if ([statement execute] != SQLITE_OK)
+				return NO;
+
+			statement = [sqlDatabase prepareStatement:@"update messages_fts set title=?, sender=?, text=? "
+				@"where docid=(select article_id from messages where folder_id=? and message_id=?)"];
+			[statement bindString:SafeString(articleTitle) atIndex:1];
+			[statement bindString:userName atIndex:2];
+			[statement bindString:[SafeString(articleBody) plainTextFromHTML] atIndex:3];
+			[statement bindInt:folderID atIndex:4];
+			[statement bindString:articleGuid atIndex:5];
+			[statement execute];
 			
-			// Add the article to the folder
-			[article setStatus:MA_MsgStatus_New];
-			[folder addArticleToCache:article];
+			[self removeCachedBody:folderID guid:articleGuid];
+			[existingArticle setParentId:parentId];
+			[existingArticle setAuthor:userName];
+			[existingArticle setLink:articleLink];
+			[existingArticle setDate:articleDate];
+			[existingArticle setTitle:articleTitle];
+			[existingArticle setBody:nil];
+			[existingArticle setSummary:articleSummary];
+			[existingArticle markRevised:revised_flag];
 			
-			// Update folder unread count
-			if (!read_flag)
-				adjustment = 1;
-		}
-		else if ([existingArticle isDeleted])
-		{
-			return NO;
+			// Update folder unread count if necessary
+			if ([existingArticle isRead])
+			{
+				++(*adjustment);
+				[article setStatus:MA_MsgStatus_New];
+				[existingArticle markRead:NO];
+			}
+			else
+				[article setStatus:MA_MsgStatus_Updated];
 		}
-		else if (![[Preferences standardPreferences] boolForKey:MAPref_CheckForUpdatedArticles])
+		else
 		{
 			return NO;
 		}
-		else
-		{
-			// The article is revised if either the title or the body has changed.
-			
-			NSString * existingTitle = [existingArticle title];
-			BOOL isArticleRevised = ![existingTitle isEqualToString:articleTitle];
-			
-			if (!isArticleRevised)
-			{
-				NSString * existingBody = [existingArticle body];
-				// If the folder is not displayed, then the article text has not been loaded yet.
-				if (existingBody == nil)
-				{
-					SQLResult * results = [sqlDatabase performQueryWithFormat:@"select text from messages where folder_id=%d and message_id='%@'", folderID, preparedArticleGuid];
-					if (results && [results rowCount])
-					{
-						existingBody = [[results rowAtIndex:0] stringForColumn:@"text"];
-					}
-					else
-						existingBody = @"";
-					[results release];
-				}
-				
-				isArticleRevised = ![existingBody isEqualToString:articleBody];
-			}
-			
-			if (isArticleRevised)
-			{
-				// Only pre-existing articles should be marked as revised.
-				// New articles created during the current refresh should not be marked as revised,
-				// even if there are multiple versions of the new article in the feed.
-				revised_flag = [existingArticle isRevised];
-				if (!revised_flag && ([existingArticle status] == MA_MsgStatus_Empty))
-					revised_flag = YES;
-				
-				SQLResult * results;
-				results = [sqlDatabase performQueryWithFormat:@"update messages set parent_id=%d, sender='%@', link='%@', date=%f, "
-					@"read_flag=0, title='%@', text='%@', revised_flag=%d where folder_id=%d and message_id='%@'",
-					parentId,
-					preparedUserName,
-					preparedArticleLink,
-					interval,
-					preparedArticleTitle,
-					preparedArticleText,
-					revised_flag,
-					folderID,
-					preparedArticleGuid];
-				if (!results)
-					return NO;
-				[results release];
-				
-				[existingArticle setTitle:articleTitle];
-				[existingArticle setBody:articleBody];
-				[existingArticle markRevised:revised_flag];
-				
-				// Update folder unread count if necessary
-				if ([existingArticle isRead])
-				{
-					adjustment = 1;
-					[article setStatus:MA_MsgStatus_New];
-					[existingArticle markRead:NO];
-				}
-				else
-					[article setStatus:MA_MsgStatus_Updated];
-			}
-			else
-			{
-				return NO;
-			}
-		}
-		
-		// Fix unread count on parent folders
-		if (adjustment != 0)
+	}
+	return YES;
+}
+
+/* createArticle
+ * Adds or updates an article in the specified folder. Returns YES if the
+ * article was added or updated or NO if we couldn't add the article for
+ * some reason.
+ */
+-(BOOL)createArticle:(int)folderID article:(Article *)article guidHistory:(NSSet *)guidHistory
+{
+	if ([self createArticles:[NSArray arrayWithObject:article] inFolder:folderID guidHistory:guidHistory] < 0)
+		return NO;
+	return [article status] != MA_MsgStatus_Empty;
+}
+
+/* createArticles
+ * Adds or updates a batch of articles in the specified folder. Articles whose guid
+ * appears in guidHistory but which are no longer in the folder were deleted by the
+ * user and are skipped. All rows are written through the cached prepared statements
+ * inside a single transaction and the folder unread count is updated once at the end.
+ * On return each article's status is MA_MsgStatus_New, MA_MsgStatus_Updated or
+ * MA_MsgStatus_Empty if it was left alone. Returns the number of new articles, or -1
+ * if the folder doesn't exist or the database is read-only.
+ */
+-(int)createArticles:(NSArray *)articles inFolder:(int)folderID guidHistory:(NSSet *)guidHistory
+{
+	// Exit now if we're read-only
+	if (readOnly)
+		return -1;
+	
+	// Make sure the folder ID is valid. We need it to decipher
+	// some info before we add the articles.
+	Folder * folder = [self folderFromID:folderID];
+	if (folder == nil)
+		return -1;
+	
+	// Prime the article cache
+	[self initArticleArray:folder];
+	
+	// Verify we're on the right thread
+	[self verifyThreadSafety];
+	
+	BOOL ownTransaction = !inTransaction;
+	if (ownTransaction)
+		[self beginTransaction];
+	
+	int adjustment = 0;
+	int countOfNewArticles = 0;
+	NSMutableArray * storedGuids = [NSMutableArray arrayWithCapacity:[articles count]];
+	for (Article * article in articles)
+	{
+		[article setStatus:MA_MsgStatus_Empty];
+		if ([self storeArticle:article inFolder:folder guidHistory:guidHistory adjustment:&adjustment])
 		{
-			countOfUnread += adjustment;
-			[self setFolderUnreadCount:folder adjustment:adjustment];
+			if ([article status] == MA_MsgStatus_New)
+				++countOfNewArticles;
+			[storedGuids addObject:[article guid]];
 		}
-		return YES;
 	}
-	return NO;
+	if ([storedGuids count] > 0)
+		[self updateSmartFolderMembership:[NSDictionary dictionaryWithObject:storedGuids forKey:[NSNumber numberWithInt:folderID]]];
+	
+	// Fix unread count on parent folders
+	if (adjustment != 0)
+	{
+		countOfUnread += adjustment;
+		[self setFolderUnreadCount:folder adjustment:adjustment];
+	}
+	
+	if (ownTransaction)
+		[self commitTransaction];
+	return countOfNewArticles;
 }
 
 /* purgeArticlesOlderThanDays
@@ -1574,6 +2136,7 @@ static Database * _sharedDatabase = nil;
 		[self verifyThreadSafety];
 		SQLResult * results = [sqlDatabase performQueryWithFormat:@"update messages set deleted_flag=1 where deleted_flag=0 and marked_flag=0 and read_flag=1 and date < %f", timeDiff];
 		[results release];
+		[self invalidateSmartFolderMembership];
 	}
 }
 
@@ -1586,10 +2149,12 @@ static Database * _sharedDatabase = nil;
 	// Verify we're on the right thread
 	[self verifyThreadSafety];
 
+	[self executeSQL:@"delete from messages_fts where docid in (select article_id from messages where deleted_flag=1)"];
 	SQLResult * results = [sqlDatabase performQuery:@"delete from messages where deleted_flag=1"];
 	if (results)
 	{
 		[self compactDatabase];
+		[self clearBodyCache];
 		[trashFolder clearCache];
 
 		[[NSNotificationCenter defaultCenter] postNotificationName:@"MA_Notify_FoldersUpdated" object:[NSNumber numberWithInt:[self trashFolderId]]];
@@ -1611,13 +2176,18 @@ static Database * _sharedDatabase = nil;
 		Article * article = [folder articleFromGuid:guid];
 		if (article != nil)
 		{
-			NSString * preparedGuid = [SQLDatabase prepareStringForQuery:guid];
-
 			// Verify we're on the right thread
 			[self verifyThreadSafety];
 			
-			SQLResult * results = [sqlDatabase performQueryWithFormat:@"delete from messages where folder_id=%d and message_id='%@'", folderId, preparedGuid];
-			if (results)
+			SQLStatement * statement = [sqlDatabase prepareStatement:@"delete from messages_fts where docid=(select article_id from messages where folder_id=? and message_id=?)"];
+			[statement bindInt:folderId atIndex:1];
+			[statement bindString:guid atIndex:2];
+			[statement execute];
+
+			statement = [sqlDatabase prepareStatement:@"delete from messages where folder_id=? and message_id=?"];
+			[statement bindInt:folderId atIndex:1];
+			[statement bindString:guid atIndex:2];
+			if ([statement execute] == SQLITE_OK)
 			{
 				if (![article isRead])
 				{
@@ -1625,7 +2195,8 @@ static Database * _sharedDatabase = nil;
 					--countOfUnread;
 				}
 				[folder removeArticleFromCache:guid];
-				[results release];
+				[self removeCachedBody:folderId guid:guid];
+				[self removeFromSmartFolderMembership:[NSDictionary dictionaryWithObject:[NSArray arrayWithObject:guid] forKey:[NSNumber numberWithInt:folderId]]];
 				return YES;
 			}
 		}
@@ -1713,6 +2284,7 @@ static Database * _sharedDatabase = nil;
 	NSString * preparedQueryString = [SQLDatabase prepareStringForQuery:[criteriaTree string]];
 	[self executeSQLWithFormat:@"update smart_folders set search_string='%@' where folder_id=%d", preparedQueryString, folderId];
 	[smartfoldersDict setObject:criteriaTree forKey:[NSNumber numberWithInt:folderId]];
+	[folderPlans removeObjectForKey:[NSNumber numberWithInt:folderId]];
 	
 	NSNotificationCenter * nc = [NSNotificationCenter defaultCenter];
 	[nc postNotificationName:@"MA_Notify_FoldersUpdated" object:[NSNumber numberWithInt:folderId]];
@@ -1787,17 +2359,28 @@ static Database * _sharedDatabase = nil;
 				NSString * linktext = [row stringForColumn:@"home_page"];
 				NSString * username = [row stringForColumn:@"username"];
 				NSString * lastUpdateString = [row stringForColumn:@"last_update_string"];
+				NSString * etag = [row stringForColumn:@"etag"];
+				NSString * bodyDigest = [row stringForColumn:@"body_digest"];
 				
 				Folder * folder = [self folderFromID:folderId];
 				[folder setFeedDescription:descriptiontext];
 				[folder setHomePage:linktext];
 				[folder setFeedURL:url];
 				[folder setLastUpdateString:lastUpdateString];
+				[folder setETag:etag];
+				[folder setBodyDigest:bodyDigest];
 				[folder setUsername:username];
 			}
 		}
 		[results release];
 
+		// Build the lookup indexes now that every folder has its feed URL
+		for (Folder * folder in [foldersDict objectEnumerator])
+			[self addFolderToIndexes:folder];
+
+		// The stored counts are only a cache so replace them with exact ones.
+		[self recountUnreadArticles];
+
 		// Fix the childUnreadCount for every parent		
 		for (Folder * folder in [foldersDict objectEnumerator])
 		{
@@ -1828,16 +2411,10 @@ static Database * _sharedDatabase = nil;
 	if (initializedfoldersDict == NO)
 		[self initFolderArray];
 
-	NSMutableArray * newArray = [NSMutableArray array];
-	if (newArray != nil)
-	{		
-		for (Folder * folder in [foldersDict objectEnumerator])
-		{
-			if ([folder parentId] == parentId)
-				[newArray addObject:folder];
-		}
-	}
-	return [newArray sortedArrayUsingSelector:@selector(folderNameCompare:)];
+	NSArray * children = [foldersByParent objectForKey:[NSNumber numberWithInt:parentId]];
+	if (children == nil)
+		return [NSArray array];
+	return [children sortedArrayUsingSelector:@selector(folderNameCompare:)];
 }
 
 /* arrayOfSubFolders
@@ -1848,17 +2425,14 @@ static Database * _sharedDatabase = nil;
 	NSMutableArray * newArray = [NSMutableArray arrayWithObject:folder];
 	if (newArray != nil)
 	{
-		int parentId = [folder itemId];
+		NSArray * children = [foldersByParent objectForKey:[NSNumber numberWithInt:[folder itemId]]];
 		
-		for (Folder * item in [foldersDict objectEnumerator])
+		for (Folder * item in children)
 		{
-			if ([item parentId] == parentId)
-			{
-				if (IsGroupFolder(item))
-					[newArray addObjectsFromArray:[self arrayOfSubFolders:item]];
-				else
-					[newArray addObject:item];
-			}
+			if (IsGroupFolder(item))
+				[newArray addObjectsFromArray:[self arrayOfSubFolders:item]];
+			else
+				[newArray addObject:item];
 		}
 	}
 	return [newArray sortedArrayUsingSelector:@selector(folderIDCompare:)];
@@ -1888,7 +2462,8 @@ static Database * _sharedDatabase = nil;
 	if ([folder countOfCachedArticles] == -1)
 	{
 		int folderId = [folder itemId];
-		SQLResult * results;
+		int row_count = 0;
+		int unread_count = 0;
 
 		// Initialize to indicate that the folder array is valid.
 		[folder markFolderEmpty];
@@ -1896,52 +2471,51 @@ static Database * _sharedDatabase = nil;
 		// Verify we're on the right thread
 		[self verifyThreadSafety];
 		
-		results = [sqlDatabase performQueryWithFormat:@"select message_id, read_flag, deleted_flag, title, link, revised_flag, hasenclosure_flag, enclosure from messages where folder_id=%d", folderId];
-		if (results && [results rowCount])
+		// Step through the rows one at a time so that only the current row is held
+		// in memory rather than the entire result table.
+		SQLStatement * statement = [sqlDatabase prepareStatement:@"select message_id, read_flag, deleted_flag, title, link, revised_flag, hasenclosure_flag, enclosure from messages where folder_id=?"];
+		[statement bindInt:folderId atIndex:1];
+		for (SQLRow * row in [statement rowEnumerator])
 		{
-			int unread_count = 0;
-			SQLRow * row;
+			NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+			NSString * guid = [row stringForColumnAtIndex:0];
+			BOOL read_flag = [row intForColumnAtIndex:1];
+			BOOL deleted_flag = [row intForColumnAtIndex:2];
+			NSString * title = [row stringForColumnAtIndex:3];
+			NSString * link = [row stringForColumnAtIndex:4];
+			BOOL revised_flag = [row intForColumnAtIndex:5];
+			BOOL hasenclosure_flag = [row intForColumnAtIndex:6];
+			NSString * enclosure = [row stringForColumnAtIndex:7];
 
-			for (row in [results rowEnumerator])
-			{
-				NSString * guid = [row stringForColumn:@"message_id"];
-				BOOL read_flag = [[row stringForColumn:@"read_flag"] intValue];
-				BOOL revised_flag = [[row stringForColumn:@"revised_flag"] intValue];
-				BOOL deleted_flag = [[row stringForColumn:@"deleted_flag"] intValue];
-				BOOL hasenclosure_flag = [[row stringForColumn:@"hasenclosure_flag"] intValue];
-				NSString * title = [row stringForColumn:@"title"];
-				NSString * link = [row stringForColumn:@"link"];
-				NSString * enclosure = [row stringForColumn:@"enclosure"];
-
-				// Keep our own track of unread articles
-				if (!read_flag)
-					++unread_count;
-				
-				Article * article = [[Article alloc] initWithGuid:guid];
-				[article markRead:read_flag];
-				[article markRevised:revised_flag];
-				[article markDeleted:deleted_flag];
-				[article setFolderId:folderId];
-				[article setTitle:title];
-				[article setLink:link];
-				[article setEnclosure:enclosure];
-				[article setHasEnclosure:hasenclosure_flag];
-				[folder addArticleToCache:article];
-				[article release];
-			}
+			// Keep our own track of unread articles
+			if (!read_flag)
+				++unread_count;
+			++row_count;
+			
+			Article * article = [[Article alloc] initWithGuid:guid];
+			[article markRead:read_flag];
+			[article markRevised:revised_flag];
+			[article markDeleted:deleted_flag];
+			[article setFolderId:folderId];
+			[article setTitle:title];
+			[article setLink:link];
+			[article setEnclosure:enclosure];
+			[article setHasEnclosure:hasenclosure_flag];
+			[folder addArticleToCache:article];
+			[article release];
+			[pool drain];
+		}
 
-			// This is a good time to do a quick check to ensure that our
-			// own count of unread is in sync with the folders count and fix
-			// them if not.
-			if (unread_count != [folder unreadCount])
-			{
-				NSLog(@"Fixing unread count for %@ (%d on folder versus %d in articles)", [folder name], [folder unreadCount], unread_count);
-				int diff = (unread_count - [folder unreadCount]);
-				[self setFolderUnreadCount:folder adjustment:diff];
-				countOfUnread += diff;
-			}
+		// This is a good time to do a quick check to ensure that our
+		// own count of unread is in sync with the folders count and fix
+		// them if not.
+		if (row_count > 0 && unread_count != [folder unreadCount])
+		{
+			NSLog(@"Fixing unread count for %@ (%d on folder versus %d in articles)", [folder name], [folder unreadCount], unread_count);
+			int diff = (unread_count - [folder unreadCount]);
+			[self setFolderUnreadCount:folder adjustment:diff];
+			countOfUnread += diff;
 		}
-		[results release];
 	}
 	return YES;
 }
@@ -1954,6 +2528,8 @@ static Database * _sharedDatabase = nil;
 	[newSearchString retain];
 	[searchString release];
 	searchString = newSearchString;
+	if (searchFolder != nil)
+		[folderPlans removeObjectForKey:[NSNumber numberWithInt:[searchFolder itemId]]];
 }
 
 /* sqlScopeForFolder
@@ -1964,7 +2540,6 @@ static Database * _sharedDatabase = nil;
 {
 	Field * field = [self fieldByName:MA_Field_Folder];
 	NSString * operatorString = (scopeFlags & MA_Scope_Inclusive) ? @"=" : @"<>";
-	NSString * conditionString = (scopeFlags & MA_Scope_Inclusive) ? @" or " : @" and ";
 	BOOL subScope = (scopeFlags & MA_Scope_SubFolders) ? YES : NO; // Avoid problems casting into BOOL.
 	int folderId;
 
@@ -1985,28 +2560,51 @@ static Database * _sharedDatabase = nil;
 	if (!subScope)
 		return [NSString stringWithFormat:@"%@%@%d", [field sqlField], operatorString, folderId];
 
-	// For under/not-under operators, we're creating a SQL statement of the format
-	// (folder_id = <value1> || folder_id = <value2>...). It is possible to try and simplify
-	// the string by looking for ranges but I suspect that given the spread of IDs this may
-	// well be false optimisation.
-	//
-	NSArray * childFolders = [self arrayOfSubFolders:folder];
-	NSMutableString * sqlString = [[NSMutableString alloc] init];
-	int count = [childFolders count];
-	int index;
-	
-	if (count > 1)
-		[sqlString appendString:@"("];
-	for (index = 0; index < count; ++index)
+	// For under/not-under operators the folder and everything below it come from the
+	// folder_tree table. The clause is the same size however many folders there are and
+	// SQLite answers the subquery from the table's primary key.
+	NSString * inString = (scopeFlags & MA_Scope_Inclusive) ? @" in " : @" not in ";
+	return [NSString stringWithFormat:@"%@%@(select folder_id from folder_tree where ancestor_id=%d)", [field sqlField], inString, folderId];
+}
+
+/* searchIndexQuery
+ * Converts a search value into an FTS3 MATCH expression, quoted ready to be placed in
+ * a SQL statement. The words are matched as a phrase with the last word treated as
+ * a prefix, unless the value has the \w whole word prefix. If columnNames is not nil
+ * the match is restricted to those columns of the index. Returns nil if the value has
+ * no words to search for.
+ */
+-(NSString *)searchIndexQuery:(NSString *)value columns:(NSArray *)columnNames
+{
+	BOOL wholeWord = NO;
+	if ([value hasPrefix:@"\\w"])
 	{
-		Folder * folder = [childFolders objectAtIndex:index];
-		if (index > 0)
-			[sqlString appendString:conditionString];
-		[sqlString appendFormat:@"%@%@%d", [field sqlField], operatorString, [folder itemId]];
+		value = [value substringFromIndex:2];
+		wholeWord = YES;
 	}
-	if (count > 1)
-		[sqlString appendString:@")"];
-	return [sqlString autorelease];
+
+	// The FTS3 simple tokenizer only keeps letters and digits, so anything else just
+	// separates words. Double quotes would end the phrase so they go too.
+	NSMutableArray * words = [NSMutableArray array];
+	NSCharacterSet * separators = [[NSCharacterSet alphanumericCharacterSet] invertedSet];
+	for (NSString * word in [value componentsSeparatedByCharactersInSet:separators])
+	{
+		if ([word length] > 0)
+			[words addObject:word];
+	}
+	if ([words count] == 0)
+		return nil;
+
+	NSString * phrase = [words componentsJoinedByString:@" "];
+	NSString * query = [NSString stringWithFormat:@"\"%@%@\"", phrase, wholeWord ? @"" : @"*"];
+	if (columnNames != nil)
+	{
+		NSMutableArray * columnQueries = [NSMutableArray arrayWithCapacity:[columnNames count]];
+		for (NSString * columnName in columnNames)
+			[columnQueries addObject:[NSString stringWithFormat:@"%@:%@", columnName, query]];
+		query = [columnQueries componentsJoinedByString:@" OR "];
+	}
+	return [SQLDatabase prepareStringForQuery:query];
 }
 
 /* criteriaToSQL
@@ -2045,6 +2643,7 @@ static Database * _sharedDatabase = nil;
 				// Handle the operatorString later. For now just make sure we're working with the
 				// right field types.
 				NSAssert([field type] == MA_FieldType_Folder, @"Under operators only valid for folder field types");
+				operatorString = @"";
 				break;
 		}
 
@@ -2078,24 +2677,8 @@ static Database * _sharedDatabase = nil;
 				}
 				
 			case MA_FieldType_Date: {
-				NSCalendarDate * startDate = [NSCalendarDate date];
-				NSString * criteriaValue = [[criteria value] lowercaseString];
-				int spanOfDays = 1;
-				
-				// "yesterday" is a short hand way of specifying the previous day.
-				if ([criteriaValue isEqualToString:@"yesterday"])
-				{
-					startDate = [startDate dateByAddingYears:0 months:0 days:-1 hours:0 minutes:0 seconds:0];
-				}
-				// "last week" is a short hand way of specifying a range from 7 days ago to today.
-				else if ([criteriaValue isEqualToString:@"last week"])
-				{
-					startDate = [startDate dateByAddingYears:0 months:0 days:-6 hours:0 minutes:0 seconds:0];
-					spanOfDays = 7;
-				}
-				
-				criteriaValue = [NSString stringWithFormat:@"%d/%d/%d %d:%d:%d", [startDate dayOfMonth], [startDate monthOfYear], [startDate yearOfCommonEra], 0, 0, 0];
-				startDate = [NSCalendarDate dateWithString:criteriaValue calendarFormat:@"%d/%m/%Y %H:%M:%S"];
+				int spanOfDays;
+				NSCalendarDate * startDate = [CriteriaMatcher startDateForCriteria:criteria spanOfDays:&spanOfDays];
 				
 				if ([criteria operator] == MA_CritOper_Is)
 				{
@@ -2116,7 +2699,37 @@ static Database * _sharedDatabase = nil;
 				break;
 				}
 
-			case MA_FieldType_String:
+			case MA_FieldType_String: {
+				BOOL isContains = ([criteria operator] == MA_CritOper_Contains || [criteria operator] == MA_CritOper_NotContains);
+				if (isContains)
+				{
+					// Text, subject and author searches go through the full text search index.
+					// A text search also covers the title, as the regexp search below does.
+					NSArray * columnNames = nil;
+					switch ([field tag])
+					{
+						case MA_FieldID_Text:		columnNames = [NSArray arrayWithObjects:@"text", @"title", nil]; break;
+						case MA_FieldID_Subject:	columnNames = [NSArray arrayWithObject:@"title"]; break;
+						case MA_FieldID_Author:		columnNames = [NSArray arrayWithObject:@"sender"]; break;
+					}
+					NSString * matchString = nil;
+					if (columnNames != nil)
+						matchString = [self searchIndexQuery:[criteria value] columns:columnNames];
+					if (matchString != nil)
+					{
+						[sqlString appendFormat:@"article_id %@ (select docid from messages_fts where messages_fts match '%@')",
+							([criteria operator] == MA_CritOper_Contains) ? @"in" : @"not in",
+							matchString];
+						break;
+					}
+				}
+
+				// The regexp operators already quote their value. Other comparisons need the
+				// value quoted so that it is compared as a string.
+				NSString * criteriaValue = [SQLDatabase prepareStringForQuery:[criteria value]];
+				if (!isContains)
+					criteriaValue = [NSString stringWithFormat:@"'%@'", criteriaValue];
+
 				if ([field tag] == MA_FieldID_Text)
 				{
 					// Special case for searching the text field. We always include the title field in the
@@ -2127,11 +2740,14 @@ static Database * _sharedDatabase = nil;
 					// where op is the appropriate operator.
 					//
 					Field * titleField = [self fieldByName:MA_Field_Subject];
-					NSString * value = [NSString stringWithFormat:operatorString, [criteria value]];
+					NSString * value = [NSString stringWithFormat:operatorString, criteriaValue];
 					[sqlString appendFormat:@"(%@%@ or %@%@)", [field sqlField], value, [titleField sqlField], value];
 					break;
 				}
-					
+				valueString = criteriaValue;
+				break;
+				}
+
 			case MA_FieldType_Integer:
 				valueString = [NSString stringWithFormat:@"%@", [criteria value]];
 				break;
@@ -2180,6 +2796,348 @@ static Database * _sharedDatabase = nil;
 	return [tree autorelease];
 }
 
+/* sqlForFolder
+ * Returns the SQL condition that selects the articles in the specified folder. The
+ * condition compiled from the folder's criteria is remembered and reused until the
+ * criteria change, a folder is added, renamed or deleted or, for criteria that
+ * refer to relative dates such as "today", the day changes.
+ */
+-(NSString *)sqlForFolder:(Folder *)folder
+{
+	NSNumber * folderNumber = [NSNumber numberWithInt:[folder itemId]];
+	NSDictionary * plan = [folderPlans objectForKey:folderNumber];
+	if (plan != nil && [[plan objectForKey:@"expires"] timeIntervalSinceNow] > 0)
+		return [plan objectForKey:@"sql"];
+
+	CriteriaTree * tree = [self criteriaForFolder:[folder itemId]];
+	NSString * sqlString = [self criteriaToSQL:tree];
+	NSDate * expires = [NSDate distantFuture];
+	if ([self criteriaTreeDependsOnDate:tree])
+	{
+		NSCalendarDate * now = [NSCalendarDate calendarDate];
+		NSCalendarDate * today = [NSCalendarDate dateWithYear:[now yearOfCommonEra] month:[now monthOfYear] day:[now dayOfMonth] hour:0 minute:0 second:0 timeZone:[now timeZone]];
+		expires = [today dateByAddingYears:0 months:0 days:1 hours:0 minutes:0 seconds:0];
+	}
+	[folderPlans setObject:[NSDictionary dictionaryWithObjectsAndKeys:sqlString, @"sql", expires, @"expires", nil] forKey:folderNumber];
+	return sqlString;
+}
+
+/* criteriaTreeDependsOnDate
+ * Returns whether any clause of the criteria tree compares a date field. Such
+ * clauses are converted to SQL relative to the current day.
+ */
+-(BOOL)criteriaTreeDependsOnDate:(CriteriaTree *)criteriaTree
+{
+	for (Criteria * criteria in [criteriaTree criteriaEnumerator])
+	{
+		if ([[self fieldByName:[criteria field]] type] == MA_FieldType_Date)
+			return YES;
+	}
+	return NO;
+}
+
+/* invalidateFolderPlans
+ * Discards all compiled folder queries. Cached smart folder results are kept since
+ * they are checked against the recompiled query before they are used.
+ */
+-(void)invalidateFolderPlans
+{
+	[folderPlans removeAllObjects];
+}
+
+/* cachedArticlesForFolder
+ * Returns the articles last retrieved for the specified smart folder if neither its
+ * query nor anything in the database has changed since, or nil otherwise. Every
+ * insert, update and delete made through our connection bumps the SQLite change
+ * count so any write invalidates the cached results.
+ */
+-(NSArray *)cachedArticlesForFolder:(Folder *)folder sql:(NSString *)sql
+{
+	NSNumber * folderNumber = [NSNumber numberWithInt:[folder itemId]];
+	NSDictionary * entry = [smartFolderResults objectForKey:folderNumber];
+	if (entry == nil)
+		return nil;
+
+	if ([[entry objectForKey:@"changes"] intValue] != [sqlDatabase totalChanges] || ![[entry objectForKey:@"sql"] isEqualToString:sql])
+	{
+		[smartFolderResults removeObjectForKey:folderNumber];
+		[smartFolderResultsOrder removeObject:folderNumber];
+		return nil;
+	}
+
+	// Move the folder to the most recently used end
+	[smartFolderResultsOrder removeObject:folderNumber];
+	[smartFolderResultsOrder addObject:folderNumber];
+	return [entry objectForKey:@"articles"];
+}
+
+/* cacheArticles
+ * Remembers the articles retrieved for the specified smart folder along with the
+ * query and database change count they were retrieved with. Only the most recently
+ * used MA_Smart_Folder_Result_Cache_Size folders are kept.
+ */
+-(void)cacheArticles:(NSArray *)articles forFolder:(Folder *)folder sql:(NSString *)sql
+{
+	NSNumber * folderNumber = [NSNumber numberWithInt:[folder itemId]];
+	NSDictionary * entry = [NSDictionary dictionaryWithObjectsAndKeys:
+							articles, @"articles",
+							sql, @"sql",
+							[NSNumber numberWithInt:[sqlDatabase totalChanges]], @"changes",
+							nil];
+	[smartFolderResults setObject:entry forKey:folderNumber];
+	[smartFolderResultsOrder removeObject:folderNumber];
+	[smartFolderResultsOrder addObject:folderNumber];
+
+	while ([smartFolderResultsOrder count] > MA_Smart_Folder_Result_Cache_Size)
+	{
+		[smartFolderResults removeObjectForKey:[smartFolderResultsOrder objectAtIndex:0]];
+		[smartFolderResultsOrder removeObjectAtIndex:0];
+	}
+}
+
+/* unreadCountOfSmartFolder
+ * Returns the number of unread articles that match the specified smart folder. The
+ * folder's query is only run the first time the count is wanted. After that the
+ * membership of the folder is kept current as articles are added and changed.
+ */
+-(int)unreadCountOfSmartFolder:(int)folderId
+{
+	Folder * folder = [self folderFromID:folderId];
+	if (folder == nil || !IsSmartFolder(folder))
+		return 0;
+	return (int)[[[self membershipOfSmartFolder:folder] objectForKey:@"unread"] count];
+}
+
+/* membershipOfSmartFolder
+ * Returns a dictionary holding the set of articles that match the specified smart
+ * folder, the subset of those that are unread and the SQL the sets were computed
+ * with. Articles are identified by folder ID and guid. The folder's query is run
+ * again if the membership isn't known or the compiled query has changed.
+ */
+-(NSMutableDictionary *)membershipOfSmartFolder:(Folder *)folder
+{
+	NSNumber * folderNumber = [NSNumber numberWithInt:[folder itemId]];
+	NSString * folderSQL = [self sqlForFolder:folder];
+	NSMutableDictionary * membership = [smartFolderMembers objectForKey:folderNumber];
+	if (membership != nil && [[membership objectForKey:@"sql"] isEqualToString:folderSQL])
+		return membership;
+
+	NSMutableSet * members = [NSMutableSet set];
+	NSMutableSet * unread = [NSMutableSet set];
+
+	[self verifyThreadSafety];
+	SQLStatement * statement = [sqlDatabase streamQuery:[NSString stringWithFormat:@"select folder_id, message_id, read_flag from messages where (%@) and deleted_flag=0", folderSQL]];
+	for (SQLRow * row in [statement rowEnumerator])
+	{
+		NSString * key = [NSString stringWithFormat:@"%d/%@", [row intForColumnAtIndex:0], [row stringForColumnAtIndex:1]];
+		[members addObject:key];
+		if ([row intForColumnAtIndex:2] == 0)
+			[unread addObject:key];
+	}
+
+	membership = [NSMutableDictionary dictionaryWithObjectsAndKeys:members, @"members", unread, @"unread", folderSQL, @"sql", nil];
+	[smartFolderMembers setObject:membership forKey:folderNumber];
+	return membership;
+}
+
+/* setMembershipOfSmartFolder
+ * Replaces the membership of the specified smart folder with the articles that were
+ * just read by running its query.
+ */
+-(void)setMembershipOfSmartFolder:(Folder *)folder fromArticles:(NSArray *)articles sql:(NSString *)sql
+{
+	NSMutableSet * members = [NSMutableSet setWithCapacity:[articles count]];
+	NSMutableSet * unread = [NSMutableSet set];
+
+	for (Article * article in articles)
+	{
+		if ([article isDeleted])
+			continue;
+
+		NSString * key = [NSString stringWithFormat:@"%d/%@", [article folderId], [article guid]];
+		[members addObject:key];
+		if (![article isRead])
+			[unread addObject:key];
+	}
+
+	NSMutableDictionary * membership = [NSMutableDictionary dictionaryWithObjectsAndKeys:members, @"members", unread, @"unread", sql, @"sql", nil];
+	[smartFolderMembers setObject:membership forKey:[NSNumber numberWithInt:[folder itemId]]];
+}
+
+/* readFlagsForQuery
+ * Runs a query that returns message_id and read_flag against a set of articles in one
+ * folder. The format follows the same rules as executeSQL:inFolder:forGuids:. Returns
+ * a dictionary that maps the guid of each row returned to its read flag.
+ */
+-(NSDictionary *)readFlagsForQuery:(NSString *)sqlFormat inFolder:(int)folderId forGuids:(NSArray *)guids
+{
+	NSMutableDictionary * readFlags = [NSMutableDictionary dictionary];
+	NSUInteger start = 0;
+
+	[self verifyThreadSafety];
+	while (start < [guids count])
+	{
+		SQLStatement * statement = [self prepareBatch:sqlFormat inFolder:folderId forGuids:guids start:&start];
+		if (statement == nil)
+			break;
+		for (SQLRow * row in [statement rowEnumerator])
+			[readFlags setObject:[NSNumber numberWithInt:[row intForColumnAtIndex:1]] forKey:[row stringForColumnAtIndex:0]];
+	}
+	return readFlags;
+}
+
+/* updateSmartFolderMembership
+ * Tests a set of new or changed articles, given as arrays of guids keyed by folder ID,
+ * against every smart folder whose membership is known and adds or removes them.
+ * Articles in the folder cache are tested in memory by the smart folder's compiled
+ * CriteriaMatcher. Otherwise the folder's query is run restricted to just those
+ * articles. Either way the cost is in proportion to the number of articles that
+ * changed rather than the size of the database. A notification is sent for each smart
+ * folder whose unread count changes.
+ */
+-(void)updateSmartFolderMembership:(NSDictionary *)guidsByFolder
+{
+	NSMutableArray * changedFolders = [NSMutableArray array];
+
+	for (NSNumber * smartFolderNumber in [smartFolderMembers allKeys])
+	{
+		NSMutableDictionary * membership = [smartFolderMembers objectForKey:smartFolderNumber];
+		Folder * smartFolder = [self folderFromID:[smartFolderNumber intValue]];
+		NSString * folderSQL = (smartFolder != nil) ? [self sqlForFolder:smartFolder] : nil;
+
+		// If the query has changed the membership is worked out again in full the
+		// next time it is needed.
+		if (folderSQL == nil || ![[membership objectForKey:@"sql"] isEqualToString:folderSQL])
+		{
+			[smartFolderMembers removeObjectForKey:smartFolderNumber];
+			[changedFolders addObject:smartFolderNumber];
+			continue;
+		}
+
+		NSMutableSet * members = [membership objectForKey:@"members"];
+		NSMutableSet * unread = [membership objectForKey:@"unread"];
+		NSUInteger countOfUnreadMembers = [unread count];
+
+		CriteriaMatcher * matcher = [membership objectForKey:@"matcher"];
+		if (matcher == nil || [[matcher expiryDate] timeIntervalSinceNow] <= 0)
+		{
+			matcher = [[CriteriaMatcher alloc] initWithCriteriaTree:[self criteriaForFolder:[smartFolderNumber intValue]]];
+			[membership setObject:matcher forKey:@"matcher"];
+			[matcher release];
+		}
+
+		// The compiled condition may itself contain % characters so it is escaped
+		// before it becomes part of a format.
+		NSString * condition = [folderSQL stringByReplacingOccurrencesOfString:@"%" withString:@"%%"];
+		NSString * sqlFormat = [NSString stringWithFormat:@"select message_id, read_flag from messages where (%@) and deleted_flag=0 and folder_id=? and message_id in (%%@)", condition];
+
+		for (NSNumber * folderNumber in guidsByFolder)
+		{
+			NSArray * guids = [guidsByFolder objectForKey:folderNumber];
+			NSDictionary * readFlags = nil;
+
+			// Articles in the folder's cache are tested in memory unless the criteria
+			// look at the article text, which the cache doesn't hold.
+			Folder * folder = [self folderFromID:[folderNumber intValue]];
+			if (![matcher needsArticleText] && [folder countOfCachedArticles] > 0)
+			{
+				NSMutableDictionary * matchedReadFlags = [NSMutableDictionary dictionary];
+				for (NSString * guid in guids)
+				{
+					Article * article = [folder articleFromGuid:guid];
+					if (article == nil)
+					{
+						matchedReadFlags = nil;
+						break;
+					}
+					if (![article isDeleted] && [matcher matchesArticle:article])
+						[matchedReadFlags setObject:[NSNumber numberWithInt:[article isRead]] forKey:guid];
+				}
+				readFlags = matchedReadFlags;
+			}
+			if (readFlags == nil)
+				readFlags = [self readFlagsForQuery:sqlFormat inFolder:[folderNumber intValue] forGuids:guids];
+			for (NSString * guid in guids)
+			{
+				NSString * key = [NSString stringWithFormat:@"%@/%@", folderNumber, guid];
+				NSNumber * readFlag = [readFlags objectForKey:guid];
+				if (readFlag == nil)
+				{
+					[members removeObject:key];
+					[unread removeObject:key];
+				}
+				else
+				{
+					[members addObject:key];
+					if ([readFlag intValue] == 0)
+						[unread addObject:key];
+					else
+						[unread removeObject:key];
+				}
+			}
+		}
+		if ([unread count] != countOfUnreadMembers)
+			[changedFolders addObject:smartFolderNumber];
+	}
+
+	NSNotificationCenter * nc = [NSNotificationCenter defaultCenter];
+	for (NSNumber * smartFolderNumber in changedFolders)
+		[nc postNotificationName:@"MA_Notify_FoldersUpdated" object:smartFolderNumber];
+}
+
+/* removeFromSmartFolderMembership
+ * Removes a set of articles, given as arrays of guids keyed by folder ID, from every
+ * smart folder. Used when articles are deleted since they can then match nothing.
+ */
+-(void)removeFromSmartFolderMembership:(NSDictionary *)guidsByFolder
+{
+	NSMutableArray * changedFolders = [NSMutableArray array];
+
+	for (NSNumber * smartFolderNumber in smartFolderMembers)
+	{
+		NSMutableDictionary * membership = [smartFolderMembers objectForKey:smartFolderNumber];
+		NSMutableSet * members = [membership objectForKey:@"members"];
+		NSMutableSet * unread = [membership objectForKey:@"unread"];
+		NSUInteger countOfUnreadMembers = [unread count];
+
+		for (NSNumber * folderNumber in guidsByFolder)
+		{
+			for (NSString * guid in [guidsByFolder objectForKey:folderNumber])
+			{
+				NSString * key = [NSString stringWithFormat:@"%@/%@", folderNumber, guid];
+				[members removeObject:key];
+				[unread removeObject:key];
+			}
+		}
+		if ([unread count] != countOfUnreadMembers)
+			[changedFolders addObject:smartFolderNumber];
+	}
+
+	NSNotificationCenter * nc = [NSNotificationCenter defaultCenter];
+	for (NSNumber * smartFolderNumber in changedFolders)
+		[nc postNotificationName:@"MA_Notify_FoldersUpdated" object:smartFolderNumber];
+}
+
+/* invalidateSmartFolderMembership
+ * Forgets the membership of every smart folder after a change that can affect too many
+ * articles to track one by one. Each one is worked out again when it is next needed.
+ */
+-(void)invalidateSmartFolderMembership
+{
+	if ([smartFolderMembers count] == 0)
+		return;
+
+	NSArray * smartFolderNumbers = [smartFolderMembers allKeys];
+	[smartFolderMembers removeAllObjects];
+
+	NSNotificationCenter * nc = [NSNotificationCenter defaultCenter];
+	for (NSNumber * smartFolderNumber in smartFolderNumbers)
+	{
+		if ([self folderFromID:[smartFolderNumber intValue]] != nil)
+			[nc postNotificationName:@"MA_Notify_FoldersUpdated" object:smartFolderNumber];
+	}
+}
+
 /* arrayOfUnreadArticles
  * Retrieves an array of ArticleReference objects that represent all unread
  * articles in the specified folder.
@@ -2234,18 +3192,45 @@ static Database * _sharedDatabase = nil;
 -(NSArray *)arrayOfArticles:(int)folderId filterString:(NSString *)filterString
 {
 	NSMutableArray * newArray = [NSMutableArray array];
+	NSMutableArray * allArticles = nil;
+	NSString * cacheSQL = nil;
 	NSString * filterClause = @"";
 	NSString * queryString;
 	Folder * folder = nil;
 	int unread_count = 0;
 
+	// The article text is deliberately left out of the columns. Bodies are large and
+	// most are never displayed so they're fetched on demand by bodyOfArticle.
+	NSString * columns = @"message_id, folder_id, parent_id, read_flag, marked_flag, deleted_flag, title, sender, link, createddate, date, revised_flag, hasenclosure_flag, enclosuredownloaded_flag, enclosure, summary";
+
+	// The filter string is matched against the full text search index by joining with
+	// the matching index rows, and the results come back best match first. If the
+	// filter has no words the index can use we fall back to a plain substring search.
+	NSString * fromClause = @"messages";
+	NSString * orderClause = @"";
+	if ([filterString isNotEqualTo:@""])
+	{
+		NSString * matchString = [self searchIndexQuery:filterString columns:nil];
+		if (matchString != nil)
+		{
+			fromClause = [NSString stringWithFormat:@"messages join (select docid, fts_rank(matchinfo(messages_fts)) as rank from messages_fts "
+						  @"where messages_fts match '%@') as hits on article_id=hits.docid", matchString];
+			orderClause = @" order by hits.rank desc";
+		}
+		else
+		{
+			NSString * preparedFilterString = [SQLDatabase prepareStringForQuery:filterString];
+			filterClause = [NSString stringWithFormat:@"(title like '%%%@%%' or text like '%%%@%%')", preparedFilterString, preparedFilterString];
+		}
+	}
+
 	// If folderId is zero then we're searching the entire
 	// database with or without a filter string.
 	if (folderId == 0)
 	{
-		if ([filterString isNotEqualTo:@""])
-			filterClause = [NSString stringWithFormat:@" where text like '%%%@%%'", filterString];
-		queryString = [NSString stringWithFormat:@"select * from messages%@", filterClause];
+		if ([filterClause isNotEqualTo:@""])
+			filterClause = [NSString stringWithFormat:@" where %@", filterClause];
+		queryString = [NSString stringWithFormat:@"select %@ from %@%@%@", columns, fromClause, filterClause, orderClause];
 	}
 	else
 	{
@@ -2254,73 +3239,226 @@ static Database * _sharedDatabase = nil;
 			return nil;
 		[folder clearCache];
 
-		// Construct a criteria tree for this query
-		CriteriaTree * tree = [self criteriaForFolder:folderId];
+		// The criteria for the folder are compiled to SQL once and reused until the
+		// folder or anything its criteria depend on changes.
+		NSString * folderSQL = [self sqlForFolder:folder];
 
-		if ([filterString isNotEqualTo:@""])
-			filterClause = [NSString stringWithFormat:@" and (title like '%%%@%%' or text like '%%%@%%')", filterString, filterString];
-		queryString = [NSString stringWithFormat:@"select * from messages where (%@)%@", [self criteriaToSQL:tree], filterClause];
+		// Smart folders that haven't changed since they were last shown are served
+		// from memory.
+		if (IsSmartFolder(folder) && [filterString isEqualTo:@""])
+		{
+			NSArray * cachedArticles = [self cachedArticlesForFolder:folder sql:folderSQL];
+			if (cachedArticles != nil)
+			{
+				for (Article * article in cachedArticles)
+				{
+					if (![article isDeleted])
+						[newArray addObject:article];
+					[folder addArticleToCache:article];
+				}
+				return newArray;
+			}
+			allArticles = [NSMutableArray array];
+			cacheSQL = folderSQL;
+		}
+
+		if ([filterClause isNotEqualTo:@""])
+			filterClause = [NSString stringWithFormat:@" and %@", filterClause];
+		queryString = [NSString stringWithFormat:@"select %@ from %@ where (%@)%@%@", columns, fromClause, folderSQL, filterClause, orderClause];
 	}
 
 	// Verify we're on the right thread
 	[self verifyThreadSafety];
 
-	// Time to run the query
-	SQLResult * results = [sqlDatabase performQuery:queryString];
-	if (results && [results rowCount])
+	// Time to run the query. Rows are stepped one at a time and each row's
+	// strings are released as soon as the article has taken what it needs.
+	SQLStatement * statement = [sqlDatabase streamQuery:queryString];
+	NSMutableSet * authors = [NSMutableSet set];
+	int row_count = 0;
+
+	for (SQLRow * row in [statement rowEnumerator])
 	{
-        Article * article;
-        NSString * text;
+		NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+		Article * article = [[Article alloc] initWithGuid:[row stringForColumn:@"message_id"]];
+		[article setTitle:[row stringForColumn:@"title"]];
 
-		for (SQLRow * row in [results rowEnumerator])
+		// Articles in a feed usually share a handful of authors so keep a single copy of each.
+		NSString * author = [row stringForColumn:@"sender"];
+		if (author != nil)
 		{
-			article = [[Article alloc] initWithGuid:[row stringForColumn:@"message_id"]];
-			[article setTitle:[row stringForColumn:@"title"]];
-			[article setAuthor:[row stringForColumn:@"sender"]];
-			[article setLink:[row stringForColumn:@"link"]];
-			[article setEnclosure:[row stringForColumn:@"enclosure"]];
-			[article setHasEnclosure:[[row stringForColumn:@"hasenclosure_flag"] intValue]];
-			[article setDate:[NSDate dateWithTimeIntervalSince1970:[[row stringForColumn:@"date"] doubleValue]]];
-			[article setCreatedDate:[NSDate dateWithTimeIntervalSince1970:[[row stringForColumn:@"createddate"] doubleValue]]];
-			[article markRead:[[row stringForColumn:@"read_flag"] intValue]];
-			[article markRevised:[[row stringForColumn:@"revised_flag"] intValue]];
-			[article markFlagged:[[row stringForColumn:@"marked_flag"] intValue]];
-			[article markDeleted:[[row stringForColumn:@"deleted_flag"] intValue]];
-			[article setFolderId:[[row stringForColumn:@"folder_id"] intValue]];
-			[article setParentId:[[row stringForColumn:@"parent_id"] intValue]];
-            text = [row stringForColumn:@"text"];
-			[article setBody:text];
-			if (folder == nil || ![article isDeleted] || IsTrashFolder(folder))
-				[newArray addObject:article];
-			[folder addArticleToCache:article];
-            
-			// Keep our own track of unread articles
-			if (![article isRead])
-				++unread_count;
-            
-			[article release];
+			NSString * sharedAuthor = [authors member:author];
+			if (sharedAuthor == nil)
+				[authors addObject:author];
+			else
+				author = sharedAuthor;
 		}
-
-		// This is a good time to do a quick check to ensure that our
-		// own count of unread is in sync with the folders count and fix
-		// them if not.
-		if (folder && [filterString isEqualTo:@""] && IsRSSFolder(folder))
+		[article setAuthor:author];
+		[article setLink:[row stringForColumn:@"link"]];
+		[article setEnclosure:[row stringForColumn:@"enclosure"]];
+		[article setHasEnclosure:[row intForColumn:@"hasenclosure_flag"]];
+		[article markEnclosureDownloaded:[row intForColumn:@"enclosuredownloaded_flag"]];
+		[article setSummary:[row stringForColumn:@"summary"]];
+		[article setDate:[NSDate dateWithTimeIntervalSince1970:[row doubleForColumn:@"date"]]];
+		[article setCreatedDate:[NSDate dateWithTimeIntervalSince1970:[row doubleForColumn:@"createddate"]]];
+		[article markRead:[row intForColumn:@"read_flag"]];
+		[article markRevised:[row intForColumn:@"revised_flag"]];
+		[article markFlagged:[row intForColumn:@"marked_flag"]];
+		[article markDeleted:[row intForColumn:@"deleted_flag"]];
+		[article setFolderId:[row intForColumn:@"folder_id"]];
+		[article setParentId:[row intForColumn:@"parent_id"]];
+		if (folder == nil || ![article isDeleted] || IsTrashFolder(folder))
+			[newArray addObject:article];
+		[folder addArticleToCache:article];
+		[allArticles addObject:article];
+
+		// Keep our own track of unread articles
+		if (![article isRead])
+			++unread_count;
+		++row_count;
+
+		[article release];
+		[pool drain];
+	}
+
+	// This is a good time to do a quick check to ensure that our
+	// own count of unread is in sync with the folders count and fix
+	// them if not.
+	if (row_count > 0 && folder && [filterString isEqualTo:@""] && IsRSSFolder(folder))
+	{
+		if (unread_count != [folder unreadCount])
 		{
-			if (unread_count != [folder unreadCount])
-			{
-				NSLog(@"Fixing unread count for %@ (%d on folder versus %d in articles)", [folder name], [folder unreadCount], unread_count);
-				int diff = (unread_count - [folder unreadCount]);
-				[self setFolderUnreadCount:folder adjustment:diff];
-				countOfUnread += diff;
-			}
+			NSLog(@"Fixing unread count for %@ (%d on folder versus %d in articles)", [folder name], [folder unreadCount], unread_count);
+			int diff = (unread_count - [folder unreadCount]);
+			[self setFolderUnreadCount:folder adjustment:diff];
+			countOfUnread += diff;
 		}
 	}
 
-	// Deallocate
-	[results release];
+	if (allArticles != nil)
+	{
+		[self cacheArticles:allArticles forFolder:folder sql:cacheSQL];
+		[self setMembershipOfSmartFolder:folder fromArticles:allArticles sql:cacheSQL];
+	}
 	return newArray;
 }
 
+/* bodyOfArticle
+ * Returns the text of the specified article. Bodies are loaded on demand and kept
+ * in a cache that is bounded by MA_Body_Cache_Limit bytes, discarding the least
+ * recently used bodies first. Returns nil if the article isn't in the database.
+ */
+-(NSString *)bodyOfArticle:(int)folderId guid:(NSString *)guid
+{
+	if (guid == nil)
+		return nil;
+
+	NSString * key = [NSString stringWithFormat:@"%d/%@", folderId, guid];
+	CachedBody * entry = [bodyCache objectForKey:key];
+	if (entry != nil)
+	{
+		if (entry != newestBody)
+		{
+			[self unlinkCachedBody:entry];
+			[self linkCachedBody:entry];
+		}
+		return [entry body];
+	}
+
+	NSString * body = nil;
+	[self verifyThreadSafety];
+	SQLStatement * statement = [sqlDatabase prepareStatement:@"select text from messages where folder_id=? and message_id=?"];
+	[statement bindInt:folderId atIndex:1];
+	[statement bindString:guid atIndex:2];
+	SQLRow * row = [statement nextRow];
+	if (row != nil)
+	{
+		body = SafeString([row stringForColumnAtIndex:0]);
+		[statement reset];
+		[self cacheBody:body forKey:key];
+	}
+	return body;
+}
+
+/* cacheBody
+ * Adds an article body to the body cache, evicting the least recently used
+ * bodies until the cache is back under its size limit.
+ */
+-(void)cacheBody:(NSString *)body forKey:(NSString *)key
+{
+	CachedBody * entry = [[CachedBody alloc] initWithKey:key body:body];
+	[bodyCache setObject:entry forKey:key];
+	[self linkCachedBody:entry];
+	[entry release];
+	bodyCacheSize += [body length] * sizeof(unichar);
+
+	while (bodyCacheSize > MA_Body_Cache_Limit && oldestBody != newestBody)
+	{
+		CachedBody * oldestEntry = oldestBody;
+		NSString * oldestKey = [[oldestEntry key] retain];
+		bodyCacheSize -= [[oldestEntry body] length] * sizeof(unichar);
+		[self unlinkCachedBody:oldestEntry];
+		[bodyCache removeObjectForKey:oldestKey];
+		[oldestKey release];
+	}
+}
+
+/* linkCachedBody
+ * Puts a body cache entry at the most recently used end of the list.
+ */
+-(void)linkCachedBody:(CachedBody *)entry
+{
+	[entry setOlder:newestBody];
+	[entry setNewer:nil];
+	if (newestBody != nil)
+		[newestBody setNewer:entry];
+	newestBody = entry;
+	if (oldestBody == nil)
+		oldestBody = entry;
+}
+
+/* unlinkCachedBody
+ * Takes a body cache entry out of the list.
+ */
+-(void)unlinkCachedBody:(CachedBody *)entry
+{
+	if ([entry newer] != nil)
+		[[entry newer] setOlder:[entry older]];
+	else
+		newestBody = [entry older];
+	if ([entry older] != nil)
+		[[entry older] setNewer:[entry newer]];
+	else
+		oldestBody = [entry newer];
+	[entry setNewer:nil];
+	[entry setOlder:nil];
+}
+
+/* removeCachedBody
+ * Drops the specified article from the body cache, if it is there.
+ */
+-(void)removeCachedBody:(int)folderId guid:(NSString *)guid
+{
+	NSString * key = [NSString stringWithFormat:@"%d/%@", folderId, guid];
+	CachedBody * entry = [bodyCache objectForKey:key];
+	if (entry != nil)
+	{
+		bodyCacheSize -= [[entry body] length] * sizeof(unichar);
+		[self unlinkCachedBody:entry];
+		[bodyCache removeObjectForKey:key];
+	}
+}
+
+/* clearBodyCache
+ * Empties the body cache.
+ */
+-(void)clearBodyCache
+{
+	[bodyCache removeAllObjects];
+	newestBody = nil;
+	oldestBody = nil;
+	bodyCacheSize = 0;
+}
+
 /* markFolderRead
  * Mark all articles in the folder and sub-folders read. This should be called
  * within a transaction since it is SQL intensive.
@@ -2360,6 +3498,7 @@ static Database * _sharedDatabase = nil;
 			}
 			countOfUnread -= count;
 			[self setFolderUnreadCount:folder adjustment:-count];
+			[self invalidateSmartFolderMembership];
 		}
 		[results release];
 		result = YES;
@@ -2381,35 +3520,44 @@ static Database * _sharedDatabase = nil;
 		Article * article = [folder articleFromGuid:guid];
 		if (article != nil && isRead != [article isRead])
 		{
-			NSString * preparedGuid = [SQLDatabase prepareStringForQuery:guid];
-
 			// Verify we're on the right thread
 			[self verifyThreadSafety];
 
 			// Mark an individual article read
-			SQLResult * results = [sqlDatabase performQueryWithFormat:@"update messages set read_flag=%d where folder_id=%d and message_id='%@'", isRead, folderId, preparedGuid];
-			if (results)
+			SQLStatement * statement = [sqlDatabase prepareStatement:@"update messages set read_flag=? where folder_id=? and message_id=?"];
+			[statement bindInt:isRead atIndex:1];
+			[statement bindInt:folderId atIndex:2];
+			[statement bindString:guid atIndex:3];
+			if ([statement execute] == SQLITE_OK)
 			{
 				int adjustment = (isRead ? -1 : 1);
 
 				[article markRead:isRead];
 				countOfUnread += adjustment;
 				[self setFolderUnreadCount:folder adjustment:adjustment];
+				[self updateSmartFolderMembership:[NSDictionary dictionaryWithObject:[NSArray arrayWithObject:guid] forKey:[NSNumber numberWithInt:folderId]]];
 			}
-			[results release];
 		}
 	}
 }
 
 /* setFolderUnreadCount
  * Adjusts the unread count on the specified folder by the given delta. The same delta is
- * also applied to the childUnreadCount of all ancestor folders.
+ * also applied to the childUnreadCount of all ancestor folders. Inside a transaction the
+ * new count is only written to the folders table when the transaction is committed, so
+ * any number of adjustments to one folder cost a single update.
  */
 -(void)setFolderUnreadCount:(Folder *)folder adjustment:(int)adjustment
 {
+	if (adjustment == 0)
+		return;
+
 	int unreadCount = [folder unreadCount];
 	[folder setUnreadCount:unreadCount + adjustment];
-	[self executeSQLWithFormat:@"update folders set unread_count=%d where folder_id=%d", [folder unreadCount], [folder itemId]];
+
+	[dirtyUnreadFolders addObject:folder];
+	if (!inTransaction)
+		[self flushUnreadCounts];
 	
 	// Update childUnreadCount for our parent. Since we're just working
 	// on one article, we do this the faster way.
@@ -2421,13 +3569,70 @@ static Database * _sharedDatabase = nil;
 	}
 }
 
+/* flushUnreadCounts
+ * Writes the unread count of every folder whose count has changed since the last flush.
+ */
+-(void)flushUnreadCounts
+{
+	if ([dirtyUnreadFolders count] == 0)
+		return;
+
+	[self verifyThreadSafety];
+	SQLStatement * statement = [sqlDatabase prepareStatement:@"update folders set unread_count=? where folder_id=?"];
+	for (Folder * folder in dirtyUnreadFolders)
+	{
+		[statement bindInt:[folder unreadCount] atIndex:1];
+		[statement bindInt:[folder itemId] atIndex:2];
+		[statement execute];
+	}
+	[dirtyUnreadFolders removeAllObjects];
+}
+
+/* recountUnreadArticles
+ * Sets the unread count of every folder from the messages table with a single query,
+ * saving any counts that had drifted from the truth. The childUnreadCount of the
+ * folders is not touched so this should be called before those are computed.
+ */
+-(void)recountUnreadArticles
+{
+	NSMutableDictionary * unreadCounts = [NSMutableDictionary dictionary];
+
+	[self verifyThreadSafety];
+	SQLStatement * statement = [sqlDatabase streamQuery:@"select folder_id, count(*) from messages where read_flag=0 group by folder_id"];
+	for (SQLRow * row in [statement rowEnumerator])
+		[unreadCounts setObject:[NSNumber numberWithInt:[row intForColumnAtIndex:1]] forKey:[NSNumber numberWithInt:[row intForColumnAtIndex:0]]];
+
+	countOfUnread = 0;
+	for (Folder * folder in [foldersDict objectEnumerator])
+	{
+		int unreadCount = IsRSSFolder(folder) ? [[unreadCounts objectForKey:[NSNumber numberWithInt:[folder itemId]]] intValue] : 0;
+		if (unreadCount != [folder unreadCount])
+		{
+			[folder setUnreadCount:unreadCount];
+			[dirtyUnreadFolders addObject:folder];
+		}
+		countOfUnread += unreadCount;
+	}
+	[self flushUnreadCounts];
+}
+
 /* markArticleFlagged
  * Marks a article as flagged or unflagged.
  */
 -(void)markArticleFlagged:(int)folderId guid:(NSString *)guid isFlagged:(BOOL)isFlagged
 {
-	NSString * preparedGuid = [SQLDatabase prepareStringForQuery:guid];
-	[self executeSQLWithFormat:@"update messages set marked_flag=%d where folder_id=%d and message_id='%@'", isFlagged, folderId, preparedGuid];
+	[self verifyThreadSafety];
+	SQLStatement * statement = [sqlDatabase prepareStatement:@"update messages set marked_flag=? where folder_id=? and message_id=?"];
+	[statement bindInt:isFlagged atIndex:1];
+	[statement bindInt:folderId atIndex:2];
+	[statement bindString:guid atIndex:3];
+	if ([statement execute] == SQLITE_OK)
+	{
+		Folder * folder = [self folderFromID:folderId];
+		if ([folder countOfCachedArticles] > 0)
+			[[folder articleFromGuid:guid] markFlagged:isFlagged];
+		[self updateSmartFolderMembership:[NSDictionary dictionaryWithObject:[NSArray arrayWithObject:guid] forKey:[NSNumber numberWithInt:folderId]]];
+	}
 }
 
 /* markArticleDeleted
@@ -2437,58 +3642,302 @@ static Database * _sharedDatabase = nil;
 {
 	if (isDeleted)
 		[self markArticleRead:folderId guid:guid isRead:YES];
-	NSString * preparedGuid = [SQLDatabase prepareStringForQuery:guid];
-	[self executeSQLWithFormat:@"update messages set deleted_flag=%d where folder_id=%d and message_id='%@'", isDeleted, folderId, preparedGuid];
+
+	[self verifyThreadSafety];
+	SQLStatement * statement = [sqlDatabase prepareStatement:@"update messages set deleted_flag=? where folder_id=? and message_id=?"];
+	[statement bindInt:isDeleted atIndex:1];
+	[statement bindInt:folderId atIndex:2];
+	[statement bindString:guid atIndex:3];
+	if ([statement execute] == SQLITE_OK)
+	{
+		Folder * folder = [self folderFromID:folderId];
+		if ([folder countOfCachedArticles] > 0)
+			[[folder articleFromGuid:guid] markDeleted:isDeleted];
+
+		// Deleted articles never appear in smart folders so they can be dropped
+		// without asking the database.
+		NSDictionary * guidsByFolder = [NSDictionary dictionaryWithObject:[NSArray arrayWithObject:guid] forKey:[NSNumber numberWithInt:folderId]];
+		if (isDeleted)
+			[self removeFromSmartFolderMembership:guidsByFolder];
+		else
+			[self updateSmartFolderMembership:guidsByFolder];
+	}
 }
 
-/* isTrashEmpty
- * Returns YES if there are no deleted articles, NO if there are deleted articles
+/* guidsByFolder
+ * Sorts an array of Article or ArticleReference objects into arrays of guids keyed
+ * by folder ID. An article that is listed more than once only appears once so that
+ * callers can count the guids as changed articles.
  */
--(BOOL)isTrashEmpty
+-(NSDictionary *)guidsByFolder:(NSArray *)articles
 {
-	[self verifyThreadSafety];
-	SQLResult * results = [sqlDatabase performQuery:@"select deleted_flag from messages where deleted_flag=1"];
-	if (results)
+	NSMutableDictionary * guidsByFolder = [NSMutableDictionary dictionary];
+	NSMutableDictionary * seenGuidsByFolder = [NSMutableDictionary dictionary];
+	for (id article in articles)
 	{
-		if ([results rowCount] > 0)
+		NSNumber * folderNumber = [NSNumber numberWithInt:[article folderId]];
+		NSMutableArray * guids = [guidsByFolder objectForKey:folderNumber];
+		NSMutableSet * seenGuids = [seenGuidsByFolder objectForKey:folderNumber];
+		if (guids == nil)
 		{
-			[results release];
+			guids = [NSMutableArray array];
+			seenGuids = [NSMutableSet set];
+			[guidsByFolder setObject:guids forKey:folderNumber];
+			[seenGuidsByFolder setObject:seenGuids forKey:folderNumber];
+		}
+
+		NSString * guid = [article guid];
+		if (![seenGuids containsObject:guid])
+		{
+			[seenGuids addObject:guid];
+			[guids addObject:guid];
+		}
+	}
+	return guidsByFolder;
+}
+
+/* executeSQL:inFolder:forGuids:
+ * Runs a statement against a set of articles in one folder. The statement format must
+ * have a single %@ where the list of guid parameters goes and a single ? parameter for
+ * the folder ID ahead of it.
+ */
+-(BOOL)executeSQL:(NSString *)sqlFormat inFolder:(int)folderId forGuids:(NSArray *)guids
+{
+	NSUInteger start = 0;
+
+	[self verifyThreadSafety];
+	while (start < [guids count])
+	{
+		SQLStatement * statement = [self prepareBatch:sqlFormat inFolder:folderId forGuids:guids start:&start];
+		if (statement == nil || [statement execute] != SQLITE_OK)
 			return NO;
+	}
+	return YES;
+}
+
+/* prepareBatch
+ * Returns the statement for the next batch of guids starting at start, with the
+ * folder ID and the guids bound, and moves start past the batch. The list of guid
+ * parameters is always MA_Guid_Small_Batch_Size or MA_Guid_Batch_Size long so that
+ * each format only ever needs two cached statements. Spare parameters repeat the last
+ * guid of the batch, which doesn't change the result of an "in" test.
+ */
+-(SQLStatement *)prepareBatch:(NSString *)sqlFormat inFolder:(int)folderId forGuids:(NSArray *)guids start:(NSUInteger *)start
+{
+	NSUInteger batchCount = MIN([guids count] - *start, MA_Guid_Batch_Size);
+	NSUInteger batchSize = (batchCount <= MA_Guid_Small_Batch_Size) ? MA_Guid_Small_Batch_Size : MA_Guid_Batch_Size;
+	NSMutableString * parameters = [NSMutableString stringWithCapacity:batchSize * 2];
+	NSUInteger index;
+
+	for (index = 0; index < batchSize; ++index)
+		[parameters appendString:(index == 0) ? @"?" : @",?"];
+
+	SQLStatement * statement = [sqlDatabase prepareStatement:[NSString stringWithFormat:sqlFormat, parameters]];
+	if (statement != nil)
+	{
+		[statement bindInt:folderId atIndex:1];
+		for (index = 0; index < batchSize; ++index)
+			[statement bindString:[guids objectAtIndex:*start + MIN(index, batchCount - 1)] atIndex:index + 2];
+	}
+	*start += batchCount;
+	return statement;
+}
+
+/* markArticlesRead
+ * Marks an array of Article or ArticleReference objects read or unread with one update
+ * per folder. Only articles whose state actually changes are touched and the unread
+ * count of each folder is adjusted once.
+ */
+-(void)markArticlesRead:(NSArray *)articles isRead:(BOOL)isRead
+{
+	NSDictionary * guidsByFolder = [self guidsByFolder:articles];
+	BOOL ownTransaction = !inTransaction;
+
+	if (ownTransaction)
+		[self beginTransaction];
+	for (NSNumber * folderNumber in guidsByFolder)
+	{
+		Folder * folder = [self folderFromID:[folderNumber intValue]];
+		if (folder == nil)
+			continue;
+
+		// Prime the article cache
+		[self initArticleArray:folder];
+
+		NSMutableArray * changedGuids = [NSMutableArray array];
+		for (NSString * guid in [guidsByFolder objectForKey:folderNumber])
+		{
+			Article * article = [folder articleFromGuid:guid];
+			if (article != nil && isRead != [article isRead])
+				[changedGuids addObject:guid];
 		}
-		else
+		if ([changedGuids count] == 0)
+			continue;
+
+		NSString * sqlFormat = [NSString stringWithFormat:@"update messages set read_flag=%d where folder_id=? and message_id in (%%@)", isRead];
+		if ([self executeSQL:sqlFormat inFolder:[folder itemId] forGuids:changedGuids])
 		{
-			[results release];
-			return YES;
+			int adjustment = (isRead ? -1 : 1) * (int)[changedGuids count];
+
+			for (NSString * guid in changedGuids)
+				[[folder articleFromGuid:guid] markRead:isRead];
+			countOfUnread += adjustment;
+			[self setFolderUnreadCount:folder adjustment:adjustment];
+			[self updateSmartFolderMembership:[NSDictionary dictionaryWithObject:changedGuids forKey:folderNumber]];
+		}
+	}
+	if (ownTransaction)
+		[self commitTransaction];
+}
+
+/* markArticlesFlagged
+ * Flags or unflags an array of Article or ArticleReference objects with one update
+ * per folder.
+ */
+-(void)markArticlesFlagged:(NSArray *)articles isFlagged:(BOOL)isFlagged
+{
+	NSDictionary * guidsByFolder = [self guidsByFolder:articles];
+	NSString * sqlFormat = [NSString stringWithFormat:@"update messages set marked_flag=%d where folder_id=? and message_id in (%%@)", isFlagged];
+	BOOL ownTransaction = !inTransaction;
+
+	if (ownTransaction)
+		[self beginTransaction];
+	for (NSNumber * folderNumber in guidsByFolder)
+	{
+		NSArray * guids = [guidsByFolder objectForKey:folderNumber];
+		if ([self executeSQL:sqlFormat inFolder:[folderNumber intValue] forGuids:guids])
+		{
+			Folder * folder = [self folderFromID:[folderNumber intValue]];
+			if ([folder countOfCachedArticles] > 0)
+			{
+				for (NSString * guid in guids)
+					[[folder articleFromGuid:guid] markFlagged:isFlagged];
+			}
 		}
 	}
+	[self updateSmartFolderMembership:guidsByFolder];
+	if (ownTransaction)
+		[self commitTransaction];
+}
+
+/* markArticlesDeleted
+ * Moves an array of Article or ArticleReference objects to or from the trash with one
+ * update per folder. Deleted articles always get marked read first.
+ */
+-(void)markArticlesDeleted:(NSArray *)articles isDeleted:(BOOL)isDeleted
+{
+	NSDictionary * guidsByFolder = [self guidsByFolder:articles];
+	NSString * sqlFormat = [NSString stringWithFormat:@"update messages set deleted_flag=%d where folder_id=? and message_id in (%%@)", isDeleted];
+	BOOL ownTransaction = !inTransaction;
+
+	if (ownTransaction)
+		[self beginTransaction];
+	if (isDeleted)
+		[self markArticlesRead:articles isRead:YES];
+
+	for (NSNumber * folderNumber in guidsByFolder)
+	{
+		NSArray * guids = [guidsByFolder objectForKey:folderNumber];
+		if ([self executeSQL:sqlFormat inFolder:[folderNumber intValue] forGuids:guids])
+		{
+			Folder * folder = [self folderFromID:[folderNumber intValue]];
+			if ([folder countOfCachedArticles] > 0)
+			{
+				for (NSString * guid in guids)
+					[[folder articleFromGuid:guid] markDeleted:isDeleted];
+			}
+		}
+	}
+	if (isDeleted)
+		[self removeFromSmartFolderMembership:guidsByFolder];
 	else
-		return YES;
+		[self updateSmartFolderMembership:guidsByFolder];
+	if (ownTransaction)
+		[self commitTransaction];
+}
+
+/* deleteArticles
+ * Permanently deletes an array of Article or ArticleReference objects from the database
+ * with one delete per folder. Returns NO if any of the deletes failed.
+ */
+-(BOOL)deleteArticles:(NSArray *)articles
+{
+	NSDictionary * guidsByFolder = [self guidsByFolder:articles];
+	BOOL ownTransaction = !inTransaction;
+	BOOL result = YES;
+
+	if (ownTransaction)
+		[self beginTransaction];
+	for (NSNumber * folderNumber in guidsByFolder)
+	{
+		Folder * folder = [self folderFromID:[folderNumber intValue]];
+		if (folder == nil)
+			continue;
+
+		// Prime the article cache
+		[self initArticleArray:folder];
+
+		int folderId = [folder itemId];
+		NSArray * guids = [guidsByFolder objectForKey:folderNumber];
+		[self executeSQL:@"delete from messages_fts where docid in (select article_id from messages where folder_id=? and message_id in (%@))" inFolder:folderId forGuids:guids];
+		if (![self executeSQL:@"delete from messages where folder_id=? and message_id in (%@)" inFolder:folderId forGuids:guids])
+		{
+			result = NO;
+			continue;
+		}
+
+		int adjustment = 0;
+		for (NSString * guid in guids)
+		{
+			Article * article = [folder articleFromGuid:guid];
+			if (article != nil)
+			{
+				if (![article isRead])
+					--adjustment;
+				[folder removeArticleFromCache:guid];
+			}
+			[self removeCachedBody:folderId guid:guid];
+		}
+		countOfUnread += adjustment;
+		[self setFolderUnreadCount:folder adjustment:adjustment];
+	}
+	[self removeFromSmartFolderMembership:guidsByFolder];
+	if (ownTransaction)
+		[self commitTransaction];
+	return result;
+}
+
+/* isTrashEmpty
+ * Returns YES if there are no deleted articles, NO if there are deleted articles
+ */
+-(BOOL)isTrashEmpty
+{
+	// Only the existence of one deleted row matters, and messages_deleted_idx
+	// answers that without touching the table.
+	[self verifyThreadSafety];
+	SQLStatement * statement = [sqlDatabase prepareStatement:@"select 1 from messages where deleted_flag=1 limit 1"];
+	BOOL isEmpty = ([statement nextRow] == nil);
+	[statement reset];
+	return isEmpty;
 }
 
 /* guidHistoryForFolderId
- * Returns an array of all article guids ever downloaded for the specified folder.
+ * Returns the set of all article guids ever downloaded for the specified folder.
  */
--(NSArray *)guidHistoryForFolderId:(int)folderId
+-(NSSet *)guidHistoryForFolderId:(int)folderId
 {
-	NSMutableArray * articleGuids = [NSMutableArray array];
+	NSMutableSet * articleGuids = [NSMutableSet set];
 	
 	[self verifyThreadSafety];
-	SQLResult * results = [sqlDatabase performQueryWithFormat:@"select message_id from rss_guids where folder_id=%i", folderId];
-	if (results)
+	SQLStatement * statement = [sqlDatabase prepareStatement:@"select message_id from rss_guids where folder_id=?"];
+	[statement bindInt:folderId atIndex:1];
+	for (SQLRow * row in [statement rowEnumerator])
 	{
-		if ([results rowCount] > 0)
+		NSString * guid = [row stringForColumnAtIndex:0];
+		if (guid != nil)
 		{
-			for (SQLRow * row in [results rowEnumerator])
-			{
-				NSString * guid = [row stringForColumn:@"message_id"];
-				if (guid != nil)
-				{
-					[articleGuids addObject:guid];
-				}
-			}
+			[articleGuids addObject:guid];
 		}
-		
-		[results release];
 	}
 	
 	return articleGuids;
@@ -2502,10 +3951,19 @@ static Database * _sharedDatabase = nil;
 {
 	[[NSNotificationCenter defaultCenter] removeObserver:self];
 	[foldersDict removeAllObjects];
+	[foldersByName removeAllObjects];
+	[foldersByFeedURL removeAllObjects];
+	[foldersByParent removeAllObjects];
 	[smartfoldersDict removeAllObjects];
+	[folderPlans removeAllObjects];
+	[smartFolderResults removeAllObjects];
+	[smartFolderResultsOrder removeAllObjects];
+	[smartFolderMembers removeAllObjects];
+	[self clearBodyCache];
 	[fieldsOrdered release];
 	[fieldsByName release];
 	[trashFolder release];
+	[self flushUnreadCounts];
 	[sqlDatabase close];
 	initializedfoldersDict = NO;
 	initializedSmartfoldersDict = NO;
@@ -2520,7 +3978,16 @@ static Database * _sharedDatabase = nil;
 {
 	[searchString release];
 	[foldersDict release];
+	[foldersByName release];
+	[foldersByFeedURL release];
+	[foldersByParent release];
 	[smartfoldersDict release];
+	[bodyCache release];
+	[dirtyUnreadFolders release];
+	[folderPlans release];
+	[smartFolderResults release];
+	[smartFolderResultsOrder release];
+	[smartFolderMembers release];
 	if (sqlDatabase)
 		[self close];
 	[sqlDatabase release];
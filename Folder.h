@@ -87,6 +87,8 @@
 -(NSString *)feedURL;
 -(NSDate *)lastUpdate;
 -(NSString *)lastUpdateString;
+-(NSString *)etag;
+-(NSString *)bodyDigest;
 -(NSString *)username;
 -(NSString *)password;
 -(NSDictionary *)attributes;
@@ -129,6 +131,8 @@
 -(void)setPassword:(NSString *)newPassword;
 -(void)setLastUpdate:(NSDate *)newLastUpdate;
 -(void)setLastUpdateString:(NSString *)newLastUpdateString;
+-(void)setETag:(NSString *)newETag;
+-(void)setBodyDigest:(NSString *)newBodyDigest;
 -(unsigned)indexOfArticle:(Article *)article;
 -(Article *)articleFromGuid:(NSString *)guid;
 -(void)addArticleToCache:(Article *)newArticle;
@@ -224,6 +224,8 @@ static NSArray * iconArray = nil;
 		[self setName:newName];
 		[self setLastUpdate:[NSDate distantPast]];
 		[self setLastUpdateString:@""];
+		[self setETag:@""];
+		[self setBodyDigest:@""];
 		[self setUsername:@""];
 	}
 	return self;
@@ -498,6 +500,40 @@ static NSArray * iconArray = nil;
 	[attributes setValue:newLastUpdateString forKey:@"LastUpdateString"];
 }
 
+/* etag
+ * Return the entity tag the server gave the feed on the last refresh.
+ */
+-(NSString *)etag
+{
+	return [attributes valueForKey:@"ETag"];
+}
+
+/* setETag
+ * Set the entity tag. Like the last update string this is passed back to the
+ * site, with If-None-Match, so that it can answer that the feed is unchanged.
+ */
+-(void)setETag:(NSString *)newETag
+{
+	[attributes setValue:newETag forKey:@"ETag"];
+}
+
+/* bodyDigest
+ * Return the digest of the feed data that was last stored.
+ */
+-(NSString *)bodyDigest
+{
+	return [attributes valueForKey:@"BodyDigest"];
+}
+
+/* setBodyDigest
+ * Set the digest of the feed data. A refresh that downloads exactly the same
+ * data again doesn't need to be parsed.
+ */
+-(void)setBodyDigest:(NSString *)newBodyDigest
+{
+	[attributes setValue:newBodyDigest forKey:@"BodyDigest"];
+}
+
 /* feedURL
  * Return the URL of the subscription.
  */
@@ -906,7 +906,14 @@
 
 		if (IsSmartFolder(folder))  // Because if the search results contain unread articles we don't want the smart folder name to be bold.
 		{
-			[realCell clearCount];
+			int smartFolderUnreadCount = [[Database sharedDatabase] unreadCountOfSmartFolder:[folder itemId]];
+			if (smartFolderUnreadCount)
+			{
+				[realCell setCount:smartFolderUnreadCount];
+				[realCell setCountBackgroundColour:[NSColor colorForControlTint:[NSColor currentControlTint]]];
+			}
+			else
+				[realCell clearCount];
 			[realCell setFont:cellFont];
 		}
 		else if ([folder unreadCount])
@@ -66,7 +66,17 @@ extern NSString * MA_Field_HasEnclosure;
 
 @class Folder;
 @interface Article : NSObject {
-	NSMutableDictionary * articleData;
+	NSString * guid;
+	NSString * title;
+	NSString * author;
+	NSString * link;
+	NSString * text;
+	NSString * summary;
+	NSString * enclosure;
+	NSDate * date;
+	NSDate * createdDate;
+	int folderId;
+	int parentId;
 	NSMutableArray * commentsArray;
 	BOOL readFlag;
 	BOOL revisedFlag;
@@ -108,6 +118,7 @@ extern NSString * MA_Field_HasEnclosure;
 -(void)setDate:(NSDate *)newDate;
 -(void)setCreatedDate:(NSDate *)newCreatedDate;
 -(void)setBody:(NSString *)newText;
+-(void)setSummary:(NSString *)newSummary;
 -(void)setEnclosure:(NSString *)newEnclosure;
 -(void)setStatus:(int)newStatus;
 -(void)setHasEnclosure:(BOOL)flag;
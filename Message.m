@@ -52,7 +52,15 @@ NSString * MA_Field_HasEnclosure = @"HasEnclosure";
 {
 	if ((self = [super init]) != nil)
 	{
-		articleData = [[NSMutableDictionary dictionary] retain];
+		guid = nil;
+		title = nil;
+		author = nil;
+		link = nil;
+		text = nil;
+		summary = nil;
+		enclosure = nil;
+		date = nil;
+		createdDate = nil;
 		commentsArray = [[NSMutableArray alloc] init];
 		readFlag = NO;
 		revisedFlag = NO;
@@ -72,21 +80,27 @@ NSString * MA_Field_HasEnclosure = @"HasEnclosure";
  */
 -(void)setTitle:(NSString *)newTitle
 {
-	[articleData setObject:newTitle forKey:MA_Field_Subject];
+	[newTitle retain];
+	[title release];
+	title = newTitle;
 }
 
 /* setAuthor
  */
 -(void)setAuthor:(NSString *)newAuthor
 {
-	[articleData setObject:newAuthor forKey:MA_Field_Author];
+	[newAuthor retain];
+	[author release];
+	author = newAuthor;
 }
 
 /* setLink
  */
 -(void)setLink:(NSString *)newLink
 {
-	[articleData setObject:newLink forKey:MA_Field_Link];
+	[newLink retain];
+	[link release];
+	link = newLink;
 }
 
 /* setDate
@@ -94,7 +108,9 @@ NSString * MA_Field_HasEnclosure = @"HasEnclosure";
  */
 -(void)setDate:(NSDate *)newDate
 {
-	[articleData setObject:newDate forKey:MA_Field_Date];
+	[newDate retain];
+	[date release];
+	date = newDate;
 }
 
 /* setCreatedDate
@@ -102,25 +118,40 @@ NSString * MA_Field_HasEnclosure = @"HasEnclosure";
  */
 -(void)setCreatedDate:(NSDate *)newCreatedDate
 {
-	[articleData setObject:newCreatedDate forKey:MA_Field_CreatedDate];
+	[newCreatedDate retain];
+	[createdDate release];
+	createdDate = newCreatedDate;
 }
 
 /* setBody
  */
 -(void)setBody:(NSString *)newText
 {
-	[articleData setObject:newText forKey:MA_Field_Text];
-	[articleData removeObjectForKey:MA_Field_Summary];
+	[newText retain];
+	[text release];
+	text = newText;
+	[summary release];
+	summary = nil;
+}
+
+/* setSummary
+ * Sets the summary that was stored with the article so that it doesn't have to be
+ * made again from the body.
+ */
+-(void)setSummary:(NSString *)newSummary
+{
+	[newSummary retain];
+	[summary release];
+	summary = newSummary;
 }
 
 /* setEnclosure
  */
 -(void)setEnclosure:(NSString *)newEnclosure
 {
-	if (newEnclosure)
-		[articleData setObject:newEnclosure forKey:MA_Field_Enclosure];
-	else
-		[articleData removeObjectForKey:MA_Field_Enclosure];
+	[newEnclosure retain];
+	[enclosure release];
+	enclosure = newEnclosure;
 }
 
 /* markEnclosureDownloaded
@@ -166,7 +197,7 @@ NSString * MA_Field_HasEnclosure = @"HasEnclosure";
 }
 
 /* accessInstanceVariablesDirectly
- * Override this so that KVC doesn't get the articleData ivar
+ * Override this so that KVC never reads the ivars behind the accessors
  */
 +(BOOL)accessInstanceVariablesDirectly
 {
@@ -201,6 +232,30 @@ NSString * MA_Field_HasEnclosure = @"HasEnclosure";
 		{
 			return [self summary];
 		}
+		else if ([key isEqualToString:MA_Field_CreatedDate])
+		{
+			return [self createdDate];
+		}
+		else if ([key isEqualToString:MA_Field_Enclosure])
+		{
+			return [self enclosure];
+		}
+		else if ([key isEqualToString:MA_Field_GUID])
+		{
+			return [self guid];
+		}
+		else if ([key isEqualToString:MA_Field_Text])
+		{
+			return [self body];
+		}
+		else if ([key isEqualToString:MA_Field_Folder])
+		{
+			return [NSNumber numberWithInt:[self folderId]];
+		}
+		else if ([key isEqualToString:MA_Field_Parent])
+		{
+			return [NSNumber numberWithInt:[self parentId]];
+		}
 		else
 		{
 			return [super valueForKeyPath:keyPath];
@@ -222,28 +277,36 @@ NSString * MA_Field_HasEnclosure = @"HasEnclosure";
 -(BOOL)hasEnclosure				{ return hasEnclosureFlag; }
 -(BOOL)enclosureDownloaded		{ return enclosureDownloadedFlag; }
 -(int)status					{ return status; }
--(int)folderId					{ return [[articleData objectForKey:MA_Field_Folder] intValue]; }
--(NSString *)author				{ return [articleData objectForKey:MA_Field_Author]; }
--(NSString *)link				{ return [articleData objectForKey:MA_Field_Link]; }
--(NSString *)guid				{ return [articleData objectForKey:MA_Field_GUID]; }
--(int)parentId					{ return [[articleData objectForKey:MA_Field_Parent] intValue]; }
--(NSString *)title				{ return [articleData objectForKey:MA_Field_Subject]; }
+-(int)folderId					{ return folderId; }
+-(NSString *)author				{ return author; }
+-(NSString *)link				{ return link; }
+-(NSString *)guid				{ return guid; }
+-(int)parentId					{ return parentId; }
+-(NSString *)title				{ return title; }
 -(NSString *)summary
 {
-	NSString * summary = [articleData objectForKey:MA_Field_Summary];
 	if (summary == nil)
 	{
-		summary = [[articleData objectForKey:MA_Field_Text] summaryTextFromHTML];
+		summary = [[[self body] summaryTextFromHTML] retain];
 		if (summary == nil)
 			summary = @"";
-		[articleData setObject:summary forKey:MA_Field_Summary];
 	}
 	return summary;
 }
--(NSDate *)date					{ return [articleData objectForKey:MA_Field_Date]; }
--(NSDate *)createdDate			{ return [articleData objectForKey:MA_Field_CreatedDate]; }
--(NSString *)body				{ return [articleData objectForKey:MA_Field_Text]; }
--(NSString *)enclosure			{ return [articleData objectForKey:MA_Field_Enclosure]; }
+-(NSDate *)date					{ return date; }
+-(NSDate *)createdDate			{ return createdDate; }
+-(NSString *)enclosure			{ return enclosure; }
+
+/* body
+ * Returns the article text. Articles read from the database don't carry their
+ * text so it is fetched on demand from the database's body cache.
+ */
+-(NSString *)body
+{
+	if (text != nil)
+		return text;
+	return [[Database sharedDatabase] bodyOfArticle:folderId guid:guid];
+}
 
 /* containingFolder
  */
@@ -256,21 +319,23 @@ NSString * MA_Field_HasEnclosure = @"HasEnclosure";
  */
 -(void)setFolderId:(int)newFolderId
 {
-	[articleData setObject:[NSNumber numberWithInt:newFolderId] forKey:MA_Field_Folder];
+	folderId = newFolderId;
 }
 
 /* setGuid
  */
 -(void)setGuid:(NSString *)newGuid
 {
-	[articleData setObject:newGuid forKey:MA_Field_GUID];
+	[newGuid retain];
+	[guid release];
+	guid = newGuid;
 }
 
 /* setParentId
  */
 -(void)setParentId:(int)newParentId
 {
-	[articleData setObject:[NSNumber numberWithInt:newParentId] forKey:MA_Field_Parent];
+	parentId = newParentId;
 }
 
 /* setStatus
@@ -445,7 +510,15 @@ NSString * MA_Field_HasEnclosure = @"HasEnclosure";
 -(void)dealloc
 {
 	[commentsArray release];
-	[articleData release];
+	[createdDate release];
+	[date release];
+	[enclosure release];
+	[summary release];
+	[text release];
+	[link release];
+	[author release];
+	[title release];
+	[guid release];
 	[super dealloc];
 }
 @end
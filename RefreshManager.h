@@ -24,18 +24,35 @@
 #import "FeedCredentials.h"
 #import "RefreshPlugin.h"
 
+@class RefreshQueue;
+@class LatencySamples;
+
 @interface RefreshManager : NSObject {
 	int maximumConnections;
 	int countOfNewArticles;
 	NSMutableArray * connectionsArray;
-	NSMutableArray * refreshArray;
+	RefreshQueue * refreshQueue;
 	NSMutableArray * authQueue;
-	NSTimer * pumpTimer;
+	NSTimeInterval pluginDelayInterval;
 	FeedCredentials * credentialsController;
 	BOOL hasStarted;
 	BOOL didFinish;
+	BOOL isWaitingToStart;
 	NSString * statusMessageDuringRefresh;
 	NSMutableDictionary * statusMessagePerPlugin;
+	NSOperationQueue * parseQueue;
+	NSMutableArray * pendingParses;
+	NSMutableDictionary * streamingParses;
+	NSMutableDictionary * hostStates;
+	NSMutableDictionary * connectionHosts;
+	NSMutableDictionary * connectionStartTimes;
+	LatencySamples * fetchLatencies;
+	LatencySamples * parseLatencies;
+	LatencySamples * updateLatencies;
+	NSTimeInterval refreshStartTime;
+	NSTimeInterval refreshEndTime;
+	int countOfNotModified;
+	int countOfUnchangedBodies;
 }
 
 +(RefreshManager *)sharedManager;
@@ -47,4 +64,6 @@
 -(NSString *)statusMessageDuringRefresh;
 -(BOOL)isRefreshing;
 -(void)setStatusMessage:(NSString *)statusMessage forPlugin:(id<RefreshPlugin>)plugin;
+-(void)resumeDelayedRefresh;
+-(NSDictionary *)pipelineStatistics;
 @end
@@ -28,10 +28,59 @@
 #import "Constants.h"
 #import "ViennaApp.h"
 #import "PluginHelper.h"
+#import "RefreshScheduler.h"
+#import <CommonCrypto/CommonDigest.h>
+#include <sys/resource.h>
 
 // Singleton
 static RefreshManager * _refreshManager = nil;
 
+// How long to wait before first asking again whether a plugin still wants the
+// refresh held back, and the longest the wait grows to.
+static const NSTimeInterval MA_Plugin_Delay_Initial_Interval = 0.2;
+static const NSTimeInterval MA_Plugin_Delay_Longest_Interval = 5.0;
+
+// Feeds that the server says are at least this long are parsed while they
+// download rather than once the download is complete.
+static const long long MA_Stream_Minimum_Length = 128 * 1024;
+
+// How much of a streamed feed is kept to check whether it is an HTML redirect.
+static const NSUInteger MA_Redirect_Scan_Length = 16 * 1024;
+
+// Politeness limits for the connections to any one host. A host whose feeds
+// take longer than MA_Slow_Host_Latency on average only gets one connection and
+// the slow hosts between them only get half of the connections. A host that
+// finished a connection within MA_Warm_Host_Interval is preferred since the
+// connection can probably be reused.
+static const NSUInteger MA_Max_Connections_Per_Host = 2;
+static const NSTimeInterval MA_Min_Host_Spacing = 0.25;
+static const NSTimeInterval MA_Slow_Host_Latency = 5.0;
+static const NSTimeInterval MA_Warm_Host_Interval = 5.0;
+
+/* hexStringOfDigest
+ * Returns a SHA-1 digest as a hex string.
+ */
+static NSString * hexStringOfDigest(const unsigned char * digest)
+{
+	char hexDigest[2 * CC_SHA1_DIGEST_LENGTH + 1];
+	unsigned int index;
+
+	for (index = 0; index < CC_SHA1_DIGEST_LENGTH; ++index)
+		snprintf(&hexDigest[2 * index], 3, "%02x", digest[index]);
+	return [NSString stringWithUTF8String:hexDigest];
+}
+
+/* digestOfData
+ * Returns the SHA-1 digest of the data as a hex string.
+ */
+static NSString * digestOfData(NSData * data)
+{
+	unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+
+	CC_SHA1([data bytes], (CC_LONG)[data length], digest);
+	return hexStringOfDigest(digest);
+}
+
 // Refresh types
 typedef enum {
 	MA_Refresh_NilType = -1,
@@ -39,6 +88,8 @@ typedef enum {
 	MA_Refresh_FavIcon
 } RefreshTypes;
 
+@class FeedParseOperation;
+
 // Private functions
 @interface RefreshManager (Private)
 	-(BOOL)isRefreshingFolder:(Folder *)folder ofType:(RefreshTypes)type;
@@ -49,71 +100,888 @@ typedef enum {
 	-(void)pumpSubscriptionRefresh:(Folder *)folder;
 	-(void)pumpFolderIconRefresh:(Folder *)folder;
 	-(void)refreshFeed:(Folder *)folder fromURL:(NSURL *)url withLog:(ActivityItem *)aItem;
-	-(void)beginRefreshTimer;
-	-(void)refreshPumper:(NSTimer *)aTimer;
+	-(void)beginRefresh;
+	-(void)startRefresh;
+	-(void)pumpRefresh;
+	-(void)retryAfterPluginDelay:(SEL)selector;
+	-(void)resumeAfterPluginDelay;
+	-(void)storeParsedFeed:(FeedParseOperation *)operation;
+	-(void)storeUnchangedFeed:(Folder *)folder fromConnection:(AsyncConnection *)connector;
+	-(void)storeETagFromConnection:(AsyncConnection *)connector forFolder:(int)folderId;
+	-(void)connection:(AsyncConnection *)connector didReceiveFeedData:(NSData *)data;
+	-(NSUInteger)indexOfNextRefreshItem:(NSTimeInterval)now nextStartTime:(NSTimeInterval *)nextStartTime;
 	-(void)addConnection:(AsyncConnection *)conn;
 	-(void)removeConnection:(AsyncConnection *)conn;
 	-(void)folderIconRefreshCompleted:(AsyncConnection *)connector;
 	-(NSString *)getRedirectURL:(NSData *)data;
 	-(void)setStatusMessageDuringRefresh:(NSString *)newStatusMessage;
+	-(void)feedParseCompleted:(id)operation;
+	-(void)resetPipelineStatistics;
 @end
 
 // Single refresh item type
 @interface RefreshItem : NSObject {
 	Folder * folder;
 	RefreshTypes type;
+	NSString * host;
+}
+
+// Accessor functions
+-(void)setFolder:(Folder *)newFolder;
+-(void)setType:(RefreshTypes)newType;
+-(Folder *)folder;
+-(RefreshTypes)type;
+-(NSString *)host;
+@end
+
+// What we know about the connections to one host
+@interface RefreshHost : NSObject {
+	NSUInteger countOfConnections;
+	NSTimeInterval lastStartTime;
+	NSTimeInterval lastFinishTime;
+	NSTimeInterval averageLatency;
+}
+
+// Accessor functions
+-(NSUInteger)countOfConnections;
+-(NSTimeInterval)lastStartTime;
+-(NSTimeInterval)lastFinishTime;
+-(NSTimeInterval)averageLatency;
+-(BOOL)isSlow;
+-(void)connectionStartedAt:(NSTimeInterval)startTime;
+-(void)connectionFinishedAt:(NSTimeInterval)finishTime latency:(NSTimeInterval)latency;
+@end
+
+@implementation RefreshItem
+
+/* init
+ * Initialises an empty RefreshItem with default values.
+ */
+-(id)init
+{
+	if ((self = [super init]) != nil)
+	{
+		[self setFolder:nil];
+		[self setType:MA_Refresh_NilType];
+		host = nil;
+	}
+	return self;
+}
+
+/* setFolder
+ */
+-(void)setFolder:(Folder *)newFolder
+{
+	[newFolder retain];
+	[folder release];
+	folder = newFolder;
+}
+
+/* folder
+ */
+-(Folder *)folder
+{
+	return folder;
+}
+
+/* setType
+ */
+-(void)setType:(RefreshTypes)newType
+{
+	type = newType;
+}
+
+/* type
+ */
+-(RefreshTypes)type
+{
+	return type;
+}
+
+/* host
+ * Returns the lower case name of the host that this item will connect to, or an
+ * empty string if the URL has no host.
+ */
+-(NSString *)host
+{
+	if (host == nil)
+	{
+		NSString * urlString = (type == MA_Refresh_FavIcon) ? [[folder homePage] trim] : [folder feedURL];
+		host = [[[[NSURL URLWithString:urlString] host] lowercaseString] retain];
+		if (host == nil)
+			host = [@"" retain];
+	}
+	return host;
+}
+
+/* dealloc
+ * Clean up behind ourselves.
+ */
+-(void)dealloc
+{
+	[folder release];
+	[host release];
+	[super dealloc];
+}
+@end
+
+@implementation RefreshHost
+
+/* init
+ * Initialises a host that hasn't been connected to yet.
+ */
+-(id)init
+{
+	if ((self = [super init]) != nil)
+	{
+		countOfConnections = 0;
+		lastStartTime = 0;
+		lastFinishTime = 0;
+		averageLatency = 0;
+	}
+	return self;
+}
+
+/* countOfConnections
+ * Returns the number of connections open to the host.
+ */
+-(NSUInteger)countOfConnections
+{
+	return countOfConnections;
+}
+
+/* lastStartTime
+ */
+-(NSTimeInterval)lastStartTime
+{
+	return lastStartTime;
+}
+
+/* lastFinishTime
+ */
+-(NSTimeInterval)lastFinishTime
+{
+	return lastFinishTime;
+}
+
+/* averageLatency
+ * Returns the moving average of the time taken by the connections to the host.
+ */
+-(NSTimeInterval)averageLatency
+{
+	return averageLatency;
+}
+
+/* isSlow
+ * Returns YES if connections to the host usually take a long time.
+ */
+-(BOOL)isSlow
+{
+	return averageLatency > MA_Slow_Host_Latency;
+}
+
+/* connectionStartedAt
+ * Records that a connection to the host has been opened.
+ */
+-(void)connectionStartedAt:(NSTimeInterval)startTime
+{
+	++countOfConnections;
+	lastStartTime = startTime;
+}
+
+/* connectionFinishedAt
+ * Records that a connection to the host has closed and how long it took. A
+ * negative latency, for a connection that was cancelled, isn't counted.
+ */
+-(void)connectionFinishedAt:(NSTimeInterval)finishTime latency:(NSTimeInterval)latency
+{
+	NSAssert(countOfConnections > 0, @"Finishing a connection to a host with none open");
+	--countOfConnections;
+	lastFinishTime = finishTime;
+	if (latency >= 0)
+		averageLatency = (averageLatency == 0) ? latency : (averageLatency * 0.7) + (latency * 0.3);
+}
+@end
+
+// The time each feed spent in one stage of the refresh pipeline
+@interface LatencySamples : NSObject {
+	double * samples;
+	NSUInteger count;
+	NSUInteger capacity;
+	double total;
+}
+
+// Accessor functions
+-(void)addSample:(NSTimeInterval)latency;
+-(void)removeAllSamples;
+-(NSUInteger)count;
+-(NSTimeInterval)average;
+-(void)addToStatistics:(NSMutableDictionary *)statistics withPrefix:(NSString *)prefix;
+@end
+
+/* compareSamples
+ * qsort comparator for latency samples.
+ */
+static int compareSamples(const void * first, const void * second)
+{
+	double firstSample = *(const double *)first;
+	double secondSample = *(const double *)second;
+	return (firstSample < secondSample) ? -1 : (firstSample > secondSample) ? 1 : 0;
+}
+
+@implementation LatencySamples
+
+/* init
+ * Initialise an empty set of samples.
+ */
+-(id)init
+{
+	if ((self = [super init]) != nil)
+	{
+		capacity = 64;
+		samples = malloc(sizeof(double) * capacity);
+		count = 0;
+		total = 0;
+	}
+	return self;
+}
+
+/* addSample
+ * Records the time one feed spent in the stage.
+ */
+-(void)addSample:(NSTimeInterval)latency
+{
+	if (count == capacity)
+	{
+		capacity *= 2;
+		samples = realloc(samples, sizeof(double) * capacity);
+	}
+	samples[count++] = latency;
+	total += latency;
+}
+
+/* removeAllSamples
+ */
+-(void)removeAllSamples
+{
+	count = 0;
+	total = 0;
+}
+
+/* count
+ * Returns the number of feeds that went through the stage.
+ */
+-(NSUInteger)count
+{
+	return count;
+}
+
+/* average
+ * Returns the mean time in the stage, or zero if there are no samples.
+ */
+-(NSTimeInterval)average
+{
+	return (count > 0) ? total / count : 0.0;
+}
+
+/* addToStatistics
+ * Adds the mean and the 50th, 90th and 99th percentile times to the statistics
+ * under keys that start with the prefix. The percentiles are taken by rank from a
+ * sorted copy of the samples so the order they arrived in doesn't matter.
+ */
+-(void)addToStatistics:(NSMutableDictionary *)statistics withPrefix:(NSString *)prefix
+{
+	static const int percentiles[] = { 50, 90, 99 };
+	double * sortedSamples = NULL;
+	unsigned int index;
+
+	if (count > 0)
+	{
+		sortedSamples = malloc(sizeof(double) * count);
+		memcpy(sortedSamples, samples, sizeof(double) * count);
+		qsort(sortedSamples, count, sizeof(double), compareSamples);
+	}
+
+	[statistics setObject:[NSNumber numberWithDouble:[self average]] forKey:[prefix stringByAppendingString:@"Latency"]];
+	for (index = 0; index < sizeof(percentiles) / sizeof(percentiles[0]); ++index)
+	{
+		double value = 0.0;
+		if (count > 0)
+		{
+			NSUInteger rank = (count * percentiles[index] + 99) / 100;
+			value = sortedSamples[MAX(rank, 1u) - 1];
+		}
+		[statistics setObject:[NSNumber numberWithDouble:value] forKey:[NSString stringWithFormat:@"%@LatencyP%d", prefix, percentiles[index]]];
+	}
+	free(sortedSamples);
+}
+
+/* dealloc
+ * Clean up behind us.
+ */
+-(void)dealloc
+{
+	free(samples);
+	[super dealloc];
+}
+@end
+
+// A first-in first-out queue of refresh items held in a ring buffer so that
+// taking the next item off the front doesn't move the rest.
+@interface RefreshQueue : NSObject {
+	id * items;
+	NSUInteger head;
+	NSUInteger count;
+	NSUInteger capacity;
+}
+
+// Accessor functions
+-(NSUInteger)count;
+-(id)objectAtIndex:(NSUInteger)index;
+-(void)addObject:(id)anObject;
+-(void)removeFirstObject;
+-(void)removeObjectAtIndex:(NSUInteger)index;
+-(void)removeAllObjects;
+@end
+
+@implementation RefreshQueue
+
+/* init
+ * Initialise an empty queue.
+ */
+-(id)init
+{
+	if ((self = [super init]) != nil)
+	{
+		capacity = 16;
+		items = malloc(sizeof(id) * capacity);
+		head = 0;
+		count = 0;
+	}
+	return self;
+}
+
+/* count
+ * Returns the number of items in the queue.
+ */
+-(NSUInteger)count
+{
+	return count;
+}
+
+/* objectAtIndex
+ * Returns the item at the specified position from the front of the queue.
+ */
+-(id)objectAtIndex:(NSUInteger)index
+{
+	NSAssert(index < count, @"Index beyond the end of the refresh queue");
+	return items[(head + index) % capacity];
+}
+
+/* addObject
+ * Adds an item to the back of the queue.
+ */
+-(void)addObject:(id)anObject
+{
+	if (count == capacity)
+	{
+		// Unwrap the items into a buffer twice the size.
+		id * newItems = malloc(sizeof(id) * capacity * 2);
+		NSUInteger index;
+		for (index = 0; index < count; ++index)
+			newItems[index] = items[(head + index) % capacity];
+		free(items);
+		items = newItems;
+		capacity *= 2;
+		head = 0;
+	}
+	items[(head + count) % capacity] = [anObject retain];
+	++count;
+}
+
+/* removeFirstObject
+ * Removes the item at the front of the queue.
+ */
+-(void)removeFirstObject
+{
+	NSAssert(count > 0, @"Removing from an empty refresh queue");
+	[items[head] release];
+	head = (head + 1) % capacity;
+	--count;
+}
+
+/* removeObjectAtIndex
+ * Removes the item at the specified position, closing up the gap.
+ */
+-(void)removeObjectAtIndex:(NSUInteger)index
+{
+	NSAssert(index < count, @"Index beyond the end of the refresh queue");
+	[items[(head + index) % capacity] release];
+	for (; index + 1 < count; ++index)
+		items[(head + index) % capacity] = items[(head + index + 1) % capacity];
+	--count;
+}
+
+/* removeAllObjects
+ * Empties the queue.
+ */
+-(void)removeAllObjects
+{
+	while (count > 0)
+		[self removeFirstObject];
+	head = 0;
+}
+
+/* dealloc
+ * Clean up behind us.
+ */
+-(void)dealloc
+{
+	[self removeAllObjects];
+	free(items);
+	[super dealloc];
+}
+@end
+
+// Parses the data downloaded for one feed and turns its items into Article
+// objects ready for the database. This runs on a worker thread so it must not
+// touch the database, the folder objects or the activity log. A streamed feed
+// is fed to the parser by a chain of chunk operations while it downloads and
+// this operation only completes it.
+@interface FeedParseOperation : NSOperation {
+	AsyncConnection * connector;
+	int folderId;
+	NSString * feedURL;
+	NSString * connectionURL;
+	NSString * feedSourcePath;
+	BOOL shouldBackupFeedSource;
+	NSString * redirectURL;
+	BOOL didParse;
+	NSString * feedTitle;
+	NSString * feedDescription;
+	NSString * feedLink;
+	NSMutableArray * articleArray;
+	NSTimeInterval postingInterval;
+	NSTimeInterval updateInterval;
+	NSTimeInterval queuedTime;
+	NSTimeInterval parsedTime;
+	NSString * bodyDigest;
+	BOOL isStreamed;
+	BOOL hasStreamError;
+	RichXMLParser * streamParser;
+	NSMutableData * leadingData;
+	CC_SHA1_CTX digestContext;
+	NSOperation * lastChunkOperation;
+}
+
+// Accessor functions
+-(id)initWithConnection:(AsyncConnection *)conn folderId:(int)theFolderId feedURL:(NSString *)theFeedURL;
+-(void)setFeedSourcePath:(NSString *)path backup:(BOOL)backupFlag;
+-(void)setBodyDigest:(NSString *)newBodyDigest;
+-(NSString *)bodyDigest;
+-(void)queueChunk:(NSData *)data onQueue:(NSOperationQueue *)queue;
+-(void)finishStreaming;
+-(void)cancelStreaming;
+-(AsyncConnection *)connector;
+-(int)folderId;
+-(NSString *)redirectURL;
+-(BOOL)didParse;
+-(NSString *)feedTitle;
+-(NSString *)feedDescription;
+-(NSString *)feedLink;
+-(NSArray *)articleArray;
+-(NSTimeInterval)postingInterval;
+-(NSTimeInterval)updateInterval;
+-(NSTimeInterval)queuedTime;
+-(NSTimeInterval)parsedTime;
+@end
+
+@implementation FeedParseOperation
+
+/* initWithConnection
+ * Initialises an operation for the data received by the specified connection. The
+ * connection must already be complete unless its data is streamed with queueChunk.
+ */
+-(id)initWithConnection:(AsyncConnection *)conn folderId:(int)theFolderId feedURL:(NSString *)theFeedURL
+{
+	if ((self = [super init]) != nil)
+	{
+		connector = [conn retain];
+		folderId = theFolderId;
+		feedURL = [theFeedURL copy];
+		connectionURL = [[conn URLString] copy];
+		feedSourcePath = nil;
+		shouldBackupFeedSource = NO;
+		redirectURL = nil;
+		didParse = NO;
+		articleArray = [[NSMutableArray alloc] init];
+		postingInterval = 0;
+		updateInterval = 0;
+		queuedTime = [NSDate timeIntervalSinceReferenceDate];
+		parsedTime = queuedTime;
+		bodyDigest = nil;
+		isStreamed = NO;
+		hasStreamError = NO;
+		streamParser = nil;
+		leadingData = nil;
+		lastChunkOperation = nil;
+		CC_SHA1_Init(&digestContext);
+	}
+	return self;
+}
+
+/* setFeedSourcePath
+ * Specifies where the raw feed should be saved. A nil path means the source
+ * isn't saved.
+ */
+-(void)setFeedSourcePath:(NSString *)path backup:(BOOL)backupFlag
+{
+	[path retain];
+	[feedSourcePath release];
+	feedSourcePath = path;
+	shouldBackupFeedSource = backupFlag;
+}
+
+/* setBodyDigest
+ * Sets the digest of the data being parsed, which is stored with the feed once
+ * its articles are in the database.
+ */
+-(void)setBodyDigest:(NSString *)newBodyDigest
+{
+	[newBodyDigest retain];
+	[bodyDigest release];
+	bodyDigest = newBodyDigest;
+}
+
+/* bodyDigest
+ */
+-(NSString *)bodyDigest
+{
+	return bodyDigest;
+}
+
+/* queueChunk
+ * Queues the next piece of a streamed feed for the parser. Each piece waits for
+ * the one before it so the parser sees the feed in order. Called on the main
+ * thread as the data arrives.
+ */
+-(void)queueChunk:(NSData *)data onQueue:(NSOperationQueue *)queue
+{
+	NSInvocationOperation * chunkOperation = [[NSInvocationOperation alloc] initWithTarget:self selector:@selector(parseChunk:) object:data];
+	if (lastChunkOperation != nil)
+		[chunkOperation addDependency:lastChunkOperation];
+	[lastChunkOperation release];
+	lastChunkOperation = chunkOperation;
+	isStreamed = YES;
+	[queue addOperation:chunkOperation];
+}
+
+/* finishStreaming
+ * Called when the last piece of a streamed feed has been queued. The operation
+ * must not start until the parser has seen all of it.
+ */
+-(void)finishStreaming
+{
+	if (lastChunkOperation != nil)
+	{
+		[self addDependency:lastChunkOperation];
+		[lastChunkOperation release];
+		lastChunkOperation = nil;
+	}
+	queuedTime = [NSDate timeIntervalSinceReferenceDate];
+}
+
+/* cancelStreaming
+ * Abandons a streamed feed. Any pieces still queued are skipped.
+ */
+-(void)cancelStreaming
+{
+	[self cancel];
+	[lastChunkOperation release];
+	lastChunkOperation = nil;
+}
+
+/* parseChunk
+ * Passes the next piece of a streamed feed to the parser. This runs on a worker
+ * thread, one piece at a time.
+ */
+-(void)parseChunk:(NSData *)data
+{
+	if ([self isCancelled])
+		return;
+
+	NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+	CC_SHA1_Update(&digestContext, [data bytes], (CC_LONG)[data length]);
+
+	// Keep the start of the feed in case it is an HTML redirect.
+	if (leadingData == nil)
+		leadingData = [[NSMutableData alloc] init];
+	if ([leadingData length] < MA_Redirect_Scan_Length)
+		[leadingData appendBytes:[data bytes] length:MIN([data length], MA_Redirect_Scan_Length - [leadingData length])];
+
+	// Once the feed is known to be malformed there's no point parsing the rest.
+	if (!hasStreamError)
+	{
+		NS_DURING
+		if (streamParser == nil)
+		{
+			streamParser = [[RichXMLParser alloc] init];
+			hasStreamError = ![streamParser beginParsing];
+		}
+		if (!hasStreamError)
+			hasStreamError = ![streamParser parseData:data];
+		NS_HANDLER
+			hasStreamError = YES;
+		NS_ENDHANDLER
+	}
+	[pool release];
+}
+
+/* saveFeedSource
+ * Writes the raw feed to the feed source path, first moving any previous copy
+ * aside if a backup was requested.
+ */
+-(void)saveFeedSource:(NSData *)receivedData
+{
+	if (shouldBackupFeedSource)
+	{
+		BOOL isDirectory = YES;
+		NSFileManager * defaultManager = [[[NSFileManager alloc] init] autorelease];
+		if ([defaultManager fileExistsAtPath:feedSourcePath isDirectory:&isDirectory] && !isDirectory)
+		{
+			NSString * backupPath = [feedSourcePath stringByAppendingPathExtension:@"bak"];
+			if (![defaultManager fileExistsAtPath:backupPath] || [defaultManager removeItemAtPath:backupPath error:NULL]) // Remove any old backup first
+			{
+				[defaultManager moveItemAtPath:feedSourcePath toPath:backupPath error:NULL];
+			}
+		}
+	}
+	[receivedData writeToFile:feedSourcePath options:NSAtomicWrite error:NULL];
+}
+
+/* main
+ * Parse the feed and collect its articles.
+ */
+-(void)main
+{
+	NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+	NSData * receivedData = isStreamed ? leadingData : [connector receivedData];
+
+	if (![self isCancelled])
+	{
+		// Check whether this is an HTML redirect. A redirect to the same URL is
+		// parsed anyway to avoid looping.
+		redirectURL = [[[RefreshManager sharedManager] getRedirectURL:receivedData] retain];
+		if (redirectURL == nil || [redirectURL isEqualToString:connectionURL])
+		{
+			// Empty data feed is OK if we got HTTP 200
+			didParse = YES;
+			if (isStreamed || [receivedData length] > 0)
+			{
+				RichXMLParser * newFeed;
+				if (isStreamed)
+				{
+					// The parser has already seen the whole feed so it only
+					// needs completing.
+					unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+					CC_SHA1_Final(digest, &digestContext);
+					[self setBodyDigest:hexStringOfDigest(digest)];
+
+					newFeed = streamParser;
+					streamParser = nil;
+					didParse = (newFeed != nil && !hasStreamError && [newFeed endParsing]);
+				}
+				else
+				{
+					if (feedSourcePath != nil)
+						[self saveFeedSource:receivedData];
+
+					newFeed = [[RichXMLParser alloc] init];
+					didParse = (newFeed != nil && [newFeed parseRichXML:receivedData]);
+				}
+				if (didParse)
+				{
+					// Extract the latest title and description
+					feedTitle = [[newFeed title] retain];
+					feedDescription = [[newFeed description] retain];
+					feedLink = [[newFeed link] retain];
+
+					// Synthesize feed link if it is missing
+					if (feedLink == nil || [feedLink isBlank])
+					{
+						[feedLink release];
+						feedLink = [[feedURL baseURL] retain];
+					}
+
+					// Maps each guid to its index in articleArray.
+					NSMutableDictionary * articleIndexes = [NSMutableDictionary dictionary];
+
+					// The span of the item dates gives how often the feed posts.
+					NSDate * newestDate = nil;
+					NSDate * oldestDate = nil;
+					int countOfDatedItems = 0;
+					updateInterval = [newFeed updateInterval];
+
+					for (FeedItem * newsItem in [newFeed items])
+					{
+						NSDate * articleDate = [newsItem date];
+						NSString * articleGuid = [newsItem guid];
+
+						if (articleDate != nil)
+						{
+							if (newestDate == nil || [articleDate compare:newestDate] == NSOrderedDescending)
+								newestDate = articleDate;
+							if (oldestDate == nil || [articleDate compare:oldestDate] == NSOrderedAscending)
+								oldestDate = articleDate;
+							++countOfDatedItems;
+						}
+
+						// This routine attempts to synthesize a GUID from an incomplete item that lacks an
+						// ID field. Generally we'll have three things to work from: a link, a title and a
+						// description. The link alone is not sufficiently unique and I've seen feeds where
+						// the description is also not unique. The title field generally does vary but we need
+						// to be careful since separate articles with different descriptions may have the same
+						// title. The solution is to use the link and title and build a GUID from those.
+						// We add the folderId at the beginning to ensure that items in different feeds do not share a guid.
+						if ([articleGuid isEqualToString:@""])
+							articleGuid = [NSString stringWithFormat:@"%d-%@-%@", folderId, [newsItem link], [newsItem title]];
+
+						if (articleDate == nil)
+							articleDate = [NSDate date];
+
+						Article * article = [[Article alloc] initWithGuid:articleGuid];
+						[article setFolderId:folderId];
+						[article setAuthor:[newsItem author]];
+						[article setBody:[newsItem description]];
+						[article setTitle:[newsItem title]];
+						[article setLink:[newsItem link]];
+						[article setDate:articleDate];
+						[article setEnclosure:[newsItem enclosure]];
+						if ([[article enclosure] isNotEqualTo:@""])
+						{
+							[article setHasEnclosure:YES];
+						}
+
+						// This is a horrible hack for horrible feeds that contain more than one item with the same guid.
+						// Bad feeds! I'm talking to you, WordPress Trac. The later item wins but keeps the position
+						// of the first one.
+						NSNumber * articleIndex = [articleIndexes objectForKey:articleGuid];
+						if (articleIndex == nil)
+						{
+							[articleIndexes setObject:[NSNumber numberWithUnsignedInteger:[articleArray count]] forKey:articleGuid];
+							[articleArray addObject:article];
+						}
+						else if ([newsItem date] != nil)
+						{
+							Article * existingArticle = [articleArray objectAtIndex:[articleIndex unsignedIntegerValue]];
+							if ([articleDate compare:[existingArticle date]] == NSOrderedDescending)
+								[articleArray replaceObjectAtIndex:[articleIndex unsignedIntegerValue] withObject:article];
+						}
+						[article release];
+					}
+					if (countOfDatedItems > 1)
+						postingInterval = [newestDate timeIntervalSinceDate:oldestDate] / (countOfDatedItems - 1);
+				}
+				[newFeed release];
+			}
+		}
+	}
+
+	// Hand the results back to the main thread which owns the database.
+	parsedTime = [NSDate timeIntervalSinceReferenceDate];
+	[[RefreshManager sharedManager] performSelectorOnMainThread:@selector(feedParseCompleted:) withObject:self waitUntilDone:NO];
+	[pool release];
+}
+
+/* connector
+ */
+-(AsyncConnection *)connector
+{
+	return connector;
+}
+
+/* folderId
+ */
+-(int)folderId
+{
+	return folderId;
+}
+
+/* redirectURL
+ * Returns the URL of an HTML redirect in the feed data, or nil if there was none.
+ */
+-(NSString *)redirectURL
+{
+	return redirectURL;
+}
+
+/* didParse
+ * Returns whether the feed data was parsed successfully.
+ */
+-(BOOL)didParse
+{
+	return didParse;
+}
+
+/* feedTitle
+ */
+-(NSString *)feedTitle
+{
+	return feedTitle;
+}
+
+/* feedDescription
+ */
+-(NSString *)feedDescription
+{
+	return feedDescription;
 }
 
-// Accessor functions
--(void)setFolder:(Folder *)newFolder;
--(void)setType:(RefreshTypes)newType;
--(Folder *)folder;
--(RefreshTypes)type;
-@end
-
-@implementation RefreshItem
+/* feedLink
+ */
+-(NSString *)feedLink
+{
+	return feedLink;
+}
 
-/* init
- * Initialises an empty RefreshItem with default values.
+/* articleArray
  */
--(id)init
+-(NSArray *)articleArray
 {
-	if ((self = [super init]) != nil)
-	{
-		[self setFolder:nil];
-		[self setType:MA_Refresh_NilType];
-	}
-	return self;
+	return articleArray;
 }
 
-/* setFolder
+/* postingInterval
+ * Returns the average time between the dated items in the feed, or 0 if
+ * there are too few to tell.
  */
--(void)setFolder:(Folder *)newFolder
+-(NSTimeInterval)postingInterval
 {
-	[newFolder retain];
-	[folder release];
-	folder = newFolder;
+	return postingInterval;
 }
 
-/* folder
+/* updateInterval
+ * Returns how often the feed says it should be polled, or 0 if it doesn't say.
  */
--(Folder *)folder
+-(NSTimeInterval)updateInterval
 {
-	return folder;
+	return updateInterval;
 }
 
-/* setType
+/* queuedTime
+ * Returns when the operation was created.
  */
--(void)setType:(RefreshTypes)newType
+-(NSTimeInterval)queuedTime
 {
-	type = newType;
+	return queuedTime;
 }
 
-/* type
+/* parsedTime
+ * Returns when the operation finished parsing.
  */
--(RefreshTypes)type
+-(NSTimeInterval)parsedTime
 {
-	return type;
+	return parsedTime;
 }
 
 /* dealloc
@@ -121,7 +989,19 @@ typedef enum {
  */
 -(void)dealloc
 {
-	[folder release];
+	[connector release];
+	[feedURL release];
+	[connectionURL release];
+	[feedSourcePath release];
+	[redirectURL release];
+	[feedTitle release];
+	[feedDescription release];
+	[feedLink release];
+	[articleArray release];
+	[bodyDigest release];
+	[streamParser release];
+	[leadingData release];
+	[lastChunkOperation release];
 	[super dealloc];
 }
 @end
@@ -137,12 +1017,28 @@ typedef enum {
 	{
 		maximumConnections = [[Preferences standardPreferences] integerForKey:MAPref_RefreshThreads];
 		countOfNewArticles = 0;
-		refreshArray = [[NSMutableArray alloc] initWithCapacity:10];
+		refreshQueue = [[RefreshQueue alloc] init];
 		connectionsArray = [[NSMutableArray alloc] initWithCapacity:maximumConnections];
 		authQueue = [[NSMutableArray alloc] init];
 		hasStarted = NO;
+		isWaitingToStart = NO;
+		pluginDelayInterval = MA_Plugin_Delay_Initial_Interval;
 		statusMessageDuringRefresh = nil;
 		statusMessagePerPlugin = [[NSMutableDictionary alloc] init];
+		connectionStartTimes = [[NSMutableDictionary alloc] init];
+		pendingParses = [[NSMutableArray alloc] init];
+		streamingParses = [[NSMutableDictionary alloc] init];
+		hostStates = [[NSMutableDictionary alloc] init];
+		connectionHosts = [[NSMutableDictionary alloc] init];
+		fetchLatencies = [[LatencySamples alloc] init];
+		parseLatencies = [[LatencySamples alloc] init];
+		updateLatencies = [[LatencySamples alloc] init];
+		[self resetPipelineStatistics];
+
+		// Downloaded feeds are parsed on this queue, off the main thread. The HTML entity
+		// map is built on first use so build it here before any parse can need it.
+		[NSString mapEntityToString:@"amp"];
+		parseQueue = [[NSOperationQueue alloc] init];
 
 		NSNotificationCenter * nc = [NSNotificationCenter defaultCenter];
 		[nc addObserver:self selector:@selector(handleGotAuthenticationForFolder:) name:@"MA_Notify_GotAuthenticationForFolder" object:nil];
@@ -174,12 +1070,12 @@ typedef enum {
 	Folder * folder = [[Database sharedDatabase] folderFromID:[[nc object] intValue]];
 	if (folder != nil)
 	{
-		int index = [refreshArray count];
+		int index = [refreshQueue count];
 		while (--index >= 0)
 		{
-			RefreshItem * item = [refreshArray objectAtIndex:index];
+			RefreshItem * item = [refreshQueue objectAtIndex:index];
 			if ([item folder] == folder)
-				[refreshArray removeObjectAtIndex:index];
+				[refreshQueue removeObjectAtIndex:index];
 		}
 
 		index = [connectionsArray count];
@@ -193,11 +1089,23 @@ typedef enum {
 				break;
 			}
 		}
+
+		// Drop any feed for this folder that is still being parsed. The queue also
+		// holds the pieces of streamed feeds, which are skipped once their feed is
+		// cancelled.
+		for (NSOperation * operation in [parseQueue operations])
+		{
+			if ([operation isKindOfClass:[FeedParseOperation class]] && [(FeedParseOperation *)operation folderId] == [folder itemId])
+			{
+				[operation cancel];
+				[pendingParses removeObjectIdenticalTo:operation];
+			}
+		}
 	}
 }
 
 /* refreshSubscriptions
- * Add the folders specified in the foldersArray to the refreshArray.
+ * Add the folders specified in the foldersArray to the refresh queue.
  */
 -(void)refreshSubscriptions:(NSArray *)foldersArray ignoringSubscriptionStatus:(BOOL)ignoreSubStatus
 {
@@ -216,17 +1124,17 @@ typedef enum {
 					RefreshItem * newItem = [[RefreshItem alloc] init];
 					[newItem setFolder:folder];
 					[newItem setType:MA_Refresh_Feed];
-					[refreshArray addObject:newItem];
+					[refreshQueue addObject:newItem];
 					[newItem release];
 				}
 			}
 		}
 	}
-	[self beginRefreshTimer];
+	[self beginRefresh];
 }
 
 /* refreshFolderIconCacheForSubscriptions
- * Add the folders specified in the foldersArray to the refreshArray.
+ * Add the folders specified in the foldersArray to the refresh queue.
  */
 -(void)refreshFolderIconCacheForSubscriptions:(NSArray *)foldersArray
 {
@@ -244,7 +1152,7 @@ typedef enum {
 }
 
 /* refreshFavIcon
- * Adds the specified folder to the refreshArray.
+ * Adds the specified folder to the refresh queue.
  */
 -(void)refreshFavIcon:(Folder *)folder
 {
@@ -261,20 +1169,22 @@ typedef enum {
 		RefreshItem * newItem = [[RefreshItem alloc] init];
 		[newItem setFolder:folder];
 		[newItem setType:MA_Refresh_FavIcon];
-		[refreshArray addObject:newItem];
+		[refreshQueue addObject:newItem];
 		[newItem release];
-		[self beginRefreshTimer];
+		[self beginRefresh];
 	}
 }
 
 /* isRefreshingFolder
- * Returns whether refreshArray has an queue refresh for the specified folder
+ * Returns whether the refresh queue has a queued refresh for the specified folder
  * and refresh type.
  */
 -(BOOL)isRefreshingFolder:(Folder *)folder ofType:(RefreshTypes)type
 {
-	for (RefreshItem * item in refreshArray)
+	NSUInteger index;
+	for (index = 0; index < [refreshQueue count]; ++index)
 	{
+		RefreshItem * item = [refreshQueue objectAtIndex:index];
 		if ([item folder] == folder && [item type] == type)
 			return YES;
 	}
@@ -294,7 +1204,9 @@ typedef enum {
  */
 -(void)cancelAll
 {
-	[refreshArray removeAllObjects];
+	[refreshQueue removeAllObjects];
+	[parseQueue cancelAllOperations];
+	[pendingParses removeAllObjects];
 	
 	// We don't know whether to remove the connections from the array, because some might already be complete.
 	// Let the cancel method take care of that.
@@ -445,53 +1357,88 @@ typedef enum {
 	[self setStatusMessageDuringRefresh:[[statusMessagePerPlugin allValues] componentsJoinedByString:@", "]];
 }
 
-/* beginRefreshTimer
- * Start the connection refresh timer running.
+/* beginRefresh
+ * Starts a refresh of whatever is in the refresh queue, or fills any free connection
+ * slots if a refresh is already running.
  */
--(void)beginRefreshTimer
+-(void)beginRefresh
 {
 	PluginHelper * plugins = [PluginHelper helper];
 	[plugins willRefreshArticles];
 	
-	if (pumpTimer == nil)
-		pumpTimer = [[NSTimer scheduledTimerWithTimeInterval:0.2 target:self selector:@selector(refreshPumper:) userInfo:nil repeats:YES] retain];
-	[self refreshPumper:pumpTimer];
+	if (hasStarted)
+		[self pumpRefresh];
+	else
+	{
+		isWaitingToStart = YES;
+		[self startRefresh];
+	}
 }
 
-/* refreshPumper
- * This is the heart of the refresh code. We manage the refreshArray by creating a
- * connection for each item in the array up to a maximum number of simultaneous
- * connections as defined in the maximumConnections variable.
+/* startRefresh
+ * Marks the refresh as started, unless a plugin is holding it back, then starts
+ * the first connections.
  */
--(void)refreshPumper:(NSTimer *)aTimer
+-(void)startRefresh
 {
-	
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(startRefresh) object:nil];
+	if (hasStarted || !isWaitingToStart)
+		return;
+
 	// check if any plugins are asking for a delay
-	if (!hasStarted && [[PluginHelper helper] shouldDelayStartOfArticleRefresh])
+	if ([[PluginHelper helper] shouldDelayStartOfArticleRefresh])
 	{
-		// return without beginning the refresh; timer keeps
-		// running and we will try this again momentarily
+		[self retryAfterPluginDelay:@selector(startRefresh)];
 		return;
 	}
 
+	pluginDelayInterval = MA_Plugin_Delay_Initial_Interval;
+	isWaitingToStart = NO;
+	countOfNewArticles = 0;
+	hasStarted = YES;
+	didFinish = NO;
+	[self resetPipelineStatistics];
+
+	[self setStatusMessageDuringRefresh:NSLocalizedString(@"Refreshing subscriptions...", nil)];
+	[[NSNotificationCenter defaultCenter] postNotificationName:@"MA_Notify_RefreshStatus" object:nil];
+	[self pumpRefresh];
+}
+
+/* pumpRefresh
+ * This is the heart of the refresh code. It takes items off the refresh queue and
+ * creates a connection for each, up to the maximum number of simultaneous connections
+ * in maximumConnections. Items are taken in order except where their host already has
+ * as many connections as it should, so the hosts are interleaved. It runs whenever
+ * something is added to the queue, a connection finishes, a downloaded feed has been
+ * stored or a host becomes free again, and it ends the refresh once there is nothing
+ * left to do.
+ */
+-(void)pumpRefresh
+{
+	[NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(pumpRefresh) object:nil];
 	if (!hasStarted)
-	{
-		countOfNewArticles = 0;
-		hasStarted = YES;
-		didFinish = NO;
-	
-		[self setStatusMessageDuringRefresh:NSLocalizedString(@"Refreshing subscriptions...", nil)];
-		[[NSNotificationCenter defaultCenter] postNotificationName:@"MA_Notify_RefreshStatus" object:nil];
-	}
+		return;
 
-	
-	while (([connectionsArray count] < maximumConnections) && ([refreshArray count] > 0))
+	NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+	NSTimeInterval nextStartTime = 0;
+	while (([connectionsArray count] < maximumConnections) && ([refreshQueue count] > 0))
 	{
-		RefreshItem * item = [refreshArray objectAtIndex:0];
+		NSUInteger itemIndex = [self indexOfNextRefreshItem:now nextStartTime:&nextStartTime];
+		if (itemIndex == NSNotFound)
+		{
+			// Every host with work waiting is busy. Come back when the first one
+			// that is only being spaced out can take another connection.
+			if (nextStartTime > 0)
+				[self performSelector:@selector(pumpRefresh) withObject:nil afterDelay:nextStartTime - now];
+			break;
+		}
+
+		RefreshItem * item = [[[refreshQueue objectAtIndex:itemIndex] retain] autorelease];
+		[refreshQueue removeObjectAtIndex:itemIndex];
 		switch ([item type])
 		{
 		case MA_Refresh_NilType:
-			NSAssert(false, @"Uninitialised RefreshItem in refreshArray");
+			NSAssert(false, @"Uninitialised RefreshItem in refresh queue");
 			break;
 
 		case MA_Refresh_Feed:
@@ -502,35 +1449,123 @@ typedef enum {
 			[self pumpFolderIconRefresh:[item folder]];
 			break;
 		}
-		[refreshArray removeObjectAtIndex:0];
 	}
 	
-	if ([connectionsArray count] == 0 && [refreshArray count] == 0 && hasStarted)
+	// The refresh isn't over until every downloaded feed has been parsed and
+	// written to the database.
+	if ([connectionsArray count] == 0 && [refreshQueue count] == 0 && [pendingParses count] == 0)
 	{
 		if (!didFinish)
 		{
 			didFinish = YES;
+			refreshEndTime = [NSDate timeIntervalSinceReferenceDate];
 			[[PluginHelper helper] didRefreshArticles];
 		}
 		
 		// check if any plugins are asking for a delay
-		if (hasStarted && [[PluginHelper helper] shouldDelayEndOfArticleRefresh])
+		if ([[PluginHelper helper] shouldDelayEndOfArticleRefresh])
 		{
-			// return without finishing the refresh; timer keeps
-			// running and we will try this again momentarily
+			[self retryAfterPluginDelay:@selector(pumpRefresh)];
 			return;
 		}
 		
-		[pumpTimer invalidate];
-		[pumpTimer release];
-		pumpTimer = nil;
-
+		pluginDelayInterval = MA_Plugin_Delay_Initial_Interval;
 		hasStarted = NO;
 		[statusMessagePerPlugin removeAllObjects];
 		[[NSNotificationCenter defaultCenter] postNotificationName:@"MA_Notify_RefreshStatus" object:nil];
 	}
 }
 
+/* indexOfNextRefreshItem
+ * Returns the position in the refresh queue of the next item to start, or NSNotFound
+ * if every item is waiting for its host. The first item whose host can take another
+ * connection is chosen unless a later one can reuse a warm connection. The earliest
+ * time at which a host that is only being spaced out becomes free is returned in
+ * nextStartTime.
+ */
+-(NSUInteger)indexOfNextRefreshItem:(NSTimeInterval)now nextStartTime:(NSTimeInterval *)nextStartTime
+{
+	NSUInteger countOfSlowConnections = 0;
+	for (RefreshHost * host in [connectionHosts objectEnumerator])
+	{
+		if ([host isSlow])
+			++countOfSlowConnections;
+	}
+
+	NSUInteger maximumSlowConnections = MAX(1, maximumConnections / 2);
+	NSUInteger countOfItems = [refreshQueue count];
+	NSUInteger firstIndex = NSNotFound;
+	NSUInteger index;
+
+	for (index = 0; index < countOfItems; ++index)
+	{
+		NSString * hostName = [(RefreshItem *)[refreshQueue objectAtIndex:index] host];
+		RefreshHost * host = [hostStates objectForKey:hostName];
+
+		// Local files and hosts we haven't connected to yet are always free.
+		if (host == nil)
+		{
+			if (firstIndex == NSNotFound)
+				firstIndex = index;
+			continue;
+		}
+
+		if ([host isSlow])
+		{
+			if ([host countOfConnections] > 0 || countOfSlowConnections >= maximumSlowConnections)
+				continue;
+		}
+		else if ([host countOfConnections] >= MA_Max_Connections_Per_Host)
+			continue;
+
+		NSTimeInterval startTime = [host lastStartTime] + MA_Min_Host_Spacing;
+		if (startTime > now)
+		{
+			if (*nextStartTime == 0 || startTime < *nextStartTime)
+				*nextStartTime = startTime;
+			continue;
+		}
+
+		if (now - [host lastFinishTime] < MA_Warm_Host_Interval)
+			return index;
+		if (firstIndex == NSNotFound)
+			firstIndex = index;
+	}
+	return firstIndex;
+}
+
+/* retryAfterPluginDelay
+ * Asks again later on behalf of a plugin that is holding back the start or the end
+ * of a refresh. The wait doubles each time so that a plugin that never calls
+ * resumeDelayedRefresh doesn't keep the application busy.
+ */
+-(void)retryAfterPluginDelay:(SEL)selector
+{
+	[self performSelector:selector withObject:nil afterDelay:pluginDelayInterval];
+	pluginDelayInterval = MIN(pluginDelayInterval * 2, MA_Plugin_Delay_Longest_Interval);
+}
+
+/* resumeDelayedRefresh
+ * Called by a plugin that held back the start or the end of a refresh when it is
+ * ready for the refresh to go on. This may be called from any thread.
+ */
+-(void)resumeDelayedRefresh
+{
+	[self performSelectorOnMainThread:@selector(resumeAfterPluginDelay) withObject:nil waitUntilDone:NO];
+}
+
+/* resumeAfterPluginDelay
+ * Picks up a refresh that plugins were holding back.
+ */
+-(void)resumeAfterPluginDelay
+{
+	pluginDelayInterval = MA_Plugin_Delay_Initial_Interval;
+	if (isWaitingToStart)
+		[self startRefresh];
+	else
+		[self pumpRefresh];
+}
+
 /* pumpSubscriptionRefresh
  * Pick the folder at the head of the refresh array and spawn a connection to
  * refresh that folder.
@@ -590,8 +1625,14 @@ typedef enum {
 		
 		[headers setValue:@"gzip" forKey:@"Accept-Encoding"];
 		[headers setValue:[folder lastUpdateString] forKey:@"If-Modified-Since"];
+		[headers setValue:[folder etag] forKey:@"If-None-Match"];
 		
 		[conn setHttpHeaders:headers];
+
+		// Long feeds are parsed as they download unless the raw feed has to be
+		// saved, which needs all of it in hand.
+		if (![[Preferences standardPreferences] shouldSaveFeedSource])
+			[conn setStreamingHandler:@selector(connection:didReceiveFeedData:) minimumLength:MA_Stream_Minimum_Length];
 		
 		if ([conn beginLoadDataFromURL:url
 							  username:[folder username]
@@ -600,7 +1641,9 @@ typedef enum {
 						   contextData:folder
 								   log:aItem
 						didEndSelector:@selector(folderRefreshCompleted:)])
+		{
 			[self addConnection:conn];
+		}
 	}
 	@finally
 	{
@@ -649,6 +1692,20 @@ typedef enum {
 	Folder * folder = (Folder *)[connector contextData];
 	int folderId = [folder itemId];
 	Database * db = [Database sharedDatabase];
+	NSString * bodyDigest = nil;
+
+	// The digest tells whether the data is the same as last time even when the
+	// server doesn't support conditional requests.
+	if ([connector status] == MA_Connect_Succeeded && [[connector receivedData] length] > 0)
+		bodyDigest = digestOfData([connector receivedData]);
+
+	// A streamed feed is already partly parsed. Keep it only if the download
+	// completed.
+	NSValue * connectionKey = [NSValue valueWithNonretainedObject:connector];
+	FeedParseOperation * streamedOperation = [[[streamingParses objectForKey:connectionKey] retain] autorelease];
+	[streamingParses removeObjectForKey:connectionKey];
+	if (streamedOperation != nil && [connector status] != MA_Connect_Succeeded)
+		[streamedOperation cancelStreaming];
 
 	[self setFolderUpdatingFlag:folder flag:NO];
 	if ([connector status] == MA_Connect_NeedCredentials)
@@ -667,16 +1724,9 @@ typedef enum {
 	}
 	else if ([connector status] == MA_Connect_Stopped)
 	{
-		// Stopping the connection isn't an error, so clear any
-		// existing error flag.
-		[self setFolderErrorFlag:folder flag:NO];
-		
-		// Set the last update date for this folder.
-		[db setFolderLastUpdate:folderId lastUpdate:[NSDate date]];
-		
-		// If this folder also requires an image refresh, add that
-		if ([folder flags] & MA_FFlag_CheckForImage)
-			[self refreshFavIcon:folder];
+		// The server said that the feed hasn't changed.
+		++countOfNotModified;
+		[self storeUnchangedFeed:folder fromConnection:connector];
 	}
 	else if ([connector status] == MA_Connect_URLIsGone)
 	{
@@ -689,216 +1739,334 @@ typedef enum {
 	{
 		// Mark the feed as failed
 		[self setFolderErrorFlag:folder flag:YES];
+		[[RefreshScheduler sharedScheduler] folderRefreshFailed:folderId];
+	}
+	else if ([connector status] == MA_Connect_Succeeded && [[connector receivedData] length] > 0 && [bodyDigest isEqualToString:[folder bodyDigest]])
+	{
+		// The server sent exactly what we stored last time so there is nothing
+		// to parse.
+		++countOfUnchangedBodies;
+		[[connector aItem] setStatus:NSLocalizedString(@"No new articles available", nil)];
+		[self storeUnchangedFeed:folder fromConnection:connector];
 	}
 	else if ([connector status] == MA_Connect_Succeeded)
 	{
-		NSData * receivedData = [connector receivedData];
-
-		// Check whether this is an HTML redirect. If so, create a new connection using
-		// the redirect.
-		NSString * redirectURL = [self getRedirectURL:receivedData];
-		if (redirectURL != nil)
+		// Hand the data to the parse queue, or let a streamed feed complete once
+		// the parser has caught up. The results come back to the main thread in
+		// feedParseCompleted.
+		FeedParseOperation * operation;
+		if (streamedOperation != nil)
 		{
-			if ([redirectURL isEqualToString:[connector URLString]])
-			{
-				// To prevent an infinite loop, don't redirect to the same URL.
-				[[connector aItem] appendDetail:[NSString stringWithFormat:NSLocalizedString(@"Improper infinitely looping URL redirect to %@", nil), [connector URLString]]];
-			}
-			else
-			{
-				[self refreshFeed:folder fromURL:[NSURL URLWithString:redirectURL] withLog:[connector aItem]];
-				[self removeConnection:connector];
-				return;
-			}
+			operation = [streamedOperation retain];
+			[operation finishStreaming];
 		}
-
-		// Remember the last modified date
-		NSString * lastModifiedString = [[connector responseHeaders] valueForKey:@"Last-Modified"];
-		if (lastModifiedString != nil)
-			[db setFolderLastUpdateString:folderId lastUpdateString:lastModifiedString];
-
-		// Empty data feed is OK if we got HTTP 200
-		int newArticlesFromFeed = 0;	
-		RichXMLParser * newFeed = [[RichXMLParser alloc] init];
-		if ([receivedData length] > 0)
+		else
 		{
+			operation = [[FeedParseOperation alloc] initWithConnection:connector folderId:folderId feedURL:[folder feedURL]];
+			[operation setBodyDigest:bodyDigest];
 			Preferences * standardPreferences = [Preferences standardPreferences];
 			if ([standardPreferences shouldSaveFeedSource])
-			{
-				NSString * feedSourcePath = [folder feedSourceFilePath];
-				
-				if ([standardPreferences boolForKey:MAPref_ShouldSaveFeedSourceBackup])
-				{
-					BOOL isDirectory = YES;
-					NSFileManager * defaultManager = [NSFileManager defaultManager];
-					if ([defaultManager fileExistsAtPath:feedSourcePath isDirectory:&isDirectory] && !isDirectory)
-					{
-						NSString * backupPath = [feedSourcePath stringByAppendingPathExtension:@"bak"];
-						if (![defaultManager fileExistsAtPath:backupPath] || [defaultManager removeItemAtPath:backupPath error:NULL]) // Remove any old backup first
-						{
-							[defaultManager moveItemAtPath:feedSourcePath toPath:backupPath error:NULL];
-						}
-					}
-				}
-				
-				[receivedData writeToFile:feedSourcePath options:NSAtomicWrite error:NULL];
-			}
-			
-			// Create a new rich XML parser instance that will take care of
-			// parsing the XML data we just got.
-			if (newFeed == nil || ![newFeed parseRichXML:receivedData])
-			{
-				// Mark the feed as failed
-				[self setFolderErrorFlag:folder flag:YES];
-				[[connector aItem] setStatus:NSLocalizedString(@"Error parsing XML data in feed", nil)];
-				[newFeed release];
-				[self removeConnection:connector];
-				return;
-			}
+				[operation setFeedSourcePath:[folder feedSourceFilePath] backup:[standardPreferences boolForKey:MAPref_ShouldSaveFeedSourceBackup]];
+		}
 
-			// Log number of bytes we received
-			[[connector aItem] appendDetail:[NSString stringWithFormat:NSLocalizedString(@"%ld bytes received", nil), [receivedData length]]];
-			
-			// Extract the latest title and description
-			NSString * feedTitle = [newFeed title];
-			NSString * feedDescription = [newFeed description];
-			NSString * feedLink = [newFeed link];
-			
-			// Synthesize feed link if it is missing
-			if (feedLink == nil || [feedLink isBlank])
-				feedLink = [[folder feedURL] baseURL];
-			
-			// We'll be collecting articles into this array
-			NSMutableArray * articleArray = [NSMutableArray array];
-			NSMutableArray * articleGuidArray = [NSMutableArray array];
-			
-			// Parse off items.
-			
-			for (FeedItem * newsItem in [newFeed items])
-			{
-				NSDate * articleDate = [newsItem date];
-				
-				NSString * articleGuid = [newsItem guid];
-				
-				// This routine attempts to synthesize a GUID from an incomplete item that lacks an
-				// ID field. Generally we'll have three things to work from: a link, a title and a
-				// description. The link alone is not sufficiently unique and I've seen feeds where
-				// the description is also not unique. The title field generally does vary but we need
-				// to be careful since separate articles with different descriptions may have the same
-				// title. The solution is to use the link and title and build a GUID from those.
-				// We add the folderId at the beginning to ensure that items in different feeds do not share a guid.
-				if ([articleGuid isEqualToString:@""])
-					articleGuid = [NSString stringWithFormat:@"%d-%@-%@", folderId, [newsItem link], [newsItem title]];
-				
-				// This is a horrible hack for horrible feeds that contain more than one item with the same guid.
-				// Bad feeds! I'm talking to you, WordPress Trac.
-				NSUInteger articleIndex = [articleGuidArray indexOfObject:articleGuid];
-				if (articleIndex != NSNotFound)
-				{
-					if (articleDate == nil)
-						continue; // Skip this duplicate article
-					
-					Article * existingArticle = [articleArray objectAtIndex:articleIndex];
-					if ([articleDate compare:[existingArticle date]] == NSOrderedDescending)
-					{
-						// This article is later, so use it instead
-						[articleArray removeObjectAtIndex:articleIndex];
-						[articleGuidArray removeObjectAtIndex:articleIndex];
-					}
-					else
-						continue; // Skip this duplicate article
-				}
-				[articleGuidArray addObject:articleGuid];
-				
-				if (articleDate == nil)
-					articleDate = [NSDate date];
-				
-				Article * article = [[Article alloc] initWithGuid:articleGuid];
-				[article setFolderId:folderId];
-				[article setAuthor:[newsItem author]];
-				[article setBody:[newsItem description]];
-				[article setTitle:[newsItem title]];
-				[article setLink:[newsItem link]];
-				[article setDate:articleDate];
-				[article setEnclosure:[newsItem enclosure]];
-				if ([[article enclosure] isNotEqualTo:@""])
-				{
-					[article setHasEnclosure:YES];
-				}
-				[articleArray addObject:article];
-				[article release];
-			}
+		// Track the fetch stage latency.
+		NSNumber * startTime = [connectionStartTimes objectForKey:[NSValue valueWithNonretainedObject:connector]];
+		if (startTime != nil)
+			[fetchLatencies addSample:[operation queuedTime] - [startTime doubleValue]];
 
-			// Here's where we add the articles to the database
-			if ([articleArray count] > 0u)
-			{
-				NSArray * guidHistory = [db guidHistoryForFolderId:folderId];
-				
-				[folder clearCache];
-				 // Should we wrap the entire loop or just individual article updates?
-				[db beginTransaction];
-				for (Article * article in articleArray)
-				{
-					if ([db createArticle:folderId article:article guidHistory:guidHistory] && ([article status] == MA_MsgStatus_New))
-						++newArticlesFromFeed;
-				}
-				[db commitTransaction];				
-			}
-			
-			[db beginTransaction];
+		[pendingParses addObject:operation];
+		[parseQueue addOperation:operation];
+		[operation release];
+	}
+	[self removeConnection:connector];
+}
 
-			// A notify is only needed if we added any new articles.
-			if ([[folder name] hasPrefix:[Database untitledFeedFolderName]] && ![feedTitle isBlank])
-			{
-				// If there's an existing feed with this title, make ours unique
-				// BUGBUG: This duplicates logic in database.m so consider moving it there.
-				NSString * oldFeedTitle = feedTitle;
-				unsigned int index = 1;
+/* storeUnchangedFeed
+ * Records a refresh that found the feed unchanged, either because the server
+ * answered that it wasn't modified or because it sent the same data as last time.
+ * Nothing is parsed and no articles are touched.
+ */
+-(void)storeUnchangedFeed:(Folder *)folder fromConnection:(AsyncConnection *)connector
+{
+	int folderId = [folder itemId];
+	Database * db = [Database sharedDatabase];
 
-				while (([db folderFromName:feedTitle]) != nil)
-					feedTitle = [NSString stringWithFormat:@"%@ (%i)", oldFeedTitle, index++];
+	// An unchanged feed isn't an error, so clear any existing error flag.
+	[self setFolderErrorFlag:folder flag:NO];
+	[[RefreshScheduler sharedScheduler] folderRefreshed:folderId countOfNewArticles:0 postingInterval:0 updateInterval:0 responseHeaders:[connector responseHeaders]];
 
-				[[connector aItem] setName:feedTitle];
-				[db setFolderName:folderId newName:feedTitle];
-			}
-			if (feedDescription != nil)
-				[db setFolderDescription:folderId newDescription:feedDescription];
+	// The server may have given the same content a new ETag.
+	[self storeETagFromConnection:connector forFolder:folderId];
 
-			if (feedLink!= nil)
-				[db setFolderHomePage:folderId newHomePage:feedLink];
-			
-			[db commitTransaction];
-			
-			// Let interested callers know that the folder has changed.
-			[[NSNotificationCenter defaultCenter] postNotificationName:@"MA_Notify_FoldersUpdated" object:[NSNumber numberWithInt:folderId]];
+	// Set the last update date for this folder.
+	[db setFolderLastUpdate:folderId lastUpdate:[NSDate date]];
+
+	// If this folder also requires an image refresh, add that
+	if ([folder flags] & MA_FFlag_CheckForImage)
+		[self refreshFavIcon:folder];
+}
+
+/* storeETagFromConnection
+ * Remembers the ETag that the server sent with the feed, if any, so that it is
+ * sent back with If-None-Match on the next refresh.
+ */
+-(void)storeETagFromConnection:(AsyncConnection *)connector forFolder:(int)folderId
+{
+	NSDictionary * responseHeaders = [connector responseHeaders];
+	for (NSString * headerField in responseHeaders)
+	{
+		// Header names are case insensitive and Foundation spells this one Etag.
+		if ([headerField caseInsensitiveCompare:@"ETag"] == NSOrderedSame)
+		{
+			[[Database sharedDatabase] setFolderETag:folderId etag:[responseHeaders objectForKey:headerField]];
+			break;
 		}
+	}
+}
 
-		// Mark the feed as succeeded
-		[self setFolderErrorFlag:folder flag:NO];
-		
-		// Set the last update date for this folder.
-		[db setFolderLastUpdate:folderId lastUpdate:[NSDate date]];
-		
-		// Send status to the activity log
-		if (newArticlesFromFeed == 0)
-			[[connector aItem] setStatus:NSLocalizedString(@"No new articles available", nil)];
+/* connection:didReceiveFeedData
+ * Called as each piece of a streamed feed arrives. The piece is queued for the
+ * parser straight away so that little is left to parse when the download ends.
+ */
+-(void)connection:(AsyncConnection *)connector didReceiveFeedData:(NSData *)data
+{
+	NSValue * connectionKey = [NSValue valueWithNonretainedObject:connector];
+	FeedParseOperation * operation = [streamingParses objectForKey:connectionKey];
+	if (operation == nil)
+	{
+		Folder * folder = (Folder *)[connector contextData];
+		operation = [[FeedParseOperation alloc] initWithConnection:connector folderId:[folder itemId] feedURL:[folder feedURL]];
+		[streamingParses setObject:operation forKey:connectionKey];
+		[operation release];
+	}
+	[operation queueChunk:[[data copy] autorelease] onQueue:parseQueue];
+}
+
+/* feedParseCompleted
+ * Called on the main thread when a feed has been parsed. Once the feed is stored
+ * the refresh may be able to move on or finish.
+ */
+-(void)feedParseCompleted:(id)parseResult
+{
+	[self storeParsedFeed:(FeedParseOperation *)parseResult];
+	[self pumpRefresh];
+}
+
+/* storeParsedFeed
+ * This is where the new articles and the feed details from a parsed feed are
+ * written to the database.
+ */
+-(void)storeParsedFeed:(FeedParseOperation *)operation
+{
+	AsyncConnection * connector = [operation connector];
+	int folderId = [operation folderId];
+	Database * db = [Database sharedDatabase];
+	Folder * folder = [db folderFromID:folderId];
+
+	// Nothing to do if the refresh was cancelled or the folder was deleted
+	// while the feed was being parsed.
+	if ([pendingParses indexOfObjectIdenticalTo:operation] == NSNotFound)
+		return;
+	[pendingParses removeObjectIdenticalTo:operation];
+	if (folder == nil)
+		return;
+
+	[parseLatencies addSample:[operation parsedTime] - [operation queuedTime]];
+
+	// Check whether this is an HTML redirect. If so, create a new connection using
+	// the redirect.
+	NSString * redirectURL = [operation redirectURL];
+	if (redirectURL != nil)
+	{
+		if ([redirectURL isEqualToString:[connector URLString]])
+		{
+			// To prevent an infinite loop, don't redirect to the same URL.
+			[[connector aItem] appendDetail:[NSString stringWithFormat:NSLocalizedString(@"Improper infinitely looping URL redirect to %@", nil), [connector URLString]]];
+		}
 		else
 		{
-			NSString * logText = [NSString stringWithFormat:NSLocalizedString(@"%d new articles retrieved", nil), newArticlesFromFeed];
-			[[connector aItem] setStatus:logText];
+			[self refreshFeed:folder fromURL:[NSURL URLWithString:redirectURL] withLog:[connector aItem]];
+			return;
+		}
+	}
+
+	// Remember the last modified date and the ETag
+	NSString * lastModifiedString = [[connector responseHeaders] valueForKey:@"Last-Modified"];
+	if (lastModifiedString != nil)
+		[db setFolderLastUpdateString:folderId lastUpdateString:lastModifiedString];
+	[self storeETagFromConnection:connector forFolder:folderId];
+
+	if (![operation didParse])
+	{
+		// Mark the feed as failed
+		[self setFolderErrorFlag:folder flag:YES];
+		[[connector aItem] setStatus:NSLocalizedString(@"Error parsing XML data in feed", nil)];
+		[[RefreshScheduler sharedScheduler] folderRefreshFailed:folderId];
+		return;
+	}
+
+	// A streamed feed is parsed before its digest is known but the database can
+	// still be left alone if it hasn't changed.
+	if ([operation bodyDigest] != nil && [[operation bodyDigest] isEqualToString:[folder bodyDigest]])
+	{
+		++countOfUnchangedBodies;
+		[[connector aItem] setStatus:NSLocalizedString(@"No new articles available", nil)];
+		[self storeUnchangedFeed:folder fromConnection:connector];
+		return;
+	}
+
+	int newArticlesFromFeed = 0;
+	NSUInteger countOfBytesReceived = [connector countOfBytesReceived];
+	if (countOfBytesReceived > 0)
+	{
+		// Log number of bytes we received
+		[[connector aItem] appendDetail:[NSString stringWithFormat:NSLocalizedString(@"%ld bytes received", nil), countOfBytesReceived]];
+
+		NSString * feedTitle = [operation feedTitle];
+		NSString * feedDescription = [operation feedDescription];
+		NSString * feedLink = [operation feedLink];
+
+		// Here's where we add the articles to the database
+		NSArray * articleArray = [operation articleArray];
+		if ([articleArray count] > 0u)
+		{
+			NSSet * guidHistory = [db guidHistoryForFolderId:folderId];
+
+			[folder clearCache];
+			int countOfCreatedArticles = [db createArticles:articleArray inFolder:folderId guidHistory:guidHistory];
+			if (countOfCreatedArticles > 0)
+				newArticlesFromFeed += countOfCreatedArticles;
 		}
-		
-		// Done with this connection
-		[newFeed release];
 
-		// If this folder also requires an image refresh, add that
-		if ([folder flags] & MA_FFlag_CheckForImage)
-			[self refreshFavIcon:folder];
+		[db beginTransaction];
+
+		// A notify is only needed if we added any new articles.
+		if ([[folder name] hasPrefix:[Database untitledFeedFolderName]] && ![feedTitle isBlank])
+		{
+			// If there's an existing feed with this title, make ours unique
+			// BUGBUG: This duplicates logic in database.m so consider moving it there.
+			NSString * oldFeedTitle = feedTitle;
+			unsigned int index = 1;
+
+			while (([db folderFromName:feedTitle]) != nil)
+				feedTitle = [NSString stringWithFormat:@"%@ (%i)", oldFeedTitle, index++];
 
-		// Add to count of new articles so far
-		countOfNewArticles += newArticlesFromFeed;
+			[[connector aItem] setName:feedTitle];
+			[db setFolderName:folderId newName:feedTitle];
+		}
+		if (feedDescription != nil)
+			[db setFolderDescription:folderId newDescription:feedDescription];
+
+		if (feedLink!= nil)
+			[db setFolderHomePage:folderId newHomePage:feedLink];
+
+		[db commitTransaction];
+
+		// Let interested callers know that the folder has changed.
+		[[NSNotificationCenter defaultCenter] postNotificationName:@"MA_Notify_FoldersUpdated" object:[NSNumber numberWithInt:folderId]];
 	}
-	[self removeConnection:connector];
+
+	// Now that the articles are stored the same data can be skipped next time.
+	if ([operation bodyDigest] != nil)
+		[db setFolderBodyDigest:folderId bodyDigest:[operation bodyDigest]];
+
+	// Mark the feed as succeeded and schedule its next refresh from what we learned
+	[self setFolderErrorFlag:folder flag:NO];
+	[[RefreshScheduler sharedScheduler] folderRefreshed:folderId
+									 countOfNewArticles:newArticlesFromFeed
+										postingInterval:[operation postingInterval]
+										 updateInterval:[operation updateInterval]
+										responseHeaders:[connector responseHeaders]];
+
+	// Set the last update date for this folder.
+	[db setFolderLastUpdate:folderId lastUpdate:[NSDate date]];
+
+	// Send status to the activity log
+	if (newArticlesFromFeed == 0)
+		[[connector aItem] setStatus:NSLocalizedString(@"No new articles available", nil)];
+	else
+	{
+		NSString * logText = [NSString stringWithFormat:NSLocalizedString(@"%d new articles retrieved", nil), newArticlesFromFeed];
+		[[connector aItem] setStatus:logText];
+	}
+
+	// If this folder also requires an image refresh, add that
+	if ([folder flags] & MA_FFlag_CheckForImage)
+		[self refreshFavIcon:folder];
+
+	// Add to count of new articles so far
+	countOfNewArticles += newArticlesFromFeed;
+
+	// Track the update stage latency, including the wait for the main thread.
+	NSTimeInterval endTime = [NSDate timeIntervalSinceReferenceDate];
+	[updateLatencies addSample:endTime - [operation parsedTime]];
+}
+
+/* resetPipelineStatistics
+ * Clears the latency counters at the start of a refresh.
+ */
+-(void)resetPipelineStatistics
+{
+	[fetchLatencies removeAllSamples];
+	[parseLatencies removeAllSamples];
+	[updateLatencies removeAllSamples];
+	countOfNotModified = 0;
+	countOfUnchangedBodies = 0;
+	refreshStartTime = [NSDate timeIntervalSinceReferenceDate];
+	refreshEndTime = 0;
+}
+
+/* pipelineStatistics
+ * Returns the depth of the queue in front of each stage of the refresh pipeline
+ * and the time in seconds a feed spent in each stage during the current or last
+ * refresh, as a mean and as 50th, 90th and 99th percentiles. The counts show how
+ * many feeds stopped at the server because they weren't modified, how many stopped
+ * before parsing because the same data came back, and how many went all the way
+ * to the database. FeedsPerSecond is the rate at which feeds were completed over
+ * the whole refresh and PeakMemory is the most memory in bytes that the process
+ * has held so far. SlowHosts is the number of hosts held to a single connection
+ * because they respond slowly.
+ */
+-(NSDictionary *)pipelineStatistics
+{
+	// The parse queue also holds the chunks of streamed feeds, so the depth comes from
+	// the feeds themselves. Those still parsing are in the parse stage and the rest are
+	// waiting to be written to the database.
+	int countOfPendingParses = 0;
+	for (FeedParseOperation * operation in pendingParses)
+	{
+		if (![operation isFinished])
+			++countOfPendingParses;
+	}
+	int countOfSlowHosts = 0;
+	for (RefreshHost * host in [hostStates objectEnumerator])
+	{
+		if ([host isSlow])
+			++countOfSlowHosts;
+	}
+
+	int countOfCompletedFeeds = [updateLatencies count] + countOfNotModified + countOfUnchangedBodies;
+	NSTimeInterval elapsedTime = ((refreshEndTime > 0) ? refreshEndTime : [NSDate timeIntervalSinceReferenceDate]) - refreshStartTime;
+
+	struct rusage usage;
+	long peakMemory = (getrusage(RUSAGE_SELF, &usage) == 0) ? usage.ru_maxrss : 0;
+
+	NSMutableDictionary * statistics = [NSMutableDictionary dictionaryWithObjectsAndKeys:
+		[NSNumber numberWithInt:[refreshQueue count]], @"FetchQueueDepth",
+		[NSNumber numberWithInt:[connectionsArray count]], @"ActiveConnections",
+		[NSNumber numberWithInt:countOfPendingParses], @"ParseQueueDepth",
+		[NSNumber numberWithInt:[pendingParses count] - countOfPendingParses], @"UpdateQueueDepth",
+		[NSNumber numberWithInt:countOfNotModified], @"NotModifiedCount",
+		[NSNumber numberWithInt:countOfUnchangedBodies], @"UnchangedBodyCount",
+		[NSNumber numberWithInt:[updateLatencies count]], @"StoredCount",
+		[NSNumber numberWithDouble:(elapsedTime > 0) ? countOfCompletedFeeds / elapsedTime : 0.0], @"FeedsPerSecond",
+		[NSNumber numberWithLong:peakMemory], @"PeakMemory",
+		[NSNumber numberWithInt:countOfSlowHosts], @"SlowHosts",
+		nil];
+	[fetchLatencies addToStatistics:statistics withPrefix:@"Fetch"];
+	[parseLatencies addToStatistics:statistics withPrefix:@"Parse"];
+	[updateLatencies addToStatistics:statistics withPrefix:@"Update"];
+	return statistics;
 }
 
 /* getRedirectURL
@@ -1026,7 +2194,26 @@ typedef enum {
 {
 	if (![connectionsArray containsObject:conn])
 	{
+		NSValue * connectionKey = [NSValue valueWithNonretainedObject:conn];
+		NSTimeInterval startTime = [NSDate timeIntervalSinceReferenceDate];
+
 		[connectionsArray addObject:conn];
+		[connectionStartTimes setObject:[NSNumber numberWithDouble:startTime] forKey:connectionKey];
+
+		// Count the connection against its host.
+		NSString * hostName = [[[NSURL URLWithString:[conn URLString]] host] lowercaseString];
+		if (hostName != nil)
+		{
+			RefreshHost * host = [hostStates objectForKey:hostName];
+			if (host == nil)
+			{
+				host = [[RefreshHost alloc] init];
+				[hostStates setObject:host forKey:hostName];
+				[host release];
+			}
+			[host connectionStartedAt:startTime];
+			[connectionHosts setObject:host forKey:connectionKey];
+		}
 	}
 }
 
@@ -1039,9 +2226,27 @@ typedef enum {
 	NSAssert([connectionsArray count] > 0, @"Calling removeConnection with zero active connection count");
 	if ([connectionsArray containsObject:conn])
 	{
+		NSValue * connectionKey = [NSValue valueWithNonretainedObject:conn];
+
+		// Let the host know how long the connection took.
+		RefreshHost * host = [connectionHosts objectForKey:connectionKey];
+		if (host != nil)
+		{
+			NSTimeInterval finishTime = [NSDate timeIntervalSinceReferenceDate];
+			NSTimeInterval latency = finishTime - [[connectionStartTimes objectForKey:connectionKey] doubleValue];
+			[host connectionFinishedAt:finishTime latency:([conn status] == MA_Connect_Cancelled) ? -1 : latency];
+			[connectionHosts removeObjectForKey:connectionKey];
+		}
+
 		// Close the connection before we release as otherwise it leaks
 		[conn close];
+		[connectionStartTimes removeObjectForKey:connectionKey];
+		[[streamingParses objectForKey:connectionKey] cancelStreaming];
+		[streamingParses removeObjectForKey:connectionKey];
 		[connectionsArray removeObject:conn];
+
+		// Give the free slot to the next item in the queue straight away.
+		[self pumpRefresh];
 	}
 }
 
@@ -1052,11 +2257,23 @@ typedef enum {
 {
 	[[NSNotificationCenter defaultCenter] removeObserver:self];
 	[statusMessagePerPlugin release];
+	for (FeedParseOperation * operation in [streamingParses objectEnumerator])
+		[operation cancelStreaming];
+	[parseQueue cancelAllOperations];
+	[parseQueue release];
+	[pendingParses release];
+	[streamingParses release];
+	[hostStates release];
+	[connectionHosts release];
+	[fetchLatencies release];
+	[parseLatencies release];
+	[updateLatencies release];
+	[connectionStartTimes release];
 	[statusMessageDuringRefresh release];
-	[pumpTimer release];
+	[NSObject cancelPreviousPerformRequestsWithTarget:self];
 	[authQueue release];
 	[connectionsArray release];
-	[refreshArray release];
+	[refreshQueue release];
 	[super dealloc];
 }
 
@@ -29,12 +29,14 @@
 /* shouldDelayStartOfArticleRefresh
  * Return YES if RefreshManager should not begin refreshing
  * articles, e.g. if the plugin needs to do something first.
+ * Call resumeDelayedRefresh on the RefreshManager once ready.
  */
 -(BOOL)shouldDelayStartOfArticleRefresh;
 
 /* shouldDelayEndOfArticleRefresh
  * Return YES if RefreshManager should not finish refreshing
  * articles, e.g. if the plugin needs to do something first.
+ * Call resumeDelayedRefresh on the RefreshManager once ready.
  */
 -(BOOL)shouldDelayEndOfArticleRefresh;
 
@@ -0,0 +1,48 @@
+//
+//  RefreshScheduler.h
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Cocoa/Cocoa.h>
+
+// One pending refresh in the queue. The layout is private to the scheduler.
+typedef struct ScheduleEntry ScheduleEntry;
+
+/* RefreshScheduler
+ * Decides when each subscription is next refreshed. Every feed gets its own
+ * interval which starts at the refresh frequency set in the preferences and is
+ * stretched for feeds that post rarely, keep answering that nothing changed or
+ * ask to be polled less often. Feeds that fail are backed off exponentially.
+ * Due feeds are handed to the RefreshManager as they come up rather than all
+ * subscriptions being refreshed at once.
+ */
+@interface RefreshScheduler : NSObject {
+	NSMutableDictionary * schedules;
+	ScheduleEntry * queue;
+	NSUInteger countOfEntries;
+	NSUInteger sizeOfQueue;
+	NSTimer * dueTimer;
+	NSTimeInterval refreshFrequency;
+	NSTimeInterval resumeTime;
+	BOOL hasLoadedSchedules;
+}
+
+// Public functions
++(RefreshScheduler *)sharedScheduler;
+-(void)setRefreshFrequency:(NSTimeInterval)newFrequency;
+-(void)deferRefreshesForInterval:(NSTimeInterval)delay;
+-(void)folderRefreshed:(int)folderId countOfNewArticles:(int)countOfNewArticles postingInterval:(NSTimeInterval)postingInterval updateInterval:(NSTimeInterval)updateInterval responseHeaders:(NSDictionary *)responseHeaders;
+-(void)folderRefreshFailed:(int)folderId;
+@end
@@ -0,0 +1,468 @@
+//
+//  RefreshScheduler.m
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "RefreshScheduler.h"
+#import "RefreshManager.h"
+#import "Database.h"
+#import "XMLParser.h"
+
+// No feed is left longer than this between refreshes unless the refresh
+// frequency in the preferences is longer still.
+static const NSTimeInterval MA_Schedule_Longest_Interval = 24 * 60 * 60;
+
+// Feeds that come due within this many seconds of each other are handed to
+// the refresh manager together.
+static const NSTimeInterval MA_Schedule_Coalesce_Interval = 60;
+
+// The most times the interval of a failing feed is doubled.
+static const int MA_Schedule_Max_Backoff_Steps = 8;
+
+// The most times the interval of a quiet feed is stretched by half again.
+static const int MA_Schedule_Max_Quiet_Steps = 6;
+
+// A pending refresh. Entries are never removed from the middle of the queue;
+// an entry whose time no longer matches its feed's schedule is skipped.
+struct ScheduleEntry {
+	NSTimeInterval dueTime;
+	int folderId;
+};
+
+// Singleton
+static RefreshScheduler * _refreshScheduler = nil;
+
+// What the scheduler has learned about one feed.
+@interface FeedSchedule : NSObject {
+	NSTimeInterval lastRefresh;
+	NSTimeInterval nextDue;
+	NSTimeInterval postingInterval;
+	NSTimeInterval hintedInterval;
+	int quietCount;
+	int errorCount;
+}
+
+// Accessor functions
+-(id)initWithLastRefresh:(NSTimeInterval)theLastRefresh;
+-(NSTimeInterval)lastRefresh;
+-(NSTimeInterval)nextDue;
+-(void)setNextDue:(NSTimeInterval)newNextDue;
+-(NSTimeInterval)intervalForFrequency:(NSTimeInterval)frequency;
+-(void)recordRefreshWithNewArticles:(int)countOfNewArticles postingInterval:(NSTimeInterval)newPostingInterval hintedInterval:(NSTimeInterval)newHintedInterval;
+-(void)recordAttempt;
+-(void)recordFailure;
+@end
+
+@implementation FeedSchedule
+
+/* initWithLastRefresh
+ * Initialises the schedule of a feed that was last refreshed at the specified time.
+ */
+-(id)initWithLastRefresh:(NSTimeInterval)theLastRefresh
+{
+	if ((self = [super init]) != nil)
+	{
+		lastRefresh = theLastRefresh;
+		nextDue = 0;
+		postingInterval = 0;
+		hintedInterval = 0;
+		quietCount = 0;
+		errorCount = 0;
+	}
+	return self;
+}
+
+/* lastRefresh
+ */
+-(NSTimeInterval)lastRefresh
+{
+	return lastRefresh;
+}
+
+/* nextDue
+ */
+-(NSTimeInterval)nextDue
+{
+	return nextDue;
+}
+
+/* setNextDue
+ */
+-(void)setNextDue:(NSTimeInterval)newNextDue
+{
+	nextDue = newNextDue;
+}
+
+/* intervalForFrequency
+ * Returns how long to wait between refreshes of this feed given the refresh frequency
+ * from the preferences. A feed is never refreshed more often than that frequency.
+ */
+-(NSTimeInterval)intervalForFrequency:(NSTimeInterval)frequency
+{
+	NSTimeInterval longestInterval = MAX(frequency, MA_Schedule_Longest_Interval);
+	NSTimeInterval interval = frequency;
+
+	if (errorCount > 0)
+		interval = frequency * (1 << MIN(errorCount, MA_Schedule_Max_Backoff_Steps));
+	else
+	{
+		// Check twice as often as the feed usually posts then stretch that for
+		// every refresh in a row that found nothing new.
+		int step;
+		interval = MAX(interval, postingInterval / 2);
+		for (step = 0; step < MIN(quietCount, MA_Schedule_Max_Quiet_Steps); ++step)
+			interval *= 1.5;
+		interval = MAX(interval, hintedInterval);
+	}
+	return MIN(interval, longestInterval);
+}
+
+/* recordRefreshWithNewArticles
+ * Updates the schedule after a refresh that succeeded or found the feed unchanged.
+ */
+-(void)recordRefreshWithNewArticles:(int)countOfNewArticles postingInterval:(NSTimeInterval)newPostingInterval hintedInterval:(NSTimeInterval)newHintedInterval
+{
+	lastRefresh = [NSDate timeIntervalSinceReferenceDate];
+	errorCount = 0;
+	quietCount = (countOfNewArticles > 0) ? 0 : quietCount + 1;
+	if (newPostingInterval > 0)
+		postingInterval = (postingInterval > 0) ? (postingInterval + newPostingInterval) / 2 : newPostingInterval;
+	if (newHintedInterval > 0)
+		hintedInterval = newHintedInterval;
+}
+
+/* recordAttempt
+ * Notes that a refresh of the feed has been started.
+ */
+-(void)recordAttempt
+{
+	lastRefresh = [NSDate timeIntervalSinceReferenceDate];
+}
+
+/* recordFailure
+ * Updates the schedule after a refresh that failed.
+ */
+-(void)recordFailure
+{
+	lastRefresh = [NSDate timeIntervalSinceReferenceDate];
+	++errorCount;
+}
+@end
+
+// Private functions
+@interface RefreshScheduler (Private)
+	-(void)loadSchedules;
+	-(FeedSchedule *)scheduleForFolder:(int)folderId;
+	-(void)scheduleFolder:(int)folderId schedule:(FeedSchedule *)schedule;
+	-(void)rescheduleAll;
+	-(void)armTimer;
+	-(void)refreshDueFolders:(NSTimer *)aTimer;
+@end
+
+/* siftUp
+ * Moves the entry at index towards the head of the queue until it is in order.
+ */
+static void siftUp(ScheduleEntry * queue, NSUInteger index)
+{
+	ScheduleEntry entry = queue[index];
+	while (index > 0)
+	{
+		NSUInteger parent = (index - 1) / 2;
+		if (queue[parent].dueTime <= entry.dueTime)
+			break;
+		queue[index] = queue[parent];
+		index = parent;
+	}
+	queue[index] = entry;
+}
+
+/* siftDown
+ * Moves the entry at index away from the head of the queue until it is in order.
+ */
+static void siftDown(ScheduleEntry * queue, NSUInteger count, NSUInteger index)
+{
+	ScheduleEntry entry = queue[index];
+	for (;;)
+	{
+		NSUInteger child = index * 2 + 1;
+		if (child >= count)
+			break;
+		if (child + 1 < count && queue[child + 1].dueTime < queue[child].dueTime)
+			++child;
+		if (entry.dueTime <= queue[child].dueTime)
+			break;
+		queue[index] = queue[child];
+		index = child;
+	}
+	queue[index] = entry;
+}
+
+/* freshnessIntervalFromHeaders
+ * Returns how long the server says the feed stays fresh from its Cache-Control or
+ * Expires response headers, or 0 if it doesn't say.
+ */
+static NSTimeInterval freshnessIntervalFromHeaders(NSDictionary * headers)
+{
+	NSString * cacheControl = [[headers valueForKey:@"Cache-Control"] lowercaseString];
+	if (cacheControl != nil)
+	{
+		NSRange range = [cacheControl rangeOfString:@"max-age="];
+		if (range.location != NSNotFound)
+			return MAX([[cacheControl substringFromIndex:NSMaxRange(range)] intValue], 0);
+	}
+
+	NSString * expires = [headers valueForKey:@"Expires"];
+	if (expires != nil)
+	{
+		NSDate * expiryDate = [XMLParser parseXMLDate:expires];
+		if (expiryDate != nil)
+			return MAX([expiryDate timeIntervalSinceNow], 0);
+	}
+	return 0;
+}
+
+@implementation RefreshScheduler
+
+/* init
+ * Initialise the class.
+ */
+-(id)init
+{
+	if ((self = [super init]) != nil)
+	{
+		schedules = [[NSMutableDictionary alloc] init];
+		queue = NULL;
+		countOfEntries = 0;
+		sizeOfQueue = 0;
+		dueTimer = nil;
+		refreshFrequency = 0;
+		resumeTime = 0;
+		hasLoadedSchedules = NO;
+	}
+	return self;
+}
+
+/* sharedScheduler
+ * Returns the single instance of the refresh scheduler.
+ */
++(RefreshScheduler *)sharedScheduler
+{
+	if (!_refreshScheduler)
+		_refreshScheduler = [[RefreshScheduler alloc] init];
+	return _refreshScheduler;
+}
+
+/* setRefreshFrequency
+ * Sets the refresh frequency from the preferences, in seconds, and reschedules every
+ * feed from its last refresh. A frequency of 0 stops scheduled refreshes.
+ */
+-(void)setRefreshFrequency:(NSTimeInterval)newFrequency
+{
+	if (hasLoadedSchedules && newFrequency == refreshFrequency)
+		return;
+	refreshFrequency = newFrequency;
+	if (!hasLoadedSchedules)
+		[self loadSchedules];
+	[self rescheduleAll];
+	[self armTimer];
+}
+
+/* deferRefreshesForInterval
+ * Holds back any scheduled refresh for the specified number of seconds. This is
+ * used after the system wakes to give the network time to come back.
+ */
+-(void)deferRefreshesForInterval:(NSTimeInterval)delay
+{
+	resumeTime = [NSDate timeIntervalSinceReferenceDate] + delay;
+	[self armTimer];
+}
+
+/* folderRefreshed
+ * Called when a feed has been refreshed, whether or not it had changed, so that the
+ * next refresh can be scheduled from what was learned.
+ */
+-(void)folderRefreshed:(int)folderId countOfNewArticles:(int)countOfNewArticles postingInterval:(NSTimeInterval)postingInterval updateInterval:(NSTimeInterval)updateInterval responseHeaders:(NSDictionary *)responseHeaders
+{
+	FeedSchedule * schedule = [self scheduleForFolder:folderId];
+	NSTimeInterval hintedInterval = MAX(updateInterval, freshnessIntervalFromHeaders(responseHeaders));
+
+	[schedule recordRefreshWithNewArticles:countOfNewArticles postingInterval:postingInterval hintedInterval:hintedInterval];
+	[self scheduleFolder:folderId schedule:schedule];
+	[self armTimer];
+}
+
+/* folderRefreshFailed
+ * Called when a feed could not be refreshed.
+ */
+-(void)folderRefreshFailed:(int)folderId
+{
+	FeedSchedule * schedule = [self scheduleForFolder:folderId];
+	[schedule recordFailure];
+	[self scheduleFolder:folderId schedule:schedule];
+	[self armTimer];
+}
+
+/* loadSchedules
+ * Creates a schedule for every feed from the time it was last refreshed.
+ */
+-(void)loadSchedules
+{
+	for (Folder * folder in [[Database sharedDatabase] arrayOfAllFolders])
+	{
+		if (IsRSSFolder(folder))
+		{
+			NSDate * lastUpdate = [folder lastUpdate];
+			FeedSchedule * schedule = [[FeedSchedule alloc] initWithLastRefresh:(lastUpdate != nil) ? [lastUpdate timeIntervalSinceReferenceDate] : 0];
+			[schedules setObject:schedule forKey:[NSNumber numberWithInt:[folder itemId]]];
+			[schedule release];
+		}
+	}
+	hasLoadedSchedules = YES;
+}
+
+/* scheduleForFolder
+ * Returns the schedule for the specified feed, creating one if the feed is new.
+ */
+-(FeedSchedule *)scheduleForFolder:(int)folderId
+{
+	NSNumber * key = [NSNumber numberWithInt:folderId];
+	FeedSchedule * schedule = [schedules objectForKey:key];
+	if (schedule == nil)
+	{
+		schedule = [[FeedSchedule alloc] initWithLastRefresh:[NSDate timeIntervalSinceReferenceDate]];
+		[schedules setObject:schedule forKey:key];
+		[schedule release];
+	}
+	return schedule;
+}
+
+/* scheduleFolder
+ * Queues the next refresh of the specified feed one interval after its last refresh.
+ */
+-(void)scheduleFolder:(int)folderId schedule:(FeedSchedule *)schedule
+{
+	if (refreshFrequency <= 0)
+		return;
+
+	// Superseded entries stay in the queue until they reach the head so rebuild it
+	// once they outnumber the live ones.
+	if (countOfEntries > [schedules count] * 2 + 16)
+	{
+		[self rescheduleAll];
+		return;
+	}
+
+	if (countOfEntries == sizeOfQueue)
+	{
+		sizeOfQueue = MAX(sizeOfQueue * 2, 64u);
+		queue = realloc(queue, sizeof(ScheduleEntry) * sizeOfQueue);
+	}
+	NSTimeInterval dueTime = [schedule lastRefresh] + [schedule intervalForFrequency:refreshFrequency];
+	[schedule setNextDue:dueTime];
+	queue[countOfEntries].dueTime = dueTime;
+	queue[countOfEntries].folderId = folderId;
+	siftUp(queue, countOfEntries++);
+}
+
+/* rescheduleAll
+ * Rebuilds the queue with one entry for every feed.
+ */
+-(void)rescheduleAll
+{
+	countOfEntries = 0;
+	for (NSNumber * key in [schedules allKeys])
+		[self scheduleFolder:[key intValue] schedule:[schedules objectForKey:key]];
+}
+
+/* armTimer
+ * Sets the timer to fire when the feed at the head of the queue comes due.
+ */
+-(void)armTimer
+{
+	[dueTimer invalidate];
+	[dueTimer release];
+	dueTimer = nil;
+	if (refreshFrequency > 0 && countOfEntries > 0)
+	{
+		NSTimeInterval fireTime = MAX(queue[0].dueTime, resumeTime);
+		NSTimeInterval delay = MAX(fireTime - [NSDate timeIntervalSinceReferenceDate], 0);
+		dueTimer = [[NSTimer scheduledTimerWithTimeInterval:delay
+													 target:self
+												   selector:@selector(refreshDueFolders:)
+												   userInfo:nil
+													repeats:NO] retain];
+	}
+}
+
+/* refreshDueFolders
+ * Hands every feed that is due to the refresh manager. The due entries are all taken
+ * off the queue before any feed is rescheduled, since a feed with an interval shorter
+ * than the coalescing window would otherwise be due again straight away. Each feed is
+ * rescheduled in case its refresh is cancelled; a refresh that completes reschedules
+ * it again from what it learned.
+ */
+-(void)refreshDueFolders:(NSTimer *)aTimer
+{
+	Database * db = [Database sharedDatabase];
+	NSMutableArray * dueKeys = [NSMutableArray array];
+	NSMutableArray * dueFolders = [NSMutableArray array];
+	NSTimeInterval dueTime = [NSDate timeIntervalSinceReferenceDate] + MA_Schedule_Coalesce_Interval;
+
+	while (countOfEntries > 0 && queue[0].dueTime <= dueTime)
+	{
+		ScheduleEntry entry = queue[0];
+		queue[0] = queue[--countOfEntries];
+		if (countOfEntries > 0)
+			siftDown(queue, countOfEntries, 0);
+
+		NSNumber * key = [NSNumber numberWithInt:entry.folderId];
+		FeedSchedule * schedule = [schedules objectForKey:key];
+		if (schedule != nil && [schedule nextDue] == entry.dueTime)
+			[dueKeys addObject:key];
+	}
+
+	for (NSNumber * key in dueKeys)
+	{
+		Folder * folder = [db folderFromID:[key intValue]];
+		if (folder == nil || !IsRSSFolder(folder))
+		{
+			[schedules removeObjectForKey:key];
+			continue;
+		}
+
+		FeedSchedule * schedule = [schedules objectForKey:key];
+		[schedule recordAttempt];
+		[self scheduleFolder:[key intValue] schedule:schedule];
+		if (!IsUnsubscribed(folder) && !IsUpdating(folder))
+			[dueFolders addObject:folder];
+	}
+
+	if ([dueFolders count] > 0)
+		[[RefreshManager sharedManager] refreshSubscriptions:dueFolders ignoringSubscriptionStatus:NO];
+	[self armTimer];
+}
+
+/* dealloc
+ * Clean up after ourselves.
+ */
+-(void)dealloc
+{
+	[dueTimer invalidate];
+	[dueTimer release];
+	free(queue);
+	[schedules release];
+	[super dealloc];
+}
+@end
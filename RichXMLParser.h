@@ -40,22 +40,70 @@
 -(NSString *)enclosure;
 @end
 
-@interface RichXMLParser : XMLParser {
+// Opaque libxml2 push parser context
+struct _xmlParserCtxt;
+
+// Number of recently parsed dates each parser remembers
+#define MA_Date_Cache_Size	4
+
+@interface RichXMLParser : NSObject {
 	NSString * title;
 	NSString * link;
 	NSString * description;
 	NSDate * lastModified;
+	NSTimeInterval timeToLive;
+	NSTimeInterval updatePeriod;
+	int updateFrequency;
 	NSMutableArray * items;
 	NSMutableArray * orderArray;
-	NSArray * titleTags;
+
+	// Streaming parser state
+	struct _xmlParserCtxt * parserContext;
+	NSMutableData * pendingData;
+	NSMutableData * sanitizedData;
+	NSStringEncoding encodingType;
+	BOOL hasEncodingType;
+	BOOL isInMultiByteSequence;
+	BOOL hasParseError;
+	int feedFormat;
+	NSMutableArray * elementStack;
+	int xmlContentDepth;
+	BOOL isXMLTagOpen;
+	BOOL isInChannel;
+
+	// State of the item being parsed
+	FeedItem * currentItem;
+	NSUInteger currentItemDepth;
+	NSMutableString * articleBody;
+	NSString * itemIdentifier;
+	BOOL hasDetailedContent;
+	BOOL hasLink;
+	NSMutableArray * itemsBeforeFeedLink;
+	NSMutableArray * itemsWithoutLink;
+
+	// Atom link resolution
+	NSString * defaultAuthor;
+	NSString * linkBase;
+	NSURL * linkBaseURL;
+	NSString * entryBase;
+	NSURL * entryBaseURL;
+
+	// Recently parsed dates
+	NSString * cachedDateStrings[MA_Date_Cache_Size];
+	NSDate * cachedDates[MA_Date_Cache_Size];
+	NSUInteger nextCachedDate;
 }
 
 // General functions
 -(BOOL)parseRichXML:(NSData *)xmlData;
+-(BOOL)beginParsing;
+-(BOOL)parseData:(NSData *)xmlData;
+-(BOOL)endParsing;
 +(BOOL)extractFeeds:(NSData *)xmlData toArray:(NSMutableArray *)linkArray;
 -(NSString *)title;
 -(NSString *)description;
 -(NSString *)link;
 -(NSDate *)lastModified;
+-(NSTimeInterval)updateInterval;
 -(NSArray *)items;
 @end
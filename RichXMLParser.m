@@ -21,6 +21,47 @@
 #import "StringExtensions.h"
 #import "ArrayExtensions.h"
 #import "XMLTag.h"
+#import <libxml/parser.h>
+
+// Feed formats recognised from the document element
+#define MA_FeedFormat_Unknown	0
+#define MA_FeedFormat_RSS		1
+#define MA_FeedFormat_RDF		2
+#define MA_FeedFormat_Atom		3
+
+// Size of the slices in which parseRichXML hands a complete feed to the parser
+static const NSUInteger MA_Parse_Chunk_Size = 32 * 1024;
+
+// Longest entity name the sanitiser will look ahead for before treating the
+// '&' as a literal character.
+static const NSUInteger MA_Max_Entity_Length = 32;
+
+// Worst case growth of the data going through the sanitiser. A single byte can
+// become a 6 byte hex entity.
+static const NSUInteger MA_Sanitize_Expansion = 6;
+
+// SAX callbacks shared by every parser. Filled in once by +initialize.
+static xmlSAXHandler saxHandler;
+
+// An open element in the document. Only the elements between the root and the current
+// parse position are alive at any time, which bounds the parser's memory to one item.
+@interface FeedElement : NSObject {
+	NSString * name;
+	NSDictionary * attributes;
+	NSMutableString * value;
+	NSMutableDictionary * childValues;
+	BOOL isXMLContent;
+}
+
+// Accessor functions
+-(id)initWithName:(NSString *)newName attributes:(NSDictionary *)newAttributes;
+-(NSString *)name;
+-(NSString *)valueOfAttribute:(NSString *)attributeName;
+-(NSMutableString *)valueOfElement;
+-(BOOL)isXMLContent;
+-(void)setChildValue:(NSString *)childValue forName:(NSString *)childName;
+-(NSString *)childValue:(NSString *)childName;
+@end
 
 @interface FeedItem (Private)
 	-(void)setTitle:(NSString *)newTitle;
@@ -34,22 +75,193 @@
 
 @interface RichXMLParser (Private)
 	-(void)reset;
-	-(NSData *)preFlightValidation:(NSData *)xmlData;
+	-(void)resetParseState;
 	-(NSStringEncoding)parseEncodingType:(NSData *)xmlData;
-	-(BOOL)initRSSFeed:(XMLParser *)feedTree isRDF:(BOOL)isRDF;
-	-(XMLParser *)channelTree:(XMLParser *)feedTree;
-	-(BOOL)initRSSFeedHeader:(XMLParser *)feedTree;
-	-(BOOL)initRSSFeedItems:(XMLParser *)feedTree;
-	-(BOOL)initAtomFeed:(XMLParser *)feedTree;
-	-(void)parseSequence:(XMLParser *)seqTree;
+	-(void)sanitizeAndParseBytes:(const unsigned char *)bytes length:(NSUInteger)length isFinal:(BOOL)isFinal;
+	-(void)startElement:(NSString *)name attributes:(NSDictionary *)attributes;
+	-(void)endElement:(NSString *)name;
+	-(void)foundCharacters:(const char *)characters length:(int)length isCDATA:(BOOL)isCDATA;
+	-(void)didStartElement:(FeedElement *)element depth:(NSUInteger)depth;
+	-(void)didEndElement:(FeedElement *)element depth:(NSUInteger)depth;
+	-(void)parseRSSChannelElement:(FeedElement *)element;
+	-(BOOL)parseUpdateHintElement:(FeedElement *)element;
+	-(void)parseRSSItemElement:(FeedElement *)element;
+	-(void)finishRSSItem;
+	-(void)finishRSSFeed;
+	-(void)parseAtomFeedElement:(FeedElement *)element;
+	-(void)parseAtomEntryElement:(FeedElement *)element;
+	-(void)finishAtomEntry;
 	-(void)setTitle:(NSString *)newTitle;
 	-(void)setLink:(NSString *)newLink;
 	-(void)setDescription:(NSString *)newDescription;
 	-(void)setLastModified:(NSDate *)newDate;
+	-(NSDate *)dateFromString:(NSString *)dateString;
 	-(NSString *)stripHTMLTags:(NSString *)htmlString;
 	-(void)ensureTitle:(FeedItem *)item;
 @end
 
+/* appendEscapedText
+ * Appends text to an XML string, escaping the characters that would otherwise be
+ * read back as markup.
+ */
+static void appendEscapedText(NSMutableString * xmlString, NSString * text)
+{
+	NSUInteger startIndex = [xmlString length];
+	[xmlString appendString:text];
+	NSRange range = NSMakeRange(startIndex, [xmlString length] - startIndex);
+	range.length += [xmlString replaceOccurrencesOfString:@"&" withString:@"&amp;" options:NSLiteralSearch range:range] * 4;
+	range.length += [xmlString replaceOccurrencesOfString:@"<" withString:@"&lt;" options:NSLiteralSearch range:range] * 3;
+	[xmlString replaceOccurrencesOfString:@">" withString:@"&gt;" options:NSLiteralSearch range:range];
+}
+
+/* startElementHandler
+ * libxml2 callback for the start of an element. Attribute names and values arrive in
+ * a NULL terminated array of name/value pairs. Entities in the values are expanded
+ * except for '&' which libxml2 hands back as a character reference unless it is told
+ * to substitute entities, and that would also let a feed pull in external entities.
+ */
+static void startElementHandler(void * context, const xmlChar * name, const xmlChar ** attributes)
+{
+	NSMutableDictionary * attributesDict = nil;
+	if (attributes != NULL)
+	{
+		attributesDict = [NSMutableDictionary dictionary];
+		for (; attributes[0] != NULL; attributes += 2)
+		{
+			NSString * attributeName = [NSString stringWithUTF8String:(const char *)attributes[0]];
+			NSString * attributeValue = (attributes[1] != NULL) ? [NSString stringWithUTF8String:(const char *)attributes[1]] : @"";
+			if (attributes[1] != NULL && strstr((const char *)attributes[1], "&#38;") != NULL)
+				attributeValue = [attributeValue stringByReplacingOccurrencesOfString:@"&#38;" withString:@"&"];
+			if (attributeName != nil && attributeValue != nil)
+				[attributesDict setObject:attributeValue forKey:attributeName];
+		}
+	}
+	[(RichXMLParser *)context startElement:[NSString stringWithUTF8String:(const char *)name] attributes:attributesDict];
+}
+
+/* endElementHandler
+ * libxml2 callback for the end of an element.
+ */
+static void endElementHandler(void * context, const xmlChar * name)
+{
+	[(RichXMLParser *)context endElement:[NSString stringWithUTF8String:(const char *)name]];
+}
+
+/* charactersHandler
+ * libxml2 callback for a run of character data. The text is always UTF-8.
+ */
+static void charactersHandler(void * context, const xmlChar * characters, int length)
+{
+	[(RichXMLParser *)context foundCharacters:(const char *)characters length:length isCDATA:NO];
+}
+
+/* cdataBlockHandler
+ * libxml2 callback for the contents of a CDATA section.
+ */
+static void cdataBlockHandler(void * context, const xmlChar * characters, int length)
+{
+	[(RichXMLParser *)context foundCharacters:(const char *)characters length:length isCDATA:YES];
+}
+
+/* errorHandler
+ * Swallow libxml2 diagnostics. A malformed feed is reported through the
+ * wellFormed flag instead.
+ */
+static void errorHandler(void * context, const char * message, ...)
+{
+}
+
+@implementation FeedElement
+
+/* initWithName
+ * Creates an element with the given name and attribute dictionary.
+ */
+-(id)initWithName:(NSString *)newName attributes:(NSDictionary *)newAttributes
+{
+	if ((self = [super init]) != nil)
+	{
+		name = [newName retain];
+		attributes = [newAttributes retain];
+		value = nil;
+		childValues = nil;
+
+		// Content of these types is XML embedded in the feed without a CDATA
+		// wrapper. The raw markup is the value of the element.
+		NSString * mimeType = [attributes objectForKey:@"type"];
+		isXMLContent = [mimeType isEqualToString:@"application/xhtml+xml"] || [mimeType isEqualToString:@"xhtml"];
+		if ([mimeType isEqualToString:@"text/html"])
+			isXMLContent = ![[attributes objectForKey:@"mode"] isEqualToString:@"escaped"];
+	}
+	return self;
+}
+
+/* name
+ * Returns the qualified name of the element.
+ */
+-(NSString *)name
+{
+	return name;
+}
+
+/* valueOfAttribute
+ * Returns the value of the named attribute or nil if it isn't present.
+ */
+-(NSString *)valueOfAttribute:(NSString *)attributeName
+{
+	return [attributes objectForKey:attributeName];
+}
+
+/* valueOfElement
+ * Returns the text of the element collected so far. For XML content this is the
+ * markup of the child elements.
+ */
+-(NSMutableString *)valueOfElement
+{
+	if (value == nil)
+		value = [[NSMutableString alloc] init];
+	return value;
+}
+
+/* isXMLContent
+ * Returns whether the children of this element are collected as raw markup.
+ */
+-(BOOL)isXMLContent
+{
+	return isXMLContent;
+}
+
+/* setChildValue
+ * Remembers the value of a child element for containers such as the Atom author
+ * whose meaning depends on more than one child.
+ */
+-(void)setChildValue:(NSString *)childValue forName:(NSString *)childName
+{
+	if (childValues == nil)
+		childValues = [[NSMutableDictionary alloc] init];
+	[childValues setObject:childValue forKey:childName];
+}
+
+/* childValue
+ * Returns the value remembered for the named child element.
+ */
+-(NSString *)childValue:(NSString *)childName
+{
+	return [childValues objectForKey:childName];
+}
+
+/* dealloc
+ * Clean up when we're released.
+ */
+-(void)dealloc
+{
+	[name release];
+	[attributes release];
+	[value release];
+	[childValues release];
+	[super dealloc];
+}
+@end
+
 @implementation FeedItem
 
 /* init
@@ -214,6 +426,27 @@
 
 @implementation RichXMLParser
 
+/* initialize
+ * Make sure libxml2 has set up its global tables and the SAX callbacks are
+ * filled in before any parser is created, possibly on a secondary thread.
+ */
++(void)initialize
+{
+	if (self == [RichXMLParser class])
+	{
+		xmlInitParser();
+
+		memset(&saxHandler, 0, sizeof(saxHandler));
+		saxHandler.startElement = startElementHandler;
+		saxHandler.endElement = endElementHandler;
+		saxHandler.characters = charactersHandler;
+		saxHandler.cdataBlock = cdataBlockHandler;
+		saxHandler.warning = errorHandler;
+		saxHandler.error = errorHandler;
+		saxHandler.fatalError = errorHandler;
+	}
+}
+
 /* init
  * Creates a RichXMLParser instance.
  */
@@ -224,9 +457,33 @@
 		[self setTitle:@""];
 		[self setDescription:@""];
 		lastModified = nil;
+		timeToLive = 0;
+		updatePeriod = 0;
+		updateFrequency = 0;
 		link = nil;
 		items = nil;
 		orderArray = nil;
+		parserContext = NULL;
+		pendingData = nil;
+		sanitizedData = nil;
+		elementStack = nil;
+		currentItem = nil;
+		articleBody = nil;
+		itemIdentifier = nil;
+		itemsBeforeFeedLink = nil;
+		itemsWithoutLink = nil;
+		defaultAuthor = nil;
+		linkBase = nil;
+		linkBaseURL = nil;
+		entryBase = nil;
+		entryBaseURL = nil;
+		NSUInteger index;
+		for (index = 0; index < MA_Date_Cache_Size; ++index)
+		{
+			cachedDateStrings[index] = nil;
+			cachedDates[index] = nil;
+		}
+		nextCachedDate = 0;
 	}
 	return self;
 }
@@ -246,6 +503,47 @@
 	lastModified = nil;
 	link = nil;
 	items = nil;
+	timeToLive = 0;
+	updatePeriod = 0;
+	updateFrequency = 0;
+}
+
+/* resetParseState
+ * Releases everything that only lives for the duration of a parse.
+ */
+-(void)resetParseState
+{
+	if (parserContext != NULL)
+	{
+		xmlFreeParserCtxt(parserContext);
+		parserContext = NULL;
+	}
+	[pendingData release];
+	[sanitizedData release];
+	[elementStack release];
+	[currentItem release];
+	[articleBody release];
+	[itemIdentifier release];
+	[itemsBeforeFeedLink release];
+	[itemsWithoutLink release];
+	[defaultAuthor release];
+	[linkBase release];
+	[linkBaseURL release];
+	[entryBase release];
+	[entryBaseURL release];
+	pendingData = nil;
+	sanitizedData = nil;
+	elementStack = nil;
+	currentItem = nil;
+	articleBody = nil;
+	itemIdentifier = nil;
+	itemsBeforeFeedLink = nil;
+	itemsWithoutLink = nil;
+	defaultAuthor = nil;
+	linkBase = nil;
+	linkBaseURL = nil;
+	entryBase = nil;
+	entryBaseURL = nil;
 }
 
 /* parseRichXML
@@ -256,527 +554,697 @@
 {
 	BOOL success = NO;
 	NS_DURING
-	NSData * parsedXmlData = [self preFlightValidation:xmlData];
-	if (parsedXmlData && [self setData:parsedXmlData])
+	if ([self beginParsing])
 	{
-		XMLParser * subtree;
-		
-		// If this RSS?
-		if ((subtree = [self treeByName:@"rss"]) != nil)
-			success = [self initRSSFeed:subtree isRDF:NO];
-
-		// If this RSS:RDF?
-		else if ((subtree = [self treeByName:@"rdf:RDF"]) != nil)
-			success = [self initRSSFeed:subtree isRDF:YES];
-
-		// Atom?
-		else if ((subtree = [self treeByName:@"feed"]) != nil)
-			success = [self initAtomFeed:subtree];
+		const unsigned char * bytes = [xmlData bytes];
+		NSUInteger length = [xmlData length];
+		NSUInteger offset = 0;
+
+		while (offset < length && !hasParseError)
+		{
+			NSUInteger chunkLength = MIN(MA_Parse_Chunk_Size, length - offset);
+			NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+			[self sanitizeAndParseBytes:bytes + offset length:chunkLength isFinal:NO];
+			[pool release];
+			offset += chunkLength;
+		}
+		success = [self endParsing];
 	}
 	NS_HANDLER
+		[self resetParseState];
 		success = NO;
 	NS_ENDHANDLER
 	return success;
 }
 
-/* extractFeeds
- * Given a block of XML data, determine whether this is HTML format and, if so,
- * extract all RSS links in the data. Returns YES if we found any feeds, or NO if
- * this was not HTML.
+/* beginParsing
+ * Prepares the parser to receive a feed in pieces through parseData. Items are
+ * added to the items array as soon as their closing tag has been seen.
  */
-+(BOOL)extractFeeds:(NSData *)xmlData toArray:(NSMutableArray *)linkArray
+-(BOOL)beginParsing
 {
-	BOOL success = NO;
-	NS_DURING
-	NSArray * arrayOfTags = [XMLTag parserFromData:xmlData];
-	if (arrayOfTags != nil)
-	{
-		for (XMLTag * tag in arrayOfTags)
-		{
-			NSString * tagName = [tag name];
+	[self resetParseState];
+	[orderArray release];
+	orderArray = nil;
+	[items release];
+	items = nil;
+	hasEncodingType = NO;
+	isInMultiByteSequence = NO;
+	hasParseError = NO;
+	feedFormat = MA_FeedFormat_Unknown;
+	xmlContentDepth = 0;
+	isXMLTagOpen = NO;
+	isInChannel = NO;
+	currentItemDepth = 0;
+
+	pendingData = [[NSMutableData alloc] init];
+	sanitizedData = [[NSMutableData alloc] init];
+	elementStack = [[NSMutableArray alloc] init];
+	itemsBeforeFeedLink = [[NSMutableArray alloc] init];
+	itemsWithoutLink = [[NSMutableArray alloc] init];
+	defaultAuthor = [@"" retain];
+
+	parserContext = xmlCreatePushParserCtxt(&saxHandler, self, NULL, 0, NULL);
+	if (parserContext == NULL)
+		return NO;
+	xmlCtxtUseOptions(parserContext, XML_PARSE_NONET);
+	return YES;
+}
 
-			if ([tagName isEqualToString:@"rss"] || [tagName isEqualToString:@"rdf:rdf"] || [tagName isEqualToString:@"feed"])
-			{
-				success = NO;
-				break;
-			}
-			if ([tagName isEqualToString:@"link"])
-			{
-				NSDictionary * tagAttributes = [tag attributes];
-				NSString * linkType = [tagAttributes objectForKey:@"type"];
+/* parseData
+ * Hands the next piece of the feed to the parser. Returns NO as soon as the feed
+ * is known to be malformed.
+ */
+-(BOOL)parseData:(NSData *)xmlData
+{
+	if (parserContext == NULL || hasParseError)
+		return NO;
+	NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+	[self sanitizeAndParseBytes:[xmlData bytes] length:[xmlData length] isFinal:NO];
+	[pool release];
+	return !hasParseError;
+}
 
-				// We're looking for the link tag. Specifically we're looking for the one which
-				// has application/rss+xml or atom+xml type. There may be more than one which is why we're
-				// going to be returning an array.
-				if ([linkType isEqualToString:@"application/rss+xml"])
-				{
-					NSString * href = [tagAttributes objectForKey:@"href"];
-					if (href != nil)
-						[linkArray addObject:href];
-				}
-				else if ([linkType isEqualToString:@"application/atom+xml"])
-				{
-					NSString * href = [tagAttributes objectForKey:@"href"];
-					if (href != nil)
-						[linkArray addObject:href];
-				}
-			}
-			if ([tagName isEqualToString:@"/head"])
-				break;
-			success = [linkArray count] > 0;
-		}
-	}
-	NS_HANDLER
-	success = NO;
-	NS_ENDHANDLER
+/* endParsing
+ * Flushes the last of the feed through the parser and completes the items. Returns
+ * YES if the feed was well formed RSS, RDF or Atom.
+ */
+-(BOOL)endParsing
+{
+	if (parserContext == NULL)
+		return NO;
+
+	if (!hasParseError)
+		[self sanitizeAndParseBytes:NULL length:0 isFinal:YES];
+	BOOL success = !hasParseError && parserContext->wellFormed && feedFormat != MA_FeedFormat_Unknown;
+	if (success && feedFormat != MA_FeedFormat_Atom)
+		[self finishRSSFeed];
+	[self resetParseState];
 	return success;
 }
 
-/* preFlightValidation
- * Try and sanitise the XML data before the XML parser gets a chance to reject it. This
- * should address the most common bad-feed errors until we can change the parser to one
- * that provides us more control.
+/* sanitizeAndParseBytes
+ * Try and sanitise the XML data before the XML parser gets a chance to reject it, then pass
+ * it on. This addresses the most common bad-feed errors: stray '&' characters, HTML entities
+ * that XML doesn't define and stray high-bit characters in a UTF-8 feed. Bytes that can't be
+ * judged until more data arrives are held over to the next call.
  */
--(NSData *)preFlightValidation:(NSData *)xmlData
+-(void)sanitizeAndParseBytes:(const unsigned char *)bytes length:(NSUInteger)length isFinal:(BOOL)isFinal
 {
-	int count = [xmlData length];
-	const unsigned char * srcPtr = [xmlData bytes];
-	const unsigned char * srcEndPtr = srcPtr + count;
+	// Join any bytes held over from the last call with the new ones.
+	if ([pendingData length] > 0u)
+	{
+		if (length > 0u)
+			[pendingData appendBytes:bytes length:length];
+		bytes = [pendingData bytes];
+		length = [pendingData length];
+	}
 
-	// We'll create another data stream with the converted characters
-	NSMutableData * newXmlData = [NSMutableData dataWithLength:count];
-	char * destPtr = [newXmlData mutableBytes];
-	int destCapacity = count;
-	int destSize = count;
-	int destIndex = 0;
+	const unsigned char * srcPtr = bytes;
+	const unsigned char * srcEndPtr = srcPtr + length;
 
-	// Determine XML encoding and BOM
-	NSStringEncoding encodedType;
+	// Determine XML encoding and BOM. We need the whole XML declaration in hand
+	// before we can do that.
+	[sanitizedData setLength:(length * MA_Sanitize_Expansion) + 16];
+	char * destPtr = [sanitizedData mutableBytes];
+	NSUInteger destIndex = 0;
 
-	if ( (count > 2 && srcPtr[0] == 0xFE && srcPtr[1] == 0xFF) ||
-		  (count > 2 && srcPtr[0] == 0xFF && srcPtr[1] == 0xFE) )
+	if (!hasEncodingType)
 	{
-		// Copy Unicode UTF-16 big/little-endian BOM.
-		destPtr[destIndex++] = srcPtr[0];
-		destPtr[destIndex++] = srcPtr[1];
-		srcPtr += 2;
-
-		char* encodingNameStr = "UTF-16";
-		CFStringRef encodingName = CFStringCreateWithBytes(kCFAllocatorDefault, (unsigned char *)encodingNameStr, strlen(encodingNameStr), kCFStringEncodingISOLatin1, false);
-		encodedType = CFStringConvertIANACharSetNameToEncoding(encodingName);
-		CFRelease(encodingName);
-	}
+		if (!isFinal && memchr(bytes, '>', length) == NULL)
+		{
+			if (bytes != [pendingData bytes])
+				[pendingData appendBytes:bytes length:length];
+			return;
+		}
 
-	else if (count > 3 && srcPtr[0] == 0xEF && srcPtr[1] == 0xBB && srcPtr[2] == 0xBF)
-	{
-		// Copy Unicode UTF-8 little-endian BOM.
-		destPtr[destIndex++] = srcPtr[0];
-		destPtr[destIndex++] = srcPtr[1];
-		destPtr[destIndex++] = srcPtr[2];
-		srcPtr += 3;
-
-		char* encodingNameStr = "UTF-8";
-		CFStringRef encodingName = CFStringCreateWithBytes(kCFAllocatorDefault, (unsigned char *)encodingNameStr, strlen(encodingNameStr), kCFStringEncodingISOLatin1, false);
-		encodedType = CFStringConvertIANACharSetNameToEncoding(encodingName);
-		CFRelease(encodingName);
-	}
+		if ( (length > 2 && srcPtr[0] == 0xFE && srcPtr[1] == 0xFF) ||
+			 (length > 2 && srcPtr[0] == 0xFF && srcPtr[1] == 0xFE) )
+		{
+			// Copy Unicode UTF-16 big/little-endian BOM.
+			destPtr[destIndex++] = srcPtr[0];
+			destPtr[destIndex++] = srcPtr[1];
+			srcPtr += 2;
 
-	else
-	{
-		// Lets see if we have any better luck parsing the XML
-		encodedType = [self parseEncodingType:xmlData];
+			char* encodingNameStr = "UTF-16";
+			CFStringRef encodingName = CFStringCreateWithBytes(kCFAllocatorDefault, (unsigned char *)encodingNameStr, strlen(encodingNameStr), kCFStringEncodingISOLatin1, false);
+			encodingType = CFStringConvertIANACharSetNameToEncoding(encodingName);
+			CFRelease(encodingName);
+		}
+		else if (length > 3 && srcPtr[0] == 0xEF && srcPtr[1] == 0xBB && srcPtr[2] == 0xBF)
+		{
+			// Copy Unicode UTF-8 little-endian BOM.
+			destPtr[destIndex++] = srcPtr[0];
+			destPtr[destIndex++] = srcPtr[1];
+			destPtr[destIndex++] = srcPtr[2];
+			srcPtr += 3;
+
+			char* encodingNameStr = "UTF-8";
+			CFStringRef encodingName = CFStringCreateWithBytes(kCFAllocatorDefault, (unsigned char *)encodingNameStr, strlen(encodingNameStr), kCFStringEncodingISOLatin1, false);
+			encodingType = CFStringConvertIANACharSetNameToEncoding(encodingName);
+			CFRelease(encodingName);
+		}
+		else
+		{
+			// Lets see if we have any better luck parsing the XML
+			encodingType = [self parseEncodingType:[NSData dataWithBytesNoCopy:(void *)bytes length:length freeWhenDone:NO]];
+		}
+		hasEncodingType = YES;
 	}
-	
+
 	while (srcPtr < srcEndPtr)
 	{
-		unsigned char ch = *srcPtr++;
-		if (ch >= 0xC0 && ch <= 0xFD && srcPtr < srcEndPtr && *srcPtr >= 0x80 && *srcPtr <= 0xBF)
+		unsigned char ch = *srcPtr;
+		if (isInMultiByteSequence)
+		{
+			// Copy the rest of a UTF-8 sequence unchanged.
+			if (ch & 0x80)
+			{
+				destPtr[destIndex++] = ch;
+				++srcPtr;
+				continue;
+			}
+			isInMultiByteSequence = NO;
+		}
+		if (ch >= 0xC0 && ch <= 0xFD && srcPtr + 1 >= srcEndPtr && !isFinal)
+		{
+			// Can't tell whether this is a lead byte until the next byte arrives.
+			break;
+		}
+		if (ch >= 0xC0 && ch <= 0xFD && srcPtr + 1 < srcEndPtr && srcPtr[1] >= 0x80 && srcPtr[1] <= 0xBF)
 		{
 			// Copy UTF-8 lead bytes unchanged. The parser can cope with
 			// these fine.
 			destPtr[destIndex++] = ch;
-			while (srcPtr < srcEndPtr && (*srcPtr & 0x80))
-				destPtr[destIndex++] = *srcPtr++;
+			++srcPtr;
+			isInMultiByteSequence = YES;
 		}
-		else if (ch > 0x7F && encodedType == NSUTF8StringEncoding)
+		else if (ch > 0x7F && encodingType == NSUTF8StringEncoding)
 		{
 			// Other characters with their high bits set are not valid UTF-8.
 			// But regardless of the encoding scheme, their entity equivalents
 			// are. So convert them into a hex entity character code.
-			if (destSize + 5 > destCapacity)
-			{
-				[newXmlData setLength:destCapacity += 256];
-				destPtr = [newXmlData mutableBytes];
-			}
 			destPtr[destIndex++] = '&';
 			destPtr[destIndex++] = '#';
 			destPtr[destIndex++] = 'x';
 			destPtr[destIndex++] = "0123456789ABCDEF"[(ch / 16)];
 			destPtr[destIndex++] = "0123456789ABCDEF"[(ch % 16)];
 			destPtr[destIndex++] = ';';
-			destSize += 5;
+			++srcPtr;
 		}
-		else if (ch == '&' && srcPtr < srcEndPtr && *srcPtr != '#')
+		else if (ch == '&' && (srcPtr + 1 < srcEndPtr || !isFinal) && (srcPtr + 1 >= srcEndPtr || srcPtr[1] != '#'))
 		{
 			// Some feeds use a '&' outside of its intended use as an entity
-			// delimiter. So if '&' is followed by a non-alphanumeric, make it
+			// delimiter. So if '&' is not followed by an entity name and a ';', make it
 			// into its entity equivalent.
-			const unsigned char * srcTmpPtr = srcPtr;
-			while (srcTmpPtr < srcEndPtr && isalpha(*srcTmpPtr))
+			const unsigned char * namePtr = srcPtr + 1;
+			const unsigned char * srcTmpPtr = namePtr;
+			while (srcTmpPtr < srcEndPtr && isalpha(*srcTmpPtr) && (NSUInteger)(srcTmpPtr - namePtr) < MA_Max_Entity_Length)
 				++srcTmpPtr;
-			if (srcTmpPtr < srcEndPtr && *srcTmpPtr == ';')
-				destPtr[destIndex++] = '&';
-			else
+			if (srcTmpPtr >= srcEndPtr && !isFinal)
+			{
+				// Wait for the rest of the entity name.
+				break;
+			}
+			if (srcTmpPtr < srcEndPtr && *srcTmpPtr == ';' && srcTmpPtr > namePtr)
 			{
-				if (destSize + 4 > destCapacity)
+				NSString * entityName = [[NSString alloc] initWithBytes:namePtr length:srcTmpPtr - namePtr encoding:NSASCIIStringEncoding];
+				if ([entityName isEqualToString:@"amp"] || [entityName isEqualToString:@"lt"] || [entityName isEqualToString:@"gt"] ||
+					[entityName isEqualToString:@"quot"] || [entityName isEqualToString:@"apos"])
 				{
-					[newXmlData setLength:destCapacity += 256];
-					destPtr = [newXmlData mutableBytes];
+					destPtr[destIndex++] = '&';
+					++srcPtr;
+				}
+				else
+				{
+					// XML only predefines five entities. Turn the HTML ones we know about
+					// into character references and quote the rest so they survive as text.
+					NSString * entityString = [NSString mapEntityToString:entityName];
+					if ([entityString hasPrefix:@"&"])
+					{
+						memcpy(destPtr + destIndex, "&amp;", 5);
+						destIndex += 5;
+						++srcPtr;
+					}
+					else
+					{
+						NSUInteger index;
+						for (index = 0; index < [entityString length]; ++index)
+							destIndex += sprintf(destPtr + destIndex, "&#%u;", (unsigned int)[entityString characterAtIndex:index]);
+						srcPtr = srcTmpPtr + 1;
+					}
 				}
-				destPtr[destIndex++] = '&';
-				destPtr[destIndex++] = 'a';
-				destPtr[destIndex++] = 'm';
-				destPtr[destIndex++] = 'p';
-				destPtr[destIndex++] = ';';
-				destSize += 4;
+				[entityName release];
+			}
+			else
+			{
+				memcpy(destPtr + destIndex, "&amp;", 5);
+				destIndex += 5;
+				++srcPtr;
 			}
 		}
 		else
+		{
 			destPtr[destIndex++] = ch;
+			++srcPtr;
+		}
 	}
-	NSAssert(destIndex == destSize, @"Did not copy all data bytes to destination buffer");
-	[newXmlData setLength:destIndex];
-	
-	// Make sure that the last valid character of the feed is '>' otherwise it was truncated. The
-	// CFXML parser annoyingly crashes if it is given a truncated feed.
-	while (--destIndex > 0 && (destPtr[destIndex] == '\0' || isspace(destPtr[destIndex])));
-	return (destPtr[destIndex] == '>') ? newXmlData : nil;
+
+	// Hold over whatever we couldn't decide on yet.
+	NSData * remainder = (srcPtr < srcEndPtr) ? [NSData dataWithBytes:srcPtr length:srcEndPtr - srcPtr] : nil;
+	[pendingData setLength:0];
+	if (remainder != nil)
+		[pendingData appendData:remainder];
+
+	if (xmlParseChunk(parserContext, destPtr, destIndex, isFinal) != 0)
+		hasParseError = YES;
 }
 
-/* parseEncodingType
- * Parse off the encoding field.
+/* startElement
+ * Called by the SAX handler at the start of each element. Inside XML content the
+ * element is re-serialised into the value of the enclosing element rather than
+ * getting an entry on the stack.
  */
--(NSStringEncoding)parseEncodingType:(NSData *)xmlData
+-(void)startElement:(NSString *)name attributes:(NSDictionary *)attributes
 {
-	NSStringEncoding encodingType = NSUTF8StringEncoding;
-	const char * textPtr = [xmlData bytes];
-	const char * textEndPtr = textPtr + [xmlData length];
-
-	while (textPtr < textEndPtr && *textPtr != '<')
-		++textPtr;
-
-	// Scan for the encoding attribute name up until the closing tag
-	const char * encodingAttribute = "encoding=";
-	const char * encodingAttributePtr = encodingAttribute;
-	while (textPtr < textEndPtr && *encodingAttributePtr != '\0' && *textPtr != '>')
+	if (xmlContentDepth > 0)
 	{
-		if (*textPtr == *encodingAttributePtr)
-			++encodingAttributePtr;
-		else
-			encodingAttributePtr = encodingAttribute;
-		++textPtr;
+		NSMutableString * xmlString = [[elementStack lastObject] valueOfElement];
+		if (isXMLTagOpen)
+			[xmlString appendString:@">"];
+		[xmlString appendFormat:@"<%@", name];
+		for (NSString * attributeName in attributes)
+			[xmlString appendFormat:@" %@=\"%@\"", attributeName, [XMLParser quoteAttributes:[attributes objectForKey:attributeName]]];
+		isXMLTagOpen = YES;
+		++xmlContentDepth;
+		return;
 	}
 
-	// If we found it, parse off the encoding type name
-	if (*encodingAttributePtr == '\0')
+	FeedElement * element = [[FeedElement alloc] initWithName:name attributes:attributes];
+	[elementStack addObject:element];
+	if ([element isXMLContent])
 	{
-		if (textPtr < textEndPtr && *textPtr == '"')
-			++textPtr;
-
-		// We need to special case UTF-8 as CFStringConvertIANACharSetNameToEncoding
-		// doesn't recognise it.
-		const char * encodingNamePtr = textPtr;
-		const char * utf8EncodingName = "UTF-8";
-		const char * utf8EncodingNamePtr = utf8EncodingName;
-		while (textPtr < textEndPtr && *textPtr != '"')
-		{
-			if (toupper(*textPtr) == *utf8EncodingNamePtr)
-				++utf8EncodingNamePtr;
-			else
-				utf8EncodingNamePtr = utf8EncodingName;
-			++textPtr;
-		}
-
-		// Now extract the encoding name if it wasn't UTF-8
-		if (*utf8EncodingNamePtr != '\0')
-		{
-			CFStringRef encodingName = CFStringCreateWithBytes(kCFAllocatorDefault, (unsigned char *)encodingNamePtr, textPtr - encodingNamePtr, kCFStringEncodingISOLatin1, false);
-			encodingType = CFStringConvertIANACharSetNameToEncoding(encodingName);
-			CFRelease(encodingName);
-		}
+		xmlContentDepth = 1;
+		isXMLTagOpen = NO;
 	}
-	return encodingType;
+	[self didStartElement:element depth:[elementStack count]];
+	[element release];
 }
 
-/* initRSSFeed
- * Prime the feed with header and items from an RSS feed
+/* endElement
+ * Called by the SAX handler at the end of each element.
  */
--(BOOL)initRSSFeed:(XMLParser *)feedTree isRDF:(BOOL)isRDF
+-(void)endElement:(NSString *)name
 {
-	BOOL success = [self initRSSFeedHeader:[self channelTree:feedTree]];
-	if (success)
+	if (xmlContentDepth > 1)
 	{
-		if (isRDF)
-			success = [self initRSSFeedItems:feedTree];
+		NSMutableString * xmlString = [[elementStack lastObject] valueOfElement];
+		if (isXMLTagOpen)
+			[xmlString appendString:@"/>"];
 		else
-			success = [self initRSSFeedItems:[self channelTree:feedTree]];
+			[xmlString appendFormat:@"</%@>", name];
+		isXMLTagOpen = NO;
+		--xmlContentDepth;
+		return;
 	}
-	return success;
-}
+	xmlContentDepth = 0;
 
-/* channelTree
- * Return the root of the RSS feed's channel.
- */
--(XMLParser *)channelTree:(XMLParser *)feedTree
-{
-	XMLParser * channelTree = [feedTree treeByName:@"channel"];
-	if (channelTree == nil)
-		channelTree = [feedTree treeByName:@"rss:channel"];
-	return channelTree;
+	FeedElement * element = [[elementStack lastObject] retain];
+	if (element != nil)
+	{
+		[self didEndElement:element depth:[elementStack count]];
+		[elementStack removeLastObject];
+		[element release];
+	}
 }
 
-/* initRSSFeedHeader
- * Parse an RSS feed header items.
+/* foundCharacters
+ * Called by the SAX handler with character data. The text belongs to the innermost
+ * open element.
  */
--(BOOL)initRSSFeedHeader:(XMLParser *)feedTree
+-(void)foundCharacters:(const char *)characters length:(int)length isCDATA:(BOOL)isCDATA
 {
-	BOOL success = YES;
-	
-	// Iterate through the channel items
-	int count = [feedTree countOfChildren];
-	int index;
-	
-	for (index = 0; index < count; ++index)
-	{
-		XMLParser * subTree = [feedTree treeByIndex:index];
-		NSString * nodeName = [subTree nodeName];
+	FeedElement * element = [elementStack lastObject];
+	if (element == nil)
+		return;
 
-		// Parse title
-		if ([nodeName isEqualToString:@"title"])
+	NSString * text = [[NSString alloc] initWithBytes:characters length:length encoding:NSUTF8StringEncoding];
+	if (text != nil)
+	{
+		NSMutableString * valueString = [element valueOfElement];
+		if (xmlContentDepth == 0)
+			[valueString appendString:text];
+		else
 		{
-			[self setTitle:[[subTree valueOfElement] stringByUnescapingExtendedCharacters]];
-			continue;
+			if (isXMLTagOpen)
+			{
+				[valueString appendString:@">"];
+				isXMLTagOpen = NO;
+			}
+			if (isCDATA)
+				[valueString appendFormat:@"<![CDATA[%@]]>", text];
+			else
+				appendEscapedText(valueString, text);
 		}
+		[text release];
+	}
+}
+
+/* didStartElement
+ * Works out the feed format from the document element and notes the start of each
+ * item so that its children can be collected.
+ */
+-(void)didStartElement:(FeedElement *)element depth:(NSUInteger)depth
+{
+	NSString * name = [element name];
 
-		// Parse items group which dictates the sequence of the articles.
-		if ([nodeName isEqualToString:@"items"])
+	if (depth == 1)
+	{
+		if ([name isEqualToString:@"rss"])
+			feedFormat = MA_FeedFormat_RSS;
+		else if ([name isEqualToString:@"rdf:RDF"])
+			feedFormat = MA_FeedFormat_RDF;
+		else if ([name isEqualToString:@"feed"])
 		{
-			XMLParser * seqTree = [subTree treeByName:@"rdf:Seq"];
-			if (seqTree != nil)
-				[self parseSequence:seqTree];
-		}
+			feedFormat = MA_FeedFormat_Atom;
 
-		// Parse description
-		if ([nodeName isEqualToString:@"description"])
+			// Look for feed attributes we need to process
+			linkBase = [[[element valueOfAttribute:@"xml:base"] stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding] retain];
+			if (linkBase == nil)
+				linkBase = [[[self link] stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding] retain];
+			linkBaseURL = (linkBase != nil) ? [[NSURL URLWithString:linkBase] retain] : nil;
+		}
+		if (feedFormat != MA_FeedFormat_Unknown)
 		{
-			[self setDescription:[subTree valueOfElement]];
-			continue;
-		}			
-		
-		// Parse link
-		if ([nodeName isEqualToString:@"link"])
+			NSAssert(items == nil, @"Feed items allocated more than once per initialisation");
+			items = [[NSMutableArray alloc] initWithCapacity:10];
+		}
+		return;
+	}
+
+	if (feedFormat == MA_FeedFormat_RSS || feedFormat == MA_FeedFormat_RDF)
+	{
+		if (depth == 2 && ([name isEqualToString:@"channel"] || [name isEqualToString:@"rss:channel"]))
 		{
-			[self setLink:[[subTree valueOfElement] stringByUnescapingExtendedCharacters]];
-			continue;
-		}			
-		
-		// Parse the date when this feed was last updated
-		if ([nodeName isEqualToString:@"lastBuildDate"])
+			isInChannel = YES;
+			return;
+		}
+
+		// RSS items live in the channel while RDF puts them alongside it.
+		BOOL isItemDepth = (feedFormat == MA_FeedFormat_RDF) ? (depth == 2) : (isInChannel && depth == 3);
+		if (isItemDepth && currentItem == nil && [name isEqualToString:@"item"])
 		{
-			NSString * dateString = [subTree valueOfElement];
-			[self setLastModified:[XMLParser parseXMLDate:dateString]];
-			continue;
+			currentItem = [[FeedItem alloc] init];
+			currentItemDepth = depth;
+			hasDetailedContent = NO;
+			hasLink = NO;
+
+			// Check for rdf:about so we can identify this item in the orderArray.
+			itemIdentifier = [[element valueOfAttribute:@"rdf:about"] retain];
+			return;
 		}
-		
-		// Parse item date
-		if ([nodeName isEqualToString:@"dc:date"])
+
+		// The items group dictates the sequence of the articles.
+		if (isInChannel && depth == 4 && [name isEqualToString:@"rdf:Seq"] && [[[elementStack objectAtIndex:2] name] isEqualToString:@"items"])
 		{
-			NSString * dateString = [subTree valueOfElement];
-			[self setLastModified:[XMLParser parseXMLDate:dateString]];
-			continue;
+			[orderArray release];
+			orderArray = [[NSMutableArray alloc] init];
 		}
-		
-		// Parse item date
-		if ([nodeName isEqualToString:@"pubDate"])
+		return;
+	}
+
+	if (feedFormat == MA_FeedFormat_Atom && depth == 2 && currentItem == nil && [name isEqualToString:@"entry"])
+	{
+		currentItem = [[FeedItem alloc] init];
+		currentItemDepth = depth;
+		[currentItem setAuthor:defaultAuthor];
+
+		// Look for the xml:base attribute, and use absolute url or stack relative url
+		NSString * newEntryBase = [[element valueOfAttribute:@"xml:base"] stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+		if (newEntryBase == nil)
+			newEntryBase = linkBase;
+		NSURL * newEntryBaseURL = (newEntryBase != nil) ? [NSURL URLWithString:newEntryBase] : nil;
+		if ((newEntryBaseURL != nil) && (linkBaseURL != nil) && ([newEntryBaseURL scheme] == nil))
 		{
-			NSString * dateString = [subTree valueOfElement];
-			[self setLastModified:[XMLParser parseXMLDate:dateString]];
-			continue;
+			newEntryBaseURL = [NSURL URLWithString:newEntryBase relativeToURL:linkBaseURL];
+			if (newEntryBaseURL != nil)
+				newEntryBase = [newEntryBaseURL absoluteString];
 		}
+		entryBase = [newEntryBase retain];
+		entryBaseURL = [newEntryBaseURL retain];
 	}
-	return success;
 }
 
-/* parseSequence
- * Parses an RDF sequence and initialises orderArray with the appropriate sequence.
- * The RSS parser will then use this to order the actual items appropriately.
+/* didEndElement
+ * Dispatches a completed element to the code that handles its position in the feed.
  */
--(void)parseSequence:(XMLParser *)seqTree
+-(void)didEndElement:(FeedElement *)element depth:(NSUInteger)depth
 {
-	int count = [seqTree countOfChildren];
-	int index;
-
-	[orderArray release];
-	orderArray = [[NSMutableArray alloc] initWithCapacity:count];
-	for (index = 0; index < count; ++index)
+	if (feedFormat == MA_FeedFormat_RSS || feedFormat == MA_FeedFormat_RDF)
 	{
-		XMLParser * subTree = [seqTree treeByIndex:index];
-		if ([[subTree nodeName] isEqualToString:@"rdf:li"])
+		if (currentItem != nil && depth == currentItemDepth)
+			[self finishRSSItem];
+		else if (currentItem != nil && depth == currentItemDepth + 1)
+			[self parseRSSItemElement:element];
+		else if (isInChannel && depth == 3)
+			[self parseRSSChannelElement:element];
+		else if (isInChannel && depth == 2)
+			isInChannel = NO;
+		else if (isInChannel && depth == 5 && orderArray != nil && [[element name] isEqualToString:@"rdf:li"] &&
+				 [[[elementStack objectAtIndex:3] name] isEqualToString:@"rdf:Seq"] && [[[elementStack objectAtIndex:2] name] isEqualToString:@"items"])
 		{
-			NSString * resourceString = [subTree valueOfAttribute:@"rdf:resource"];
+			NSString * resourceString = [element valueOfAttribute:@"rdf:resource"];
 			if (resourceString == nil)
-				resourceString = [subTree valueOfAttribute:@"resource"];
+				resourceString = [element valueOfAttribute:@"resource"];
 			if (resourceString != nil)
 				[orderArray addObject:resourceString];
 		}
 	}
+	else if (feedFormat == MA_FeedFormat_Atom)
+	{
+		if (currentItem != nil && depth == currentItemDepth)
+			[self finishAtomEntry];
+		else if (currentItem != nil && depth == currentItemDepth + 1)
+			[self parseAtomEntryElement:element];
+		else if (depth == 2)
+			[self parseAtomFeedElement:element];
+		else if (depth > 2 && [[[elementStack objectAtIndex:depth - 2] name] isEqualToString:@"author"])
+		{
+			// Remember the name and email of an author for when the author element closes.
+			[[elementStack objectAtIndex:depth - 2] setChildValue:[element valueOfElement] forName:[element name]];
+		}
+	}
 }
 
-/* initRSSFeedItems
- * Parse the items from an RSS feed
+/* parseRSSChannelElement
+ * Parse an RSS feed header item.
  */
--(BOOL)initRSSFeedItems:(XMLParser *)feedTree
+-(void)parseRSSChannelElement:(FeedElement *)element
 {
-	BOOL success = YES;
+	NSString * nodeName = [element name];
 
-	// Iterate through the channel items
-	int count = [feedTree countOfChildren];
-	int index;
+	// Parse title
+	if ([nodeName isEqualToString:@"title"])
+	{
+		[self setTitle:[[element valueOfElement] stringByUnescapingExtendedCharacters]];
+		return;
+	}
 
-	// Allocate an items array
-	NSAssert(items == nil, @"initRSSFeedItems called more than once per initialisation");
-	items = [[NSMutableArray alloc] initWithCapacity:count];
+	// Parse description
+	if ([nodeName isEqualToString:@"description"])
+	{
+		[self setDescription:[element valueOfElement]];
+		return;
+	}
 
-	for (index = 0; index < count; ++index)
+	// Parse link
+	if ([nodeName isEqualToString:@"link"])
 	{
-		XMLParser * subTree = [feedTree treeByIndex:index];
-		NSString * nodeName = [subTree nodeName];
-		
-		// Parse a single item to construct a FeedItem object which is appended to
-		// the items array we maintain.
-		if ([nodeName isEqualToString:@"item"])
-		{
-			FeedItem * newItem = [[FeedItem alloc] init];
-			int itemCount = [subTree countOfChildren];
-			NSMutableString * articleBody = nil;
-			BOOL hasDetailedContent = NO;
-			BOOL hasLink = NO;
-			int itemIndex;
+		[self setLink:[[element valueOfElement] stringByUnescapingExtendedCharacters]];
+		return;
+	}
 
-			// Check for rdf:about so we can identify this item in the orderArray.
-			NSString * itemIdentifier = [subTree valueOfAttribute:@"rdf:about"];
+	// Parse the date when this feed was last updated
+	if ([nodeName isEqualToString:@"lastBuildDate"] || [nodeName isEqualToString:@"dc:date"] || [nodeName isEqualToString:@"pubDate"])
+	{
+		NSString * dateString = [element valueOfElement];
+		[self setLastModified:[self dateFromString:dateString]];
+		return;
+	}
 
-			for (itemIndex = 0; itemIndex < itemCount; ++itemIndex)
-			{
-				XMLParser * subItemTree = [subTree treeByIndex:itemIndex];
-				NSString * itemNodeName = [subItemTree nodeName];
+	// Parse how often the feed says it should be polled
+	if ([self parseUpdateHintElement:element])
+		return;
+}
 
-				// Parse item title
-				if ([itemNodeName isEqualToString:@"title"])
-				{
-					NSString * newTitle = [[subItemTree valueOfElement] stringByUnescapingExtendedCharacters];
-					[newItem setTitle:[[self stripHTMLTags:newTitle] firstNonBlankLine]];
-					continue;
-				}
-				
-				// Parse item description
-				if ([itemNodeName isEqualToString:@"description"] && !hasDetailedContent)
-				{
-					[articleBody release];
-					articleBody = [[subItemTree valueOfElement] retain];
-					continue;
-				}
-				
-				// Parse GUID. The GUID may optionally have a permaLink attribute
-				// in which case this is also the article link unless overridden by
-				// an explicit link tag.
-				if ([itemNodeName isEqualToString:@"guid"])
-				{
-					NSString * permaLink = [subItemTree valueOfAttribute:@"isPermaLink"];
-					if (permaLink && [permaLink isEqualToString:@"true"] && !hasLink)
-						[newItem setLink:[subItemTree valueOfElement]];
-					[newItem setGuid:[subItemTree valueOfElement]];
-					continue;
-				}
-				
-				// Parse detailed item description. This overrides the existing
-				// description for this item.
-				if ([itemNodeName isEqualToString:@"content:encoded"])
-				{
-					[articleBody release];
-					articleBody = [[subItemTree valueOfElement] retain];
-					hasDetailedContent = YES;
-					continue;
-				}
-				
-				// Parse item author
-				if ([itemNodeName isEqualToString:@"author"])
-				{
-					[newItem setAuthor:[subItemTree valueOfElement]];
-					continue;
-				}
-				
-				// Parse item author
-				if ([itemNodeName isEqualToString:@"dc:creator"])
-				{
-					[newItem setAuthor:[subItemTree valueOfElement]];
-					continue;
-				}
-				
-				// Parse item date
-				if ([itemNodeName isEqualToString:@"dc:date"])
-				{
-					NSString * dateString = [subItemTree valueOfElement];
-					[newItem setDate:[XMLParser parseXMLDate:dateString]];
-					continue;
-				}
-				
-				// Parse item link
-				if ([itemNodeName isEqualToString:@"link"])
-				{
-					[newItem setLink:[[subItemTree valueOfElement] stringByUnescapingExtendedCharacters]];
-					hasLink = YES;
-					continue;
-				}
-				
-				// Parse item date
-				if ([itemNodeName isEqualToString:@"pubDate"])
-				{
-					NSString * dateString = [subItemTree valueOfElement];
-					[newItem setDate:[XMLParser parseXMLDate:dateString]];
-					continue;
-				}
-				
-				// Parse associated enclosure
-				if ([itemNodeName isEqualToString:@"enclosure"])
-				{
-					if ([subItemTree valueOfAttribute:@"url"])
-						[newItem setEnclosure:[subItemTree valueOfAttribute:@"url"]];
-					continue;
-				}
+/* parseUpdateHintElement
+ * Parses the RSS ttl element and the syndication module's update period and
+ * frequency, which tell readers how often the feed is worth polling. Returns
+ * YES if the element was one of these.
+ */
+-(BOOL)parseUpdateHintElement:(FeedElement *)element
+{
+	NSString * nodeName = [element name];
 
-			}
-			
-			// If no link, set it to the feed link if there is one
-			if (!hasLink && [self link])
-				[newItem setLink:[self link]];
+	if ([nodeName isEqualToString:@"ttl"])
+	{
+		timeToLive = [[element valueOfElement] intValue] * 60;
+		return YES;
+	}
+	if ([nodeName isEqualToString:@"sy:updatePeriod"])
+	{
+		NSString * period = [[[element valueOfElement] trim] lowercaseString];
+		if ([period isEqualToString:@"hourly"])
+			updatePeriod = 60 * 60;
+		else if ([period isEqualToString:@"daily"])
+			updatePeriod = 24 * 60 * 60;
+		else if ([period isEqualToString:@"weekly"])
+			updatePeriod = 7 * 24 * 60 * 60;
+		else if ([period isEqualToString:@"monthly"])
+			updatePeriod = 30 * 24 * 60 * 60;
+		else if ([period isEqualToString:@"yearly"])
+			updatePeriod = 365 * 24 * 60 * 60;
+		return YES;
+	}
+	if ([nodeName isEqualToString:@"sy:updateFrequency"])
+	{
+		updateFrequency = [[element valueOfElement] intValue];
+		return YES;
+	}
+	return NO;
+}
 
-			// Do relative IMG tag fixup
-			[articleBody fixupRelativeImgTags:[self link]];
-			[newItem setDescription:SafeString(articleBody)];
-			[articleBody release];
+/* parseRSSItemElement
+ * Parse one child of an RSS item into the FeedItem being built.
+ */
+-(void)parseRSSItemElement:(FeedElement *)element
+{
+	NSString * itemNodeName = [element name];
 
-			// Derive any missing title
-			[self ensureTitle:newItem];
-			
-			// Add this item in the proper location in the array
-			NSInteger indexOfItem = (orderArray && itemIdentifier) ? [orderArray indexOfStringInArray:itemIdentifier] : NSNotFound;
-			if (indexOfItem == NSNotFound || indexOfItem >= [items count])
-				[items addObject:newItem];
-			else
-				[items insertObject:newItem atIndex:indexOfItem];
-			[newItem release];
+	// Parse item title
+	if ([itemNodeName isEqualToString:@"title"])
+	{
+		NSString * newTitle = [[element valueOfElement] stringByUnescapingExtendedCharacters];
+		[currentItem setTitle:[[self stripHTMLTags:newTitle] firstNonBlankLine]];
+		return;
+	}
+
+	// Parse item description
+	if ([itemNodeName isEqualToString:@"description"] && !hasDetailedContent)
+	{
+		[articleBody release];
+		articleBody = [[element valueOfElement] retain];
+		return;
+	}
+
+	// Parse GUID. The GUID may optionally have a permaLink attribute
+	// in which case this is also the article link unless overridden by
+	// an explicit link tag.
+	if ([itemNodeName isEqualToString:@"guid"])
+	{
+		NSString * permaLink = [element valueOfAttribute:@"isPermaLink"];
+		if (permaLink && [permaLink isEqualToString:@"true"] && !hasLink)
+			[currentItem setLink:[element valueOfElement]];
+		[currentItem setGuid:[element valueOfElement]];
+		return;
+	}
+
+	// Parse detailed item description. This overrides the existing
+	// description for this item.
+	if ([itemNodeName isEqualToString:@"content:encoded"])
+	{
+		[articleBody release];
+		articleBody = [[element valueOfElement] retain];
+		hasDetailedContent = YES;
+		return;
+	}
+
+	// Parse item author
+	if ([itemNodeName isEqualToString:@"author"] || [itemNodeName isEqualToString:@"dc:creator"])
+	{
+		[currentItem setAuthor:[element valueOfElement]];
+		return;
+	}
+
+	// Parse item date
+	if ([itemNodeName isEqualToString:@"dc:date"] || [itemNodeName isEqualToString:@"pubDate"])
+	{
+		NSString * dateString = [element valueOfElement];
+		[currentItem setDate:[self dateFromString:dateString]];
+		return;
+	}
+
+	// Parse item link
+	if ([itemNodeName isEqualToString:@"link"])
+	{
+		[currentItem setLink:[[element valueOfElement] stringByUnescapingExtendedCharacters]];
+		hasLink = YES;
+		return;
+	}
+
+	// Parse associated enclosure
+	if ([itemNodeName isEqualToString:@"enclosure"])
+	{
+		if ([element valueOfAttribute:@"url"])
+			[currentItem setEnclosure:[element valueOfAttribute:@"url"]];
+		return;
+	}
+}
+
+/* finishRSSItem
+ * Completes the current RSS item and adds it to the items array in its proper place.
+ */
+-(void)finishRSSItem
+{
+	// If no link, set it to the feed link if there is one. The channel link
+	// may not have been seen yet in which case finishRSSFeed takes care of it.
+	if ([self link] == nil)
+	{
+		[itemsBeforeFeedLink addObject:currentItem];
+		if (!hasLink)
+			[itemsWithoutLink addObject:currentItem];
+	}
+	else if (!hasLink)
+		[currentItem setLink:[self link]];
+
+	// Do relative IMG tag fixup
+	[articleBody fixupRelativeImgTags:[self link]];
+	[currentItem setDescription:SafeString(articleBody)];
+
+	// Derive any missing title
+	[self ensureTitle:currentItem];
+
+	// Add this item in the proper location in the array
+	NSInteger indexOfItem = (orderArray && itemIdentifier) ? [orderArray indexOfStringInArray:itemIdentifier] : NSNotFound;
+	if (indexOfItem == NSNotFound || indexOfItem >= [items count])
+		[items addObject:currentItem];
+	else
+		[items insertObject:currentItem atIndex:indexOfItem];
+
+	[currentItem release];
+	[articleBody release];
+	[itemIdentifier release];
+	currentItem = nil;
+	articleBody = nil;
+	itemIdentifier = nil;
+}
+
+/* finishRSSFeed
+ * Fills in the details that depend on the feed as a whole once all items are in.
+ */
+-(void)finishRSSFeed
+{
+	// Items that closed before the channel link was seen still need it.
+	if ([self link] != nil)
+	{
+		for (FeedItem * anItem in itemsBeforeFeedLink)
+		{
+			NSMutableString * newDescription = [NSMutableString stringWithString:[anItem description]];
+			[newDescription fixupRelativeImgTags:[self link]];
+			[anItem setDescription:newDescription];
 		}
+		for (FeedItem * anItem in itemsWithoutLink)
+			[anItem setLink:[self link]];
 	}
 
 	// Now scan the array and set the article date if it is missing. We'll use the
@@ -791,258 +1259,286 @@
 			[anItem setDate:itemDate];
 		itemDate = [itemDate addTimeInterval:-1.0];
 	}
-	return success;
 }
 
-/* initAtomFeed
- * Prime the feed with header and items from an Atom feed
+/* parseAtomFeedElement
+ * Parse an Atom feed header item.
  */
--(BOOL)initAtomFeed:(XMLParser *)feedTree
+-(void)parseAtomFeedElement:(FeedElement *)element
 {
-	BOOL success = YES;
-	
-	// Allocate an items array
-	NSAssert(items == nil, @"initAtomFeed called more than once per initialisation");
-	items = [[NSMutableArray alloc] initWithCapacity:10];
-	
-	// Look for feed attributes we need to process
-	NSString * linkBase = [[feedTree valueOfAttribute:@"xml:base"] stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
-	if (linkBase == nil)
-		linkBase = [[self link] stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
-	NSURL * linkBaseURL = (linkBase != nil) ? [NSURL URLWithString:linkBase] : nil;
-
-	// Iterate through the atom items
-	NSString * defaultAuthor = @"";
-	int count = [feedTree countOfChildren];
-	int index;
-	
-	for (index = 0; index < count; ++index)
+	NSString * nodeName = [element name];
+
+	// Parse title
+	if ([nodeName isEqualToString:@"title"])
 	{
-		XMLParser * subTree = [feedTree treeByIndex:index];
-		NSString * nodeName = [subTree nodeName];
+		[self setTitle:[[element valueOfElement] stringByUnescapingExtendedCharacters]];
+		return;
+	}
 
-		// Parse title
-		if ([nodeName isEqualToString:@"title"])
-		{
-			[self setTitle:[[subTree valueOfElement] stringByUnescapingExtendedCharacters]];
-			continue;
-		}
-		
-		// Parse description
-		if ([nodeName isEqualToString:@"subtitle"])
-		{
-			[self setDescription:[subTree valueOfElement]];
-			continue;
-		}			
-		
-		// Parse description
-		if ([nodeName isEqualToString:@"tagline"])
-		{
-			[self setDescription:[subTree valueOfElement]];
-			continue;
-		}			
+	// Parse description
+	if ([nodeName isEqualToString:@"subtitle"] || [nodeName isEqualToString:@"tagline"])
+	{
+		[self setDescription:[element valueOfElement]];
+		return;
+	}
 
-		// Parse link
-		if ([nodeName isEqualToString:@"link"])
+	// Parse link
+	if ([nodeName isEqualToString:@"link"])
+	{
+		if ([element valueOfAttribute:@"rel"] == nil || [[element valueOfAttribute:@"rel"] isEqualToString:@"alternate"])
 		{
-			if ([subTree valueOfAttribute:@"rel"] == nil || [[subTree valueOfAttribute:@"rel"] isEqualToString:@"alternate"])
+			NSString * theLink = [[element valueOfAttribute:@"href"] stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+			if (theLink != nil)
 			{
-				NSString * theLink = [[subTree valueOfAttribute:@"href"] stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
-				if (theLink != nil)
+				if ((linkBaseURL != nil) && ![theLink hasPrefix:@"http://"])
 				{
-					if ((linkBaseURL != nil) && ![theLink hasPrefix:@"http://"])
-					{
-						NSURL * theLinkURL = [NSURL URLWithString:theLink relativeToURL:linkBaseURL];
-						[self setLink:(theLinkURL != nil) ? [theLinkURL absoluteString] : theLink];
-					}
-					else
-						[self setLink:theLink];
+					NSURL * theLinkURL = [NSURL URLWithString:theLink relativeToURL:linkBaseURL];
+					[self setLink:(theLinkURL != nil) ? [theLinkURL absoluteString] : theLink];
 				}
+				else
+					[self setLink:theLink];
 			}
-			continue;
-		}			
-		
-		// Parse author at the feed level. This is the default for any entry
-		// that doesn't have an explicit author.
-		if ([nodeName isEqualToString:@"author"])
-		{
-			XMLParser * emailTree = [subTree treeByName:@"name"];
-			if (emailTree != nil)
-				defaultAuthor = [emailTree valueOfElement];
-			continue;
 		}
-		
-		// Parse the date when this feed was last updated
-		if ([nodeName isEqualToString:@"updated"])
+		return;
+	}
+
+	// Parse author at the feed level. This is the default for any entry
+	// that doesn't have an explicit author.
+	if ([nodeName isEqualToString:@"author"])
+	{
+		NSString * authorName = [element childValue:@"name"];
+		if (authorName != nil)
 		{
-			NSString * dateString = [subTree valueOfElement];
-			[self setLastModified:[XMLParser parseXMLDate:dateString]];
-			continue;
+			[authorName retain];
+			[defaultAuthor release];
+			defaultAuthor = authorName;
 		}
-		
-		// Parse the date when this feed was last updated
-		if ([nodeName isEqualToString:@"modified"])
+		return;
+	}
+
+	// Parse the date when this feed was last updated
+	if ([nodeName isEqualToString:@"updated"] || [nodeName isEqualToString:@"modified"])
+	{
+		NSString * dateString = [element valueOfElement];
+		[self setLastModified:[self dateFromString:dateString]];
+		return;
+	}
+
+	// Parse how often the feed says it should be polled
+	if ([self parseUpdateHintElement:element])
+		return;
+}
+
+/* parseAtomEntryElement
+ * Parse one child of an Atom entry into the FeedItem being built.
+ */
+-(void)parseAtomEntryElement:(FeedElement *)element
+{
+	NSString * itemNodeName = [element name];
+
+	// Parse item title
+	if ([itemNodeName isEqualToString:@"title"])
+	{
+		NSString * newTitle = [[element valueOfElement] stringByUnescapingExtendedCharacters];
+		NSString * titleType = [element valueOfAttribute:@"type"];
+
+		if ([titleType isEqualToString:@"html"] || [titleType isEqualToString:@"xhtml"])
+			newTitle = [self stripHTMLTags:newTitle];
+
+		[currentItem setTitle:[newTitle firstNonBlankLine]];
+		return;
+	}
+
+	// Parse item description
+	if ([itemNodeName isEqualToString:@"content"] || [itemNodeName isEqualToString:@"summary"])
+	{
+		[articleBody release];
+		articleBody = [[element valueOfElement] retain];
+		return;
+	}
+
+	// Parse item author
+	if ([itemNodeName isEqualToString:@"author"])
+	{
+		NSString * authorName = [element childValue:@"name"];
+		if (authorName == nil)
+			authorName = [element childValue:@"email"];
+		if (authorName != nil)
+			[currentItem setAuthor:authorName];
+		return;
+	}
+
+	// Parse item link
+	if ([itemNodeName isEqualToString:@"link"])
+	{
+		NSString * relType = [element valueOfAttribute:@"rel"];
+		BOOL isEnclosure = [relType isEqualToString:@"enclosure"];
+		if (isEnclosure || relType == nil || [relType isEqualToString:@"alternate"])
 		{
-			NSString * dateString = [subTree valueOfElement];
-			[self setLastModified:[XMLParser parseXMLDate:dateString]];
-			continue;
+			NSString * theLink = [[element valueOfAttribute:@"href"] stringByUnescapingExtendedCharacters];
+			if (theLink != nil)
+			{
+				if ((entryBaseURL != nil) && ([[NSURL URLWithString:theLink] scheme] == nil))
+				{
+					NSURL * theLinkURL = [NSURL URLWithString:theLink relativeToURL:entryBaseURL];
+					theLink = (theLinkURL != nil) ? [theLinkURL absoluteString] : theLink;
+				}
+				if (isEnclosure)
+					[currentItem setEnclosure:theLink];
+				else
+					[currentItem setLink:theLink];
+			}
 		}
-		
-		// Parse a single item to construct a FeedItem object which is appended to
-		// the items array we maintain.
-		if ([nodeName isEqualToString:@"entry"])
+		return;
+	}
+
+	// Parse item id
+	if ([itemNodeName isEqualToString:@"id"])
+	{
+		[currentItem setGuid:[element valueOfElement]];
+		return;
+	}
+
+	// Parse item date
+	if ([itemNodeName isEqualToString:@"modified"] || [itemNodeName isEqualToString:@"created"] || [itemNodeName isEqualToString:@"updated"])
+	{
+		NSString * dateString = [element valueOfElement];
+		NSDate * newDate = [self dateFromString:dateString];
+		if ([currentItem date] == nil || [newDate isGreaterThan:[currentItem date]])
+			[currentItem setDate:newDate];
+		return;
+	}
+}
+
+/* finishAtomEntry
+ * Completes the current Atom entry and appends it to the items array.
+ */
+-(void)finishAtomEntry
+{
+	// Do relative IMG tag fixup
+	[articleBody fixupRelativeImgTags:entryBase];
+	[currentItem setDescription:SafeString(articleBody)];
+
+	// Derive any missing title
+	[self ensureTitle:currentItem];
+	[items addObject:currentItem];
+
+	[currentItem release];
+	[articleBody release];
+	[entryBase release];
+	[entryBaseURL release];
+	currentItem = nil;
+	articleBody = nil;
+	entryBase = nil;
+	entryBaseURL = nil;
+}
+
+/* extractFeeds
+ * Given a block of XML data, determine whether this is HTML format and, if so,
+ * extract all RSS links in the data. Returns YES if we found any feeds, or NO if
+ * this was not HTML.
+ */
++(BOOL)extractFeeds:(NSData *)xmlData toArray:(NSMutableArray *)linkArray
+{
+	BOOL success = NO;
+	NS_DURING
+	NSArray * arrayOfTags = [XMLTag parserFromData:xmlData];
+	if (arrayOfTags != nil)
+	{
+		for (XMLTag * tag in arrayOfTags)
 		{
-			FeedItem * newItem = [[FeedItem alloc] init];
-			[newItem setAuthor:defaultAuthor];
-			int itemCount = [subTree countOfChildren];
-			NSMutableString * articleBody = nil;
-			int itemIndex;
-
-			// Look for the xml:base attribute, and use absolute url or stack relative url
-			NSString * entryBase = [[subTree valueOfAttribute:@"xml:base"] stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
-			if (entryBase == nil)
-				entryBase = linkBase;
-			NSURL * entryBaseURL = (entryBase != nil) ? [NSURL URLWithString:entryBase] : nil;
-			if ((entryBaseURL != nil) && (linkBaseURL != nil) && ([entryBaseURL scheme] == nil))
+			NSString * tagName = [tag name];
+
+			if ([tagName isEqualToString:@"rss"] || [tagName isEqualToString:@"rdf:rdf"] || [tagName isEqualToString:@"feed"])
 			{
-				entryBaseURL = [NSURL URLWithString:entryBase relativeToURL:linkBaseURL];
-				if (entryBaseURL != nil)
-					entryBase = [entryBaseURL absoluteString];
+				success = NO;
+				break;
 			}
-
-			for (itemIndex = 0; itemIndex < itemCount; ++itemIndex)
+			if ([tagName isEqualToString:@"link"])
 			{
-				XMLParser * subItemTree = [subTree treeByIndex:itemIndex];
-				NSString * itemNodeName = [subItemTree nodeName];
-				
-				// Parse item title
-				if ([itemNodeName isEqualToString:@"title"])
-				{
-					NSString * newTitle = [[subItemTree valueOfElement] stringByUnescapingExtendedCharacters];
-					NSString * titleType = [subItemTree valueOfAttribute:@"type"];
-					
-					if ([titleType isEqualToString:@"html"] || [titleType isEqualToString:@"xhtml"])
-						newTitle = [self stripHTMLTags:newTitle];
-					
-					[newItem setTitle:[newTitle firstNonBlankLine]];
-					continue;
-				}
+				NSDictionary * tagAttributes = [tag attributes];
+				NSString * linkType = [tagAttributes objectForKey:@"type"];
 
-				// Parse item description
-				if ([itemNodeName isEqualToString:@"content"])
-				{
-					[articleBody release];
-					articleBody = [[subItemTree valueOfElement] retain];
-					continue;
-				}
-				
-				// Parse item description
-				if ([itemNodeName isEqualToString:@"summary"])
-				{
-					[articleBody release];
-					articleBody = [[subItemTree valueOfElement] retain];
-					continue;
-				}
-				
-				// Parse item author
-				if ([itemNodeName isEqualToString:@"author"])
-				{
-					NSString * authorName = [[subItemTree treeByName:@"name"] valueOfElement];
-					if (authorName == nil)
-						authorName = [[subItemTree treeByName:@"email"] valueOfElement];
-					if (authorName != nil)
-						[newItem setAuthor:authorName];
-					continue;
-				}
-				
-				// Parse item link
-				if ([itemNodeName isEqualToString:@"link"])
-				{
-					if ([[subItemTree valueOfAttribute:@"rel"] isEqualToString:@"enclosure"])
-					{
-						NSString * theLink = [[subItemTree valueOfAttribute:@"href"] stringByUnescapingExtendedCharacters];
-						if (theLink != nil)
-						{
-							if ((entryBaseURL != nil) && ([[NSURL URLWithString:theLink] scheme] == nil))
-							{
-								NSURL * theLinkURL = [NSURL URLWithString:theLink relativeToURL:entryBaseURL];
-								[newItem setEnclosure:(theLinkURL != nil) ? [theLinkURL absoluteString] : theLink];
-							}
-							else
-								[newItem setEnclosure:theLink];
-					}
-				}
-				else
+				// We're looking for the link tag. Specifically we're looking for the one which
+				// has application/rss+xml or atom+xml type. There may be more than one which is why we're
+				// going to be returning an array.
+				if ([linkType isEqualToString:@"application/rss+xml"])
 				{
-					if ([subItemTree valueOfAttribute:@"rel"] == nil || [[subItemTree valueOfAttribute:@"rel"] isEqualToString:@"alternate"])
-					{
-						NSString * theLink = [[subItemTree valueOfAttribute:@"href"] stringByUnescapingExtendedCharacters];
-						if (theLink != nil)
-						{
-							if ((entryBaseURL != nil) && ([[NSURL URLWithString:theLink] scheme] == nil))
-							{
-								NSURL * theLinkURL = [NSURL URLWithString:theLink relativeToURL:entryBaseURL];
-								[newItem setLink:(theLinkURL != nil) ? [theLinkURL absoluteString] : theLink];
-							}
-							else
-								[newItem setLink:theLink];
-						}
-					}
-					continue;
-				}
+					NSString * href = [tagAttributes objectForKey:@"href"];
+					if (href != nil)
+						[linkArray addObject:href];
 				}
-				
-				// Parse item id
-				if ([itemNodeName isEqualToString:@"id"])
+				else if ([linkType isEqualToString:@"application/atom+xml"])
 				{
-					[newItem setGuid:[subItemTree valueOfElement]];
-					continue;
+					NSString * href = [tagAttributes objectForKey:@"href"];
+					if (href != nil)
+						[linkArray addObject:href];
 				}
+			}
+			if ([tagName isEqualToString:@"/head"])
+				break;
+			success = [linkArray count] > 0;
+		}
+	}
+	NS_HANDLER
+	success = NO;
+	NS_ENDHANDLER
+	return success;
+}
 
-				// Parse item date
-				if ([itemNodeName isEqualToString:@"modified"])
-				{
-					NSString * dateString = [subItemTree valueOfElement];
-					NSDate * newDate = [XMLParser parseXMLDate:dateString];
-					if ([newItem date] == nil || [newDate isGreaterThan:[newItem date]])
-						[newItem setDate:newDate];
-					continue;
-				}
+/* parseEncodingType
+ * Parse off the encoding field.
+ */
+-(NSStringEncoding)parseEncodingType:(NSData *)xmlData
+{
+	NSStringEncoding encodingType = NSUTF8StringEncoding;
+	const char * textPtr = [xmlData bytes];
+	const char * textEndPtr = textPtr + [xmlData length];
 
-				// Parse item date
-				if ([itemNodeName isEqualToString:@"created"])
-				{
-					NSString * dateString = [subItemTree valueOfElement];
-					NSDate * newDate = [XMLParser parseXMLDate:dateString];
-					if ([newItem date] == nil || [newDate isGreaterThan:[newItem date]])
-						[newItem setDate:newDate];
-					continue;
-				}
-				
-				// Parse item date
-				if ([itemNodeName isEqualToString:@"updated"])
-				{
-					NSString * dateString = [subItemTree valueOfElement];
-					NSDate * newDate = [XMLParser parseXMLDate:dateString];
-					if ([newItem date] == nil || [newDate isGreaterThan:[newItem date]])
-						[newItem setDate:newDate];
-					continue;
-				}
-			}
+	while (textPtr < textEndPtr && *textPtr != '<')
+		++textPtr;
 
-			// Do relative IMG tag fixup
-			[articleBody fixupRelativeImgTags:entryBase];
-			[newItem setDescription:SafeString(articleBody)];
-			[articleBody release];
-			
-			// Derive any missing title
-			[self ensureTitle:newItem];
-			[items addObject:newItem];
-			[newItem release];
+	// Scan for the encoding attribute name up until the closing tag
+	const char * encodingAttribute = "encoding=";
+	const char * encodingAttributePtr = encodingAttribute;
+	while (textPtr < textEndPtr && *encodingAttributePtr != '\0' && *textPtr != '>')
+	{
+		if (*textPtr == *encodingAttributePtr)
+			++encodingAttributePtr;
+		else
+			encodingAttributePtr = encodingAttribute;
+		++textPtr;
+	}
+
+	// If we found it, parse off the encoding type name
+	if (*encodingAttributePtr == '\0')
+	{
+		if (textPtr < textEndPtr && *textPtr == '"')
+			++textPtr;
+
+		// We need to special case UTF-8 as CFStringConvertIANACharSetNameToEncoding
+		// doesn't recognise it.
+		const char * encodingNamePtr = textPtr;
+		const char * utf8EncodingName = "UTF-8";
+		const char * utf8EncodingNamePtr = utf8EncodingName;
+		while (textPtr < textEndPtr && *textPtr != '"')
+		{
+			if (toupper(*textPtr) == *utf8EncodingNamePtr)
+				++utf8EncodingNamePtr;
+			else
+				utf8EncodingNamePtr = utf8EncodingName;
+			++textPtr;
+		}
+
+		// Now extract the encoding name if it wasn't UTF-8
+		if (*utf8EncodingNamePtr != '\0')
+		{
+			CFStringRef encodingName = CFStringCreateWithBytes(kCFAllocatorDefault, (unsigned char *)encodingNamePtr, textPtr - encodingNamePtr, kCFStringEncodingISOLatin1, false);
+			encodingType = CFStringConvertIANACharSetNameToEncoding(encodingName);
+			CFRelease(encodingName);
 		}
 	}
-	
-	return success;
+	return encodingType;
 }
 
 /* setTitle
@@ -1085,6 +1581,40 @@
 	lastModified = newDate;
 }
 
+/* dateFromString
+ * Returns the date for a date string in the feed. Feeds often give many items the
+ * same date, or repeat the feed date on each item, so the last few dates are kept
+ * and reused. Dates in the common formats are parsed without going through
+ * NSCalendarDate.
+ */
+-(NSDate *)dateFromString:(NSString *)dateString
+{
+	NSUInteger index;
+	for (index = 0; index < MA_Date_Cache_Size; ++index)
+	{
+		if (cachedDateStrings[index] != nil && [cachedDateStrings[index] isEqualToString:dateString])
+			return cachedDates[index];
+	}
+
+	NSDate * date;
+	NSTimeInterval timeInterval;
+	if ([XMLParser getTimeInterval:&timeInterval fromXMLDate:dateString])
+		date = [NSDate dateWithTimeIntervalSinceReferenceDate:timeInterval];
+	else
+		date = [XMLParser parseUnusualXMLDate:dateString];
+
+	if (date != nil)
+	{
+		index = nextCachedDate;
+		nextCachedDate = (nextCachedDate + 1) % MA_Date_Cache_Size;
+		[cachedDateStrings[index] release];
+		[cachedDates[index] release];
+		cachedDateStrings[index] = [dateString copy];
+		cachedDates[index] = [date retain];
+	}
+	return date;
+}
+
 /* title
  * Return the title string.
  */
@@ -1125,6 +1655,19 @@
 	return lastModified;
 }
 
+/* updateInterval
+ * Returns how often, in seconds, the feed says it should be polled or 0 if it
+ * doesn't say. The RSS ttl wins over the syndication module's update period.
+ */
+-(NSTimeInterval)updateInterval
+{
+	if (timeToLive > 0)
+		return timeToLive;
+	if (updatePeriod > 0)
+		return updatePeriod / MAX(updateFrequency, 1);
+	return 0;
+}
+
 /* stripHTMLTags
  * Strip off HTML tags from title strings. This code takes stricter approach to
  * HTML removal because some feeds use HTML tags in the title which are actually part
@@ -1183,6 +1726,13 @@
  */
 -(void)dealloc
 {
+	NSUInteger index;
+	for (index = 0; index < MA_Date_Cache_Size; ++index)
+	{
+		[cachedDateStrings[index] release];
+		[cachedDates[index] release];
+	}
+	[self resetParseState];
 	[orderArray release];
 	[title release];
 	[description release];
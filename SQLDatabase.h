@@ -12,12 +12,15 @@
 
 @class SQLResult;
 @class SQLRow;
+@class SQLStatement;
 
 @interface SQLDatabase : NSObject 
 {
-	sqlite3 *	mDatabase;
-	int			lastError;
-	NSString *	mPath;
+	sqlite3 *				mDatabase;
+	int						lastError;
+	NSString *				mPath;
+	NSMutableDictionary *	mStatementCache;
+	NSMutableArray *		mStatementOrder;
 }
 
 + (id)databaseWithFile:(NSString*)inPath;
@@ -31,8 +34,12 @@
 + (NSString*)prepareStringForQuery:(NSString*)inString;
 -(SQLResult*)performQuery:(NSString*)inQuery;
 -(SQLResult*)performQueryWithFormat:(NSString*)inFormat, ...;
+-(SQLStatement*)prepareStatement:(NSString*)inQuery;
+-(SQLStatement*)streamQuery:(NSString*)inQuery;
+-(SQLStatement*)streamQueryWithFormat:(NSString*)inFormat, ...;
 
 -(int)lastInsertRowId;
+-(int)totalChanges;
 
 @end
 
@@ -53,14 +60,46 @@
 
 @interface SQLRow : NSObject
 {
-	char**	mRowData;
-	char**	mColumns;
-	int		mColumnCount;
+	char**			mRowData;
+	char**			mColumns;
+	int				mColumnCount;
+	sqlite3_stmt *	mStatement;
 }
 
 -(int)columnCount;
 
 -(NSString*)stringForColumn:(NSString*)inColumnName;
 -(NSString*)stringForColumnAtIndex:(int)inIndex;
+-(int)intForColumn:(NSString*)inColumnName;
+-(int)intForColumnAtIndex:(int)inIndex;
+-(double)doubleForColumn:(NSString*)inColumnName;
+-(double)doubleForColumnAtIndex:(int)inIndex;
+-(NSData*)dataForColumn:(NSString*)inColumnName;
+-(NSData*)dataForColumnAtIndex:(int)inIndex;
+
+@end
+
+@interface SQLStatement : NSObject
+{
+	sqlite3_stmt *	mStatement;
+	NSString *		mQuery;
+	SQLRow *		mRow;
+	int				lastError;
+}
+
+-(NSString*)query;
+-(int)lastError;
+
+-(void)reset;
+-(void)bindInt:(int)inValue atIndex:(int)inIndex;
+-(void)bindDouble:(double)inValue atIndex:(int)inIndex;
+-(void)bindString:(NSString*)inValue atIndex:(int)inIndex;
+-(void)bindData:(NSData*)inValue atIndex:(int)inIndex;
+-(void)bindNullAtIndex:(int)inIndex;
+
+-(SQLRow*)nextRow;
+-(NSEnumerator*)rowEnumerator;
+-(int)execute;
+-(void)close;
 
 @end
\ No newline at end of file
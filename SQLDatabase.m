@@ -9,6 +9,10 @@
 #import "SQLDatabase.h"
 #import "SQLDatabasePrivate.h"
 
+// Number of compiled statements kept by prepareStatement. Once the cache is full
+// the least recently used statement is discarded.
+static const unsigned int kMaxCachedStatements = 32;
+
 @implementation SQLDatabase
 
 +(id)databaseWithFile:(NSString*)inPath
@@ -26,6 +30,8 @@
 	mPath = [inPath copy];
 	mDatabase = NULL;
 	lastError = SQLITE_OK;
+	mStatementCache = [[NSMutableDictionary alloc] initWithCapacity:kMaxCachedStatements];
+	mStatementOrder = [[NSMutableArray alloc] initWithCapacity:kMaxCachedStatements];
 	
 	return self;
 }
@@ -37,6 +43,8 @@
 	
 	mPath = NULL;
 	mDatabase = NULL;
+	mStatementCache = [[NSMutableDictionary alloc] initWithCapacity:kMaxCachedStatements];
+	mStatementOrder = [[NSMutableArray alloc] initWithCapacity:kMaxCachedStatements];
 	
 	return self;
 }
@@ -44,6 +52,8 @@
 -(void)dealloc
 {
 	[self close];
+	[mStatementCache release];
+	[mStatementOrder release];
 	[mPath release];
 	[super dealloc];
 }
@@ -90,6 +100,44 @@ static void sqlite3_regexp(sqlite3_context *DB, int argc, sqlite3_value **argv)
 	sqlite3_result_int(DB, retval);
 }
 
+// Scores a full text search hit from the FTS3 matchinfo() blob. The blob holds the
+// phrase and column counts followed by the hit counts for every phrase and column
+// across all rows, then the hit counts for the current row. Each column contributes
+// the share of all hits that fall in this row, with earlier columns (the title in
+// the article index) weighted more heavily than later ones.
+static void sqlite3_fts_rank(sqlite3_context *DB, int argc, sqlite3_value **argv)
+{
+	double score = 0.0;
+	
+	if (argc == 1)
+	{
+		const unsigned int * matchinfo = (const unsigned int *)sqlite3_value_blob(argv[0]);
+		int bytes = sqlite3_value_bytes(argv[0]);
+		if (matchinfo && bytes >= (int)(2 * sizeof(unsigned int)))
+		{
+			unsigned int phrases = matchinfo[0];
+			unsigned int columns = matchinfo[1];
+			unsigned int cells = phrases * columns;
+			if (bytes >= (int)((2 + 2 * cells) * sizeof(unsigned int)))
+			{
+				const unsigned int * globalHits = matchinfo + 2;
+				const unsigned int * rowHits = globalHits + cells;
+				unsigned int cell;
+				for (cell = 0; cell < cells; ++cell)
+				{
+					if (rowHits[cell] > 0 && globalHits[cell] > 0)
+					{
+						unsigned int column = cell % columns;
+						double weight = (double)(columns - column);
+						score += weight * (double)rowHits[cell] / (double)globalHits[cell];
+					}
+				}
+			}
+		}
+	}
+	sqlite3_result_double(DB, score);
+}
+
 -(BOOL)open
 {
 	if (sqlite3_open( [mPath fileSystemRepresentation], &mDatabase) == SQLITE_OK)
@@ -99,7 +147,13 @@ static void sqlite3_regexp(sqlite3_context *DB, int argc, sqlite3_value **argv)
 		[[self performQuery:@"pragma temp_store=1;"] release];
 		[[self performQuery:@"pragma auto_vacuum=0;"] release];
 
-		if (sqlite3_create_function(mDatabase, "regexp", 2, SQLITE_UTF8, NULL, sqlite3_regexp, NULL, NULL) == SQLITE_OK)
+		// The journal file is kept between transactions rather than being created and
+		// deleted on every commit, and commits only sync at the critical points.
+		[[self performQuery:@"pragma journal_mode=persist;"] release];
+		[[self performQuery:@"pragma synchronous=normal;"] release];
+
+		if (sqlite3_create_function(mDatabase, "regexp", 2, SQLITE_UTF8, NULL, sqlite3_regexp, NULL, NULL) == SQLITE_OK &&
+			sqlite3_create_function(mDatabase, "fts_rank", 1, SQLITE_ANY, NULL, sqlite3_fts_rank, NULL, NULL) == SQLITE_OK)
 			return YES;
 	}
 	return NO;
@@ -110,6 +164,11 @@ static void sqlite3_regexp(sqlite3_context *DB, int argc, sqlite3_value **argv)
 	if( !mDatabase )
 		return;
 	
+	// Every compiled statement must be finalized before the database will close.
+	[[mStatementCache allValues] makeObjectsPerformSelector:@selector( close )];
+	[mStatementCache removeAllObjects];
+	[mStatementOrder removeAllObjects];
+	
 	sqlite3_close( mDatabase );
 	mDatabase = NULL;
 }
@@ -148,6 +207,14 @@ static void sqlite3_regexp(sqlite3_context *DB, int argc, sqlite3_value **argv)
 	return sqlite3_last_insert_rowid( mDatabase );
 }
 
+-(int)totalChanges
+{
+	if( !mDatabase )
+		return -1;
+
+	return sqlite3_total_changes( mDatabase );
+}
+
 -(int)lastError
 {
 	return lastError;
@@ -231,4 +298,87 @@ static void LogElapsedTime( NSString * query, double startTime )
 	return sqlResult;
 }
 
+// Returns a compiled statement for the query, ready to have its parameters bound.
+// Statements are cached by their SQL text so callers should use '?' parameters
+// rather than formatting values into the query. The statement remains owned by
+// the cache and must be finished with before the same query is prepared again.
+-(SQLStatement*)prepareStatement:(NSString*)inQuery
+{
+	SQLStatement*	statement;
+	
+	if( !mDatabase || inQuery == nil )
+		return nil;
+	
+	statement = [mStatementCache objectForKey:inQuery];
+	if( statement )
+	{
+		[statement reset];
+		if( [mStatementOrder lastObject] != statement )
+		{
+			[statement retain];
+			[mStatementOrder removeObjectIdenticalTo:statement];
+			[mStatementOrder addObject:statement];
+			[statement release];
+		}
+		return statement;
+	}
+	
+	statement = [[SQLStatement alloc] initWithDatabase:mDatabase query:inQuery];
+	if( !statement )
+	{
+		lastError = sqlite3_errcode( mDatabase );
+		return nil;
+	}
+	
+	if( [mStatementOrder count] >= kMaxCachedStatements )
+	{
+		// Evicted statements are finalized when the last reference goes away.
+		SQLStatement* oldest = [[mStatementOrder objectAtIndex:0] retain];
+		[mStatementCache removeObjectForKey:[oldest query]];
+		[mStatementOrder removeObjectAtIndex:0];
+		[oldest autorelease];
+	}
+	[mStatementCache setObject:statement forKey:inQuery];
+	[mStatementOrder addObject:statement];
+	
+	return [statement autorelease];
+}
+
+// Compiles a one-off query whose rows are stepped through one at a time rather than
+// collected into a table up front, so only the current row is held in memory. The
+// statement is not cached and is finalized when it is released.
+-(SQLStatement*)streamQuery:(NSString*)inQuery
+{
+	SQLStatement*	statement;
+	
+	if( !mDatabase || inQuery == nil )
+		return nil;
+	
+	statement = [[SQLStatement alloc] initWithDatabase:mDatabase query:inQuery];
+	if( !statement )
+		lastError = sqlite3_errcode( mDatabase );
+	
+	return [statement autorelease];
+}
+
+-(SQLStatement*)streamQueryWithFormat:(NSString*)inFormat, ...
+{
+	SQLStatement*	statement = nil;
+	NSString*		query = nil;
+	va_list			arguments;
+	
+	if( inFormat == nil )
+		return nil;
+	
+	va_start( arguments, inFormat );
+	
+	query = [[NSString alloc] initWithFormat:inFormat arguments:arguments];
+	statement = [self streamQuery:query];
+	[query release];
+	
+	va_end( arguments );
+	
+	return statement;
+}
+
 @end
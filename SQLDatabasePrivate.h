@@ -30,5 +30,20 @@
 
 @interface SQLRow (Private)
 -(id)initWithColumns:(char**)inColumns rowData:(char**)inRowData columns:(int)inColumnCount;
+-(id)initWithStatement:(sqlite3_stmt*)inStatement;
+-(int)indexForColumn:(NSString*)inColumnName;
 -(BOOL)valid;
+@end
+
+@interface SQLStatement (Private)
+-(id)initWithDatabase:(sqlite3*)inDatabase query:(NSString*)inQuery;
+@end
+
+@interface SQLStatementEnumerator : NSEnumerator
+{
+	SQLStatement*	mStatement;
+}
+
+-(id)initWithStatement:(SQLStatement*)inStatement;
+
 @end
\ No newline at end of file
@@ -19,6 +19,22 @@
 	mRowData = inRowData;
 	mColumns = inColumns;
 	mColumnCount = inColumnCount;
+	mStatement = NULL;
+	
+	return self;
+}
+
+// A row created from a statement is a cursor: it always reflects whatever row the
+// statement was last stepped to, and reads the values straight from the statement.
+-(id)initWithStatement:(sqlite3_stmt*)inStatement
+{
+	if( ![super init])
+		return nil;
+	
+	mRowData = NULL;
+	mColumns = NULL;
+	mColumnCount = sqlite3_column_count( inStatement );
+	mStatement = inStatement;
 	
 	return self;
 }
@@ -31,6 +47,7 @@
 	mRowData = NULL;
 	mColumns = NULL;
 	mColumnCount = 0;
+	mStatement = NULL;
 	
 	return self;
 }
@@ -47,20 +64,37 @@
 	return mColumnCount;
 }
 
+-(int)indexForColumn:(NSString*)inColumnName
+{
+	const char*	name;
+	int			index;
+	
+	if( mStatement )
+	{
+		name = [inColumnName UTF8String];
+		for( index = 0; index < mColumnCount; index++ )
+			if( strcmp( sqlite3_column_name( mStatement, index ), name ) == 0 )
+				break;
+	}
+	else
+	{
+		name = [inColumnName cStringUsingEncoding:NSASCIIStringEncoding];
+		for( index = 0; index < mColumnCount; index++ )
+			if( strcmp( mColumns[ index ], name ) == 0 )
+				break;
+	}
+	
+	return index;
+}
+
 #pragma mark -
 
 -(NSString*)stringForColumn:(NSString*)inColumnName
 {
-	int index;
-	
 	if( ![self valid])
 		return nil;
 	
-	for( index = 0; index < mColumnCount; index++ )
-		if( strcmp( mColumns[ index ], [inColumnName cStringUsingEncoding:NSASCIIStringEncoding]) == 0 )
-			break;
-	
-	return [self stringForColumnAtIndex:index];
+	return [self stringForColumnAtIndex:[self indexForColumn:inColumnName]];
 }
 
 -(NSString*)stringForColumnAtIndex:(int)inIndex
@@ -68,12 +102,85 @@
 	if( inIndex >= mColumnCount || ![self valid])
 		return nil;
 	
+	if( mStatement )
+	{
+		const unsigned char* text = sqlite3_column_text( mStatement, inIndex );
+		if( text == NULL )
+			return nil;
+		return [NSString stringWithUTF8String:(const char*)text];
+	}
+	
 	if (mRowData[ inIndex ] == nil)
 		return nil;
 
 	return [NSString stringWithUTF8String:mRowData[ inIndex ]];
 }
 
+-(int)intForColumn:(NSString*)inColumnName
+{
+	if( ![self valid])
+		return 0;
+	
+	return [self intForColumnAtIndex:[self indexForColumn:inColumnName]];
+}
+
+-(int)intForColumnAtIndex:(int)inIndex
+{
+	if( inIndex >= mColumnCount || ![self valid])
+		return 0;
+	
+	if( mStatement )
+		return sqlite3_column_int( mStatement, inIndex );
+	
+	return ( mRowData[ inIndex ] != NULL ) ? atoi( mRowData[ inIndex ] ) : 0;
+}
+
+-(double)doubleForColumn:(NSString*)inColumnName
+{
+	if( ![self valid])
+		return 0.0;
+	
+	return [self doubleForColumnAtIndex:[self indexForColumn:inColumnName]];
+}
+
+-(double)doubleForColumnAtIndex:(int)inIndex
+{
+	if( inIndex >= mColumnCount || ![self valid])
+		return 0.0;
+	
+	if( mStatement )
+		return sqlite3_column_double( mStatement, inIndex );
+	
+	return ( mRowData[ inIndex ] != NULL ) ? atof( mRowData[ inIndex ] ) : 0.0;
+}
+
+-(NSData*)dataForColumn:(NSString*)inColumnName
+{
+	if( ![self valid])
+		return nil;
+	
+	return [self dataForColumnAtIndex:[self indexForColumn:inColumnName]];
+}
+
+-(NSData*)dataForColumnAtIndex:(int)inIndex
+{
+	if( inIndex >= mColumnCount || ![self valid])
+		return nil;
+	
+	if( mStatement )
+	{
+		const void* bytes = sqlite3_column_blob( mStatement, inIndex );
+		if( bytes == NULL )
+			return nil;
+		return [NSData dataWithBytes:bytes length:sqlite3_column_bytes( mStatement, inIndex )];
+	}
+	
+	if( mRowData[ inIndex ] == NULL )
+		return nil;
+	
+	return [NSData dataWithBytes:mRowData[ inIndex ] length:strlen( mRowData[ inIndex ] )];
+}
+
 #pragma mark -
 
 -(NSString*)description
@@ -84,7 +191,10 @@
 	for( column = 0; column < mColumnCount; column++ )
 	{
 		if( column ) [string appendString:@" | "];
-		[string appendFormat:@"%s", mRowData[ column ]];
+		if( mStatement )
+			[string appendFormat:@"%s", sqlite3_column_text( mStatement, column )];
+		else
+			[string appendFormat:@"%s", mRowData[ column ]];
 	}
 	
 	return string;
@@ -94,6 +204,8 @@
 
 -(BOOL)valid
 {
+	if( mStatement )
+		return ( mColumnCount > 0 );
 	return ( mRowData != NULL && mColumns != NULL && mColumnCount > 0 );
 }
 
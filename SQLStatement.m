@@ -0,0 +1,225 @@
+//
+//  SQLStatement.m
+//  Vienna
+//
+//  Copyright (c) 2004-2010 Steve Palmer. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "SQLDatabase.h"
+#import "SQLDatabasePrivate.h"
+
+@implementation SQLStatement
+
+/* initWithDatabase
+ * Compiles the specified query against the database. Returns nil if the query
+ * could not be compiled.
+ */
+-(id)initWithDatabase:(sqlite3*)inDatabase query:(NSString*)inQuery
+{
+	if( ![super init])
+		return nil;
+	
+	mQuery = [inQuery copy];
+	mRow = nil;
+	lastError = sqlite3_prepare_v2( inDatabase, [inQuery UTF8String], -1, &mStatement, NULL );
+	if( lastError != SQLITE_OK )
+	{
+		NSLog( @"Cannot prepare \"%@\": %s", inQuery, sqlite3_errmsg( inDatabase ));
+		mStatement = NULL;
+		[self release];
+		return nil;
+	}
+	
+	mRow = [[SQLRow alloc] initWithStatement:mStatement];
+	return self;
+}
+
+/* dealloc
+ * Finalize the compiled statement and release resources.
+ */
+-(void)dealloc
+{
+	[self close];
+	[mRow release];
+	[mQuery release];
+	[super dealloc];
+}
+
+/* close
+ * Finalizes the compiled statement. The statement cannot be used after this.
+ */
+-(void)close
+{
+	if( mStatement )
+	{
+		sqlite3_finalize( mStatement );
+		mStatement = NULL;
+	}
+}
+
+/* query
+ * Returns the SQL text from which this statement was compiled.
+ */
+-(NSString*)query
+{
+	return mQuery;
+}
+
+/* lastError
+ * Returns the result code of the last operation on this statement.
+ */
+-(int)lastError
+{
+	return lastError;
+}
+
+/* reset
+ * Rewinds the statement so it can be run again and clears any bound parameters.
+ */
+-(void)reset
+{
+	sqlite3_reset( mStatement );
+	sqlite3_clear_bindings( mStatement );
+}
+
+/* bindInt
+ * Binds an integer to the parameter at the specified (1-based) index.
+ */
+-(void)bindInt:(int)inValue atIndex:(int)inIndex
+{
+	lastError = sqlite3_bind_int( mStatement, inIndex, inValue );
+}
+
+/* bindDouble
+ * Binds a floating point value to the parameter at the specified (1-based) index.
+ */
+-(void)bindDouble:(double)inValue atIndex:(int)inIndex
+{
+	lastError = sqlite3_bind_double( mStatement, inIndex, inValue );
+}
+
+/* bindString
+ * Binds a string to the parameter at the specified (1-based) index. A nil string
+ * is bound as NULL. No quoting is required.
+ */
+-(void)bindString:(NSString*)inValue atIndex:(int)inIndex
+{
+	if( inValue == nil )
+		lastError = sqlite3_bind_null( mStatement, inIndex );
+	else
+		lastError = sqlite3_bind_text( mStatement, inIndex, [inValue UTF8String], -1, SQLITE_TRANSIENT );
+}
+
+/* bindData
+ * Binds a blob to the parameter at the specified (1-based) index. A nil object
+ * is bound as NULL.
+ */
+-(void)bindData:(NSData*)inValue atIndex:(int)inIndex
+{
+	if( inValue == nil )
+		lastError = sqlite3_bind_null( mStatement, inIndex );
+	else
+		lastError = sqlite3_bind_blob( mStatement, inIndex, [inValue bytes], [inValue length], SQLITE_TRANSIENT );
+}
+
+/* bindNullAtIndex
+ * Binds NULL to the parameter at the specified (1-based) index.
+ */
+-(void)bindNullAtIndex:(int)inIndex
+{
+	lastError = sqlite3_bind_null( mStatement, inIndex );
+}
+
+/* nextRow
+ * Steps the statement and returns a row cursor positioned on the result, or nil
+ * when there are no more rows. The same SQLRow is returned on each step so callers
+ * must copy out any values they need before stepping again.
+ */
+-(SQLRow*)nextRow
+{
+	lastError = sqlite3_step( mStatement );
+	if( lastError == SQLITE_ROW )
+		return mRow;
+	
+	sqlite3_reset( mStatement );
+	return nil;
+}
+
+/* rowEnumerator
+ * Returns an enumerator that steps the statement once per call to nextObject.
+ * Like nextRow, every object it returns is the same cursor.
+ */
+-(NSEnumerator*)rowEnumerator
+{
+	return [[[SQLStatementEnumerator alloc] initWithStatement:self] autorelease];
+}
+
+/* execute
+ * Runs the statement to completion, discarding any result rows, and leaves it
+ * ready to be run again. Returns SQLITE_OK on success.
+ */
+-(int)execute
+{
+	while( ( lastError = sqlite3_step( mStatement ) ) == SQLITE_ROW )
+		;
+	sqlite3_reset( mStatement );
+	if( lastError == SQLITE_DONE )
+		lastError = SQLITE_OK;
+	return lastError;
+}
+
+@end
+
+#pragma mark -
+
+@implementation SQLStatementEnumerator
+
+-(id)initWithStatement:(SQLStatement*)inStatement
+{
+	if( ![super init])
+		return nil;
+	
+	mStatement = [inStatement retain];
+	
+	return self;
+}
+
+-(void)dealloc
+{
+	[mStatement release];
+	[super dealloc];
+}
+
+-(id)nextObject
+{
+	return [mStatement nextRow];
+}
+
+// Hand out exactly one row per batch. Fast enumeration would otherwise be free to
+// read ahead, which would move the shared cursor past the row being processed.
+-(NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState*)state objects:(id*)stackbuf count:(NSUInteger)len
+{
+	id row = [mStatement nextRow];
+	if( row == nil || len == 0 )
+		return 0;
+	
+	stackbuf[ 0 ] = row;
+	state->state = 1;
+	state->itemsPtr = stackbuf;
+	state->mutationsPtr = (unsigned long*)self;
+	return 1;
+}
+
+@end
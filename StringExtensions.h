@@ -33,6 +33,7 @@
 	-(NSString *)firstNonBlankLine;
 	-(NSString *)summaryTextFromHTML;
 	-(NSString *)titleTextFromHTML;
+	-(NSString *)plainTextFromHTML;
 	-(NSInteger)indexOfCharacterInString:(char)ch afterIndex:(int)startIndex;
 	-(NSString *)stringByEscapingExtendedCharacters;
 	-(NSString *)stringByUnescapingExtendedCharacters;
@@ -142,6 +142,54 @@ static NSMutableDictionary * entityMap = nil;
 	return [[NSString stringByRemovingHTML:self] firstNonBlankLine];
 }
 
+/* plainTextFromHTML
+ * Returns the complete text of an HTML string with all tags removed and entity characters
+ * converted to their unicode equivalents. Unlike stringByRemovingHTML this does not truncate
+ * and makes a single pass over the string, so it is suitable for indexing whole article bodies.
+ * Each tag is replaced by a space so that words either side of it are not run together.
+ */
+-(NSString *)plainTextFromHTML
+{
+	NSUInteger length = [self length];
+	if (length == 0)
+		return @"";
+
+	unichar * buffer = (unichar *)malloc(length * sizeof(unichar));
+	if (buffer == NULL)
+		return self;
+	[self getCharacters:buffer];
+
+	NSUInteger indexOfChr;
+	NSUInteger outLength = 0;
+	BOOL isInTag = NO;
+	BOOL isInQuote = NO;
+	for (indexOfChr = 0; indexOfChr < length; ++indexOfChr)
+	{
+		unichar ch = buffer[indexOfChr];
+		if (isInTag)
+		{
+			if (ch == '"')
+				isInQuote = !isInQuote;
+			else if (ch == '>' && !isInQuote)
+			{
+				isInTag = NO;
+				if (outLength > 0 && buffer[outLength - 1] != ' ')
+					buffer[outLength++] = ' ';
+			}
+		}
+		else if (ch == '<')
+		{
+			isInTag = YES;
+			isInQuote = NO;
+		}
+		else
+			buffer[outLength++] = ch;
+	}
+
+	NSString * plainText = [[NSString alloc] initWithCharactersNoCopy:buffer length:outLength freeWhenDone:YES];
+	return [[plainText autorelease] stringByUnescapingExtendedCharacters];
+}
+
 /* firstWord
  * Returns the first word in self.
  */
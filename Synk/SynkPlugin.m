@@ -501,6 +501,7 @@
 	[progressWindow orderOut:self];
 	currentState = SynkStateIdle;
 	[[NSNotificationCenter defaultCenter] postNotificationName:SynkCacheStateChanged object:self];
+	[[RefreshManager sharedManager] resumeDelayedRefresh];
 }
 
 /* getAllFolders:
@@ -648,6 +649,7 @@
 	
 	currentState = SynkStateIdle;
 	[[NSNotificationCenter defaultCenter] postNotificationName:SynkCacheStateChanged object:self];
+	[[RefreshManager sharedManager] resumeDelayedRefresh];
 	
 	[pool release];
 }
@@ -0,0 +1,173 @@
+//
+//  CheckPreferences.m
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Cocoa/Cocoa.h>
+#import "Constants.h"
+
+// A stand-in for the application's Preferences class for the tools that open a
+// database. The real class brings in Sparkle, the plugins and the user's defaults,
+// none of which the database needs, so this one only has the handful of settings
+// that Database, Folder, Article and RefreshManager read. Preferences.h is
+// deliberately not imported since the stand-in implements so little of it.
+@interface Preferences : NSObject {
+	NSMutableDictionary * values;
+	NSString * defaultDatabase;
+	int foldersTreeSortMethod;
+}
+
+// Accessor functions
++(Preferences *)standardPreferences;
+-(BOOL)boolForKey:(NSString *)defaultName;
+-(int)integerForKey:(NSString *)defaultName;
+-(void)setBool:(BOOL)value forKey:(NSString *)defaultName;
+-(void)setInteger:(int)value forKey:(NSString *)defaultName;
+-(NSString *)defaultDatabase;
+-(void)setDefaultDatabase:(NSString *)newDatabase;
+-(int)foldersTreeSortMethod;
+-(void)setFoldersTreeSortMethod:(int)newMethod;
+-(NSString *)imagesFolder;
+-(NSString *)feedSourcesFolder;
+-(BOOL)shouldSaveFeedSource;
+@end
+
+static Preferences * _standardPreferences = nil;
+
+@implementation Preferences
+
+/* init
+ * Start with the application's defaults for the settings that the tools read.
+ */
+-(id)init
+{
+	if ((self = [super init]) != nil)
+	{
+		values = [[NSMutableDictionary alloc] init];
+		[values setObject:[NSNumber numberWithInt:MA_Default_RefreshThreads] forKey:MAPref_RefreshThreads];
+	}
+	return self;
+}
+
+/* standardPreferences
+ * Returns the single set of preferences.
+ */
++(Preferences *)standardPreferences
+{
+	if (_standardPreferences == nil)
+		_standardPreferences = [[Preferences alloc] init];
+	return _standardPreferences;
+}
+
+/* boolForKey
+ * Returns the boolean setting that the tool made, or NO for any other.
+ */
+-(BOOL)boolForKey:(NSString *)defaultName
+{
+	return [[values objectForKey:defaultName] boolValue];
+}
+
+/* integerForKey
+ * Returns the integer setting that the tool made or the default, or 0 for any other.
+ */
+-(int)integerForKey:(NSString *)defaultName
+{
+	return [[values objectForKey:defaultName] intValue];
+}
+
+/* setBool
+ * Changes a boolean setting for this run of the tool only.
+ */
+-(void)setBool:(BOOL)value forKey:(NSString *)defaultName
+{
+	[values setObject:[NSNumber numberWithBool:value] forKey:defaultName];
+}
+
+/* setInteger
+ * Changes an integer setting for this run of the tool only.
+ */
+-(void)setInteger:(int)value forKey:(NSString *)defaultName
+{
+	[values setObject:[NSNumber numberWithInt:value] forKey:defaultName];
+}
+
+/* defaultDatabase
+ * Returns the path of the database that the tool has asked for.
+ */
+-(NSString *)defaultDatabase
+{
+	return defaultDatabase;
+}
+
+/* setDefaultDatabase
+ * Sets the database that the next call to sharedDatabase opens.
+ */
+-(void)setDefaultDatabase:(NSString *)newDatabase
+{
+	[newDatabase retain];
+	[defaultDatabase release];
+	defaultDatabase = newDatabase;
+}
+
+/* foldersTreeSortMethod
+ * Returns the sort order that the database last set.
+ */
+-(int)foldersTreeSortMethod
+{
+	return foldersTreeSortMethod;
+}
+
+/* setFoldersTreeSortMethod
+ * Remembers the sort order. Nothing is listening for the change.
+ */
+-(void)setFoldersTreeSortMethod:(int)newMethod
+{
+	foldersTreeSortMethod = newMethod;
+}
+
+/* imagesFolder
+ * Folder images are never read or written by the tools.
+ */
+-(NSString *)imagesFolder
+{
+	return NSTemporaryDirectory();
+}
+
+/* feedSourcesFolder
+ * Feed sources are never saved by the tools.
+ */
+-(NSString *)feedSourcesFolder
+{
+	return NSTemporaryDirectory();
+}
+
+/* shouldSaveFeedSource
+ * The tools never keep a copy of the feeds they download.
+ */
+-(BOOL)shouldSaveFeedSource
+{
+	return NO;
+}
+
+/* dealloc
+ * Clean up behind us.
+ */
+-(void)dealloc
+{
+	[defaultDatabase release];
+	[values release];
+	[super dealloc];
+}
+@end
@@ -0,0 +1,358 @@
+//
+//  CriteriaCheck.m
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "Preferences.h"
+#import "Database.h"
+#import "CriteriaMatcher.h"
+#import "Message.h"
+
+// The number of fields on each line of the articles corpus
+#define MA_Article_Field_Count	10
+
+static int countOfFailures = 0;
+
+/* readCorpus
+ * Returns the lines of a corpus file, or nil after reporting why it couldn't be read.
+ */
+static NSArray * readCorpus(NSString * path)
+{
+	NSError * error = nil;
+	NSString * corpus = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:&error];
+	if (corpus == nil)
+	{
+		fprintf(stderr, "criteriacheck: cannot read %s: %s\n", [path UTF8String], [[error localizedDescription] UTF8String]);
+		return nil;
+	}
+	return [corpus componentsSeparatedByString:@"\n"];
+}
+
+/* isBlankLine
+ * Returns whether a corpus line is empty or a comment.
+ */
+static BOOL isBlankLine(NSString * line)
+{
+	NSString * trimmedLine = [line stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+	return [trimmedLine length] == 0 || [trimmedLine hasPrefix:@"#"];
+}
+
+/* optionalString
+ * Returns nil for an empty corpus field so the article is stored as if the feed had
+ * left it out.
+ */
+static NSString * optionalString(NSString * field)
+{
+	return ([field length] == 0) ? nil : field;
+}
+
+/* folderForPath
+ * Returns the ID of the folder at a slash separated path, creating it if needed. The
+ * last component is a subscription and the ones before it are groups.
+ */
+static int folderForPath(Database * db, NSString * path, NSMutableDictionary * foldersByPath)
+{
+	NSNumber * folderNumber = [foldersByPath objectForKey:path];
+	if (folderNumber != nil)
+		return [folderNumber intValue];
+
+	NSArray * components = [path componentsSeparatedByString:@"/"];
+	NSString * groupPath = nil;
+	int parentId = MA_Root_Folder;
+	NSUInteger index;
+
+	for (index = 0; index + 1 < [components count]; ++index)
+	{
+		NSString * name = [components objectAtIndex:index];
+		groupPath = (groupPath == nil) ? name : [groupPath stringByAppendingFormat:@"/%@", name];
+		folderNumber = [foldersByPath objectForKey:groupPath];
+		if (folderNumber == nil)
+		{
+			folderNumber = [NSNumber numberWithInt:[db addFolder:parentId afterChild:-1 folderName:name type:MA_Group_Folder canAppendIndex:NO]];
+			[foldersByPath setObject:folderNumber forKey:groupPath];
+		}
+		parentId = [folderNumber intValue];
+	}
+
+	NSString * feedURL = [NSString stringWithFormat:@"http://localhost/%@.xml", [path stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding]];
+	int folderId = [db addRSSFolder:[components lastObject] underParent:parentId afterChild:-1 subscriptionURL:feedURL];
+	[foldersByPath setObject:[NSNumber numberWithInt:folderId] forKey:path];
+	return folderId;
+}
+
+/* loadArticles
+ * Creates the folders and articles listed in the corpus. Each line has the folder
+ * path, guid, title, author, link, enclosure, flags, age in days, parent ID and body
+ * separated by tabs. The flags are any of r(ead), f(lagged), d(eleted) and e(nclosure)
+ * or - for none. Article dates count back from midday today so that the ages fall
+ * squarely inside the days that the date criteria name.
+ */
+static BOOL loadArticles(Database * db, NSString * path)
+{
+	NSArray * lines = readCorpus(path);
+	if (lines == nil)
+		return NO;
+
+	NSCalendarDate * now = [NSCalendarDate calendarDate];
+	NSCalendarDate * midday = [NSCalendarDate dateWithYear:[now yearOfCommonEra] month:[now monthOfYear] day:[now dayOfMonth] hour:12 minute:0 second:0 timeZone:[now timeZone]];
+	NSMutableDictionary * foldersByPath = [NSMutableDictionary dictionary];
+	NSMutableDictionary * articlesByFolder = [NSMutableDictionary dictionary];
+	NSMutableArray * folderOrder = [NSMutableArray array];
+	int lineNumber = 0;
+
+	for (NSString * line in lines)
+	{
+		NSArray * fields = [line componentsSeparatedByString:@"\t"];
+
+		++lineNumber;
+		if (isBlankLine(line))
+			continue;
+		if ([fields count] != MA_Article_Field_Count)
+		{
+			fprintf(stderr, "criteriacheck: %s:%d: expected %d fields separated by tabs\n", [path UTF8String], lineNumber, MA_Article_Field_Count);
+			return NO;
+		}
+
+		NSNumber * folderNumber = [NSNumber numberWithInt:folderForPath(db, [fields objectAtIndex:0], foldersByPath)];
+		NSString * flags = [fields objectAtIndex:6];
+		Article * article = [[Article alloc] initWithGuid:[fields objectAtIndex:1]];
+
+		[article setTitle:optionalString([fields objectAtIndex:2])];
+		[article setAuthor:optionalString([fields objectAtIndex:3])];
+		[article setLink:optionalString([fields objectAtIndex:4])];
+		[article setEnclosure:optionalString([fields objectAtIndex:5])];
+		[article markRead:[flags rangeOfString:@"r"].location != NSNotFound];
+		[article markFlagged:[flags rangeOfString:@"f"].location != NSNotFound];
+		[article markDeleted:[flags rangeOfString:@"d"].location != NSNotFound];
+		[article setHasEnclosure:[flags rangeOfString:@"e"].location != NSNotFound];
+		[article setDate:[midday dateByAddingYears:0 months:0 days:-[[fields objectAtIndex:7] intValue] hours:0 minutes:0 seconds:0]];
+		[article setParentId:[[fields objectAtIndex:8] intValue]];
+		[article setBody:[fields objectAtIndex:9]];
+
+		NSMutableArray * articles = [articlesByFolder objectForKey:folderNumber];
+		if (articles == nil)
+		{
+			articles = [NSMutableArray array];
+			[articlesByFolder setObject:articles forKey:folderNumber];
+			[folderOrder addObject:folderNumber];
+		}
+		[articles addObject:article];
+		[article release];
+	}
+
+	for (NSNumber * folderNumber in folderOrder)
+	{
+		NSArray * articles = [articlesByFolder objectForKey:folderNumber];
+		if ([db createArticles:articles inFolder:[folderNumber intValue] guidHistory:[NSSet set]] != (int)[articles count])
+		{
+			fprintf(stderr, "criteriacheck: cannot store the articles in %s\n", [[[db folderFromID:[folderNumber intValue]] name] UTF8String]);
+			return NO;
+		}
+	}
+	return YES;
+}
+
+/* articleKey
+ * Returns a string that names an article for the report.
+ */
+static NSString * articleKey(Database * db, Article * article)
+{
+	return [NSString stringWithFormat:@"%@/%@", [[db folderFromID:[article folderId]] name], [article guid]];
+}
+
+/* reportArticles
+ * Lists the articles that one side found and the other didn't.
+ */
+static void reportArticles(const char * heading, NSMutableSet * keys)
+{
+	if ([keys count] == 0)
+		return;
+	printf("  %s:\n", heading);
+	for (NSString * key in [[keys allObjects] sortedArrayUsingSelector:@selector(compare:)])
+		printf("    %s\n", [key UTF8String]);
+}
+
+/* checkCriteria
+ * Runs one criteria tree as the SQL of a smart folder and through the matcher over
+ * every article and reports any article that only one of them selects.
+ */
+static void checkCriteria(Database * db, CriteriaTree * tree, NSArray * allArticles, int lineNumber)
+{
+	NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+	NSString * folderName = [NSString stringWithFormat:@"Case %d", lineNumber];
+	int smartFolderId = [db addSmartFolder:folderName underParent:MA_Root_Folder withQuery:tree];
+	NSMutableSet * sqlKeys = [NSMutableSet set];
+	NSMutableSet * matcherKeys = [NSMutableSet set];
+
+	if (smartFolderId == -1)
+	{
+		fprintf(stderr, "criteriacheck: cannot create a smart folder for the criteria at line %d\n", lineNumber);
+		++countOfFailures;
+		[pool release];
+		return;
+	}
+
+	for (Article * article in [db arrayOfArticles:smartFolderId filterString:@""])
+		[sqlKeys addObject:articleKey(db, article)];
+
+	// Smart folders leave out deleted articles whatever the criteria say
+	CriteriaMatcher * matcher = [[CriteriaMatcher alloc] initWithCriteriaTree:tree];
+	for (Article * article in allArticles)
+	{
+		if (![article isDeleted] && [matcher matchesArticle:article])
+			[matcherKeys addObject:articleKey(db, article)];
+	}
+	[matcher release];
+
+	if (![sqlKeys isEqualToSet:matcherKeys])
+	{
+		NSMutableSet * sqlOnly = [NSMutableSet setWithSet:sqlKeys];
+		NSMutableSet * matcherOnly = [NSMutableSet setWithSet:matcherKeys];
+		[sqlOnly minusSet:matcherKeys];
+		[matcherOnly minusSet:sqlKeys];
+
+		printf("FAIL %d: %s\n  sql: %s\n", lineNumber, [[tree string] UTF8String], [[db criteriaToSQL:tree] UTF8String]);
+		reportArticles("only selected by the SQL", sqlOnly);
+		reportArticles("only selected by the matcher", matcherOnly);
+		++countOfFailures;
+	}
+	[pool release];
+}
+
+/* checkAllCriteria
+ * Reads the criteria corpus and checks each criteria tree in it. A tree starts with
+ * a line saying "all" or "any" and is followed by a line for each clause with the
+ * field name, operator and value separated by tabs. Trees are separated by blank
+ * lines. Returns the number of trees checked, or -1 if the corpus was unreadable.
+ */
+static int checkAllCriteria(Database * db, NSString * path, NSArray * allArticles)
+{
+	NSArray * lines = readCorpus(path);
+	if (lines == nil)
+		return -1;
+
+	CriteriaTree * tree = nil;
+	int treeLineNumber = 0;
+	int countOfTrees = 0;
+	int lineNumber = 0;
+
+	// The extra blank line ends the last tree in the file
+	for (NSString * line in [lines arrayByAddingObject:@""])
+	{
+		NSString * trimmedLine = [line stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+		++lineNumber;
+
+		if ([trimmedLine hasPrefix:@"#"])
+			continue;
+		if ([trimmedLine length] == 0)
+		{
+			if (tree != nil)
+			{
+				checkCriteria(db, tree, allArticles, treeLineNumber);
+				[tree release];
+				tree = nil;
+				++countOfTrees;
+			}
+			continue;
+		}
+
+		if (tree == nil)
+		{
+			CriteriaCondition condition = [CriteriaTree conditionFromString:trimmedLine];
+			if (condition == MA_CritCondition_Invalid)
+			{
+				fprintf(stderr, "criteriacheck: %s:%d: expected \"all\" or \"any\"\n", [path UTF8String], lineNumber);
+				++countOfFailures;
+				continue;
+			}
+			tree = [[CriteriaTree alloc] init];
+			[tree setCondition:condition];
+			treeLineNumber = lineNumber;
+			continue;
+		}
+
+		NSArray * fields = [line componentsSeparatedByString:@"\t"];
+		if ([fields count] != 3)
+		{
+			fprintf(stderr, "criteriacheck: %s:%d: expected a field, operator and value separated by tabs\n", [path UTF8String], lineNumber);
+			++countOfFailures;
+			continue;
+		}
+		if ([db fieldByName:[fields objectAtIndex:0]] == nil)
+		{
+			fprintf(stderr, "criteriacheck: %s:%d: there is no field called %s\n", [path UTF8String], lineNumber, [[fields objectAtIndex:0] UTF8String]);
+			++countOfFailures;
+			continue;
+		}
+
+		// An operator that isn't recognised is kept as 0, which both sides skip
+		CriteriaOperator operator = [Criteria operatorFromString:[fields objectAtIndex:1]];
+		Criteria * clause = [[Criteria alloc] initWithField:[fields objectAtIndex:0] withOperator:operator withValue:[fields objectAtIndex:2]];
+		[tree addCriteria:clause];
+		[clause release];
+	}
+	return countOfTrees;
+}
+
+/* main
+ * Builds a scratch database from the articles corpus and checks that the criteria in
+ * the criteria corpus select the same articles through SQL as through CriteriaMatcher.
+ * Exits with a non-zero status if they disagreed about any of them.
+ */
+int main(int argc, const char * argv[])
+{
+	NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+
+	if (argc < 3)
+	{
+		fprintf(stderr, "usage: criteriacheck articles criteria [database]\n");
+		[pool release];
+		return 2;
+	}
+
+	NSString * articlesPath = [NSString stringWithUTF8String:argv[1]];
+	NSString * criteriaPath = [NSString stringWithUTF8String:argv[2]];
+	NSString * databasePath = (argc > 3) ? [NSString stringWithUTF8String:argv[3]] : [NSTemporaryDirectory() stringByAppendingPathComponent:@"criteriacheck.db"];
+
+	// Always start from an empty database
+	[[NSFileManager defaultManager] removeFileAtPath:databasePath handler:nil];
+	[[Preferences standardPreferences] setDefaultDatabase:databasePath];
+	Database * db = [Database sharedDatabase];
+	if (db == nil)
+	{
+		fprintf(stderr, "criteriacheck: cannot create a database at %s\n", [databasePath UTF8String]);
+		[pool release];
+		return 2;
+	}
+	if (!loadArticles(db, articlesPath))
+	{
+		[pool release];
+		return 2;
+	}
+
+	// Every article including the deleted ones, each with its folder ID set
+	NSArray * allArticles = [db arrayOfArticles:0 filterString:@""];
+	int countOfTrees = checkAllCriteria(db, criteriaPath, allArticles);
+	if (countOfTrees < 0)
+	{
+		[pool release];
+		return 2;
+	}
+
+	printf("%lu articles, %d criteria checked, %d failed\n", (unsigned long)[allArticles count], countOfTrees, countOfFailures);
+	[db close];
+	[pool release];
+	return (countOfFailures > 0) ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+//
+//  DateCheck.m
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "XMLParser.h"
+#include <time.h>
+
+// Largest difference between the parsed and the expected time that still counts as a match
+#define MA_Date_Tolerance	0.0005
+
+/* parseExpectedDate
+ * Converts a corpus time of the form YYYY-MM-DD HH:MM:SS[.fff] in GMT to an interval
+ * since the reference date. This deliberately goes through timegm rather than any of
+ * the parser's own arithmetic.
+ */
+static BOOL parseExpectedDate(NSString * string, NSTimeInterval * timeInterval)
+{
+	struct tm components;
+	int year, month, day, hour, minute;
+	double second;
+
+	if (sscanf([string UTF8String], "%d-%d-%d %d:%d:%lf", &year, &month, &day, &hour, &minute, &second) != 6)
+		return NO;
+	memset(&components, 0, sizeof(components));
+	components.tm_year = year - 1900;
+	components.tm_mon = month - 1;
+	components.tm_mday = day;
+	components.tm_hour = hour;
+	components.tm_min = minute;
+	*timeInterval = (double)timegm(&components) + second - NSTimeIntervalSince1970;
+	return YES;
+}
+
+/* describeDate
+ * Returns the interval as a GMT time in the same form as the corpus.
+ */
+static NSString * describeDate(NSTimeInterval timeInterval)
+{
+	NSCalendarDate * date = [NSCalendarDate dateWithTimeIntervalSinceReferenceDate:timeInterval];
+	return [date descriptionWithCalendarFormat:@"%Y-%m-%d %H:%M:%S.%F" timeZone:[NSTimeZone timeZoneWithName:@"GMT"] locale:nil];
+}
+
+/* main
+ * Runs every date in the corpus through the XMLParser fast path and reports any that
+ * don't give the expected time. Exits with a non-zero status if there were any.
+ */
+int main(int argc, const char * argv[])
+{
+	NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+	NSString * corpusPath = (argc > 1) ? [NSString stringWithUTF8String:argv[1]] : @"dates.txt";
+	NSError * error = nil;
+	NSString * corpus = [NSString stringWithContentsOfFile:corpusPath encoding:NSUTF8StringEncoding error:&error];
+	int countOfDates = 0;
+	int countOfFailures = 0;
+	int lineNumber = 0;
+
+	if (corpus == nil)
+	{
+		fprintf(stderr, "datecheck: cannot read %s: %s\n", [corpusPath UTF8String], [[error localizedDescription] UTF8String]);
+		[pool release];
+		return 2;
+	}
+
+	NSEnumerator * enumerator = [[corpus componentsSeparatedByString:@"\n"] objectEnumerator];
+	NSString * line;
+
+	while ((line = [enumerator nextObject]) != nil)
+	{
+		NSString * trimmedLine = [line stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+		NSArray * fields = [line componentsSeparatedByString:@"\t"];
+		NSTimeInterval parsedInterval;
+		NSTimeInterval expectedInterval;
+
+		++lineNumber;
+		if ([trimmedLine length] == 0 || [trimmedLine hasPrefix:@"#"])
+			continue;
+		if ([fields count] != 2)
+		{
+			fprintf(stderr, "datecheck: %s:%d: expected a date and a result separated by a tab\n", [corpusPath UTF8String], lineNumber);
+			++countOfFailures;
+			continue;
+		}
+
+		NSString * dateString = [fields objectAtIndex:0];
+		NSString * expected = [[fields objectAtIndex:1] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+		BOOL parsed = [XMLParser getTimeInterval:&parsedInterval fromXMLDate:dateString];
+
+		++countOfDates;
+		if ([expected isEqualToString:@"none"])
+		{
+			if (parsed)
+			{
+				printf("FAIL %d: \"%s\" should be left to the slow parser but was read as %s\n", lineNumber, [dateString UTF8String], [describeDate(parsedInterval) UTF8String]);
+				++countOfFailures;
+			}
+		}
+		else if (!parseExpectedDate(expected, &expectedInterval))
+		{
+			fprintf(stderr, "datecheck: %s:%d: cannot read the expected time \"%s\"\n", [corpusPath UTF8String], lineNumber, [expected UTF8String]);
+			++countOfFailures;
+		}
+		else if (!parsed)
+		{
+			printf("FAIL %d: \"%s\" was not parsed, expected %s\n", lineNumber, [dateString UTF8String], [expected UTF8String]);
+			++countOfFailures;
+		}
+		else if (fabs(parsedInterval - expectedInterval) > MA_Date_Tolerance)
+		{
+			printf("FAIL %d: \"%s\" was read as %s, expected %s\n", lineNumber, [dateString UTF8String], [describeDate(parsedInterval) UTF8String], [expected UTF8String]);
+			++countOfFailures;
+		}
+	}
+
+	printf("%d dates checked, %d failed\n", countOfDates, countOfFailures);
+	[pool release];
+	return (countOfFailures > 0) ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+//
+//  ParserCheck.m
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "RichXMLParser.h"
+#import "LegacyRichXMLParser.h"
+
+// Sizes of the pieces a feed is cut into when it is streamed through the parser. One
+// byte splits every entity and multi-byte character; the others land at odd places.
+static const NSUInteger chunkSizes[] = { 1, 61, 4096 };
+
+// Item dates within this many seconds of each other are the same.
+#define MA_Date_Tolerance		0.001
+
+// Items without a date are given one counting back from the time of parsing, which
+// can't be the same for two parsers that run one after the other.
+#define MA_Synthesised_Date_Tolerance	0.5
+
+static int countOfDifferences = 0;
+
+/* displayString
+ * Returns a printable form of a parsed value that tells nil apart from an empty string.
+ */
+static const char * displayString(id value)
+{
+	if (value == nil)
+		return "(nil)";
+	if ([value isKindOfClass:[NSDate class]])
+		value = [value descriptionWithCalendarFormat:@"%Y-%m-%d %H:%M:%S.%F" timeZone:[NSTimeZone timeZoneWithName:@"GMT"] locale:nil];
+	return [[NSString stringWithFormat:@"\"%@\"", value] UTF8String];
+}
+
+/* reportDifference
+ * Prints one difference between the parsers.
+ */
+static void reportDifference(NSString * context, NSString * fieldName, id legacyValue, id newValue)
+{
+	printf("DIFF %s %s\n  legacy: %s\n  new:    %s\n", [context UTF8String], [fieldName UTF8String], displayString(legacyValue), displayString(newValue));
+	++countOfDifferences;
+}
+
+/* stringsMatch
+ * Returns whether two strings are identical or both nil.
+ */
+static BOOL stringsMatch(NSString * legacyValue, NSString * newValue)
+{
+	if (legacyValue == nil || newValue == nil)
+		return legacyValue == newValue;
+	return [legacyValue isEqualToString:newValue];
+}
+
+/* compareStrings
+ * Reports a difference if the two strings aren't identical. A nil string and an empty
+ * one are different since RefreshManager treats an empty guid specially.
+ */
+static void compareStrings(NSString * context, NSString * fieldName, NSString * legacyValue, NSString * newValue)
+{
+	if (!stringsMatch(legacyValue, newValue))
+		reportDifference(context, fieldName, legacyValue, newValue);
+}
+
+/* compareDates
+ * Reports a difference if the two dates are further apart than the tolerance. Dates
+ * less than a day before the parse are taken to be ones the parser made up, and those
+ * are compared by how far each is from the moment its own parse started.
+ */
+static void compareDates(NSString * context, NSString * fieldName, NSDate * legacyValue, NSDate * newValue, NSDate * legacyStart, NSDate * newStart)
+{
+	if (legacyValue == nil && newValue == nil)
+		return;
+	if (legacyValue == nil || newValue == nil)
+	{
+		reportDifference(context, fieldName, legacyValue, newValue);
+		return;
+	}
+
+	NSTimeInterval legacyAge = [legacyValue timeIntervalSinceDate:legacyStart];
+	NSTimeInterval newAge = [newValue timeIntervalSinceDate:newStart];
+	if (legacyAge > -86400.0 && newAge > -86400.0)
+	{
+		if (fabs(legacyAge - newAge) > MA_Synthesised_Date_Tolerance)
+			reportDifference(context, fieldName, legacyValue, newValue);
+	}
+	else if (fabs([legacyValue timeIntervalSinceDate:newValue]) > MA_Date_Tolerance)
+		reportDifference(context, fieldName, legacyValue, newValue);
+}
+
+/* itemSummary
+ * Returns a short description of an item for listing the order of the items.
+ */
+static NSString * itemSummary(id item)
+{
+	return [NSString stringWithFormat:@"%@ | %@", [item guid], [item title]];
+}
+
+/* compareFeeds
+ * Compares everything that RefreshManager reads from a parsed feed.
+ */
+static void compareFeeds(NSString * context, BOOL legacySuccess, LegacyRichXMLParser * legacyFeed, NSDate * legacyStart, BOOL newSuccess, RichXMLParser * newFeed, NSDate * newStart)
+{
+	if (legacySuccess != newSuccess)
+	{
+		reportDifference(context, @"result", legacySuccess ? @"parsed" : @"failed", newSuccess ? @"parsed" : @"failed");
+		return;
+	}
+	if (!legacySuccess)
+		return;
+
+	compareStrings(context, @"feed title", [legacyFeed title], [newFeed title]);
+	compareStrings(context, @"feed description", [legacyFeed description], [newFeed description]);
+	compareStrings(context, @"feed link", [legacyFeed link], [newFeed link]);
+	compareDates(context, @"feed last modified", [legacyFeed lastModified], [newFeed lastModified], legacyStart, newStart);
+
+	NSArray * legacyItems = [legacyFeed items];
+	NSArray * newItems = [newFeed items];
+	if ([legacyItems count] != [newItems count])
+	{
+		NSArray * legacyOrder = [legacyItems valueForKey:@"guid"];
+		NSArray * newOrder = [newItems valueForKey:@"guid"];
+		reportDifference(context, @"item count", [NSString stringWithFormat:@"%lu items: %@", (unsigned long)[legacyItems count], legacyOrder], [NSString stringWithFormat:@"%lu items: %@", (unsigned long)[newItems count], newOrder]);
+		return;
+	}
+
+	NSUInteger index;
+	for (index = 0; index < [legacyItems count]; ++index)
+	{
+		LegacyFeedItem * legacyItem = [legacyItems objectAtIndex:index];
+		FeedItem * newItem = [newItems objectAtIndex:index];
+		NSString * itemContext = [NSString stringWithFormat:@"%@ item %lu", context, (unsigned long)index];
+
+		// A different guid at the same position means the items are in a different
+		// order, and comparing the rest of them would only repeat that.
+		if (!stringsMatch([legacyItem guid], [newItem guid]))
+		{
+			reportDifference(itemContext, @"order", itemSummary(legacyItem), itemSummary(newItem));
+			continue;
+		}
+		compareStrings(itemContext, @"title", [legacyItem title], [newItem title]);
+		compareStrings(itemContext, @"author", [legacyItem author], [newItem author]);
+		compareStrings(itemContext, @"link", [legacyItem link], [newItem link]);
+		compareStrings(itemContext, @"enclosure", [legacyItem enclosure], [newItem enclosure]);
+		compareStrings(itemContext, @"description", [legacyItem description], [newItem description]);
+		compareDates(itemContext, @"date", [legacyItem date], [newItem date], legacyStart, newStart);
+	}
+}
+
+/* checkFeed
+ * Parses the feed with the old parser, then with the new one in a single call and
+ * streamed in chunks of each size, and compares the new results with the old.
+ */
+static void checkFeed(NSString * path)
+{
+	NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+	NSData * feedData = [NSData dataWithContentsOfFile:path];
+	NSString * feedName = [path lastPathComponent];
+
+	if (feedData == nil)
+	{
+		fprintf(stderr, "parsercheck: cannot read %s\n", [path UTF8String]);
+		++countOfDifferences;
+		[pool release];
+		return;
+	}
+
+	NSDate * legacyStart = [NSDate date];
+	LegacyRichXMLParser * legacyFeed = [[LegacyRichXMLParser alloc] init];
+	BOOL legacySuccess = [legacyFeed parseRichXML:feedData];
+
+	NSDate * newStart = [NSDate date];
+	RichXMLParser * newFeed = [[RichXMLParser alloc] init];
+	BOOL newSuccess = [newFeed parseRichXML:feedData];
+	compareFeeds(feedName, legacySuccess, legacyFeed, legacyStart, newSuccess, newFeed, newStart);
+	[newFeed release];
+
+	NSUInteger sizeIndex;
+	for (sizeIndex = 0; sizeIndex < sizeof(chunkSizes) / sizeof(chunkSizes[0]); ++sizeIndex)
+	{
+		NSUInteger chunkSize = chunkSizes[sizeIndex];
+		NSUInteger offset;
+
+		newStart = [NSDate date];
+		newFeed = [[RichXMLParser alloc] init];
+		newSuccess = [newFeed beginParsing];
+		for (offset = 0; newSuccess && offset < [feedData length]; offset += chunkSize)
+		{
+			NSUInteger length = MIN(chunkSize, [feedData length] - offset);
+			newSuccess = [newFeed parseData:[feedData subdataWithRange:NSMakeRange(offset, length)]];
+		}
+		newSuccess = newSuccess && [newFeed endParsing];
+		compareFeeds([NSString stringWithFormat:@"%@ (streamed in %lu byte chunks)", feedName, (unsigned long)chunkSize], legacySuccess, legacyFeed, legacyStart, newSuccess, newFeed, newStart);
+		[newFeed release];
+	}
+
+	[legacyFeed release];
+	[pool release];
+}
+
+/* main
+ * Checks each feed named on the command line and exits with a non-zero status if the
+ * parsers disagreed about any of them.
+ */
+int main(int argc, const char * argv[])
+{
+	NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+	int index;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: parsercheck feed...\n");
+		[pool release];
+		return 2;
+	}
+	for (index = 1; index < argc; ++index)
+		checkFeed([NSString stringWithUTF8String:argv[index]]);
+
+	printf("%d feeds checked, %d differences\n", argc - 1, countOfDifferences);
+	[pool release];
+	return (countOfDifferences > 0) ? 1 : 0;
+}
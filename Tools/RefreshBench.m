@@ -0,0 +1,193 @@
+//
+//  RefreshBench.m
+//  Vienna
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "Preferences.h"
+#import "Database.h"
+#import "RefreshManager.h"
+
+// Subscriptions are spread over this many loopback addresses at most, 127.0.0.1 up
+// to 127.0.0.254.
+#define MA_Max_Bench_Hosts	254
+
+// How often the run loop comes back to check whether the refresh has finished
+#define MA_Bench_Poll_Interval	0.1
+
+/* readCount
+ * Reads the number that follows an option, which must be at least the minimum.
+ */
+static BOOL readCount(int argc, const char * argv[], int * index, int minimum, int * value)
+{
+	char * end;
+
+	if (*index + 1 >= argc)
+	{
+		fprintf(stderr, "refreshbench: %s needs a value\n", argv[*index]);
+		return NO;
+	}
+	++*index;
+	*value = (int)strtol(argv[*index], &end, 10);
+	if (*end != '\0' || *value < minimum)
+	{
+		fprintf(stderr, "refreshbench: %s must be a number of at least %d\n", argv[*index - 1], minimum);
+		return NO;
+	}
+	return YES;
+}
+
+/* addSubscriptions
+ * Subscribes to feeds 0 up to count on the feed server, each host taking the next
+ * feed in turn so that the refresh can interleave them.
+ */
+static void addSubscriptions(Database * db, int count, int countOfHosts, int port)
+{
+	int index;
+
+	[db beginTransaction];
+	for (index = 0; index < count; ++index)
+	{
+		NSString * feedURL = [NSString stringWithFormat:@"http://127.0.0.%d:%d/feed/%d", 1 + (index % countOfHosts), port, index];
+		[db addRSSFolder:[NSString stringWithFormat:@"Feed %d", index] underParent:MA_Root_Folder afterChild:-1 subscriptionURL:feedURL];
+	}
+	[db commitTransaction];
+}
+
+/* runRefresh
+ * Refreshes every subscription and waits for the whole refresh, including the
+ * writes to the database, to finish. Returns the time it took in seconds.
+ */
+static NSTimeInterval runRefresh(Database * db)
+{
+	RefreshManager * manager = [RefreshManager sharedManager];
+	NSTimeInterval startTime = [NSDate timeIntervalSinceReferenceDate];
+
+	[manager refreshSubscriptions:[db arrayOfFolders:MA_Root_Folder] ignoringSubscriptionStatus:NO];
+	while ([manager isRefreshing])
+	{
+		NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:MA_Bench_Poll_Interval]];
+		[pool release];
+	}
+	return [NSDate timeIntervalSinceReferenceDate] - startTime;
+}
+
+/* reportPass
+ * Prints what one refresh did. Latencies are shown in milliseconds and the peak
+ * memory, which getrusage gives in bytes, in megabytes. Every other statistic is
+ * printed as it is, and all of them in the same order each time so that the
+ * output of two runs can be compared line by line.
+ */
+static void reportPass(Database * db, int pass, NSTimeInterval elapsedTime)
+{
+	NSDictionary * statistics = [[RefreshManager sharedManager] pipelineStatistics];
+	int countOfUnsubscribed = 0;
+	int countOfErrors = 0;
+
+	for (Folder * folder in [db arrayOfFolders:MA_Root_Folder])
+	{
+		if (IsUnsubscribed(folder))
+			++countOfUnsubscribed;
+		if (IsError(folder))
+			++countOfErrors;
+	}
+
+	printf("pass %d: %.2f seconds\n", pass, elapsedTime);
+	for (NSString * key in [[statistics allKeys] sortedArrayUsingSelector:@selector(compare:)])
+	{
+		double value = [[statistics objectForKey:key] doubleValue];
+		if ([key rangeOfString:@"Latency"].location != NSNotFound)
+			printf("  %-22s %10.1f ms\n", [key UTF8String], value * 1000.0);
+		else if ([key isEqualToString:@"PeakMemory"])
+			printf("  %-22s %10.1f MB\n", [key UTF8String], value / (1024.0 * 1024.0));
+		else if ([key isEqualToString:@"FeedsPerSecond"])
+			printf("  %-22s %10.1f\n", [key UTF8String], value);
+		else
+			printf("  %-22s %10.0f\n", [key UTF8String], value);
+	}
+	printf("  %-22s %10d\n", "UnreadArticles", [db countOfUnread]);
+	printf("  %-22s %10d\n", "Unsubscribed", countOfUnsubscribed);
+	printf("  %-22s %10d\n", "Errors", countOfErrors);
+	fflush(stdout);
+}
+
+/* main
+ * Subscribes a scratch database to feeds on a local feedserver.py and refreshes them
+ * all a number of times, reporting the throughput, the time spent in each stage of
+ * the refresh and the peak memory after each. The first pass downloads and stores
+ * every feed. Later ones see the not modified responses and the unchanged feeds.
+ */
+int main(int argc, const char * argv[])
+{
+	NSAutoreleasePool * pool = [[NSAutoreleasePool alloc] init];
+	NSString * databasePath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"refreshbench.db"];
+	int countOfFeeds = 2000;
+	int countOfHosts = 1;
+	int port = 8900;
+	int countOfPasses = 2;
+	int countOfConnections = MA_Default_RefreshThreads;
+	int index;
+
+	for (index = 1; index < argc; ++index)
+	{
+		BOOL isValid = YES;
+		if (strcmp(argv[index], "-feeds") == 0)
+			isValid = readCount(argc, argv, &index, 1, &countOfFeeds);
+		else if (strcmp(argv[index], "-hosts") == 0)
+			isValid = readCount(argc, argv, &index, 1, &countOfHosts) && countOfHosts <= MA_Max_Bench_Hosts;
+		else if (strcmp(argv[index], "-port") == 0)
+			isValid = readCount(argc, argv, &index, 1, &port);
+		else if (strcmp(argv[index], "-passes") == 0)
+			isValid = readCount(argc, argv, &index, 1, &countOfPasses);
+		else if (strcmp(argv[index], "-connections") == 0)
+			isValid = readCount(argc, argv, &index, 1, &countOfConnections);
+		else if (argv[index][0] != '-' && index == argc - 1)
+			databasePath = [NSString stringWithUTF8String:argv[index]];
+		else
+			isValid = NO;
+		if (!isValid)
+		{
+			fprintf(stderr, "usage: refreshbench [-feeds count] [-hosts count] [-port port] [-passes count] [-connections count] [database]\n");
+			[pool release];
+			return 2;
+		}
+	}
+
+	// Always start from an empty database. The number of connections has to be set
+	// before the refresh manager is made since it only reads it once.
+	[[NSFileManager defaultManager] removeFileAtPath:databasePath handler:nil];
+	[[Preferences standardPreferences] setDefaultDatabase:databasePath];
+	[[Preferences standardPreferences] setInteger:countOfConnections forKey:MAPref_RefreshThreads];
+	Database * db = [Database sharedDatabase];
+	if (db == nil)
+	{
+		fprintf(stderr, "refreshbench: cannot create a database at %s\n", [databasePath UTF8String]);
+		[pool release];
+		return 2;
+	}
+	addSubscriptions(db, countOfFeeds, countOfHosts, port);
+
+	printf("%d feeds on %d hosts at port %d, %d connections\n", countOfFeeds, countOfHosts, port, countOfConnections);
+	for (index = 1; index <= countOfPasses; ++index)
+	{
+		NSAutoreleasePool * passPool = [[NSAutoreleasePool alloc] init];
+		reportPass(db, index, runRefresh(db));
+		[passPool release];
+	}
+
+	[db close];
+	[pool release];
+	return 0;
+}
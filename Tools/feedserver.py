@@ -0,0 +1,354 @@
+#!/usr/bin/env python
+#
+#  feedserver.py
+#  Vienna
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+#
+# Serves a corpus of feeds over HTTP on the loopback interface so that refreshbench
+# can drive a whole refresh without going near the internet. Feed n is at /feed/n on
+# every address the server listens on. How each feed behaves is picked from the seed
+# and the feed number alone, so the same options always give the same corpus:
+#
+#   - RSS 2.0, RSS 1.0 (RDF) and Atom feeds in turn, some of them large enough to be
+#     parsed as they download
+#   - a delay before each response
+#   - gzip encoding for clients that accept it
+#   - 304 Not Modified for feeds whose ETag or Last-Modified comes back
+#   - feeds that gain an item on every request
+#   - 301 redirects, 410 Gone and HTML pages with a meta http-equiv refresh
+#
+# The synthetic feeds have no home page link, which would send the refresh off to
+# port 80 for a favicon. With --corpus the feeds are the files in a directory instead.
+#
+# Mac OS X only routes 127.0.0.1 to the loopback interface. To serve from more
+# addresses, which the refresh treats as separate hosts, alias them first:
+#
+#   for i in $(jot 63 2); do sudo ifconfig lo0 alias 127.0.0.$i up; done
+#
+# The script keeps to what Python 2.5, as shipped with Mac OS X 10.5, understands.
+
+import os
+import random
+import sys
+import threading
+import time
+import zlib
+from optparse import OptionParser
+
+try:
+	from BaseHTTPServer import BaseHTTPRequestHandler, HTTPServer
+	from SocketServer import ThreadingMixIn
+except ImportError:
+	from http.server import BaseHTTPRequestHandler, HTTPServer
+	from socketserver import ThreadingMixIn
+
+# Item dates count forward an hour at a time from here so that they don't depend on
+# when the server runs. This is 1 January 2010 00:00:00 GMT.
+BASE_TIME = 1262304000
+
+WORDS = ("vienna", "cocoa", "feed", "article", "update", "release", "kernel", "market",
+	"election", "storm", "podcast", "episode", "review", "framework", "bindings", "data",
+	"network", "server", "client", "archive", "weather", "science", "history", "music",
+	"caf&#233;", "&#252;ber", "na&#239;ve", "r&#233;sum&#233;", "&#8220;quoted&#8221;")
+
+MONTHS = ("Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec")
+DAYS = ("Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun")
+
+def rfc822Date(seconds):
+	"""Formats a time as an RFC 822 date in GMT."""
+	t = time.gmtime(seconds)
+	return "%s, %02d %s %04d %02d:%02d:%02d GMT" % (DAYS[t[6]], t[2], MONTHS[t[1] - 1], t[0], t[3], t[4], t[5])
+
+def isoDate(seconds):
+	"""Formats a time as an ISO 8601 date in GMT."""
+	return time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime(seconds))
+
+def escape(text):
+	"""Escapes HTML for use as the text of an XML element."""
+	return text.replace("&", "&amp;").replace("<", "&lt;").replace(">", "&gt;")
+
+class Feed:
+	"""The behaviour of one feed in the corpus, drawn from the seed and feed number."""
+
+	def __init__(self, number, options):
+		rng = random.Random(options.seed * 1000003 + number)
+		self.number = number
+		self.format = ("rss", "rdf", "atom")[number % 3]
+
+		kind = rng.random() * 100
+		limit = options.gone
+		if kind < limit:
+			self.kind = "gone"
+		elif kind < limit + options.redirect:
+			self.kind = "redirect"
+		elif kind < limit + options.redirect + options.meta_refresh:
+			self.kind = "meta-refresh"
+		else:
+			self.kind = "feed"
+
+		self.isGzipped = rng.random() * 100 < options.gzip
+		self.isConditional = rng.random() * 100 < options.not_modified
+		self.isChanging = rng.random() * 100 < options.changing
+		self.hasGuids = rng.random() >= 0.1
+		self.countOfItems = max(1, int(options.items * (0.5 + rng.random())))
+		if rng.random() * 100 < options.large:
+			self.countOfItems = self.countOfItems * 8
+		self.latency = options.latency * (0.5 + rng.random()) / 1000.0
+
+	def version(self, countOfRequests):
+		"""Returns the version of the feed served for the given request. A changing
+		feed moves on one item each time it is fetched."""
+		if self.isChanging:
+			return countOfRequests
+		return 0
+
+	def etag(self, version):
+		return '"%d-%d"' % (self.number, version)
+
+	def lastModified(self, version):
+		return rfc822Date(BASE_TIME + (self.countOfItems + version) * 3600)
+
+	def itemText(self, serial):
+		"""Returns the title, author and HTML body of an item."""
+		rng = random.Random(self.number * 7919 + serial)
+		title = " ".join([rng.choice(WORDS) for index in range(rng.randint(3, 9))]).capitalize()
+		author = rng.choice(("Jane Smith", "John Doe", "J&#252;rgen", "", "O'Brien"))
+		paragraphs = []
+		for index in range(rng.randint(1, 8)):
+			sentence = " ".join([rng.choice(WORDS) for count in range(rng.randint(20, 60))])
+			paragraphs.append("<p>%s <a href=\"http://example.com/%d?a=1&amp;b=2\">link</a></p>" % (sentence, serial))
+		return title, author, "\n".join(paragraphs)
+
+	def body(self, host, version):
+		"""Returns the XML of the feed at a version. The newest item comes first."""
+		serials = range(version + self.countOfItems - 1, version - 1, -1)
+		base = "http://%s/feed/%d" % (host, self.number)
+		updated = BASE_TIME + (version + self.countOfItems) * 3600
+		parts = []
+		if self.format == "rss":
+			parts.append('<?xml version="1.0" encoding="utf-8"?>\n<rss version="2.0">\n<channel>\n'
+				'<title>Feed %d</title>\n<description>Synthetic RSS 2.0 feed</description>\n'
+				'<lastBuildDate>%s</lastBuildDate>\n' % (self.number, rfc822Date(updated)))
+			for serial in serials:
+				title, author, html = self.itemText(serial)
+				parts.append("<item>\n<title>%s</title>\n<link>%s/item/%d</link>\n" % (title, base, serial))
+				if self.hasGuids:
+					parts.append('<guid isPermaLink="false">%s/item/%d</guid>\n' % (base, serial))
+				if author:
+					parts.append("<author>%s</author>\n" % author)
+				if serial % 5 == 0:
+					parts.append('<enclosure url="%s/item/%d.mp3" length="%d" type="audio/mpeg"/>\n' % (base, serial, serial * 1000))
+				parts.append("<pubDate>%s</pubDate>\n<description>%s</description>\n</item>\n" % (rfc822Date(BASE_TIME + serial * 3600), escape(html)))
+			parts.append("</channel>\n</rss>\n")
+		elif self.format == "rdf":
+			parts.append('<?xml version="1.0" encoding="utf-8"?>\n'
+				'<rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#" xmlns="http://purl.org/rss/1.0/" '
+				'xmlns:dc="http://purl.org/dc/elements/1.1/">\n'
+				'<channel rdf:about="%s">\n<title>Feed %d</title>\n<description>Synthetic RSS 1.0 feed</description>\n'
+				'<dc:date>%s</dc:date>\n<items>\n<rdf:Seq>\n' % (base, self.number, isoDate(updated)))
+			for serial in serials:
+				parts.append('<rdf:li rdf:resource="%s/item/%d"/>\n' % (base, serial))
+			parts.append("</rdf:Seq>\n</items>\n</channel>\n")
+			for serial in serials:
+				title, author, html = self.itemText(serial)
+				parts.append('<item rdf:about="%s/item/%d">\n<title>%s</title>\n<link>%s/item/%d</link>\n'
+					'<dc:date>%s</dc:date>\n' % (base, serial, title, base, serial, isoDate(BASE_TIME + serial * 3600)))
+				if author:
+					parts.append("<dc:creator>%s</dc:creator>\n" % author)
+				parts.append("<description>%s</description>\n</item>\n" % escape(html))
+			parts.append("</rdf:RDF>\n")
+		else:
+			parts.append('<?xml version="1.0" encoding="utf-8"?>\n<feed xmlns="http://www.w3.org/2005/Atom">\n'
+				'<title>Feed %d</title>\n<subtitle>Synthetic Atom feed</subtitle>\n<id>%s</id>\n'
+				'<updated>%s</updated>\n' % (self.number, base, isoDate(updated)))
+			for serial in serials:
+				title, author, html = self.itemText(serial)
+				parts.append('<entry>\n<title>%s</title>\n<link href="%s/item/%d"/>\n' % (title, base, serial))
+				if self.hasGuids:
+					parts.append("<id>tag:localhost,2010:%d/%d</id>\n" % (self.number, serial))
+				if author:
+					parts.append("<author><name>%s</name></author>\n" % author)
+				parts.append('<updated>%s</updated>\n<content type="html">%s</content>\n</entry>\n' % (isoDate(BASE_TIME + serial * 3600), escape(html)))
+			parts.append("</feed>\n")
+		return "".join(parts)
+
+class FeedServer(ThreadingMixIn, HTTPServer):
+	daemon_threads = True
+	allow_reuse_address = True
+	request_queue_size = 128
+
+class FeedRequestHandler(BaseHTTPRequestHandler):
+	protocol_version = "HTTP/1.1"
+	server_version = "feedserver/1.0"
+
+	# Shared by every listening address
+	options = None
+	corpusFiles = []
+	feeds = {}
+	countsOfRequests = {}
+	lock = threading.Lock()
+
+	def log_message(self, format, *args):
+		if self.options.verbose:
+			BaseHTTPRequestHandler.log_message(self, format, *args)
+
+	def feed(self, number):
+		"""Returns the feed with the given number, making it on first use."""
+		self.lock.acquire()
+		try:
+			feed = self.feeds.get(number)
+			if feed is None:
+				feed = Feed(number, self.options)
+				self.feeds[number] = feed
+			return feed
+		finally:
+			self.lock.release()
+
+	def nextRequest(self, feed):
+		"""Counts a fetch of the feed's content and returns how many came before it."""
+		self.lock.acquire()
+		try:
+			count = self.countsOfRequests.get(feed.number, 0)
+			self.countsOfRequests[feed.number] = count + 1
+			return count
+		finally:
+			self.lock.release()
+
+	def send(self, code, body="", contentType="text/plain", headers=()):
+		data = body.encode("utf-8")
+		self.send_response(code)
+		if data:
+			self.send_header("Content-Type", contentType)
+		for name, value in headers:
+			self.send_header(name, value)
+		self.send_header("Content-Length", str(len(data)))
+		self.end_headers()
+		self.wfile.write(data)
+
+	def do_GET(self):
+		components = self.path.split("?")[0].strip("/").split("/")
+		if len(components) < 2 or components[0] != "feed" or not components[1].isdigit():
+			self.send(404, "Not found\n")
+			return
+
+		feed = self.feed(int(components[1]))
+		host = self.headers.get("Host") or "%s:%d" % self.server.server_address
+		suffix = "/".join(components[2:])
+		time.sleep(feed.latency)
+
+		if suffix == "" and feed.kind == "gone":
+			self.send(410, "Gone\n")
+		elif suffix == "" and feed.kind == "redirect":
+			location = "http://%s/feed/%d/moved" % (host, feed.number)
+			self.send(301, "Moved to %s\n" % location, headers=(("Location", location),))
+		elif suffix == "" and feed.kind == "meta-refresh":
+			location = "http://%s/feed/%d/target" % (host, feed.number)
+			self.send(200, '<html><head><meta http-equiv="refresh" content="0; url=%s"></head>'
+				'<body>This feed has moved.</body></html>\n' % location, "text/html")
+		elif suffix in ("", "moved", "target"):
+			self.sendFeed(feed, host)
+		else:
+			self.send(404, "Not found\n")
+
+	def sendFeed(self, feed, host):
+		version = feed.version(self.nextRequest(feed))
+		etag = feed.etag(version)
+		lastModified = feed.lastModified(version)
+		if feed.isConditional and (self.headers.get("If-None-Match") == etag or self.headers.get("If-Modified-Since") == lastModified):
+			self.send_response(304)
+			self.send_header("ETag", etag)
+			self.send_header("Content-Length", "0")
+			self.end_headers()
+			return
+
+		if self.corpusFiles:
+			path = self.corpusFiles[feed.number % len(self.corpusFiles)]
+			handle = open(path, "rb")
+			try:
+				data = handle.read()
+			finally:
+				handle.close()
+		else:
+			data = feed.body(host, version).encode("utf-8")
+
+		self.send_response(200)
+		self.send_header("Content-Type", "application/xml")
+		if feed.isConditional:
+			self.send_header("ETag", etag)
+			self.send_header("Last-Modified", lastModified)
+		if feed.isGzipped and "gzip" in (self.headers.get("Accept-Encoding") or ""):
+			# A gzip stream made by zlib has no timestamp so the same feed always
+			# compresses to the same bytes.
+			compressor = zlib.compressobj(6, zlib.DEFLATED, 31)
+			data = compressor.compress(data) + compressor.flush()
+			self.send_header("Content-Encoding", "gzip")
+		self.send_header("Content-Length", str(len(data)))
+		self.end_headers()
+		self.wfile.write(data)
+
+def main():
+	parser = OptionParser(usage="%prog [options]")
+	parser.add_option("--port", type="int", default=8900, help="port to listen on [%default]")
+	parser.add_option("--hosts", type="int", default=1, help="listen on 127.0.0.1 up to 127.0.0.N [%default]")
+	parser.add_option("--seed", type="int", default=1, help="seed that picks how each feed behaves [%default]")
+	parser.add_option("--items", type="int", default=20, help="average number of items in a feed [%default]")
+	parser.add_option("--large", type="float", default=5, help="percentage of feeds with eight times as many items [%default]")
+	parser.add_option("--latency", type="float", default=50, help="average delay before each response in milliseconds [%default]")
+	parser.add_option("--gzip", type="float", default=50, help="percentage of feeds sent gzipped [%default]")
+	parser.add_option("--not-modified", type="float", default=40, help="percentage of feeds that answer conditional requests with 304 [%default]")
+	parser.add_option("--changing", type="float", default=20, help="percentage of feeds that gain an item on every request [%default]")
+	parser.add_option("--redirect", type="float", default=3, help="percentage of feeds that answer with a 301 redirect [%default]")
+	parser.add_option("--gone", type="float", default=2, help="percentage of feeds that answer with 410 Gone [%default]")
+	parser.add_option("--meta-refresh", type="float", default=3, help="percentage of feeds that are HTML pages with a meta refresh [%default]")
+	parser.add_option("--corpus", help="serve the files in this directory instead of synthetic feeds")
+	parser.add_option("--verbose", action="store_true", default=False, help="log every request")
+	options, arguments = parser.parse_args()
+
+	FeedRequestHandler.options = options
+	if options.corpus:
+		FeedRequestHandler.corpusFiles = [os.path.join(options.corpus, name) for name in sorted(os.listdir(options.corpus))
+			if os.path.isfile(os.path.join(options.corpus, name))]
+		if not FeedRequestHandler.corpusFiles:
+			sys.stderr.write("feedserver: there are no files in %s\n" % options.corpus)
+			return 2
+
+	servers = []
+	for index in range(options.hosts):
+		address = "127.0.0.%d" % (index + 1)
+		try:
+			servers.append(FeedServer((address, options.port), FeedRequestHandler))
+		except Exception:
+			sys.stderr.write("feedserver: cannot listen on %s:%d: %s\n" % (address, options.port, sys.exc_info()[1]))
+			if index > 0:
+				sys.stderr.write("feedserver: add the address to the loopback interface with: sudo ifconfig lo0 alias %s up\n" % address)
+			return 2
+	for server in servers:
+		thread = threading.Thread(target=server.serve_forever)
+		if hasattr(thread, "daemon"):
+			thread.daemon = True
+		else:
+			thread.setDaemon(True)
+		thread.start()
+
+	sys.stdout.write("feedserver: listening on 127.0.0.1 to 127.0.0.%d port %d\n" % (options.hosts, options.port))
+	sys.stdout.flush()
+	try:
+		while True:
+			time.sleep(3600)
+	except KeyboardInterrupt:
+		pass
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -45,6 +45,9 @@ OSStatus keyPressed(EventHandlerCallRef nextHandler, EventRef theEvent, void *us
 // Compact database
 -(id)handleCompactDatabase:(NSScriptCommand *)cmd;
 
+// Rebuild search index
+-(id)handleRebuildSearchIndex:(NSScriptCommand *)cmd;
+
 // Empty trash
 -(id)handleEmptyTrash:(NSScriptCommand *)cmd;
 
@@ -168,6 +168,15 @@ OSStatus keyPressed(EventHandlerCallRef nextHandler, EventRef theEvent, void *us
 	return nil;
 }
 
+/* handleRebuildSearchIndex
+ * Rebuild the full text search index.
+ */
+-(id)handleRebuildSearchIndex:(NSScriptCommand *)cmd
+{
+	[[Database sharedDatabase] rebuildSearchIndex];
+	return nil;
+}
+
 /* handleEmptyTrash
  * Empty the trash.
  */
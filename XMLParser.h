@@ -45,4 +45,6 @@
 -(XMLParser *)treeByIndex:(int)index;
 +(NSString *)quoteAttributes:(NSString *)stringToProcess;
 +(NSCalendarDate *)parseXMLDate:(NSString *)dateString;
++(BOOL)getTimeInterval:(NSTimeInterval *)timeInterval fromXMLDate:(NSString *)dateString;
++(NSCalendarDate *)parseUnusualXMLDate:(NSString *)dateString;
 @end
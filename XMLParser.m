@@ -21,12 +21,337 @@
 #import "StringExtensions.h"
 #import <curl/curl.h>
 
+// Longest date string that the fast date parser will look at. Anything longer
+// isn't a date format that it knows.
+#define MA_Max_Date_Length	64
+
+// Time zones that feeds give by name, with their offset from GMT in minutes.
+static const struct {
+	const char * name;
+	int offset;
+} namedTimeZones[] = {
+	{ "GMT", 0 }, { "UT", 0 }, { "UTC", 0 }, { "Z", 0 }, { "WET", 0 },
+	{ "EST", -300 }, { "EDT", -240 }, { "CST", -360 }, { "CDT", -300 },
+	{ "MST", -420 }, { "MDT", -360 }, { "PST", -480 }, { "PDT", -420 },
+	{ "AKST", -540 }, { "AKDT", -480 }, { "HST", -600 },
+	{ "BST", 60 }, { "WEST", 60 }, { "CET", 60 }, { "CEST", 120 }, { "MET", 60 }, { "MEST", 120 },
+	{ "EET", 120 }, { "EEST", 180 }, { "MSK", 180 }, { "JST", 540 }, { "KST", 540 },
+	{ "AWST", 480 }, { "ACST", 570 }, { "AEST", 600 }, { "AEDT", 660 }, { "NZST", 720 }, { "NZDT", 780 }
+};
+
 @interface XMLParser (Private)
 	-(void)setTreeRef:(CFXMLTreeRef)treeRef;
 	+(XMLParser *)treeWithCFXMLTreeRef:(CFXMLTreeRef)ref;
 	-(XMLParser *)addTree:(NSString *)name withAttributes:(NSDictionary *)attributesDict closed:(BOOL)flag;
 @end
 
+/* isDateDigit
+ */
+static BOOL isDateDigit(char ch)
+{
+	return ch >= '0' && ch <= '9';
+}
+
+/* isDateLetter
+ */
+static BOOL isDateLetter(char ch)
+{
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+/* skipDateSpaces
+ * Moves the pointer past any spaces and tabs.
+ */
+static void skipDateSpaces(const char ** ptr, const char * end)
+{
+	while (*ptr < end && (**ptr == ' ' || **ptr == '\t'))
+		++*ptr;
+}
+
+/* scanDateNumber
+ * Reads up to maxDigits digits into value and returns how many were read.
+ */
+static int scanDateNumber(const char ** ptr, const char * end, int maxDigits, int * value)
+{
+	int countOfDigits = 0;
+	*value = 0;
+	while (*ptr < end && countOfDigits < maxDigits && isDateDigit(**ptr))
+	{
+		*value = (*value * 10) + (**ptr - '0');
+		++*ptr;
+		++countOfDigits;
+	}
+	return countOfDigits;
+}
+
+/* scanDateMonth
+ * Reads an English month name, of which only the first three letters count, and
+ * returns the month number or zero if it isn't a month.
+ */
+static int scanDateMonth(const char ** ptr, const char * end)
+{
+	static const char monthNames[] = "janfebmaraprmayjunjulaugsepoctnovdec";
+	char name[3];
+	int index;
+
+	for (index = 0; index < 3; ++index)
+	{
+		if (*ptr + index >= end || !isDateLetter((*ptr)[index]))
+			return 0;
+		name[index] = (*ptr)[index] | 0x20;
+	}
+	for (index = 0; index < 12; ++index)
+	{
+		if (name[0] == monthNames[index * 3] && name[1] == monthNames[index * 3 + 1] && name[2] == monthNames[index * 3 + 2])
+		{
+			while (*ptr < end && (isDateLetter(**ptr) || **ptr == '.'))
+				++*ptr;
+			return index + 1;
+		}
+	}
+	return 0;
+}
+
+/* scanDateTime
+ * Reads a time of the form HH:MM with optional seconds and fractional seconds.
+ */
+static BOOL scanDateTime(const char ** ptr, const char * end, int * hour, int * minute, double * second)
+{
+	int secondValue = 0;
+
+	if (scanDateNumber(ptr, end, 2, hour) == 0 || *ptr >= end || **ptr != ':')
+		return NO;
+	++*ptr;
+	if (scanDateNumber(ptr, end, 2, minute) != 2 || *hour > 24 || *minute > 59)
+		return NO;
+
+	// (GMail sometimes gives 24 as the hour, which is read as midnight.)
+	*hour %= 24;
+	*second = 0;
+	if (*ptr < end && **ptr == ':')
+	{
+		++*ptr;
+		if (scanDateNumber(ptr, end, 2, &secondValue) != 2 || secondValue > 60)
+			return NO;
+		*second = secondValue;
+		if (*ptr < end && (**ptr == '.' || **ptr == ','))
+		{
+			double scale = 0.1;
+			++*ptr;
+			if (*ptr >= end || !isDateDigit(**ptr))
+				return NO;
+			while (*ptr < end && isDateDigit(**ptr))
+			{
+				*second += (**ptr - '0') * scale;
+				scale /= 10;
+				++*ptr;
+			}
+		}
+	}
+	return YES;
+}
+
+/* scanDateOffset
+ * Reads a numeric offset from GMT such as +0100, -04:00, -4:00 or +05 into a
+ * number of minutes.
+ */
+static BOOL scanDateOffset(const char ** ptr, const char * end, int * offset)
+{
+	int sign = (**ptr == '-') ? -1 : 1;
+	int hours;
+	int minutes = 0;
+	int countOfDigits;
+
+	++*ptr;
+	countOfDigits = scanDateNumber(ptr, end, 4, &hours);
+	if (countOfDigits == 0)
+		return NO;
+	if (countOfDigits <= 2 && *ptr < end && **ptr == ':')
+	{
+		++*ptr;
+		if (scanDateNumber(ptr, end, 2, &minutes) != 2)
+			return NO;
+	}
+	else if (countOfDigits > 2)
+	{
+		minutes = hours % 100;
+		hours /= 100;
+	}
+	if (hours > 14 || minutes > 59)
+		return NO;
+	*offset = sign * ((hours * 60) + minutes);
+	return YES;
+}
+
+/* scanDateZone
+ * Reads the time zone at the end of a date, either as an offset or by name, into a
+ * number of minutes east of GMT. No time zone at all means GMT.
+ */
+static BOOL scanDateZone(const char ** ptr, const char * end, int * offset)
+{
+	*offset = 0;
+	skipDateSpaces(ptr, end);
+	if (*ptr >= end)
+		return YES;
+	if (**ptr == '+' || **ptr == '-')
+		return scanDateOffset(ptr, end, offset);
+
+	// Match the name against the ones we know.
+	const char * nameStart = *ptr;
+	while (*ptr < end && isDateLetter(**ptr))
+		++*ptr;
+	size_t nameLength = *ptr - nameStart;
+	unsigned int index;
+
+	for (index = 0; index < sizeof(namedTimeZones) / sizeof(namedTimeZones[0]); ++index)
+	{
+		const char * name = namedTimeZones[index].name;
+		size_t charIndex = 0;
+		while (charIndex < nameLength && name[charIndex] != '\0' && (nameStart[charIndex] & ~0x20) == name[charIndex])
+			++charIndex;
+		if (charIndex == nameLength && name[charIndex] == '\0')
+		{
+			*offset = namedTimeZones[index].offset;
+
+			// Allow for names followed by an offset such as GMT+2.
+			if (*ptr < end && (**ptr == '+' || **ptr == '-'))
+			{
+				int extraOffset;
+				if (!scanDateOffset(ptr, end, &extraOffset))
+					return NO;
+				*offset += extraOffset;
+			}
+			return YES;
+		}
+	}
+	return NO;
+}
+
+/* daysSince1970
+ * Returns the number of days from 1 January 1970 to the given date in the
+ * proleptic Gregorian calendar.
+ */
+static long daysSince1970(int year, int month, int day)
+{
+	if (month <= 2)
+		--year;
+	long era = ((year >= 0) ? year : year - 399) / 400;
+	long yearOfEra = year - (era * 400);
+	long dayOfYear = ((153 * (month + ((month > 2) ? -3 : 9))) + 2) / 5 + day - 1;
+	long dayOfEra = (yearOfEra * 365) + (yearOfEra / 4) - (yearOfEra / 100) + dayOfYear;
+	return (era * 146097) + dayOfEra - 719468;
+}
+
+/* parseDateBytes
+ * Parses an ISO 8601 or RFC 822 date held as UTF-8 bytes. These are the forms that
+ * are understood, with fractional seconds allowed wherever there are seconds and a
+ * time zone name or numeric offset allowed wherever there is a time zone:
+ *
+ *   2005-10-23T10:12:22-4:00
+ *   2005-10-23T10:12:22.123Z
+ *   2005-10-23 10:12:22
+ *   2005-10-23
+ *   Mon, 10 Oct 2005 10:12:22 -4:00
+ *   10 Oct 2005 10:12 EDT
+ *   10-Oct-2005 10:12:22 GMT
+ *
+ * A date without a time zone is taken to be GMT. Returns NO for anything else so
+ * that the caller can try harder.
+ */
+static BOOL parseDateBytes(const char * bytes, size_t length, NSTimeInterval * timeInterval)
+{
+	const char * ptr = bytes;
+	const char * end = bytes + length;
+	int year;
+	int month;
+	int day;
+	int hour = 0;
+	int minute = 0;
+	double second = 0;
+	int offset = 0;
+	int countOfDigits;
+
+	skipDateSpaces(&ptr, end);
+	while (end > ptr && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+		--end;
+
+	// Skip any day name.
+	if (ptr < end && isDateLetter(*ptr))
+	{
+		while (ptr < end && isDateLetter(*ptr))
+			++ptr;
+		if (ptr < end && *ptr == ',')
+			++ptr;
+		skipDateSpaces(&ptr, end);
+	}
+
+	countOfDigits = scanDateNumber(&ptr, end, 4, &year);
+	if (countOfDigits == 0 || ptr >= end)
+		return NO;
+
+	if (*ptr == '-' && (countOfDigits == 4 || countOfDigits == 2) && ptr + 1 < end && isDateDigit(ptr[1]))
+	{
+		// ISO 8601. A month name after the dash means a day first date like 10-Oct-2005.
+		if (countOfDigits == 2)
+			year += 2000;
+		++ptr;
+		if (scanDateNumber(&ptr, end, 2, &month) == 0 || ptr >= end || *ptr != '-')
+			return NO;
+		++ptr;
+		if (scanDateNumber(&ptr, end, 2, &day) == 0)
+			return NO;
+		if (ptr == end)
+		{
+			// If no time is specified, set the time to 11:59pm,
+			// so new articles within the last 24 hours are detected.
+			hour = 23;
+			minute = 59;
+		}
+		else
+		{
+			if (*ptr != 'T' && *ptr != 't' && *ptr != ' ')
+				return NO;
+			++ptr;
+			if (!scanDateTime(&ptr, end, &hour, &minute, &second) || !scanDateZone(&ptr, end, &offset))
+				return NO;
+		}
+	}
+	else if (countOfDigits <= 2)
+	{
+		// RFC 822. Dashes between the parts are allowed too.
+		day = year;
+		skipDateSpaces(&ptr, end);
+		if (ptr < end && *ptr == '-')
+			++ptr;
+		month = scanDateMonth(&ptr, end);
+		if (month == 0)
+			return NO;
+		skipDateSpaces(&ptr, end);
+		if (ptr < end && *ptr == '-')
+			++ptr;
+		countOfDigits = scanDateNumber(&ptr, end, 4, &year);
+		if (countOfDigits == 2)
+			year += (year < 70) ? 2000 : 1900;
+		else if (countOfDigits != 4)
+			return NO;
+		skipDateSpaces(&ptr, end);
+		if (ptr < end)
+		{
+			if (!scanDateTime(&ptr, end, &hour, &minute, &second) || !scanDateZone(&ptr, end, &offset))
+				return NO;
+		}
+	}
+	else
+		return NO;
+
+	if (ptr != end || month < 1 || month > 12 || day < 1 || day > 31)
+		return NO;
+
+	double secondsSince1970 = ((double)daysSince1970(year, month, day) * 86400.0) + (hour * 3600) + (minute * 60) + second - (offset * 60);
+	*timeInterval = secondsSince1970 - NSTimeIntervalSince1970;
+	return YES;
+}
+
 @implementation XMLParser
 
 /* setData
@@ -448,19 +773,46 @@
 	return date;
 }
 
+/* getTimeInterval
+ * Parses a date in an XML feed or an HTTP header straight into a time interval since
+ * the reference date. The string is read in place as UTF-8 without allocating
+ * anything. Returns NO if the date isn't in one of the common formats handled by
+ * parseDateBytes, in which case parseXMLDate may still make sense of it.
+ */
++(BOOL)getTimeInterval:(NSTimeInterval *)timeInterval fromXMLDate:(NSString *)dateString
+{
+	char buffer[MA_Max_Date_Length];
+	const char * bytes;
+
+	if (dateString == nil)
+		return NO;
+	bytes = CFStringGetCStringPtr((CFStringRef)dateString, kCFStringEncodingUTF8);
+	if (bytes == NULL)
+	{
+		if (![dateString getCString:buffer maxLength:sizeof(buffer) encoding:NSUTF8StringEncoding])
+			return NO;
+		bytes = buffer;
+	}
+	return parseDateBytes(bytes, strlen(bytes), timeInterval);
+}
+
 /* parseXMLDate
- * Parse a date in an XML header into an NSCalendarDate. This is horribly expensive and needs
- * to be replaced with a parser that can handle these formats:
- *
- *   2005-10-23T10:12:22-4:00
- *   2005-10-23T10:12:22
- *   2005-10-23T10:12:22Z
- *   Mon, 10 Oct 2005 10:12:22 -4:00
- *   10 Oct 2005 10:12:22 -4:00
- *
- * These are the formats that I've discovered so far.
+ * Parse a date in an XML header into an NSCalendarDate. The common formats are handled
+ * by getTimeInterval and anything else goes the long way round.
  */
 +(NSCalendarDate *)parseXMLDate:(NSString *)dateString
+{
+	NSTimeInterval timeInterval;
+	if ([self getTimeInterval:&timeInterval fromXMLDate:dateString])
+		return [NSCalendarDate dateWithTimeIntervalSinceReferenceDate:timeInterval];
+	return [self parseUnusualXMLDate:dateString];
+}
+
+/* parseUnusualXMLDate
+ * Parse a date that getTimeInterval didn't recognise. This is horribly expensive but
+ * it lets curl try every format it knows about before scanning the date by hand.
+ */
++(NSCalendarDate *)parseUnusualXMLDate:(NSString *)dateString
 {
 	int yearValue = 0;
 	int monthValue = 1;